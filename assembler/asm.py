@@ -22,8 +22,13 @@ OPCODES = {
     'alci': 32, 'allc': 33, 'iallc': 34,
     # push word to stack, p byte to s, pop word from stack, pop byte from stack, push pc to stack, pop pc from stack
     'pshr': 35, 'pshb': 36, 'popr': 37, 'popb': 38, 'call': 39, 'ret': 40,
+    # atomic compare and swap, fetch and add, exchange, memory fence
+    'cas': 41, 'faa': 42, 'xchg': 43, 'fence': 44,
 }
 
+# Mnemonics that take no operands, with or without a label in front
+NO_OPERANDS = ['ret', 'fence']
+
 REGISTERS = {
     'r0': 0, 'r1': 1, 'r2': 2, 'r3': 3, 'r4': 4, 'r5': 5, 'r6': 6, 'r7': 7, 'r8': 8,
     'r9': 9, 'r10': 10, 'r11': 11, 'r12': 12, 'r13': 13, 'r14': 14, 'r15': 15,
@@ -265,12 +270,12 @@ def process_instruction(parts, address):
         if not is_label(label):
             error("Invalid label")
         operator = parts[1].lower()
-        if len(parts) < 3:
+        if len(parts) < 3 and operator not in NO_OPERANDS:
             error("Must include operands")
         operands = parts[2:]
     else:
         operator = parts[0].lower()
-        if len(parts) < 2 and not operator == 'ret':
+        if len(parts) < 2 and operator not in NO_OPERANDS:
             error("Must include operands")
         operands = parts[1:]
 
@@ -429,6 +434,23 @@ def process_instruction(parts, address):
         if len(operands) != 1:
             error("Invalid operands")
 
+    elif operator in [41, 42]: # [cas, faa]
+        if len(operands) != 3:
+            error("Invalid operands")
+        op1 = parse_register(operands[0])
+        op2 = parse_register(operands[1])
+        op3 = parse_register(operands[2])
+
+    elif operator == 43: # xchg
+        if len(operands) != 2:
+            error("Invalid operands")
+        op1 = parse_register(operands[0])
+        op2 = parse_register(operands[1])
+
+    elif operator == 44: # fence
+        if len(operands) != 1 or operands[0]:
+            error("Invalid operands")
+
     else:
         error("Unsupported opcode")
 
@@ -545,20 +567,33 @@ def write_output(filename, bytecode):
     except IOError:
         error("Error writing to output file")
 
+def write_symbols(filename):
+    symbol_filename = filename.replace('.asm', '.sym')
+
+    try:
+        with open(symbol_filename, 'w') as f:
+            for label, address in sorted(labels.items(), key=lambda item: item[1]):
+                f.write(f"{address} {label}\n")
+    except IOError:
+        error("Error writing to symbol file")
+
 def main():
-    if len(sys.argv) < 2:
-        print("USAGE: python3 asm4380.py inputFile.asm")
+    if len(sys.argv) < 2 or len(sys.argv) > 3 or (len(sys.argv) == 3 and sys.argv[2] != '-s'):
+        print("USAGE: python3 asm4380.py inputFile.asm [-s]")
         sys.exit(1)
 
     filename = sys.argv[1]
 
     if not filename.endswith('.asm'):
-        print("USAGE: python3 asm4380.py inputFile.asm")
+        print("USAGE: python3 asm4380.py inputFile.asm [-s]")
         sys.exit(1)
 
     first_pass(filename)
     bytecode = second_pass()
     write_output(filename, bytecode)
+    # -s also writes the symbol table for the emulator's hot-miss report
+    if len(sys.argv) == 3:
+        write_symbols(filename)
 
     sys.exit(0)
 
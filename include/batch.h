@@ -0,0 +1,40 @@
+#pragma once
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// One line of a batch manifest: "<program> <input> [emu options]". The input file is fed to the
+// program's standard input; "-" gives it none.
+struct BatchJob {
+    std::string program;
+    std::string input;
+    std::vector<std::string> options;
+};
+
+struct BatchResult {
+    // What emu would have exited with. emu-batch uses 124 for a job it stopped after the timeout
+    // and 128 plus the signal number for one that killed its worker.
+    int status;
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long memoryCycles;
+    double seconds;
+    std::string output;
+    std::string errors;
+
+    BatchResult();
+};
+
+// Blank lines and anything after a # are skipped.
+bool loadBatchManifest(const std::string& path, std::vector<BatchJob>& jobs, std::string& error);
+
+// Runs one job to completion in this process, capturing what it prints. The emulator is reset
+// first, so jobs can follow each other and reuse the memory of the previous one.
+BatchResult runBatchJob(const BatchJob& job);
+// The same, with the program's standard input read from input instead of job.input.
+BatchResult runBatchJob(const BatchJob& job, std::streambuf* input);
+
+// One JSON object per line and per job, in manifest order.
+void writeBatchResults(std::ostream& out, const std::vector<BatchJob>& jobs, const std::vector<BatchResult>& results);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "batch.h"
+
+#include <cstddef>
+#include <vector>
+
+// Runs every job on worker processes, one per pool thread and at most one per job, and fills
+// results in manifest order. A timeout of 0 lets jobs run as long as they take. A quantum
+// above 0 runs each worker's share of the jobs at once as guest fibers, and then the timeout
+// must be 0. False when a worker cannot be started.
+bool runOnWorkers(const std::vector<BatchJob>& jobs, unsigned int threads, unsigned int timeout, unsigned int quantum,
+                  std::vector<BatchResult>& results, size_t& worker_count);
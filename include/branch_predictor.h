@@ -0,0 +1,174 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class PredictorType { NONE, NOT_TAKEN, BIMODAL, GSHARE, TOURNAMENT };
+
+// How a control transfer finds its target: conditional branches are predicted taken or not,
+// jumps and calls look their target up in the BTB, returns pop the return address stack.
+enum class BranchKind { CONDITIONAL, JUMP, INDIRECT, CALL, RETURN };
+
+struct BranchPredictorConfig {
+    PredictorType type;
+    unsigned int entries;
+    unsigned int historyBits;
+    unsigned int btbEntries;
+    unsigned int rasDepth;
+    unsigned int penalty;
+
+    BranchPredictorConfig();
+    bool isValid(std::string& error) const;
+};
+
+// Accepts "<predictor>[:<entries>[:<history_bits>]]" where predictor is none, not-taken,
+// bimodal, gshare or tournament.
+bool parsePredictorSpec(const std::string& text, BranchPredictorConfig& config);
+const char* predictorName(PredictorType type);
+
+// Taken/not-taken prediction for conditional branches.
+class DirectionPredictor {
+public:
+    virtual ~DirectionPredictor() = default;
+
+    virtual bool predict(unsigned int pc) const = 0;
+    virtual void update(unsigned int pc, bool taken) = 0;
+    virtual void reset() = 0;
+};
+
+class NotTakenPredictor final : public DirectionPredictor {
+public:
+    bool predict(unsigned int pc) const override;
+    void update(unsigned int pc, bool taken) override;
+    void reset() override;
+};
+
+// Table of 2-bit saturating counters indexed by the branch address.
+class BimodalPredictor final : public DirectionPredictor {
+private:
+    std::vector<unsigned char> counters;
+
+    unsigned int indexOf(unsigned int pc) const;
+
+public:
+    explicit BimodalPredictor(unsigned int entries);
+
+    bool predict(unsigned int pc) const override;
+    void update(unsigned int pc, bool taken) override;
+    void reset() override;
+};
+
+// 2-bit counters indexed by the branch address XOR the global outcome history.
+class GsharePredictor final : public DirectionPredictor {
+private:
+    std::vector<unsigned char> counters;
+    unsigned int historyMask;
+    unsigned int history;
+
+    unsigned int indexOf(unsigned int pc) const;
+
+public:
+    GsharePredictor(unsigned int entries, unsigned int historyBits);
+
+    bool predict(unsigned int pc) const override;
+    void update(unsigned int pc, bool taken) override;
+    void reset() override;
+};
+
+// Bimodal and gshare side by side, with a table of 2-bit counters per branch address choosing
+// whichever of the two has been right more often lately.
+class TournamentPredictor final : public DirectionPredictor {
+private:
+    BimodalPredictor local;
+    GsharePredictor global;
+    std::vector<unsigned char> choosers;
+
+    unsigned int indexOf(unsigned int pc) const;
+
+public:
+    TournamentPredictor(unsigned int entries, unsigned int historyBits);
+
+    bool predict(unsigned int pc) const override;
+    void update(unsigned int pc, bool taken) override;
+    void reset() override;
+};
+
+// Direct mapped, tagged with the full branch address.
+class BranchTargetBuffer {
+private:
+    struct Entry {
+        bool valid;
+        unsigned int pc;
+        unsigned int target;
+    };
+
+    std::vector<Entry> entries;
+
+public:
+    explicit BranchTargetBuffer(unsigned int size);
+
+    bool lookup(unsigned int pc, unsigned int& target) const;
+    void update(unsigned int pc, unsigned int target);
+    void reset();
+};
+
+// Fixed depth; a push onto a full stack overwrites the oldest entry.
+class ReturnAddressStack {
+private:
+    std::vector<unsigned int> entries;
+    unsigned int top;
+    unsigned int count;
+
+public:
+    explicit ReturnAddressStack(unsigned int depth);
+
+    void push(unsigned int address);
+    bool pop(unsigned int& address);
+    void reset();
+};
+
+struct BranchStats {
+    unsigned long long branches;
+    unsigned long long mispredictions;
+    unsigned long long conditional;
+    unsigned long long conditionalMispredictions;
+    unsigned long long btbMisses;
+    unsigned long long returnMispredictions;
+
+    BranchStats();
+};
+
+struct BranchRecord {
+    unsigned int pc;
+    unsigned long long executions;
+    unsigned long long mispredictions;
+};
+
+// Direction predictor, BTB and return address stack together. Each resolved branch is compared
+// with what the front end would have fetched next; a wrong guess costs the penalty.
+class BranchUnit {
+private:
+    BranchPredictorConfig config;
+    std::unique_ptr<DirectionPredictor> direction;
+    BranchTargetBuffer btb;
+    ReturnAddressStack ras;
+    BranchStats stats;
+    std::unordered_map<unsigned int, BranchRecord> records;
+
+    unsigned int predictTarget(unsigned int pc, BranchKind kind, unsigned int fallthrough);
+
+public:
+    explicit BranchUnit(const BranchPredictorConfig& config);
+
+    // Returns the misprediction cycles for the branch at pc, which went to target rather than
+    // to fallthrough if it was taken.
+    unsigned int resolve(unsigned int pc, BranchKind kind, unsigned int fallthrough, unsigned int target);
+
+    const BranchPredictorConfig& getConfig() const;
+    const BranchStats& getStats() const;
+    // The n branches with the most mispredictions, ties broken by executions.
+    std::vector<BranchRecord> worst(unsigned int n) const;
+    void reset();
+};
@@ -4,9 +4,18 @@
 #include <string>
 #include <vector>
 
+#include "coherence.h"
+#include "memory_timing.h"
+#include "miss_classifier.h"
+#include "prefetcher.h"
+#include "replacement.h"
+#include "victim_cache.h"
+#include "write_buffer.h"
+
 constexpr unsigned int CACHE_LINES = 32;
 constexpr unsigned int BLOCK_SIZE = 32;
 constexpr unsigned int WORDS_PER_BLOCK = BLOCK_SIZE / 4;
+constexpr unsigned int MAX_VICTIM_ENTRIES = 16;
 
 struct CacheResult {
     bool hit;
@@ -18,6 +27,102 @@ struct CacheResult {
     unsigned int getCycles() const;
 };
 
+// Shape of a cache: sets * ways lines of blockSize bytes each.
+// A direct mapped cache has one way, a fully associative cache has one set.
+struct CacheGeometry {
+    unsigned int sets;
+    unsigned int ways;
+    unsigned int blockSize;
+
+    explicit CacheGeometry(const unsigned int sets = CACHE_LINES, const unsigned int ways = 1, const unsigned int blockSize = BLOCK_SIZE);
+    unsigned int lines() const;
+    unsigned int wordsPerBlock() const;
+    bool isValid() const;
+};
+
+// One cache level as configured on the command line or in the hierarchy file.
+// type: 0 = none, 1 = direct mapped, 2 = fully associative, 3 = 2-way, 4 = N-way set associative
+struct CacheConfig {
+    unsigned int type;
+    unsigned int lines;
+    unsigned int blockSize;
+    unsigned int ways;
+    unsigned int hitLatency;
+    ReplacementType replacement;
+    unsigned int seed;
+    bool writeThrough;
+    bool writeAllocate;
+    unsigned int writeBufferEntries;
+    PrefetchType prefetcher;
+    unsigned int prefetchDegree;
+    unsigned int prefetchDistance;
+    bool classifyMisses;
+    unsigned int victimEntries;
+
+    explicit CacheConfig(const unsigned int type = 0, const unsigned int lines = CACHE_LINES, const unsigned int blockSize = BLOCK_SIZE);
+    CacheGeometry geometry() const;
+};
+
+// L1 caches backed by optional unified L2 and L3 levels, then DRAM. The flat DRAM model uses
+// dramFirstAccess and dramBurst; the banked one uses dramBurst and the remaining dram fields.
+struct HierarchyConfig {
+    CacheConfig l1d;
+    CacheConfig l1i;
+    CacheConfig l2;
+    CacheConfig l3;
+    bool inclusive;
+    MemoryTimingType dramModel;
+    unsigned int dramFirstAccess;
+    unsigned int dramBurst;
+    unsigned int dramBanks;
+    unsigned int dramRowSize;
+    unsigned int dramRowHit;
+    unsigned int dramRowMiss;
+    unsigned int dramPrecharge;
+    bool dramOpenPage;
+    // Gives every core a private L1D kept coherent over a snooping bus when more than one hart runs.
+    CoherenceProtocol coherence;
+    unsigned int coherenceTransfer;
+    unsigned int coherenceUpgrade;
+    unsigned int coherenceInvalidate;
+    // The emulator times the hierarchy on a thread of its own, fed with access records.
+    bool decoupled;
+
+    HierarchyConfig();
+    bool isValid(std::string& error) const;
+};
+
+// Accepts a comma separated list of write-back, write-through, allocate, no-allocate and buffer=<entries>.
+bool parseWritePolicy(const std::string& text, CacheConfig& config);
+
+enum class AccessType { READ, WRITE, FETCH };
+
+// hits, misses and cycles cover every access; the rest break them down. Lower levels count
+// fills requested from above as reads (or fetches) and write-backs from above as writes.
+struct CacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long cycles;
+    unsigned long long readHits;
+    unsigned long long readMisses;
+    unsigned long long writeHits;
+    unsigned long long writeMisses;
+    unsigned long long fetchHits;
+    unsigned long long fetchMisses;
+    unsigned long long writebacks;
+    unsigned long long evictions;
+    unsigned long long hitCycles;
+    unsigned long long missCycles;
+    // Only counted when miss classification is enabled. Write misses that a no-allocate level
+    // passes down without filling a line are counted apart, not as one of the three Cs.
+    unsigned long long compulsoryMisses;
+    unsigned long long capacityMisses;
+    unsigned long long conflictMisses;
+    unsigned long long noAllocateMisses;
+
+    CacheStats();
+};
+
 class Cache {
 public:
     virtual ~Cache() = default;
@@ -30,31 +135,42 @@ public:
     virtual unsigned char getCachedByte(unsigned int address) = 0;
     virtual unsigned int getCachedWord(unsigned int address) = 0;
 
+    // Coherence hooks: drop the block holding address, or write it back if dirty and keep it clean.
+    virtual void invalidateBlock(unsigned int address) = 0;
+    virtual void cleanBlock(unsigned int address) = 0;
+
     virtual void reset() = 0;
     virtual std::string getType() const = 0;
 
+    const CacheStats& getStats() const;
+    // Replaces the counts, for a report put together from runs timed elsewhere.
+    void setStats(const CacheStats& counts);
+
 protected:
+    CacheStats stats;
+
     struct AddressInfo {
         unsigned int blockAddress;
         unsigned int blockOffset;
         unsigned int tag;
         unsigned int index;
 
-        AddressInfo(const unsigned int addr, const unsigned int numSets);
+        AddressInfo(const unsigned int addr, const unsigned int numSets, const unsigned int blockSize = BLOCK_SIZE);
     };
-
-    static CacheResult calculateTiming(const bool hit, const bool wb = false, const unsigned int blocksToRead = 1);
 };
 
 class CacheLine {
 public:
     bool valid;
     bool dirty;
+    // No other cache on the coherence bus holds the block. Unused without a bus.
+    bool exclusive;
+    bool prefetched;
     unsigned int tag;
-    unsigned int lastUsed;
+    unsigned long long readyAt;
     std::vector<unsigned char> data;
 
-    CacheLine();
+    explicit CacheLine(const unsigned int blockSize = BLOCK_SIZE);
     void invalidate();
 };
 
@@ -66,97 +182,260 @@ public:
     virtual void writeByteToMemory(unsigned int address, unsigned char data) = 0;
     virtual void writeWordToMemory(unsigned int address, unsigned int data) = 0;
     virtual unsigned int getMemorySize() const = 0;
+
+    // Whole-block transfers used by cache fills and write-backs. They return the cycles taken.
+    virtual unsigned int readBlock(unsigned int address, unsigned char* data, unsigned int size) = 0;
+    virtual unsigned int writeBlock(unsigned int address, const unsigned char* data, unsigned int size) = 0;
+    // Whether the block reads that follow are on behalf of an instruction fetch.
+    virtual void setFetching(bool /*fetching*/) {}
 };
 
 class SystemMemory final : public MemoryInterface {
 private:
     unsigned char* prog_mem;
     unsigned int prog_mem_size;
+    std::unique_ptr<MemoryTimingModel> ownTiming;
+    MemoryTimingModel* timing;
 
 public:
-    SystemMemory(unsigned char* prog_mem, unsigned int prog_mem_size);
+    // Times transfers with a private flat model.
+    SystemMemory(unsigned char* prog_mem, unsigned int prog_mem_size, unsigned int firstAccessCycles = 8, unsigned int burstCycles = 2);
+    // Times transfers with a caller owned model, which may also be timing uncached accesses.
+    SystemMemory(unsigned char* prog_mem, unsigned int prog_mem_size, MemoryTimingModel* timing);
 
     unsigned char readByteFromMemory(unsigned int address) override;
     unsigned int readWordFromMemory(unsigned int address) override;
     void writeByteToMemory(unsigned int address, unsigned char data) override;
     void writeWordToMemory(unsigned int address, unsigned int data) override;
     unsigned int getMemorySize() const override;
+    unsigned int readBlock(unsigned int address, unsigned char* data, unsigned int size) override;
+    unsigned int writeBlock(unsigned int address, const unsigned char* data, unsigned int size) override;
 };
 
-class DirectMappedCache final : public Cache {
-private:
+// Shared cache engine, write-back/write-allocate unless configured otherwise. The concrete
+// caches below only pick the geometry. It is also a MemoryInterface, so a cache can be the
+// backing store of the level above it. Writes to the level below go through an optional
+// write buffer: write-through stores, no-allocate write misses and dirty evictions.
+class SetAssociativeCache : public Cache, public MemoryInterface {
+protected:
+    CacheGeometry geometry;
     std::vector<CacheLine> cache;
     MemoryInterface* memory;
-    unsigned int counter;
+    unsigned int hitLatency;
+    std::unique_ptr<ReplacementPolicy> replacement;
+    std::vector<SetAssociativeCache*> upperLevels;
+    bool writeThrough;
+    bool writeAllocate;
+    WriteBuffer writeBuffer;
+    // Whether the write buffer has entries, so record() only advances one that does.
+    bool buffered;
+    std::unique_ptr<Prefetcher> prefetcher;
+    PrefetchStats prefetchStats;
+    std::vector<unsigned int> prefetchCandidates;
+    unsigned int accessPC;
+    // Cycles spent in this cache so far; prefetch fills complete relative to it.
+    unsigned long long clock;
+    bool fetching;
+    std::unique_ptr<MissClassifier> classifier;
+    VictimCache victimCache;
+    // Scratch blocks for swapping with the victim cache.
+    std::vector<unsigned char> victimBlock;
+    std::vector<unsigned char> displacedBlock;
+    CoherenceBus* bus;
+    // The line readWordHit() last found, so the next word of the same block skips the lookup.
+    // Still current while the line is valid with the same tag.
+    CacheLine* lastLine;
+    unsigned int lastBlockStart;
+    unsigned int lastTag;
+    unsigned int lastIndex;
+    // The line the policy last heard a hit on, with nothing since; hitting it again tells the
+    // policy nothing new.
+    const CacheLine* lastTouched;
 
-    void loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const;
-    void writeBackBlock(CacheLine& line, const unsigned int index) const;
-    static void writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data);
+    SetAssociativeCache(MemoryInterface* memory, const CacheGeometry& geometry);
 
-public:
-    explicit DirectMappedCache(MemoryInterface* memory);
+    CacheLine* findLine(const AddressInfo& addr);
+    CacheLine& findVictim(const unsigned int index);
+    unsigned int wayOf(const CacheLine& line, const unsigned int index) const;
+    void touchLine(const CacheLine& line, const unsigned int index);
+    unsigned int useLine(CacheLine& line, const unsigned int index, bool& firstUse);
+    void prefetch(const unsigned int address, const bool miss, const bool firstUse);
+    virtual void beforeFill(unsigned int blockStart);
+    // ownership asks the coherence bus for the block to write it rather than to read it.
+    CacheLine& allocateLine(const AddressInfo& addr, const unsigned int address, CacheResult& result,
+                            bool ownership = false);
+    unsigned int loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const;
+    unsigned int writeBackBlock(const CacheLine& line, const unsigned int index) const;
+    unsigned int writeBelow(const unsigned int address, const unsigned char* data, const unsigned int size);
+    unsigned int completeStore(CacheLine& line, const unsigned int address, const unsigned char* data, const unsigned int size);
+    CacheResult store(const unsigned int address, const unsigned char* data, const unsigned int size);
+    unsigned int blockAddressOf(const CacheLine& line, const unsigned int index) const;
+    bool recallFromUpperLevels(CacheLine& line, const unsigned int index);
+    // Drops the other copies of a shared line before it is written. Returns the bus cycles.
+    unsigned int takeOwnership(CacheLine& line, const unsigned int blockStart);
+    CacheResult record(const CacheResult& result, AccessType type);
+    AccessType readType() const;
+    // fills is false for a miss that does not bring the block in.
+    void classify(const AddressInfo& addr, bool hit, bool fills = true);
 
-    std::string getType() const override;
+public:
     void reset() override;
-    CacheResult readByte(const unsigned int address) override;
-    CacheResult readWord(const unsigned int address) override;
-    unsigned char getCachedByte(const unsigned int address) override;
-    unsigned int getCachedWord(const unsigned int address) override;
+    // final, like the cached reads below, so that callers holding a SetAssociativeCache call them directly.
+    CacheResult readByte(const unsigned int address) final;
+    CacheResult readWord(const unsigned int address) final;
+    // Read for ownership, the load half of an atomic read-modify-write: a miss asks the other
+    // caches for the block with ownership and a shared copy is upgraded, so the store that
+    // follows finds the only copy. address must be word aligned.
+    CacheResult readWordExclusive(const unsigned int address);
+    // Reads an instruction word, counted as a fetch here and by the fills it asks the level below for.
+    CacheResult fetchWord(unsigned int address);
+    // The common case of readWord() or fetchWord() and getCachedWord() in one step: a word within
+    // one resident block, with no prefetcher to train. Anything else returns false having changed
+    // nothing, and takes the general path.
+    bool readWordHit(unsigned int address, bool fetch, unsigned int& value, unsigned int& cycles);
+    // Whether an access of size bytes at address would be served by this level alone: every block
+    // it touches is resident and nothing is prefetched or buffered for the level below. A write
+    // must also find its blocks owned and kept here rather than written through.
+    bool servesAlone(unsigned int address, unsigned int size, bool write);
+    unsigned char getCachedByte(const unsigned int address) final;
+    unsigned int getCachedWord(const unsigned int address) final;
     CacheResult writeByte(const unsigned int address, const unsigned char data) override;
     CacheResult writeWord(const unsigned int address, const unsigned int data) override;
+    void invalidateBlock(const unsigned int address) override;
+    void cleanBlock(const unsigned int address) override;
+
+    unsigned char readByteFromMemory(unsigned int address) override;
+    unsigned int readWordFromMemory(unsigned int address) override;
+    void writeByteToMemory(unsigned int address, unsigned char data) override;
+    void writeWordToMemory(unsigned int address, unsigned int data) override;
+    unsigned int getMemorySize() const override;
+    unsigned int readBlock(unsigned int address, unsigned char* data, unsigned int size) override;
+    unsigned int writeBlock(unsigned int address, const unsigned char* data, unsigned int size) override;
+
+    // Levels of an inclusive hierarchy know the caches above them and back-invalidate them on eviction.
+    void addUpperLevel(SetAssociativeCache* upper);
+    bool recallBlock(unsigned int address, unsigned char* data, unsigned int size);
+
+    void setReplacementPolicy(std::unique_ptr<ReplacementPolicy> policy);
+    const ReplacementPolicy& getReplacementPolicy() const;
+    void setHitLatency(unsigned int hitLatency);
+    void setWritePolicy(bool writeThrough, bool writeAllocate, unsigned int writeBufferEntries);
+    const WriteBuffer& getWriteBuffer() const;
+    // Empties the write buffer for a fence. Returns the stall.
+    unsigned int drainWriteBuffer();
+    // Writes every dirty line, queued store and dirty victim to the level below and keeps them
+    // clean, so that the level below is current. Nothing is counted.
+    void writeBackAll();
+    // accessPC is the instruction address the next demand accesses belong to; prefetchers train on it.
+    void setPrefetcher(std::unique_ptr<Prefetcher> prefetcher);
+    bool hasPrefetcher() const;
+    const PrefetchStats& getPrefetchStats() const;
+    void setAccessPC(unsigned int pc);
+    // Reads made while fetching is set are counted as instruction fetches, and so are the fills
+    // they ask the level below for.
+    void setFetching(bool fetching) final;
+    void setMissClassification(bool enabled);
+    bool classifiesMisses() const;
+    // 0 entries removes the victim cache.
+    void setVictimCache(unsigned int entries);
+    const VictimCache& getVictimCache() const;
+    const CacheGeometry& getGeometry() const;
+
+    void setCoherenceBus(CoherenceBus* bus);
+    // Another core's read miss. Returns whether a copy is held here, including one only in the
+    // write buffer or victim cache, which are flushed to the level below and dropped. A dirty
+    // line is copied to data and supplied; it stays dirty as the owner when keepOwnership is set,
+    // otherwise it is written back. Either way the line is left shared.
+    bool snoopRead(unsigned int blockAddress, unsigned char* data, bool keepOwnership, bool& supplied);
+    // Another core's write: drops any copy of the block. Dirty data is supplied in data, or
+    // written back to the level below when data is null.
+    bool snoopInvalidate(unsigned int blockAddress, unsigned char* data, bool& supplied);
 };
 
-class FullyAssociativeCache final : public Cache {
-private:
-    std::vector<CacheLine> cache;
-    MemoryInterface* memory;
-    unsigned int counter;
+class DirectMappedCache final : public SetAssociativeCache {
+public:
+    explicit DirectMappedCache(MemoryInterface* memory, const unsigned int lines = CACHE_LINES, const unsigned int blockSize = BLOCK_SIZE);
 
-    CacheLine& findLRULine();
-    void loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const;
-    void writeBackBlock(const CacheLine& line) const;
-    static void writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data);
+    std::string getType() const override;
+};
 
+class FullyAssociativeCache final : public SetAssociativeCache {
 public:
-    explicit FullyAssociativeCache(MemoryInterface* memory);
+    explicit FullyAssociativeCache(MemoryInterface* memory, const unsigned int lines = CACHE_LINES, const unsigned int blockSize = BLOCK_SIZE);
 
     std::string getType() const override;
-    void reset() override;
-    CacheResult readByte(const unsigned int address) override;
-    CacheResult readWord(const unsigned int address) override;
-    unsigned char getCachedByte(const unsigned int address) override;
-    unsigned int getCachedWord(const unsigned int address) override;
-    CacheResult writeByte(const unsigned int address, const unsigned char data) override;
-    CacheResult writeWord(const unsigned int address, const unsigned int data) override;
 };
 
-class TwoWaySetAssociativeCache final : public Cache {
+class TwoWaySetAssociativeCache final : public SetAssociativeCache {
 private:
-    std::vector<std::vector<CacheLine>> cache;
-    MemoryInterface* memory;
-    unsigned int counter;
     static constexpr unsigned int WAYS = 2;
-    static constexpr unsigned int SETS = CACHE_LINES / WAYS;
 
-    static CacheLine& findLRULine(std::vector<CacheLine>& set);
-    void loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const;
-    void writeBackBlock(const CacheLine& line, const unsigned int index) const;
-    static void writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data);
+public:
+    explicit TwoWaySetAssociativeCache(MemoryInterface* memory, const unsigned int lines = CACHE_LINES, const unsigned int blockSize = BLOCK_SIZE);
+
+    std::string getType() const override;
+};
 
+class NWaySetAssociativeCache final : public SetAssociativeCache {
 public:
-    explicit TwoWaySetAssociativeCache(MemoryInterface* memory);
+    NWaySetAssociativeCache(MemoryInterface* memory, const unsigned int lines, const unsigned int ways, const unsigned int blockSize = BLOCK_SIZE);
 
     std::string getType() const override;
-    void reset() override;
-    CacheResult readByte(const unsigned int address) override;
-    CacheResult readWord(const unsigned int address) override;
-    unsigned char getCachedByte(const unsigned int address) override;
-    unsigned int getCachedWord(const unsigned int address) override;
+};
+
+// Read-only L1I used by fetch(). Lines are never dirty, so evictions never write back.
+// Stores do not allocate here; they only invalidate a stale copy. Before every fill the
+// data cache is asked to clean the block so self-modifying code is fetched fresh.
+class InstructionCache final : public SetAssociativeCache {
+private:
+    std::vector<SetAssociativeCache*> dataCaches;
+
+protected:
+    void beforeFill(unsigned int blockStart) override;
+
+public:
+    InstructionCache(MemoryInterface* memory, const CacheGeometry& geometry);
+
+    std::string getType() const override;
+    // Every L1D whose dirty blocks a fill has to see; one per core when the cores have their own.
+    void addDataCache(SetAssociativeCache* dataCache);
     CacheResult writeByte(const unsigned int address, const unsigned char data) override;
     CacheResult writeWord(const unsigned int address, const unsigned int data) override;
 };
 
 class CacheFactory {
 public:
+    static CacheGeometry createGeometry(unsigned int type, unsigned int lines = CACHE_LINES, unsigned int blockSize = BLOCK_SIZE, unsigned int ways = 1);
     static std::unique_ptr<Cache> createCache(unsigned int type, MemoryInterface* memory);
+    static std::unique_ptr<Cache> createCache(unsigned int type, MemoryInterface* memory, unsigned int lines, unsigned int blockSize);
+    static std::unique_ptr<SetAssociativeCache> createLevel(const CacheConfig& config, MemoryInterface* memory);
+    static std::unique_ptr<InstructionCache> createInstructionCache(const CacheConfig& config, MemoryInterface* memory);
+    static std::unique_ptr<MemoryTimingModel> createMemoryTiming(const HierarchyConfig& config);
+};
+
+// Every level described by a HierarchyConfig, backed by one SystemMemory over a caller owned buffer.
+// The DRAM timing model outlives the caches so uncached accesses can share it.
+struct CacheHierarchy {
+    std::unique_ptr<MemoryTimingModel> timing;
+    std::unique_ptr<MemoryInterface> memory;
+    std::unique_ptr<SetAssociativeCache> l3;
+    std::unique_ptr<SetAssociativeCache> l2;
+    // Core 0's L1D, and the only one unless coherence is on.
+    std::unique_ptr<SetAssociativeCache> l1d;
+    // The L1Ds of cores 1 and up.
+    std::vector<std::unique_ptr<SetAssociativeCache>> coreL1d;
+    std::unique_ptr<InstructionCache> l1i;
+    std::unique_ptr<CoherenceBus> bus;
+    // Whether any level has a prefetcher, which is all the access PC is needed for.
+    bool prefetching = false;
+
+    // Rebuilds every level cold. Only the timing model is built when neither L1 is configured.
+    // With a coherence protocol and more than one core, each core gets an L1D of its own.
+    void build(const HierarchyConfig& config, unsigned char* data, unsigned int size, unsigned int cores = 1);
+    // The L1D core uses; nullptr without one.
+    SetAssociativeCache* dataCache(unsigned int core) const;
+    // Upper levels first, so nothing is left pointing at a freed level.
+    void clear();
+    // Leaves memory current with everything the caches hold, e.g. before they are rebuilt mid-run.
+    void writeBackAll();
 };
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class SetAssociativeCache;
+
+enum class CoherenceProtocol { NONE, MESI, MOESI };
+
+bool parseCoherenceProtocol(const std::string& text, CoherenceProtocol& protocol);
+const char* coherenceProtocolName(CoherenceProtocol protocol);
+
+struct CoherenceStats {
+    unsigned long long readRequests;
+    unsigned long long ownershipRequests;
+    unsigned long long upgrades;
+    // Copies dropped from other caches by ownership requests, upgrades and bypassing stores.
+    unsigned long long invalidations;
+    unsigned long long transfers;
+    // Dirty blocks written back because another cache asked for them (MESI only).
+    unsigned long long snoopWritebacks;
+
+    CoherenceStats();
+};
+
+// What the other caches answered to a miss.
+struct CoherenceResponse {
+    // Another cache still holds a copy, so the block cannot be filled exclusive.
+    bool shared;
+    // Another cache sent its dirty copy, so the fill does not go to the level below.
+    bool supplied;
+    // The block received differs from the level below.
+    bool dirty;
+    unsigned int cycles;
+
+    CoherenceResponse();
+};
+
+// Snooping bus between the private L1 data caches of the cores. Line states follow from the
+// bits a line already has: invalid, modified (dirty, exclusive), owned (dirty, shared, MOESI
+// only), exclusive (clean, exclusive) and shared (clean, shared). Each miss, upgrade and
+// bypassing store is broadcast to every other cache, and the coherence cycles are charged to
+// the cache that asked, i.e. to the requesting core.
+class CoherenceBus {
+private:
+    CoherenceProtocol protocol;
+    unsigned int transferCycles;
+    unsigned int upgradeCycles;
+    unsigned int invalidateCycles;
+    std::vector<SetAssociativeCache*> caches;
+    std::vector<unsigned char> scratch;
+    CoherenceStats stats;
+
+public:
+    CoherenceBus(CoherenceProtocol protocol, unsigned int transferCycles, unsigned int upgradeCycles,
+                 unsigned int invalidateCycles);
+
+    void attach(SetAssociativeCache* cache);
+
+    // A miss in requester, for reading or, with ownership, for writing. data receives the block
+    // when another cache supplies it.
+    CoherenceResponse request(const SetAssociativeCache* requester, unsigned int blockAddress, unsigned char* data,
+                              bool ownership);
+    // A store to a line requester holds shared. dirty is set when the owner of the block was
+    // among the copies dropped, so requester now holds the only up to date copy.
+    unsigned int upgrade(const SetAssociativeCache* requester, unsigned int blockAddress, bool& dirty);
+    // A store that goes past requester to the level below: every other copy is written back and dropped.
+    unsigned int invalidate(const SetAssociativeCache* requester, unsigned int blockAddress);
+
+    CoherenceProtocol getProtocol() const;
+    const CoherenceStats& getStats() const;
+    void reset();
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct BranchPredictorConfig;
+struct CacheConfig;
+struct HartConfig;
+struct HierarchyConfig;
+struct IntervalConfig;
+class LatencyTable;
+enum class PipelineMode;
+struct SamplingConfig;
+struct SimPointConfig;
+
+// Simulator configuration file: one "key = value" pair per line, '#' or ';' start a comment.
+class ConfigFile {
+private:
+    std::map<std::string, std::string> values;
+    mutable std::set<std::string> used;
+
+public:
+    bool load(const std::string& path, std::string& error);
+
+    bool has(const std::string& key) const;
+    // Leaves value untouched when the key is absent. Returns false only for a malformed number.
+    bool getUInt(const std::string& key, unsigned int& value) const;
+    bool getString(const std::string& key, std::string& value) const;
+    std::vector<std::string> unusedKeys() const;
+};
+
+// Accepts "<type>", "<type>:<lines>:<block_size>" or "<type>:<lines>:<block_size>:<ways>", as given to -c.
+bool parseCacheSpec(const std::string& text, CacheConfig& config);
+bool loadHierarchyConfig(const ConfigFile& file, HierarchyConfig& config, std::string& error);
+// Reads latency.<mnemonic> keys, e.g. latency.mul = 4, over the table's defaults.
+bool loadLatencyTable(const ConfigFile& file, LatencyTable& table, std::string& error);
+bool loadBranchConfig(const ConfigFile& file, BranchPredictorConfig& config, std::string& error);
+bool loadPipelineMode(const ConfigFile& file, PipelineMode& mode, std::string& error);
+bool loadHartConfig(const ConfigFile& file, HartConfig& config, std::string& error);
+bool loadIntervalConfig(const ConfigFile& file, IntervalConfig& config, std::string& error);
+bool loadSimPointConfig(const ConfigFile& file, SimPointConfig& config, std::string& error);
+bool loadSamplingConfig(const ConfigFile& file, SamplingConfig& config, std::string& error);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "spsc_ring.h"
+#include "timing_replay.h"
+#include "trace.h"
+
+#include <atomic>
+#include <thread>
+
+class MissProfile;
+
+// Moves cache and DRAM timing off the interpreter's thread. The interpreter only records each
+// access into a ring; a timing thread of its own replays the records through a TimingReplay
+// and counts the cycles, so the two run on separate cores.
+class DecoupledTiming {
+private:
+    TimingReplay replay;
+    MissProfile* misses;
+    SpscRing<TraceRecord> ring;
+    // Records pushed, counted by the interpreter, and records timed, published by the timing thread
+    unsigned long long pushed;
+    std::atomic<unsigned long long> timed;
+    std::atomic<bool> stopping;
+    unsigned long long fetchCycles;
+    unsigned long long dataCycles;
+    std::thread consumer;
+
+    void run();
+
+public:
+    // Misses and write-backs are attributed to their PC in misses when it is not nullptr.
+    DecoupledTiming(const HierarchyConfig& config, unsigned int memorySize, MissProfile* misses,
+                    size_t capacity = 1 << 16);
+    ~DecoupledTiming();
+    DecoupledTiming(const DecoupledTiming&) = delete;
+    DecoupledTiming& operator=(const DecoupledTiming&) = delete;
+
+    // Interpreter thread only. Waits while the ring is full.
+    void record(const TraceRecord& record);
+    // Waits until every record so far has been timed. Until the next record() the caches, the
+    // miss profile and the cycle counts can be read from the interpreter thread.
+    void sync();
+    // After sync(): the fetch and data stall cycles timed since the last call.
+    void takeCycles(unsigned long long& fetch, unsigned long long& data);
+    const CacheHierarchy& getHierarchy() const;
+};
@@ -1,5 +1,20 @@
 #pragma once
 
+#include <memory>
+#include <string>
+
+struct BranchPredictorConfig;
+struct CycleCounters;
+struct HartConfig;
+struct HierarchyConfig;
+struct IntervalConfig;
+struct SamplingConfig;
+struct SimPointConfig;
+class LatencyTable;
+struct PipelineStats;
+enum class PipelineMode;
+enum class StatsFormat;
+
 enum RegNames {
   R0 = 0, R1, R2, R3, R4, R5, R6, R7, R8, R9, R10, R11, R12, R13, R14, R15,
   PC = 16, SL, SB, SP, FP, HP
@@ -22,24 +37,39 @@ enum InstrCodes {
   CMP = 29, CMPI,
   TRP = 31,
   ALCI = 32, ALLC, IALLC,
-  PSHR = 35, PSHB, POPR, POPB, CALL, RET
+  PSHR = 35, PSHB, POPR, POPB, CALL, RET,
+  CAS = 41, FAA, XCHG, FENCE
 };
 
 enum Traps {
   HALT = 0, INT_OUT, INT_IN, CHAR_OUT, CHAR_IN, STRING_OUT, STRING_IN,
-  PRINT_REG = 98
+  SPAWN = 7, JOIN,
+  PRINT_REG = 98, PRINT_STATS
 };
 
-extern unsigned int reg_file[22];
-extern unsigned int cntrl_regs[5];
+// Registers and cycle counts belong to the hart running on the calling thread.
+extern thread_local unsigned int reg_file[22];
+extern thread_local unsigned int cntrl_regs[5];
 extern unsigned char* prog_mem;
-extern unsigned int mem_cycle_cntr;
+extern thread_local unsigned long long mem_cycle_cntr;
 extern unsigned int prog_mem_size;
+// HALT returns to the caller instead of ending the process, and the memory is kept for the next run.
 extern bool test_mode;
-extern bool memStream;
 
+// Memory starts zeroed. An allocation at least as large is reused rather than freed.
 bool init_mem(unsigned int size);
 bool init_registers(unsigned int code_section);
+// Must run after init_registers(): gives hart 0 the top stack region and lets TRP 7 start the rest.
+// Returns false when the stacks would overlap the program.
+bool init_harts(const HartConfig& config);
+// Whether hart 0 has halted in test mode.
+bool has_halted();
+// Stops every hart, clears the cycle counts and drops the reports and traces a run turned on,
+// before running another program in the same process.
+void reset_emulator();
+// Stops every spawned hart after its current instruction and waits for it, for runs that end
+// without hart 0 halting.
+void stop_harts();
 bool fetch();
 bool decode();
 bool execute();
@@ -50,3 +80,69 @@ void writeByte(unsigned int address, unsigned char byte);
 void writeWord(unsigned int address, unsigned int word);
 
 void init_cache(unsigned int cacheType);
+void init_cache(unsigned int cacheType, unsigned int lines, unsigned int blockSize);
+void init_icache(unsigned int cacheType, unsigned int lines, unsigned int blockSize);
+void init_hierarchy(const HierarchyConfig& config);
+// Ends the current run of uncached accesses; the next one pays the full DRAM latency again.
+void end_memory_stream();
+
+void set_stats_format(StatsFormat format);
+// Execution cycles per opcode; memory cycles are counted separately as fetch and data stalls.
+void set_latencies(const LatencyTable& table);
+const CycleCounters& get_cycle_counters();
+void print_cpi_breakdown();
+// Models branch prediction with misprediction penalties; PredictorType::NONE turns it off.
+void init_branch_predictor(const BranchPredictorConfig& config);
+void print_branch_report();
+// Times the run on an in-order five stage pipeline as well; PipelineMode::OFF turns it off.
+void init_pipeline(PipelineMode mode);
+// Times the run in intervals of config.length instructions, in parallel processes forked from a
+// functional pass without caches or branch prediction. Call after init_hierarchy with the
+// predictor the intervals use; a length of 0 turns it off. Reads all of std::cin first.
+void init_intervals(const IntervalConfig& config, const BranchPredictorConfig& predictor);
+// Times only representative intervals picked by clustering the run's basic block vectors, in a
+// replay process forked here, and extrapolates the rest. Call like init_intervals; false with
+// error when the replay process cannot start.
+bool init_simpoints(const SimPointConfig& config, const BranchPredictorConfig& predictor, std::string& error);
+void print_simpoint_report();
+// Alternates fast-forwarding without the timing model with warmed-up windows measured every
+// config.period instructions, and estimates the run from the windows. Call like init_intervals.
+void init_sampling(const SamplingConfig& config, const BranchPredictorConfig& predictor);
+void print_sampling_report();
+void print_pipeline_report();
+// nullptr while the pipeline model is off.
+const PipelineStats* get_pipeline_stats();
+void print_cache_statistics();
+// Tracks misses per instruction and prints the topN at halt; 0 turns it off.
+void enable_miss_profile(unsigned int topN);
+bool load_symbols(const std::string& path, std::string& error);
+void print_miss_report();
+// Profiles block reuse distances of every memory access for miss ratio curves; blockSize 0 turns it off.
+void enable_stack_distance(unsigned int blockSize, unsigned int maxLines);
+void print_miss_ratio_curve();
+// Records every memory access to a binary trace for cachesim until the program halts.
+bool enable_trace(const std::string& path, std::string& error);
+
+// Everything one run of the emulator owns: registers, memory, caches, predictor, counters, the
+// options it was given and the state of the standard streams. Lets runs take turns on one thread.
+class GuestContext {
+private:
+    struct State;
+    std::unique_ptr<State> state;
+
+public:
+    // Holds the state of an emulator that has not run yet, with the current standard streams.
+    GuestContext();
+    ~GuestContext();
+    GuestContext(const GuestContext&) = delete;
+    GuestContext& operator=(const GuestContext&) = delete;
+
+    // Exchanges the emulator's current state with the one held here: swap in, run, swap out.
+    void swap();
+};
+// Calls yield every budget instructions of whichever run is in progress; 0 turns it off.
+void set_instruction_budget(unsigned int budget, void (*yield)());
+// Set while runs share their host thread as guests. run_emulator then refuses what would start
+// host threads or processes, or write the trace every run shares.
+void set_guest_mode(bool enabled);
+bool in_guest_mode();
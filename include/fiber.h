@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <ucontext.h>
+
+// A body of code with a stack of its own, run on the calling thread until it yields or returns,
+// then resumed where it left off. The stack is mapped lazily, so thousands of fibers cost only
+// the pages they touch, and a guard page below it turns an overflow into a crash.
+class Fiber {
+private:
+    std::function<void()> body;
+    void* mapping;
+    size_t mappingSize;
+    ucontext_t context;
+    ucontext_t caller;
+    bool started;
+    bool finished;
+
+    static void start();
+
+public:
+    static constexpr size_t DEFAULT_STACK_SIZE = 256 * 1024;
+
+    explicit Fiber(std::function<void()> body, size_t stackSize = DEFAULT_STACK_SIZE);
+    ~Fiber();
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+
+    // Runs the body until it yields or returns. False when the stack could not be mapped.
+    bool resume();
+    bool isFinished() const;
+
+    // From inside a fiber: returns to whoever resumed it.
+    static void yield();
+    // The fiber running on this thread; nullptr outside of one.
+    static Fiber* current();
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "batch.h"
+#include "emu.h"
+#include "fiber.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+class GuestScheduler;
+
+// A guest's standard input: a file, a named pipe or nothing, read without blocking. When the
+// pipe has no data yet the guest waits on the scheduler's reactor instead of the host thread.
+class GuestInput : public std::streambuf {
+private:
+    GuestScheduler& scheduler;
+    int fd;
+    bool pipe;
+    char buffer[4096];
+
+protected:
+    int_type underflow() override;
+
+public:
+    GuestInput(GuestScheduler& scheduler, int fd, bool pipe);
+    ~GuestInput() override;
+    GuestInput(const GuestInput&) = delete;
+    GuestInput& operator=(const GuestInput&) = delete;
+};
+
+// Runs batch jobs as guests that take turns on the calling thread, each a fiber with an emulator
+// context of its own. A guest yields after every quantum instructions and whenever a trap reads
+// input that has not arrived; an epoll reactor on the guests' input pipes makes it ready again.
+class GuestScheduler {
+private:
+    struct Guest {
+        size_t job;
+        std::unique_ptr<GuestInput> input;
+        std::unique_ptr<GuestContext> context;
+        std::unique_ptr<Fiber> fiber;
+        BatchResult result;
+        bool waiting;
+        bool registered;
+        unsigned int events;
+    };
+
+    unsigned int quantum;
+    size_t stackSize;
+    int reactor;
+    std::deque<Guest*> ready;
+    Guest* current;
+
+    bool startGuest(Guest& guest, const BatchJob& job, std::string& error);
+    bool waitForEvents(std::string& error);
+
+public:
+    GuestScheduler(unsigned int quantum, size_t stackSize = Fiber::DEFAULT_STACK_SIZE);
+    ~GuestScheduler();
+    GuestScheduler(const GuestScheduler&) = delete;
+    GuestScheduler& operator=(const GuestScheduler&) = delete;
+
+    // Runs jobs[index] for every index given, all at once, and calls done with each job's index
+    // and result as it finishes. False when the reactor fails.
+    bool run(const std::vector<BatchJob>& jobs, const std::vector<size_t>& indices,
+             const std::function<void(size_t, const BatchResult&)>& done, std::string& error);
+    // From inside a guest: yields until fd is readable or hung up. Returns the epoll events seen,
+    // or 0 at once when fd cannot be waited on, as for a regular file.
+    unsigned int waitForInput(int fd);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+// Guest harts: hart 0 runs the program from its entry point, the others are started by TRP 7
+// and share its memory, each with a stack region of its own below SB.
+struct HartConfig {
+    static constexpr unsigned int MAX_HARTS = 64;
+
+    unsigned int harts;
+    unsigned int stackSize;
+
+    HartConfig();
+    // The stacks of all harts have to fit in memory below SB.
+    bool isValid(unsigned int memorySize, std::string& error) const;
+};
+
+// Accepts "<harts>[:<stack_size>]", as given to -H.
+bool parseHartSpec(const std::string& text, HartConfig& config);
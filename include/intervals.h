@@ -0,0 +1,137 @@
+#pragma once
+
+#include "cache.h"
+#include "latency.h"
+
+#include <sstream>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+struct IntervalConfig {
+    // Instructions per interval; 0 turns interval simulation off.
+    unsigned int length;
+    // Instructions an interval runs with the timing model before it starts counting, to warm the
+    // caches and the branch predictor.
+    unsigned int warmup;
+    // Intervals timed at once; 0 for one per hardware thread.
+    unsigned int jobs;
+
+    IntervalConfig();
+};
+
+// Accepts "<length>[:<warmup>[:<jobs>]]", as given to -I.
+bool parseIntervalSpec(const std::string& text, IntervalConfig& config);
+
+// The counts one interval measured. Cache levels are in the order L1I, L1D, L2, L3; absent ones
+// stay zero.
+struct IntervalResult {
+    static constexpr unsigned int LEVELS = 4;
+
+    CycleCounters counters;
+    unsigned long long memoryCycles;
+    CacheStats levels[LEVELS];
+
+    IntervalResult();
+    void add(const IntervalResult& other);
+    void subtract(const IntervalResult& other);
+    // Adds other's counts multiplied by factor, rounded, e.g. to extrapolate from a sample.
+    void addScaled(const IntervalResult& other, double factor);
+};
+
+// Move exactly size bytes through a pipe; false when it fails or closes first.
+bool readPipe(int fd, void* data, size_t size);
+bool writePipe(int fd, const void* data, size_t size);
+
+// Stands in for std::cin until destroyed and keeps every byte read through it, so processes
+// forked from the run can be handed the input their parent reads. It reads no further than the
+// program asks, or a forked process asks through its feed, so an interactive program still
+// prompts before it waits.
+class BufferedInput : public std::streambuf {
+private:
+    std::string history;
+    std::streambuf* source;
+    bool ended;
+    // In the functional pass: a socket to every forked process, sent each byte read from now on
+    std::vector<int> feeds;
+    // In a forked process: where its input comes from once the history runs out
+    int feed;
+
+    bool readSource();
+    bool readFeed();
+
+protected:
+    int_type underflow() override;
+
+public:
+    BufferedInput();
+    ~BufferedInput() override;
+    BufferedInput(const BufferedInput&) = delete;
+    BufferedInput& operator=(const BufferedInput&) = delete;
+
+    // Before a fork: a socket pair, the first end kept here and the second for the child.
+    bool openFeed(int& parentEnd, int& childEnd);
+    // In the child: reads past the history from childEnd instead of std::cin.
+    void followFeed(int childEnd);
+    void closeFeed(int parentEnd);
+    // When a child asks for more input on parentEnd, reads ahead for it. False once the child
+    // has closed its end.
+    bool serveFeed(int parentEnd);
+    // Everything read so far, to replay in a process forked before the run started.
+    const std::string& getHistory() const;
+    void replay(const std::string& input);
+};
+
+// Splits one run into intervals that are timed in parallel. The functional pass runs the program
+// without the timing model and forks a process where each interval starts warming up; the fork
+// is the interval's snapshot of registers and memory. Each process switches the timing model
+// on, counts its interval, sends the counts back through a pipe and ends.
+class IntervalSimulation {
+private:
+    struct Child {
+        pid_t pid;
+        int results;
+        // The child's input feed, or -1 once it has closed it
+        int input;
+    };
+
+    IntervalConfig config;
+    unsigned int jobs;
+    BufferedInput input;
+    unsigned long long nextFork;
+    unsigned int nextInterval;
+    std::vector<Child> running;
+    IntervalResult total;
+    unsigned int failed;
+    // Only in a forked interval
+    bool child;
+    int resultPipe;
+    unsigned long long measureFrom;
+    unsigned long long measureTo;
+
+    void serveInput(const Child& oldest);
+    void collect();
+    void forkInterval(unsigned long long retired);
+
+public:
+    explicit IntervalSimulation(const IntervalConfig& config);
+    ~IntervalSimulation();
+    IntervalSimulation(const IntervalSimulation&) = delete;
+    IntervalSimulation& operator=(const IntervalSimulation&) = delete;
+
+    // Called before every instruction with the instructions retired so far. In the functional
+    // pass it forks every interval that starts warming up here, and returns true in the new
+    // process, which must then turn the timing model on.
+    bool startInterval(unsigned long long retired);
+    bool startsMeasuring(unsigned long long retired) const;
+    bool endsInterval(unsigned long long retired) const;
+    bool isChild() const;
+    // In a forked interval: sends the counts to the functional pass and ends the process.
+    [[noreturn]] void report(const IntervalResult& result);
+    // In the functional pass, at halt: waits for every interval and sums their counts. Returns
+    // false when an interval did not report.
+    bool finish(IntervalResult& result, std::string& error);
+    const IntervalConfig& getConfig() const;
+    unsigned int getJobs() const;
+    unsigned int getIntervals() const;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+// Opcode mnemonics as written in assembly, e.g. "MULI"; nullptr for unused opcodes.
+const char* opcodeName(unsigned int opcode);
+bool lookupOpcode(const std::string& mnemonic, unsigned int& opcode);
+
+// Execution cycles per opcode, charged on top of whatever the memory system charges.
+// Every opcode takes one cycle except the multiplies and divides.
+class LatencyTable {
+public:
+    static constexpr unsigned int OPCODES = 256;
+
+private:
+    unsigned int cycles[OPCODES];
+
+public:
+    LatencyTable();
+
+    unsigned int operator[](unsigned int opcode) const;
+    void set(unsigned int opcode, unsigned int latency);
+    // Accepts "<mnemonic>=<cycles>", the mnemonic in either case.
+    bool parse(const std::string& spec);
+};
+
+// Cycles split by where they were spent. Fetch and data cycles are memory stalls, branch
+// cycles are misprediction penalties.
+struct CycleCounters {
+    unsigned long long instructions;
+    unsigned long long execute;
+    unsigned long long fetch;
+    unsigned long long data;
+    unsigned long long branch;
+
+    // constexpr so that the per-hart counters are initialized statically rather than on first use.
+    constexpr CycleCounters() : instructions(0), execute(0), fetch(0), data(0), branch(0) {}
+    unsigned long long total() const;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+enum class MemoryTimingType { FLAT, BANKED };
+
+struct MemoryTimingStats {
+    unsigned long long transfers;
+    unsigned long long rowHits;
+    unsigned long long rowMisses;
+    unsigned long long rowEmpty;
+
+    MemoryTimingStats();
+};
+
+bool parseMemoryTimingType(const std::string& text, MemoryTimingType& type);
+
+// Cycles charged by main memory, both for whole-block cache fills and write-backs and for
+// the CPU's own accesses when there is no cache in the way.
+class MemoryTimingModel {
+protected:
+    MemoryTimingStats stats;
+
+public:
+    virtual ~MemoryTimingModel() = default;
+
+    // One transfer of size bytes starting at address.
+    virtual unsigned int transfer(unsigned int address, unsigned int size, bool write) = 0;
+    // An uncached load or store. Successive ones belong to one stream until endStream().
+    virtual unsigned int uncachedAccess(unsigned int address, unsigned int size, bool write) = 0;
+    // Called at every instruction boundary and once an instruction has been fetched.
+    virtual void endStream();
+    virtual MemoryTimingType getType() const = 0;
+    virtual void reset();
+    const MemoryTimingStats& getStats() const;
+};
+
+// The original model: a fixed latency for the first word of a transfer and a burst cost for
+// every following one. Uncached accesses pay the full latency for the first access of a
+// stream and the burst cost for the rest, whatever their addresses.
+class FlatMemoryTiming final : public MemoryTimingModel {
+private:
+    unsigned int firstAccessCycles;
+    unsigned int burstCycles;
+    bool streaming;
+
+public:
+    FlatMemoryTiming(unsigned int firstAccessCycles = 8, unsigned int burstCycles = 2);
+
+    unsigned int transfer(unsigned int address, unsigned int size, bool write) override;
+    unsigned int uncachedAccess(unsigned int address, unsigned int size, bool write) override;
+    void endStream() override;
+    MemoryTimingType getType() const override;
+    void reset() override;
+};
+
+// DRAM with independent banks, each with one row buffer. Consecutive rows are interleaved
+// across banks. A transfer to the open row of its bank costs rowHitCycles; any other costs
+// rowMissCycles, less the precharge when the bank is already closed. With an open-page policy
+// rows stay open after an access; with a closed-page policy every bank is precharged right
+// away, so no access pays the precharge but none hits either. Words after the first cost
+// burstCycles each. Uncached accesses are plain transfers, so streaming is just row locality.
+class BankedDramTiming final : public MemoryTimingModel {
+private:
+    static constexpr unsigned int CLOSED = 0xFFFFFFFF;
+
+    unsigned int rowSize;
+    unsigned int rowHitCycles;
+    unsigned int rowMissCycles;
+    unsigned int prechargeCycles;
+    unsigned int burstCycles;
+    bool openPage;
+    std::vector<unsigned int> openRows;
+
+public:
+    BankedDramTiming(unsigned int banks, unsigned int rowSize, unsigned int rowHitCycles, unsigned int rowMissCycles,
+                     unsigned int prechargeCycles, unsigned int burstCycles, bool openPage);
+
+    unsigned int transfer(unsigned int address, unsigned int size, bool write) override;
+    unsigned int uncachedAccess(unsigned int address, unsigned int size, bool write) override;
+    MemoryTimingType getType() const override;
+    void reset() override;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+enum class MissClass { HIT, COMPULSORY, CAPACITY, CONFLICT };
+
+// Fully associative LRU set of blocks: a hash map from block to node plus an intrusive
+// doubly linked recency list threaded through a fixed node pool, so every access is O(1).
+class ShadowLRU {
+private:
+    static constexpr unsigned int NIL = 0xFFFFFFFF;
+
+    struct Node {
+        unsigned int block;
+        unsigned int prev;
+        unsigned int next;
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<unsigned int, unsigned int> index;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int used;
+
+    void unlink(unsigned int node);
+    void pushFront(unsigned int node);
+
+public:
+    explicit ShadowLRU(unsigned int capacity);
+
+    // Returns whether block was resident, then makes it the most recently used.
+    bool access(unsigned int block);
+    void reset();
+};
+
+// Classifies the misses of a real cache with the 3C model. A first touch of a block is
+// compulsory; a miss that a fully associative LRU cache of the same capacity would also
+// take is capacity; any other miss is conflict.
+class MissClassifier {
+private:
+    std::vector<bool> touched;
+    ShadowLRU shadow;
+
+public:
+    explicit MissClassifier(unsigned int lines);
+
+    // Must see every demand access, hits included, so the shadow cache stays in step.
+    MissClass access(unsigned int block, bool hit);
+    void reset();
+};
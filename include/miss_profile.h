@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct MissRecord {
+    unsigned int pc;
+    unsigned long long misses;
+    unsigned long long writebacks;
+    unsigned long long cycles;
+};
+
+// Per-instruction miss counts keyed by guest PC. Open addressing with linear probing in a
+// power of two table that doubles at 3/4 load, so recording a miss is a hash and a probe.
+class MissProfile {
+private:
+    std::vector<MissRecord> table;
+    std::vector<bool> used;
+    unsigned int count;
+
+    unsigned int slotOf(unsigned int pc) const;
+    void grow();
+
+public:
+    explicit MissProfile(unsigned int capacity = 256);
+
+    void record(unsigned int pc, unsigned int misses, unsigned int writebacks, unsigned int cycles);
+    // The n PCs with the most misses, ties broken by cycles.
+    std::vector<MissRecord> top(unsigned int n) const;
+    unsigned int size() const;
+    void reset();
+};
+
+// Labels written by the assembler with -s: one "<address> <label>" pair per line.
+class SymbolTable {
+private:
+    std::map<unsigned int, std::string> labels;
+
+public:
+    bool load(const std::string& path, std::string& error);
+    bool empty() const;
+    // "label" or "label+offset" for the closest label at or below address, "" if there is none.
+    std::string resolve(unsigned int address) const;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+
+enum class PipelineMode { OFF, FORWARDING, NO_FORWARDING };
+
+bool parsePipelineMode(const std::string& text, PipelineMode& mode);
+const char* pipelineModeName(PipelineMode mode);
+
+enum PipelineStage { STAGE_IF = 0, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB, PIPELINE_STAGES };
+
+// What the timing layer needs to know about one instruction the functional core has executed.
+struct PipelineInstruction {
+    static constexpr unsigned int MAX_SOURCES = 3;
+    static constexpr unsigned int MAX_DESTINATIONS = 2;
+
+    unsigned int sources[MAX_SOURCES];
+    unsigned int sourceCount;
+    unsigned int destinations[MAX_DESTINATIONS];
+    unsigned int destinationCount;
+    // Results come from memory, so even with forwarding they are only ready after MEM.
+    bool load;
+    unsigned int fetchCycles;
+    unsigned int executeCycles;
+    unsigned int memoryCycles;
+    // The front end fetched the wrong path; the next instruction is refetched once this resolves in EX.
+    bool redirect;
+
+    PipelineInstruction();
+    void addSource(unsigned int reg);
+    void addDestination(unsigned int reg);
+};
+
+// Fills in the registers read and written by an already decoded instruction.
+void describeInstruction(unsigned int opcode, unsigned int operand1, unsigned int operand2, unsigned int operand3,
+                         unsigned int immediate, PipelineInstruction& instruction);
+
+struct PipelineStats {
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long rawStalls;
+    // The part of rawStalls spent waiting for a load.
+    unsigned long long loadUseStalls;
+    unsigned long long flushCycles;
+    unsigned long long busy[PIPELINE_STAGES];
+
+    PipelineStats();
+};
+
+// Timing-only model of a classic in-order IF/ID/EX/MEM/WB pipeline, fed with instructions in
+// program order after the interpreter has executed them. Each stage holds one instruction and
+// takes its latency from the cycle counts of the functional run: IF the fetch cycles, EX the
+// opcode latency and MEM the data cycles. An instruction enters a stage once it has finished
+// the previous one and the instruction ahead of it has moved on, so a slow stage blocks
+// everything behind it. EX waits for its source registers: with forwarding an ALU result is
+// ready at the end of its EX and a load at the end of its MEM, without forwarding both wait
+// until the producer has written back. Mispredicted branches stop fetch until they leave EX.
+class PipelineModel {
+private:
+    static constexpr unsigned int REGISTERS = 22;
+
+    bool forwarding;
+    unsigned long long start[PIPELINE_STAGES];
+    unsigned long long end[PIPELINE_STAGES];
+    unsigned long long ready[REGISTERS];
+    bool readyFromLoad[REGISTERS];
+    unsigned long long fetchResume;
+    PipelineStats stats;
+
+public:
+    explicit PipelineModel(bool forwarding = true);
+
+    void issue(const PipelineInstruction& instruction);
+    bool isForwarding() const;
+    const PipelineStats& getStats() const;
+    void reset();
+};
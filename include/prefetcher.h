@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class PrefetchType { NONE, NEXT_LINE, STRIDE };
+
+// issued: blocks brought in by the prefetcher. useful: prefetched blocks later used by a
+// demand access. late: useful prefetches whose fill had not completed when they were used.
+// polluting: prefetched blocks evicted before any demand access used them.
+struct PrefetchStats {
+    unsigned long long issued;
+    unsigned long long useful;
+    unsigned long long late;
+    unsigned long long polluting;
+
+    PrefetchStats();
+};
+
+// Watches the demand accesses of one cache and proposes addresses to fetch ahead of them.
+// degree is how many blocks one trigger fetches, distance how far ahead the first one is.
+class Prefetcher {
+public:
+    virtual ~Prefetcher() = default;
+
+    // firstUse is set when a demand access hits a block that was prefetched and not used yet.
+    virtual void onAccess(unsigned int address, unsigned int pc, bool miss, bool firstUse,
+                          std::vector<unsigned int>& candidates) = 0;
+    virtual void reset() = 0;
+    virtual std::string getName() const = 0;
+};
+
+// Tagged next-N-line: triggers on a miss and on the first use of a prefetched block, so a
+// sequential stream keeps running ahead of the accesses.
+class NextLinePrefetcher final : public Prefetcher {
+private:
+    unsigned int degree;
+    unsigned int distance;
+    unsigned int blockSize;
+
+public:
+    NextLinePrefetcher(unsigned int degree, unsigned int distance, unsigned int blockSize);
+
+    void onAccess(unsigned int address, unsigned int pc, bool miss, bool firstUse,
+                  std::vector<unsigned int>& candidates) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+// Reference prediction table indexed by the PC of the accessing instruction. An entry
+// prefetches once the same stride has been seen CONFIDENT times in a row.
+class StridePrefetcher final : public Prefetcher {
+private:
+    static constexpr unsigned char CONFIDENT = 2;
+    static constexpr unsigned char MAX_CONFIDENCE = 3;
+
+    struct Entry {
+        bool valid;
+        unsigned int pc;
+        unsigned int lastAddress;
+        int stride;
+        unsigned char confidence;
+    };
+
+    unsigned int degree;
+    unsigned int distance;
+    std::vector<Entry> table;
+
+public:
+    StridePrefetcher(unsigned int degree, unsigned int distance, unsigned int tableSize = 64);
+
+    void onAccess(unsigned int address, unsigned int pc, bool miss, bool firstUse,
+                  std::vector<unsigned int>& candidates) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+bool parsePrefetchSpec(const std::string& text, PrefetchType& type, unsigned int& degree, unsigned int& distance);
+std::unique_ptr<Prefetcher> createPrefetcher(PrefetchType type, unsigned int degree, unsigned int distance, unsigned int blockSize);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ReplacementType { LRU, PLRU, FIFO, RANDOM, SRRIP, BRRIP };
+
+// Chooses victims within a set. The cache always fills invalid ways first and only asks
+// for a victim when every way of the set is valid. State is kept per set, not per access.
+class ReplacementPolicy {
+public:
+    virtual ~ReplacementPolicy() = default;
+
+    // A hit on the way last hit, with nothing else in between, must change nothing: the cache
+    // leaves such repeats out.
+    virtual void onHit(unsigned int set, unsigned int way) = 0;
+    virtual void onFill(unsigned int set, unsigned int way) = 0;
+    virtual unsigned int victim(unsigned int set) = 0;
+    virtual void reset() = 0;
+    virtual std::string getName() const = 0;
+};
+
+// True LRU. Each way keeps the 64-bit stamp of its last use, so a hit is one store and only
+// choosing a victim scans the set for the oldest stamp.
+class LRUPolicy final : public ReplacementPolicy {
+private:
+    unsigned int ways;
+    unsigned long long clock;
+    std::vector<unsigned long long> stamps;
+
+public:
+    LRUPolicy(unsigned int sets, unsigned int ways);
+
+    void onHit(unsigned int set, unsigned int way) override;
+    void onFill(unsigned int set, unsigned int way) override;
+    unsigned int victim(unsigned int set) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+// Binary tree pseudo-LRU: ways - 1 bits per set, each pointing towards the colder half.
+class TreePLRUPolicy final : public ReplacementPolicy {
+private:
+    unsigned int ways;
+    std::vector<bool> bits;
+
+    void touch(unsigned int set, unsigned int way);
+
+public:
+    TreePLRUPolicy(unsigned int sets, unsigned int ways);
+
+    void onHit(unsigned int set, unsigned int way) override;
+    void onFill(unsigned int set, unsigned int way) override;
+    unsigned int victim(unsigned int set) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+class FIFOPolicy final : public ReplacementPolicy {
+private:
+    unsigned int ways;
+    std::vector<unsigned short> next;
+
+public:
+    FIFOPolicy(unsigned int sets, unsigned int ways);
+
+    void onHit(unsigned int set, unsigned int way) override;
+    void onFill(unsigned int set, unsigned int way) override;
+    unsigned int victim(unsigned int set) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+// xorshift32 so runs are reproducible for a given seed.
+class RandomPolicy final : public ReplacementPolicy {
+private:
+    unsigned int ways;
+    unsigned int seed;
+    unsigned int state;
+
+public:
+    RandomPolicy(unsigned int ways, unsigned int seed);
+
+    void onHit(unsigned int set, unsigned int way) override;
+    void onFill(unsigned int set, unsigned int way) override;
+    unsigned int victim(unsigned int set) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+// Re-reference interval prediction with 2-bit RRPVs. SRRIP inserts with a long re-reference
+// prediction; BRRIP inserts with a distant one except for one fill in BRRIP_EPSILON.
+class RRIPPolicy final : public ReplacementPolicy {
+private:
+    static constexpr unsigned char MAX_RRPV = 3;
+    static constexpr unsigned int BRRIP_EPSILON = 32;
+
+    unsigned int ways;
+    bool bimodal;
+    unsigned int fills;
+    std::vector<unsigned char> rrpv;
+
+public:
+    RRIPPolicy(unsigned int sets, unsigned int ways, bool bimodal);
+
+    void onHit(unsigned int set, unsigned int way) override;
+    void onFill(unsigned int set, unsigned int way) override;
+    unsigned int victim(unsigned int set) override;
+    void reset() override;
+    std::string getName() const override;
+};
+
+bool parseReplacementType(const std::string& text, ReplacementType& type, unsigned int& seed);
+std::unique_ptr<ReplacementPolicy> createReplacementPolicy(ReplacementType type, unsigned int sets, unsigned int ways, unsigned int seed);
@@ -0,0 +1,5 @@
+#pragma once
+
+// Parses an emu command line, loads the program and runs it, returning the exit status. Unless
+// test_mode is set, a program that halts ends the process from inside.
+int run_emulator(int argc, char* argv[]);
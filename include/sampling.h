@@ -0,0 +1,68 @@
+#pragma once
+
+#include "intervals.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class StatsFormat;
+
+struct SamplingConfig {
+    // Instructions from one window to the next; 0 turns sampling off.
+    unsigned int period;
+    // Instructions measured in each window.
+    unsigned int window;
+    // Instructions timed before each window to warm the caches and the branch predictor.
+    unsigned int warmup;
+
+    SamplingConfig();
+    // The window and its warm-up must leave some of every period to fast-forward.
+    bool isValid(std::string& error) const;
+};
+
+// Accepts "<period>[:<window>[:<warmup>]]", as given to -W.
+bool parseSamplingSpec(const std::string& text, SamplingConfig& config);
+
+// A ratio estimated from sampled windows, with the half-width of its 95% confidence interval.
+struct SampledEstimate {
+    double value;
+    double margin;
+
+    SampledEstimate();
+};
+
+// Estimates sum(numerators) / sum(denominators) over the population the samples were drawn from,
+// with the variance of a ratio estimator.
+SampledEstimate estimateRatio(const std::vector<double>& numerators, const std::vector<double>& denominators);
+
+// SMARTS style systematic sampling. The program runs functionally, without caches or branch
+// prediction, and every period turns the timing model on for warmup instructions and then
+// measures window instructions at the end of the period. The windows' counts are scaled up to the
+// whole run, and the spread between windows gives each estimate a confidence interval.
+class SystematicSampler {
+private:
+    SamplingConfig config;
+    std::vector<IntervalResult> windows;
+    bool timing;
+    bool measuring;
+    unsigned long long instructions;
+    SampledEstimate cpi;
+    SampledEstimate levelMissRates[IntervalResult::LEVELS];
+
+    unsigned long long offset(unsigned long long retired) const;
+
+public:
+    explicit SystematicSampler(const SamplingConfig& config);
+
+    // Called before every instruction with the instructions retired so far, in this order.
+    bool endsWindow(unsigned long long retired) const;
+    void record(const IntervalResult& measured);
+    bool startsTiming(unsigned long long retired);
+    bool startsWindow(unsigned long long retired);
+    bool isMeasuring() const;
+    // At halt: scales the windows up to instructions into total and works out the estimates.
+    // False when the run ended before the first window.
+    bool finish(unsigned long long instructions, IntervalResult& total, std::string& error);
+    void printReport(std::ostream& out, StatsFormat format) const;
+};
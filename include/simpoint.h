@@ -0,0 +1,119 @@
+#pragma once
+
+#include "intervals.h"
+
+#include <ostream>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+enum class StatsFormat;
+
+struct SimPointConfig {
+    // Instructions per interval; 0 turns SimPoint sampling off.
+    unsigned int length;
+    // Most clusters, and so representative intervals, to pick.
+    unsigned int clusters;
+    // Instructions timed before each representative to warm the caches and the branch predictor.
+    unsigned int warmup;
+
+    SimPointConfig();
+};
+
+// Accepts "<length>[:<clusters>[:<warmup>]]", as given to -S.
+bool parseSimPointSpec(const std::string& text, SimPointConfig& config);
+
+// k-means over points of equal dimension, seeded k-means++ style from a fixed seed so that runs
+// repeat. Returns each point's cluster, numbered from 0 without gaps, and fills representatives
+// with the point nearest each cluster's centroid.
+std::vector<unsigned int> clusterPoints(const std::vector<std::vector<double>>& points, unsigned int k,
+                                        std::vector<size_t>& representatives);
+
+// SimPoint style sampling. The functional pass profiles a basic block vector per interval: how
+// many instructions ran in each block, a block being entered by any jump or taken branch. Each
+// vector is randomly projected down to DIMENSIONS, as SimPoint does. At halt the vectors are
+// clustered and the interval nearest each centroid represents its cluster.
+//
+// A replay process, forked before the first instruction, waits for that choice and for the
+// input the functional pass read. It then runs the program again functionally, turns the timing model on only around the representatives,
+// and sends back what each one measured. The whole run is extrapolated from them, weighting each
+// by the instructions in its cluster.
+class SimPointSampler {
+public:
+    static constexpr unsigned int DIMENSIONS = 15;
+
+    struct Representative {
+        size_t interval;
+        unsigned long long clusterInstructions;
+        IntervalResult measured;
+    };
+
+private:
+    struct Profile {
+        double projection[DIMENSIONS];
+        unsigned long long instructions;
+        // Known for every interval from the functional pass, to check the extrapolation against
+        unsigned long long executeCycles;
+        unsigned long long memoryCycles;
+    };
+
+    SimPointConfig config;
+    BufferedInput input;
+    std::vector<Profile> profiles;
+    Profile current;
+    unsigned long long nextBoundary;
+    unsigned int lastPC;
+    unsigned int blockStart;
+    unsigned long long blockLength;
+    unsigned long long intervalExecute;
+    unsigned long long intervalMemory;
+    pid_t replayer;
+    int selectionPipe;
+    int resultPipe;
+    std::vector<Representative> representatives;
+    double executeError;
+    double memoryError;
+    // Only in the replay process
+    bool replaying;
+    std::vector<size_t> selected;
+    size_t next;
+    unsigned long long warmFrom;
+    bool timing;
+    bool measuring;
+    std::vector<IntervalResult> results;
+
+    void endBlock();
+    void endInterval(unsigned long long executeCycles, unsigned long long memoryCycles);
+    void selectNext(unsigned long long retired);
+
+public:
+    explicit SimPointSampler(const SimPointConfig& config);
+    ~SimPointSampler();
+    SimPointSampler(const SimPointSampler&) = delete;
+    SimPointSampler& operator=(const SimPointSampler&) = delete;
+
+    // Forks the replay process, which returns from here once the representatives are known.
+    bool startReplayer(std::string& error);
+    bool isReplaying() const;
+
+    // Functional pass: called before every instruction with its PC, the instructions retired
+    // so far and the execute and memory cycles counted so far.
+    void profile(unsigned int pc, unsigned long long retired, unsigned long long executeCycles,
+                 unsigned long long memoryCycles);
+    // Functional pass, at halt: picks the representatives, has them timed and extrapolates the
+    // counts of the whole run into total.
+    bool finish(unsigned long long executeCycles, unsigned long long memoryCycles, IntervalResult& total,
+                std::string& error);
+    void printReport(std::ostream& out, StatsFormat format) const;
+
+    // Replay process, before every instruction and in this order.
+    bool endsMeasuring(unsigned long long retired) const;
+    void record(const IntervalResult& measured, unsigned long long retired);
+    bool stopsTiming(unsigned long long retired);
+    bool startsTiming(unsigned long long retired);
+    bool startsMeasuring(unsigned long long retired);
+    bool isMeasuring() const;
+    bool isDone() const;
+    // Replay process: sends what the representatives measured and ends the process.
+    [[noreturn]] void report();
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread. Each side
+// writes only its own index and publishes it with a release store, so a slot is handed over
+// without a lock. The indices sit on separate cache lines, and each side keeps its last view of
+// the other's index, only reloading it when the ring looks full or empty.
+template <typename T>
+class SpscRing {
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::vector<T> slots;
+    size_t mask;
+    char padding0[CACHE_LINE];
+    // Next slot to read; written by the consumer
+    std::atomic<size_t> head;
+    size_t cachedTail;
+    char padding1[CACHE_LINE];
+    // Next slot to write; written by the producer
+    std::atomic<size_t> tail;
+    size_t cachedHead;
+    char padding2[CACHE_LINE];
+
+public:
+    // The capacity is rounded up to a power of two.
+    explicit SpscRing(size_t capacity);
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only; false when the ring is full.
+    bool push(const T& value);
+    // Consumer only; false when the ring is empty.
+    bool pop(T& value);
+    size_t getCapacity() const;
+};
+
+template <typename T>
+SpscRing<T>::SpscRing(const size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool SpscRing<T>::push(const T& value) {
+    const size_t index = tail.load(std::memory_order_relaxed);
+    if (index - cachedHead == slots.size()) {
+        cachedHead = head.load(std::memory_order_acquire);
+        if (index - cachedHead == slots.size()) {
+            return false;
+        }
+    }
+    slots[index & mask] = value;
+    tail.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::pop(T& value) {
+    const size_t index = head.load(std::memory_order_relaxed);
+    if (index == cachedTail) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if (index == cachedTail) {
+            return false;
+        }
+    }
+    value = slots[index & mask];
+    head.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+size_t SpscRing<T>::getCapacity() const {
+    return slots.size();
+}
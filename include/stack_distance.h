@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Olken's reuse distance algorithm. Every block's most recent access is marked at its
+// timestamp in a Fenwick tree, so the number of distinct blocks touched since a block was
+// last used is a prefix sum: O(log n) per access. Timestamps are renumbered once fewer than
+// half of them are still live, which keeps the tree proportional to the distinct blocks seen.
+class StackDistance {
+private:
+    std::unordered_map<unsigned int, unsigned int> lastAccess;
+    std::vector<unsigned int> tree;
+    unsigned int now;
+
+    void add(unsigned int timestamp, int delta);
+    unsigned int prefix(unsigned int timestamp) const;
+    void rebuild(unsigned int capacity);
+
+public:
+    static constexpr unsigned int COLD = 0xFFFFFFFF;
+
+    StackDistance();
+
+    // Distinct blocks accessed since block was last used, or COLD on its first use.
+    unsigned int access(unsigned int block);
+    void reset();
+};
+
+// Single pass miss ratio curves for LRU caches of every power of two size up to maxLines.
+// Fully associative caches use StackDistance; set-associative ones keep a recency stack
+// maxWays deep per set for every power of two set count, since a hit needs distance < ways.
+class StackDistanceProfile {
+private:
+    struct SetStacks {
+        unsigned int sets;
+        std::vector<unsigned int> blocks;
+        std::vector<unsigned int> depth;
+        std::vector<unsigned long long> histogram;
+    };
+
+    unsigned int blockSize;
+    unsigned int maxLines;
+    unsigned int maxWays;
+    StackDistance fullyAssociative;
+    // Entry d counts reuses at distance d; the last entry counts cold and longer reuses.
+    std::vector<unsigned long long> distances;
+    std::vector<SetStacks> setStacks;
+    unsigned long long accesses;
+
+    void accessSets(SetStacks& stacks, unsigned int block);
+
+public:
+    StackDistanceProfile(unsigned int blockSize, unsigned int maxLines, unsigned int maxWays = 16);
+
+    void access(unsigned int address);
+    // Misses an LRU cache of lines lines would take; ways == 0 means fully associative.
+    unsigned long long misses(unsigned int lines, unsigned int ways) const;
+    unsigned long long getAccesses() const;
+    unsigned int getBlockSize() const;
+    unsigned int getMaxLines() const;
+    unsigned int getMaxWays() const;
+    void reset();
+};
+
+// Parses "block_size[:max_lines]"; both must be powers of two no larger than 65536.
+bool parseStackDistanceSpec(const std::string& text, unsigned int& blockSize, unsigned int& maxLines);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class CoherenceBus;
+struct CycleCounters;
+class MemoryTimingModel;
+class SetAssociativeCache;
+class StackDistanceProfile;
+
+enum class StatsFormat { TABLE, JSON };
+
+struct NamedCache {
+    const char* name;
+    const SetAssociativeCache* cache;
+};
+
+bool parseStatsFormat(const std::string& text, StatsFormat& format);
+
+// One row (or JSON object) per configured level, including its prefetcher and write buffer counters,
+// then the DRAM row buffer counters when memory is a banked model.
+void printCacheStatistics(std::ostream& out, const std::vector<NamedCache>& levels, unsigned long long memoryCycles,
+                          StatsFormat format, const MemoryTimingModel* memory = nullptr,
+                          const CoherenceBus* bus = nullptr);
+// Instruction count, total cycles and CPI, split into execute cycles and fetch, data and branch stalls.
+void printCpiBreakdown(std::ostream& out, const CycleCounters& counters, StatsFormat format);
+// Miss ratios of fully associative and 1..maxWays way LRU caches at every power of two size.
+void printMissRatioCurve(std::ostream& out, const StackDistanceProfile& profile, StatsFormat format);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "cache.h"
+#include "trace.h"
+
+#include <vector>
+
+// Times a stream of access records the way the emulator's memory path would have: fetches go
+// to the L1I when there is one, stores invalidate stale instruction blocks, and uncached
+// accesses are timed by the DRAM model, one stream per instruction. Only the timing is
+// modelled; the caches hold a zeroed copy of memory rather than the program's data.
+class TimingReplay {
+private:
+    std::vector<unsigned char> memory;
+    CacheHierarchy hierarchy;
+    unsigned int lastPC;
+
+public:
+    TimingReplay(const HierarchyConfig& config, unsigned int memorySize);
+    TimingReplay(const TimingReplay&) = delete;
+    TimingReplay& operator=(const TimingReplay&) = delete;
+
+    // An uncached access counts as a hit, as it never reaches a miss profile in the emulator.
+    CacheResult access(const TraceRecord& record);
+    const CacheHierarchy& getHierarchy() const;
+};
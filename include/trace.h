@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum TraceFlags : unsigned char {
+    TRACE_WRITE = 1,
+    TRACE_FETCH = 2
+};
+
+struct TraceRecord {
+    unsigned int address;
+    unsigned int pc;
+    unsigned char size;
+    unsigned char flags;
+};
+
+// On disk a trace is the 8 byte magic "EMUTRC01" followed by one 10 byte little endian record
+// per access: address (4), pc (4), size (1), flags (1).
+constexpr size_t TRACE_HEADER_SIZE = 8;
+constexpr size_t TRACE_RECORD_SIZE = 10;
+
+// Buffers records and writes them out in large blocks.
+class TraceWriter {
+private:
+    FILE* file;
+    std::vector<unsigned char> buffer;
+    size_t count;
+
+    bool flush();
+
+public:
+    TraceWriter();
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    void record(const TraceRecord& record);
+    // Flushes the buffer; returns false if any write failed.
+    bool close();
+    // Forgets the file without writing anything more to it, in a forked process that must leave
+    // its parent's trace alone.
+    void abandon();
+    bool isOpen() const;
+    size_t size() const;
+};
+
+// Read only mmap of a trace, shared by every thread replaying it.
+class MappedTrace {
+private:
+    const unsigned char* data;
+    size_t length;
+
+public:
+    MappedTrace();
+    ~MappedTrace();
+    MappedTrace(const MappedTrace&) = delete;
+    MappedTrace& operator=(const MappedTrace&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    size_t size() const;
+    TraceRecord operator[](size_t index) const;
+};
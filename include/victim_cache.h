@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+struct VictimCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long insertions;
+    unsigned long long writebacks;
+
+    VictimCacheStats();
+};
+
+// Small fully associative buffer (Jouppi's victim cache) holding the blocks most recently
+// evicted from one cache level, replaced LRU. A miss in the cache that finds its block here
+// swaps it back in for a few cycles instead of a fill from the level below. Blocks keep
+// their dirty bit while they wait; a dirty block pushed out of the buffer is handed back to
+// the owning cache to write back.
+class VictimCache {
+private:
+    struct Entry {
+        bool valid;
+        bool dirty;
+        unsigned int blockAddress;
+        unsigned long long lastUse;
+        std::vector<unsigned char> data;
+    };
+
+    std::vector<Entry> entries;
+    unsigned int blockSize;
+    unsigned int swapCycles;
+    unsigned long long useCounter;
+    VictimCacheStats stats;
+
+    Entry* find(unsigned int blockAddress);
+    const Entry* find(unsigned int blockAddress) const;
+
+public:
+    explicit VictimCache(unsigned int capacity = 0, unsigned int blockSize = 4, unsigned int swapCycles = 1);
+
+    bool isEnabled() const;
+    unsigned int getSwapCycles() const;
+
+    // Moves the block out of the buffer into data. Counts a hit or a miss.
+    bool take(unsigned int blockAddress, unsigned char* data, bool& dirty);
+    // Adds an evicted block. Returns true when that pushes out a dirty block, which is copied
+    // to displacedAddress and displaced for the caller to write back.
+    bool insert(unsigned int blockAddress, const unsigned char* data, bool dirty,
+                unsigned int& displacedAddress, std::vector<unsigned char>& displaced);
+    // Keeps a held copy current when a store bypasses the cache. Returns whether one was held.
+    bool update(unsigned int address, const unsigned char* data, unsigned int size);
+    bool forward(unsigned int address, unsigned char& value) const;
+    // Removes a held copy, merging its bytes into data if it was dirty. Returns whether it was.
+    bool recall(unsigned int blockAddress, unsigned char* data);
+    // Copies a dirty held copy to data and marks it clean. Returns whether it was dirty.
+    bool clean(unsigned int blockAddress, std::vector<unsigned char>& data);
+    // Like clean for whichever held block is dirty, copying its address to blockAddress.
+    bool cleanAny(unsigned int& blockAddress, std::vector<unsigned char>& data);
+    void invalidate(unsigned int blockAddress);
+
+    void reset();
+    const VictimCacheStats& getStats() const;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs tasks 0..count-1 on a fixed set of threads. Tasks are dealt round robin into one deque
+// per worker; a worker takes from the back of its own deque and, once it is empty, steals from
+// the front of the others, so long tasks do not leave the remaining threads idle.
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    bool takeOwn(size_t worker, size_t& task);
+    bool steal(size_t worker, size_t& task);
+    void work(size_t worker, const std::function<void(size_t)>& task);
+
+public:
+    // 0 threads means one per hardware thread.
+    explicit WorkStealingPool(unsigned int threads = 0);
+
+    // Returns once every task has finished.
+    void run(size_t count, const std::function<void(size_t)>& task);
+    unsigned int getThreads() const;
+};
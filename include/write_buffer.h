@@ -0,0 +1,66 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+class MemoryInterface;
+
+struct WriteBufferStats {
+    unsigned long long writes;
+    unsigned long long coalesced;
+    unsigned long long drains;
+    unsigned long long fullStalls;
+    unsigned long long stallCycles;
+
+    WriteBufferStats();
+};
+
+// Bounded coalescing buffer between a cache and the level below it. Each entry holds the
+// bytes written to one block; a store to a block that is already waiting merges into it.
+// Entries drain in order, one at a time, each taking the cycles the level below charges
+// for the write. The entry at the head is handed to the level below as soon as it starts
+// draining, so only the entries queued behind it hold data nobody else can see yet.
+class WriteBuffer {
+private:
+    struct Entry {
+        unsigned int blockAddress;
+        std::vector<unsigned char> data;
+        std::vector<bool> mask;
+    };
+
+    MemoryInterface* memory;
+    unsigned int capacity;
+    unsigned int blockSize;
+    std::deque<Entry> entries;
+    bool draining;
+    unsigned long long clock;
+    unsigned long long headDone;
+    unsigned int pendingStall;
+    WriteBufferStats stats;
+
+    void startDrain(unsigned long long start);
+    void retire();
+    unsigned int waitForHead();
+    unsigned int firstWaiting() const;
+
+public:
+    explicit WriteBuffer(MemoryInterface* memory = nullptr, unsigned int capacity = 0, unsigned int blockSize = 4);
+
+    bool isEnabled() const;
+
+    // Queues size bytes (all within one block) and returns the cycles the store stalled for a free entry.
+    unsigned int write(unsigned int address, const unsigned char* data, unsigned int size);
+    // Newest buffered value of a byte that has not reached the level below yet.
+    bool forward(unsigned int address, unsigned char& value) const;
+    // Waits until no entry overlapping [address, address + size) is still queued. Returns the stall.
+    unsigned int drainBlock(unsigned int address, unsigned int size);
+    // Waits until every queued entry has been handed to the level below. Returns the stall.
+    unsigned int drain();
+    // Removes the queued entries overlapping [address, address + size), merging their bytes into data.
+    bool recall(unsigned int address, unsigned char* data, unsigned int size);
+
+    // Lets the buffer drain while the owning cache spends cycles on other work.
+    void advance(unsigned int cycles);
+    void reset();
+    const WriteBufferStats& getStats() const;
+};
@@ -0,0 +1,49 @@
+; Parallel Counter Program
+; Hart 0 starts three more harts on WORK, counts along with them, then joins them
+; and prints the shared total. Run with at least four harts, e.g. -H 4
+
+; Data Section
+count   .int #0
+done    .str "Total count: "
+newline .str "\n"
+
+; Code Section
+        jmp MAIN
+
+; Adds 1 to count 1000000 times with fetch-and-add, then halts the hart
+WORK    movi r1, #1000000
+        lda r2, count
+        movi r4, #1
+LOOP    faa r5, r2, r4
+        subi r1, r1, #1
+        bnz r1, LOOP
+        trp #0
+
+MAIN    lda r3, WORK
+        trp #7            ;spawn hart 1
+        lda r3, WORK
+        trp #7            ;spawn hart 2
+        lda r3, WORK
+        trp #7            ;spawn hart 3
+
+        movi r1, #1000000
+        lda r2, count
+        movi r4, #1
+MLOOP   faa r5, r2, r4
+        subi r1, r1, #1
+        bnz r1, MLOOP
+
+        movi r3, #1
+        trp #8            ;join hart 1
+        movi r3, #2
+        trp #8            ;join hart 2
+        movi r3, #3
+        trp #8            ;join hart 3
+
+        lda r3, done
+        trp #5
+        ldr r3, count
+        trp #1
+        lda r3, newline
+        trp #5
+        trp #0
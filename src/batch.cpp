@@ -0,0 +1,131 @@
+#include "../include/batch.h"
+#include "../include/emu.h"
+#include "../include/latency.h"
+#include "../include/runner.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+BatchResult::BatchResult() : status(0), instructions(0), cycles(0), memoryCycles(0), seconds(0.0) {}
+
+bool loadBatchManifest(const std::string& path, std::vector<BatchJob>& jobs, std::string& error) {
+    std::ifstream manifest(path);
+    if (!manifest) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    unsigned int number = 0;
+    while (std::getline(manifest, line)) {
+        number++;
+        std::istringstream fields(line.substr(0, line.find('#')));
+        BatchJob job;
+        if (!(fields >> job.program)) {
+            continue;
+        }
+        if (!(fields >> job.input)) {
+            error = "line " + std::to_string(number) + ": expected a program and an input";
+            return false;
+        }
+        std::string option;
+        while (fields >> option) {
+            job.options.push_back(option);
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+BatchResult runBatchJob(const BatchJob& job) {
+    if (job.input == "-") {
+        std::istringstream noInput;
+        return runBatchJob(job, noInput.rdbuf());
+    }
+    std::ifstream input(job.input, std::ios::binary);
+    if (!input) {
+        BatchResult result;
+        result.status = 2;
+        result.errors = "Cannot open input " + job.input + "\n";
+        return result;
+    }
+    return runBatchJob(job, input.rdbuf());
+}
+
+BatchResult runBatchJob(const BatchJob& job, std::streambuf* const input) {
+    BatchResult result;
+
+    std::vector<std::string> arguments = {"emu", job.program};
+    arguments.insert(arguments.end(), job.options.begin(), job.options.end());
+    std::vector<char*> argv;
+    for (std::string& argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    std::ostringstream output;
+    std::ostringstream errors;
+    std::streambuf* const savedInput = std::cin.rdbuf(input);
+    std::streambuf* const savedOutput = std::cout.rdbuf(output.rdbuf());
+    std::streambuf* const savedErrors = std::cerr.rdbuf(errors.rdbuf());
+    std::cin.clear();
+    const bool savedTestMode = test_mode;
+    test_mode = true;
+
+    const auto start = std::chrono::steady_clock::now();
+    reset_emulator();
+    result.status = run_emulator(static_cast<int>(arguments.size()), argv.data());
+    // Harts left running by an invalid instruction still add their cycles
+    stop_harts();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    test_mode = savedTestMode;
+    std::cin.rdbuf(savedInput);
+    std::cout.rdbuf(savedOutput);
+    std::cerr.rdbuf(savedErrors);
+    std::cin.clear();
+
+    const CycleCounters& counters = get_cycle_counters();
+    result.instructions = counters.instructions;
+    result.cycles = counters.total();
+    result.memoryCycles = mem_cycle_cntr;
+    result.output = output.str();
+    result.errors = errors.str();
+    return result;
+}
+
+static std::string jsonString(const std::string& text) {
+    std::ostringstream quoted;
+    quoted << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted << '\\' << c;
+        } else if (c == '\n') {
+            quoted << "\\n";
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            quoted << c;
+        }
+    }
+    quoted << '"';
+    return quoted.str();
+}
+
+void writeBatchResults(std::ostream& out, const std::vector<BatchJob>& jobs, const std::vector<BatchResult>& results) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+        std::string options;
+        for (const std::string& option : jobs[i].options) {
+            options += (options.empty() ? "" : " ") + option;
+        }
+        const BatchResult& result = results[i];
+        out << "{\"job\": " << i << ", \"program\": " << jsonString(jobs[i].program)
+            << ", \"input\": " << jsonString(jobs[i].input) << ", \"options\": " << jsonString(options)
+            << ", \"status\": " << result.status << ", \"instructions\": " << result.instructions
+            << ", \"cycles\": " << result.cycles << ", \"memory_cycles\": " << result.memoryCycles
+            << ", \"seconds\": " << std::fixed << std::setprecision(6) << result.seconds << std::defaultfloat
+            << ", \"output\": " << jsonString(result.output) << ", \"errors\": " << jsonString(result.errors) << "}\n";
+    }
+}
@@ -0,0 +1,313 @@
+#include "../include/batch_workers.h"
+#include "../include/guests.h"
+#include "../include/work_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The emulator keeps its state in globals, so each pool thread hands its jobs to a worker
+// process of its own. A worker runs one job after another and keeps its memory between them.
+struct Worker {
+    pid_t pid;
+    int requests;
+    int replies;
+};
+
+struct Reply {
+    uint64_t job;
+    int32_t status;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t memoryCycles;
+    double seconds;
+    uint64_t outputSize;
+    uint64_t errorsSize;
+};
+
+static std::vector<Worker> workers;
+static std::vector<size_t> idle_workers;
+static std::mutex idle_mutex;
+// Held while a worker starts, so no child inherits the pipes of a worker started at the same time
+static std::mutex spawn_mutex;
+
+static bool readAll(const int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t done = read(fd, bytes, size);
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        size -= done;
+    }
+    return true;
+}
+
+static bool writeAll(const int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t done = write(fd, bytes, size);
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        size -= done;
+    }
+    return true;
+}
+
+static bool writeReply(const int replies, const size_t index, const BatchResult& result) {
+    const Reply reply = {index, result.status, result.instructions, result.cycles, result.memoryCycles,
+                         result.seconds, result.output.size(), result.errors.size()};
+    return writeAll(replies, &reply, sizeof(reply)) && writeAll(replies, result.output.data(), result.output.size()) &&
+           writeAll(replies, result.errors.data(), result.errors.size());
+}
+
+static bool readReply(const int replies, size_t& index, BatchResult& result) {
+    Reply reply;
+    if (!readAll(replies, &reply, sizeof(reply))) {
+        return false;
+    }
+    result.output.resize(reply.outputSize);
+    result.errors.resize(reply.errorsSize);
+    if (!readAll(replies, &result.output[0], reply.outputSize) ||
+        !readAll(replies, &result.errors[0], reply.errorsSize)) {
+        return false;
+    }
+    index = reply.job;
+    result.status = reply.status;
+    result.instructions = reply.instructions;
+    result.cycles = reply.cycles;
+    result.memoryCycles = reply.memoryCycles;
+    result.seconds = reply.seconds;
+    return true;
+}
+
+static void serveJobs(const int requests, const int replies, const std::vector<BatchJob>& jobs) {
+    uint64_t index;
+    while (readAll(requests, &index, sizeof(index)) && index < jobs.size()) {
+        if (!writeReply(replies, index, runBatchJob(jobs[index]))) {
+            return;
+        }
+    }
+}
+
+static bool startWorker(const size_t slot, const std::vector<BatchJob>& jobs) {
+    std::lock_guard<std::mutex> guard(spawn_mutex);
+    int requests[2];
+    int replies[2];
+    if (pipe(requests) != 0) {
+        return false;
+    }
+    if (pipe(replies) != 0) {
+        close(requests[0]);
+        close(requests[1]);
+        return false;
+    }
+    std::cout.flush();
+    std::cerr.flush();
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        for (size_t other = 0; other < workers.size(); other++) {
+            if (other != slot && workers[other].pid > 0) {
+                close(workers[other].requests);
+                close(workers[other].replies);
+            }
+        }
+        close(requests[1]);
+        close(replies[0]);
+        serveJobs(requests[0], replies[1], jobs);
+        _exit(0);
+    }
+
+    close(requests[0]);
+    close(replies[1]);
+    if (pid < 0) {
+        close(requests[1]);
+        close(replies[0]);
+        return false;
+    }
+    workers[slot] = Worker{pid, requests[1], replies[0]};
+    return true;
+}
+
+// Returns the worker's exit status the way a shell reports it.
+static int stopWorker(const size_t slot, const bool kill) {
+    Worker& worker = workers[slot];
+    if (kill) {
+        ::kill(worker.pid, SIGKILL);
+    }
+    close(worker.requests);
+    close(worker.replies);
+    int status = 0;
+    waitpid(worker.pid, &status, 0);
+    worker.pid = 0;
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static size_t acquireWorker() {
+    std::lock_guard<std::mutex> guard(idle_mutex);
+    const size_t slot = idle_workers.back();
+    idle_workers.pop_back();
+    return slot;
+}
+
+static void releaseWorker(const size_t slot) {
+    std::lock_guard<std::mutex> guard(idle_mutex);
+    idle_workers.push_back(slot);
+}
+
+// A worker that dies or runs past the timeout is replaced before its next job.
+static BatchResult runOnWorker(const size_t slot, const size_t index, const std::vector<BatchJob>& jobs,
+                               const unsigned int timeout) {
+    BatchResult result;
+    if (workers[slot].pid == 0 && !startWorker(slot, jobs)) {
+        result.status = 2;
+        result.errors = "Cannot start a worker process\n";
+        return result;
+    }
+    const Worker& worker = workers[slot];
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t request = index;
+    if (writeAll(worker.requests, &request, sizeof(request))) {
+        pollfd ready = {worker.replies, POLLIN, 0};
+        if (poll(&ready, 1, timeout == 0 ? -1 : static_cast<int>(timeout * 1000)) == 0) {
+            result.status = 124;
+            result.errors = "Timed out after " + std::to_string(timeout) + " seconds\n";
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stopWorker(slot, true);
+            return result;
+        }
+        size_t replied;
+        if (readReply(worker.replies, replied, result)) {
+            return result;
+        }
+    }
+    // The job ended the worker, by a crash or an exit the emulator could not turn into a return
+    result.status = stopWorker(slot, false);
+    result.output.clear();
+    result.errors = "The worker ended with status " + std::to_string(result.status) + "\n";
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// With -F each worker takes its share of the jobs at once and runs them as guest fibers, replying
+// as each one finishes. The workers are started together, since none of them is handed more work.
+static bool startGuestWorker(const size_t slot, const std::vector<BatchJob>& jobs, const std::vector<size_t>& share,
+                             const unsigned int quantum) {
+    int replies[2];
+    if (pipe(replies) != 0) {
+        return false;
+    }
+    std::cout.flush();
+    std::cerr.flush();
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        for (size_t other = 0; other < slot; other++) {
+            close(workers[other].replies);
+        }
+        close(replies[0]);
+        GuestScheduler scheduler(quantum);
+        std::string error;
+        const bool ran = scheduler.run(jobs, share, [&](const size_t index, const BatchResult& result) {
+            writeReply(replies[1], index, result);
+        }, error);
+        _exit(ran ? 0 : 2);
+    }
+
+    close(replies[1]);
+    if (pid < 0) {
+        close(replies[0]);
+        return false;
+    }
+    workers[slot] = Worker{pid, -1, replies[0]};
+    return true;
+}
+
+// Collects the replies of every guest worker. The jobs of a worker that ends early get its status.
+static void collectGuests(const std::vector<std::vector<size_t>>& shares, std::vector<BatchResult>& results) {
+    std::vector<std::vector<bool>> finished(shares.size());
+    std::vector<pollfd> ready;
+    for (size_t slot = 0; slot < shares.size(); slot++) {
+        finished[slot].assign(results.size(), false);
+        ready.push_back(pollfd{workers[slot].replies, POLLIN, 0});
+    }
+    size_t running = shares.size();
+    while (running > 0) {
+        if (poll(ready.data(), ready.size(), -1) < 0) {
+            continue;
+        }
+        for (size_t slot = 0; slot < shares.size(); slot++) {
+            if (ready[slot].fd < 0 || ready[slot].revents == 0) {
+                continue;
+            }
+            BatchResult result;
+            size_t index;
+            if (readReply(ready[slot].fd, index, result) && index < results.size()) {
+                results[index] = result;
+                finished[slot][index] = true;
+                continue;
+            }
+            const int status = stopWorker(slot, false);
+            for (const size_t job : shares[slot]) {
+                if (!finished[slot][job]) {
+                    results[job].status = status == 0 ? 2 : status;
+                    results[job].errors = "The worker ended with status " + std::to_string(status) + "\n";
+                }
+            }
+            ready[slot].fd = -1;
+            running--;
+        }
+    }
+}
+
+bool runOnWorkers(const std::vector<BatchJob>& jobs, const unsigned int threads, const unsigned int timeout,
+                  const unsigned int quantum, std::vector<BatchResult>& results, size_t& worker_count) {
+    // A write to a worker that has just died must fail rather than end the batch
+    std::signal(SIGPIPE, SIG_IGN);
+    WorkStealingPool pool(threads);
+    worker_count = std::min<size_t>(pool.getThreads(), jobs.size());
+    workers.assign(worker_count, Worker{0, -1, -1});
+    idle_workers.clear();
+    results.assign(jobs.size(), BatchResult());
+    if (quantum > 0) {
+        std::vector<std::vector<size_t>> shares(worker_count);
+        for (size_t index = 0; index < jobs.size(); index++) {
+            shares[index % worker_count].push_back(index);
+        }
+        for (size_t slot = 0; slot < worker_count; slot++) {
+            if (!startGuestWorker(slot, jobs, shares[slot], quantum)) {
+                return false;
+            }
+        }
+        collectGuests(shares, results);
+        return true;
+    }
+    for (size_t slot = 0; slot < worker_count; slot++) {
+        if (!startWorker(slot, jobs)) {
+            return false;
+        }
+        idle_workers.push_back(slot);
+    }
+
+    pool.run(jobs.size(), [&](const size_t index) {
+        const size_t slot = acquireWorker();
+        results[index] = runOnWorker(slot, index, jobs, timeout);
+        releaseWorker(slot);
+    });
+    for (size_t slot = 0; slot < worker_count; slot++) {
+        if (workers[slot].pid > 0) {
+            stopWorker(slot, false);
+        }
+    }
+    return true;
+}
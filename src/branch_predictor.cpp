@@ -0,0 +1,327 @@
+#include "../include/branch_predictor.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Instructions are 8 bytes, so the low address bits carry no information.
+static const unsigned int INSTRUCTION_SHIFT = 3;
+static const unsigned char WEAKLY_NOT_TAKEN = 1;
+
+static bool isPowerOfTwo(const unsigned int value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static void train(unsigned char& counter, const bool taken) {
+    if (taken && counter < 3) {
+        counter++;
+    } else if (!taken && counter > 0) {
+        counter--;
+    }
+}
+
+BranchPredictorConfig::BranchPredictorConfig()
+    : type(PredictorType::NONE), entries(1024), historyBits(10), btbEntries(256), rasDepth(8), penalty(3) {}
+
+bool BranchPredictorConfig::isValid(std::string& error) const {
+    if (type == PredictorType::NONE) {
+        return true;
+    }
+    if (!isPowerOfTwo(entries) || !isPowerOfTwo(btbEntries)) {
+        error = "branch: predictor and BTB entries must be powers of two";
+        return false;
+    }
+    if (historyBits > 24) {
+        error = "branch: at most 24 history bits";
+        return false;
+    }
+    if (rasDepth == 0) {
+        error = "branch: the return address stack needs at least one entry";
+        return false;
+    }
+    return true;
+}
+
+static bool parsePredictorType(const std::string& text, PredictorType& type) {
+    const PredictorType types[] = {PredictorType::NONE, PredictorType::NOT_TAKEN, PredictorType::BIMODAL,
+                                   PredictorType::GSHARE, PredictorType::TOURNAMENT};
+    for (const PredictorType candidate : types) {
+        if (text == predictorName(candidate)) {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parsePredictorSpec(const std::string& text, BranchPredictorConfig& config) {
+    const size_t first = text.find(':');
+    BranchPredictorConfig parsed = config;
+    if (!parsePredictorType(text.substr(0, first), parsed.type)) {
+        return false;
+    }
+    if (first != std::string::npos) {
+        const size_t second = text.find(':', first + 1);
+        try {
+            size_t used = 0;
+            const std::string entries = text.substr(first + 1, second == std::string::npos ? std::string::npos : second - first - 1);
+            parsed.entries = std::stoul(entries, &used);
+            if (used != entries.size()) {
+                return false;
+            }
+            if (second != std::string::npos) {
+                const std::string history = text.substr(second + 1);
+                parsed.historyBits = std::stoul(history, &used);
+                if (used != history.size()) {
+                    return false;
+                }
+            }
+        } catch (std::invalid_argument&) {
+            return false;
+        } catch (std::out_of_range&) {
+            return false;
+        }
+    }
+    config = parsed;
+    return true;
+}
+
+const char* predictorName(const PredictorType type) {
+    switch (type) {
+        case PredictorType::NOT_TAKEN:
+            return "not-taken";
+        case PredictorType::BIMODAL:
+            return "bimodal";
+        case PredictorType::GSHARE:
+            return "gshare";
+        case PredictorType::TOURNAMENT:
+            return "tournament";
+        default:
+            return "none";
+    }
+}
+
+bool NotTakenPredictor::predict(const unsigned int /*pc*/) const {
+    return false;
+}
+
+void NotTakenPredictor::update(const unsigned int /*pc*/, const bool /*taken*/) {}
+
+void NotTakenPredictor::reset() {}
+
+BimodalPredictor::BimodalPredictor(const unsigned int entries) : counters(entries, WEAKLY_NOT_TAKEN) {}
+
+unsigned int BimodalPredictor::indexOf(const unsigned int pc) const {
+    return (pc >> INSTRUCTION_SHIFT) & (counters.size() - 1);
+}
+
+bool BimodalPredictor::predict(const unsigned int pc) const {
+    return counters[indexOf(pc)] >= 2;
+}
+
+void BimodalPredictor::update(const unsigned int pc, const bool taken) {
+    train(counters[indexOf(pc)], taken);
+}
+
+void BimodalPredictor::reset() {
+    std::fill(counters.begin(), counters.end(), WEAKLY_NOT_TAKEN);
+}
+
+GsharePredictor::GsharePredictor(const unsigned int entries, const unsigned int historyBits)
+    : counters(entries, WEAKLY_NOT_TAKEN), historyMask((1u << historyBits) - 1), history(0) {}
+
+unsigned int GsharePredictor::indexOf(const unsigned int pc) const {
+    return ((pc >> INSTRUCTION_SHIFT) ^ history) & (counters.size() - 1);
+}
+
+bool GsharePredictor::predict(const unsigned int pc) const {
+    return counters[indexOf(pc)] >= 2;
+}
+
+void GsharePredictor::update(const unsigned int pc, const bool taken) {
+    train(counters[indexOf(pc)], taken);
+    history = ((history << 1) | (taken ? 1 : 0)) & historyMask;
+}
+
+void GsharePredictor::reset() {
+    std::fill(counters.begin(), counters.end(), WEAKLY_NOT_TAKEN);
+    history = 0;
+}
+
+TournamentPredictor::TournamentPredictor(const unsigned int entries, const unsigned int historyBits)
+    : local(entries), global(entries, historyBits), choosers(entries, WEAKLY_NOT_TAKEN) {}
+
+unsigned int TournamentPredictor::indexOf(const unsigned int pc) const {
+    return (pc >> INSTRUCTION_SHIFT) & (choosers.size() - 1);
+}
+
+// A chooser of 2 or more trusts gshare.
+bool TournamentPredictor::predict(const unsigned int pc) const {
+    return choosers[indexOf(pc)] >= 2 ? global.predict(pc) : local.predict(pc);
+}
+
+void TournamentPredictor::update(const unsigned int pc, const bool taken) {
+    const bool localCorrect = local.predict(pc) == taken;
+    const bool globalCorrect = global.predict(pc) == taken;
+    if (localCorrect != globalCorrect) {
+        train(choosers[indexOf(pc)], globalCorrect);
+    }
+    local.update(pc, taken);
+    global.update(pc, taken);
+}
+
+void TournamentPredictor::reset() {
+    local.reset();
+    global.reset();
+    std::fill(choosers.begin(), choosers.end(), WEAKLY_NOT_TAKEN);
+}
+
+BranchTargetBuffer::BranchTargetBuffer(const unsigned int size) : entries(size, Entry{false, 0, 0}) {}
+
+bool BranchTargetBuffer::lookup(const unsigned int pc, unsigned int& target) const {
+    const Entry& entry = entries[(pc >> INSTRUCTION_SHIFT) & (entries.size() - 1)];
+    if (!entry.valid || entry.pc != pc) {
+        return false;
+    }
+    target = entry.target;
+    return true;
+}
+
+void BranchTargetBuffer::update(const unsigned int pc, const unsigned int target) {
+    entries[(pc >> INSTRUCTION_SHIFT) & (entries.size() - 1)] = Entry{true, pc, target};
+}
+
+void BranchTargetBuffer::reset() {
+    for (Entry& entry : entries) {
+        entry.valid = false;
+    }
+}
+
+ReturnAddressStack::ReturnAddressStack(const unsigned int depth) : entries(depth, 0), top(0), count(0) {}
+
+void ReturnAddressStack::push(const unsigned int address) {
+    entries[top] = address;
+    top = (top + 1) % entries.size();
+    count = std::min<unsigned int>(count + 1, entries.size());
+}
+
+bool ReturnAddressStack::pop(unsigned int& address) {
+    if (count == 0) {
+        return false;
+    }
+    top = (top + entries.size() - 1) % entries.size();
+    address = entries[top];
+    count--;
+    return true;
+}
+
+void ReturnAddressStack::reset() {
+    top = 0;
+    count = 0;
+}
+
+BranchStats::BranchStats()
+    : branches(0), mispredictions(0), conditional(0), conditionalMispredictions(0), btbMisses(0),
+      returnMispredictions(0) {}
+
+static std::unique_ptr<DirectionPredictor> createDirectionPredictor(const BranchPredictorConfig& config) {
+    switch (config.type) {
+        case PredictorType::BIMODAL:
+            return std::make_unique<BimodalPredictor>(config.entries);
+        case PredictorType::GSHARE:
+            return std::make_unique<GsharePredictor>(config.entries, config.historyBits);
+        case PredictorType::TOURNAMENT:
+            return std::make_unique<TournamentPredictor>(config.entries, config.historyBits);
+        default:
+            return std::make_unique<NotTakenPredictor>();
+    }
+}
+
+BranchUnit::BranchUnit(const BranchPredictorConfig& config)
+    : config(config), direction(createDirectionPredictor(config)), btb(config.btbEntries), ras(config.rasDepth) {}
+
+// Where the front end would have gone next. A branch predicted taken still falls through
+// when the BTB has no target for it.
+unsigned int BranchUnit::predictTarget(const unsigned int pc, const BranchKind kind, const unsigned int fallthrough) {
+    unsigned int target = fallthrough;
+    if (kind == BranchKind::RETURN) {
+        ras.pop(target);
+        return target;
+    }
+    if (kind == BranchKind::CONDITIONAL && !direction->predict(pc)) {
+        return fallthrough;
+    }
+    if (!btb.lookup(pc, target)) {
+        stats.btbMisses++;
+        return fallthrough;
+    }
+    return target;
+}
+
+unsigned int BranchUnit::resolve(const unsigned int pc, const BranchKind kind, const unsigned int fallthrough,
+                                 const unsigned int target) {
+    const unsigned int predicted = predictTarget(pc, kind, fallthrough);
+    const bool taken = target != fallthrough;
+    const bool mispredicted = predicted != target;
+
+    if (kind == BranchKind::CONDITIONAL) {
+        direction->update(pc, taken);
+        stats.conditional++;
+        stats.conditionalMispredictions += mispredicted ? 1 : 0;
+    } else if (kind == BranchKind::RETURN) {
+        stats.returnMispredictions += mispredicted ? 1 : 0;
+    }
+    if (kind != BranchKind::RETURN && taken) {
+        btb.update(pc, target);
+    }
+    if (kind == BranchKind::CALL) {
+        ras.push(fallthrough);
+    }
+
+    BranchRecord& record = records[pc];
+    record.pc = pc;
+    record.executions++;
+    stats.branches++;
+    if (!mispredicted) {
+        return 0;
+    }
+    record.mispredictions++;
+    stats.mispredictions++;
+    return config.penalty;
+}
+
+const BranchPredictorConfig& BranchUnit::getConfig() const {
+    return config;
+}
+
+const BranchStats& BranchUnit::getStats() const {
+    return stats;
+}
+
+std::vector<BranchRecord> BranchUnit::worst(const unsigned int n) const {
+    std::vector<BranchRecord> sorted;
+    sorted.reserve(records.size());
+    for (const auto& entry : records) {
+        sorted.push_back(entry.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const BranchRecord& a, const BranchRecord& b) {
+        if (a.mispredictions != b.mispredictions) {
+            return a.mispredictions > b.mispredictions;
+        }
+        if (a.executions != b.executions) {
+            return a.executions > b.executions;
+        }
+        return a.pc < b.pc;
+    });
+    if (sorted.size() > n) {
+        sorted.resize(n);
+    }
+    return sorted;
+}
+
+void BranchUnit::reset() {
+    direction->reset();
+    btb.reset();
+    ras.reset();
+    stats = BranchStats();
+    records.clear();
+}
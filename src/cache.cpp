@@ -1,5 +1,7 @@
 #include "../include/cache.h"
 
+#include <stdexcept>
+
 CacheResult::CacheResult(const bool hit, const unsigned int cycles, const bool wb, const unsigned int wbCycles)
     : hit(hit), cycles(cycles), writebackOccurred(wb), writebackCycles(wbCycles) {}
 
@@ -7,46 +9,169 @@ unsigned int CacheResult::getCycles() const {
     return hit ? cycles : cycles + writebackCycles;
 }
 
-Cache::AddressInfo::AddressInfo(const unsigned int addr, const unsigned int numSets) {
-    blockAddress = addr / BLOCK_SIZE;
-    blockOffset = addr % BLOCK_SIZE;
+CacheGeometry::CacheGeometry(const unsigned int sets, const unsigned int ways, const unsigned int blockSize)
+    : sets(sets), ways(ways), blockSize(blockSize) {}
 
-    if (numSets > 0) {
-        index = blockAddress % numSets;
-        tag = blockAddress / numSets;
-    } else {
-        index = 0;
-        tag = blockAddress;
-    }
+unsigned int CacheGeometry::lines() const {
+    return sets * ways;
 }
 
-CacheResult Cache::calculateTiming(const bool hit, const bool wb, const unsigned int blocksToRead) {
-    unsigned int readCycles = 1;
-    unsigned int writebackCycles = 0;
-    if (hit) {
-        return CacheResult(hit, readCycles, wb, writebackCycles);
+unsigned int CacheGeometry::wordsPerBlock() const {
+    return blockSize / 4;
+}
+
+bool CacheGeometry::isValid() const {
+    return sets > 0 && ways > 0 && ways <= 65536 && blockSize >= 4 && blockSize % 4 == 0;
+}
+
+CacheStats::CacheStats()
+    : hits(0), misses(0), cycles(0), readHits(0), readMisses(0), writeHits(0), writeMisses(0),
+      fetchHits(0), fetchMisses(0), writebacks(0), evictions(0), hitCycles(0), missCycles(0),
+      compulsoryMisses(0), capacityMisses(0), conflictMisses(0), noAllocateMisses(0) {}
+
+const CacheStats& Cache::getStats() const {
+    return stats;
+}
+
+void Cache::setStats(const CacheStats& counts) {
+    stats = counts;
+}
+
+CacheConfig::CacheConfig(const unsigned int type, const unsigned int lines, const unsigned int blockSize)
+    : type(type), lines(lines), blockSize(blockSize), ways(4), hitLatency(1),
+      replacement(ReplacementType::LRU), seed(1), writeThrough(false), writeAllocate(true), writeBufferEntries(0),
+      prefetcher(PrefetchType::NONE), prefetchDegree(1), prefetchDistance(1), classifyMisses(false),
+      victimEntries(0) {}
+
+CacheGeometry CacheConfig::geometry() const {
+    return CacheFactory::createGeometry(type, lines, blockSize, ways);
+}
+
+HierarchyConfig::HierarchyConfig()
+    : inclusive(true), dramModel(MemoryTimingType::FLAT), dramFirstAccess(8), dramBurst(2), dramBanks(8),
+      dramRowSize(2048), dramRowHit(4), dramRowMiss(12), dramPrecharge(4), dramOpenPage(true),
+      coherence(CoherenceProtocol::NONE), coherenceTransfer(6), coherenceUpgrade(4), coherenceInvalidate(2),
+      decoupled(false) {}
+
+bool HierarchyConfig::isValid(std::string& error) const {
+    const CacheConfig* levels[] = {&l1d, &l1i, &l2, &l3};
+    const char* names[] = {"l1d", "l1i", "l2", "l3"};
+    for (unsigned int i = 0; i < 4; i++) {
+        if (levels[i]->type > 4) {
+            error = std::string(names[i]) + ": unknown cache type";
+            return false;
+        }
+        if (levels[i]->type != 0 && !levels[i]->geometry().isValid()) {
+            error = std::string(names[i]) + ": invalid geometry";
+            return false;
+        }
+        const unsigned int ways = levels[i]->geometry().ways;
+        if (levels[i]->type != 0 && levels[i]->replacement == ReplacementType::PLRU && (ways & (ways - 1)) != 0) {
+            error = std::string(names[i]) + ": tree PLRU needs a power of two number of ways";
+            return false;
+        }
+        if (levels[i]->victimEntries > MAX_VICTIM_ENTRIES) {
+            error = std::string(names[i]) + ": a victim cache holds at most " + std::to_string(MAX_VICTIM_ENTRIES) + " blocks";
+            return false;
+        }
     }
 
-    readCycles += 8 + 2 * (blocksToRead * WORDS_PER_BLOCK - 1);
+    if (l3.type != 0 && l2.type == 0) {
+        error = "l3 requires an l2";
+        return false;
+    }
+    if (l2.type != 0 && l1d.type == 0 && l1i.type == 0) {
+        error = "l2 requires an l1 cache";
+        return false;
+    }
+    if (l2.type != 0 && ((l1d.type != 0 && l2.blockSize % l1d.blockSize != 0) ||
+                         (l1i.type != 0 && l2.blockSize % l1i.blockSize != 0))) {
+        error = "l2 block size must be a multiple of the l1 block sizes";
+        return false;
+    }
+    if (l3.type != 0 && l3.blockSize % l2.blockSize != 0) {
+        error = "l3 block size must be a multiple of the l2 block size";
+        return false;
+    }
+    if (dramModel == MemoryTimingType::BANKED) {
+        if (dramBanks == 0 || dramRowSize == 0 || (dramRowSize & (dramRowSize - 1)) != 0) {
+            error = "dram: banks must be nonzero and the row size a power of two";
+            return false;
+        }
+        if (dramPrecharge > dramRowMiss) {
+            error = "dram: precharge cannot exceed the row miss latency";
+            return false;
+        }
+    }
+    if (coherence != CoherenceProtocol::NONE && l1d.type == 0) {
+        error = "coherence requires an l1d cache";
+        return false;
+    }
+    return true;
+}
 
-    if (wb) {
-        writebackCycles = 8 + 2 * (WORDS_PER_BLOCK - 1);
+bool parseWritePolicy(const std::string& text, CacheConfig& config) {
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        const std::string option = text.substr(start, end - start);
+
+        if (option == "write-back") {
+            config.writeThrough = false;
+        } else if (option == "write-through") {
+            config.writeThrough = true;
+        } else if (option == "allocate") {
+            config.writeAllocate = true;
+        } else if (option == "no-allocate") {
+            config.writeAllocate = false;
+        } else if (option.compare(0, 7, "buffer=") == 0 && option.size() > 7 &&
+                   option.find_first_not_of("0123456789", 7) == std::string::npos) {
+            try {
+                config.writeBufferEntries = static_cast<unsigned int>(std::stoul(option.substr(7)));
+            } catch (const std::out_of_range&) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+        start = end + 1;
     }
+    return true;
+}
+
+Cache::AddressInfo::AddressInfo(const unsigned int addr, const unsigned int numSets, const unsigned int blockSize) {
+    blockAddress = addr / blockSize;
+    blockOffset = addr % blockSize;
 
-    return CacheResult(hit, readCycles, wb, writebackCycles);
+    if (numSets > 0) {
+        index = blockAddress % numSets;
+        tag = blockAddress / numSets;
+    } else {
+        index = 0;
+        tag = blockAddress;
+    }
 }
 
-CacheLine::CacheLine() : valid(false), dirty(false), tag(0), lastUsed(0), data(BLOCK_SIZE, 0) {}
+CacheLine::CacheLine(const unsigned int blockSize)
+    : valid(false), dirty(false), exclusive(false), prefetched(false), tag(0), readyAt(0), data(blockSize, 0) {}
 
 void CacheLine::invalidate() {
     valid = false;
     dirty = false;
+    exclusive = false;
+    prefetched = false;
     tag = 0;
-    lastUsed = 0;
 }
+SystemMemory::SystemMemory(unsigned char* prog_mem, const unsigned int prog_mem_size,
+                           const unsigned int firstAccessCycles, const unsigned int burstCycles)
+    : prog_mem(prog_mem), prog_mem_size(prog_mem_size),
+      ownTiming(std::make_unique<FlatMemoryTiming>(firstAccessCycles, burstCycles)), timing(ownTiming.get()) {}
 
-SystemMemory::SystemMemory(unsigned char* prog_mem, const unsigned int prog_mem_size)
-    : prog_mem(prog_mem), prog_mem_size(prog_mem_size) {}
+SystemMemory::SystemMemory(unsigned char* prog_mem, const unsigned int prog_mem_size, MemoryTimingModel* timing)
+    : prog_mem(prog_mem), prog_mem_size(prog_mem_size), timing(timing) {}
 
 unsigned char SystemMemory::readByteFromMemory(const unsigned int address) {
     if (address >= prog_mem_size) { return 0; }
@@ -78,215 +203,433 @@ unsigned int SystemMemory::getMemorySize() const {
     return prog_mem_size;
 }
 
-DirectMappedCache::DirectMappedCache(MemoryInterface* memory) : memory(memory), counter(0) {
-    cache.resize(CACHE_LINES);
-}
-
-std::string DirectMappedCache::getType() const {
-    return "Direct Mapped Cache";
+unsigned int SystemMemory::readBlock(const unsigned int address, unsigned char* data, const unsigned int size) {
+    for (unsigned int i = 0; i < size; i++) {
+        data[i] = readByteFromMemory(address + i);
+    }
+    return timing->transfer(address, size, false);
 }
 
-void DirectMappedCache::reset() {
-    for (CacheLine& line : cache) {
-        line.invalidate();
+unsigned int SystemMemory::writeBlock(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    for (unsigned int i = 0; i < size; i++) {
+        writeByteToMemory(address + i, data[i]);
     }
-    counter = 0;
+    return timing->transfer(address, size, true);
 }
 
-CacheResult DirectMappedCache::readByte(const unsigned int address) {
-    const AddressInfo addr(address, CACHE_LINES);
-    CacheLine& line = cache[addr.index];
+SetAssociativeCache::SetAssociativeCache(MemoryInterface* memory, const CacheGeometry& geometry)
+    : geometry(geometry), memory(memory), hitLatency(1),
+      replacement(std::make_unique<LRUPolicy>(geometry.sets, geometry.ways)),
+      writeThrough(false), writeAllocate(true), buffered(false), accessPC(0), clock(0), fetching(false), bus(nullptr),
+      lastLine(nullptr), lastBlockStart(0), lastTag(0), lastIndex(0), lastTouched(nullptr) {
+    cache.resize(geometry.lines(), CacheLine(geometry.blockSize));
+}
 
-    if (line.valid && line.tag == addr.tag) {
-        line.lastUsed = ++counter;
-        return calculateTiming(true);
-    }
+const CacheGeometry& SetAssociativeCache::getGeometry() const {
+    return geometry;
+}
 
-    const bool needsWriteback = line.valid && line.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+void SetAssociativeCache::setReplacementPolicy(std::unique_ptr<ReplacementPolicy> policy) {
+    replacement = std::move(policy);
+}
 
-    if (needsWriteback) {
-        writeBackBlock(line, addr.index);
-    }
+const ReplacementPolicy& SetAssociativeCache::getReplacementPolicy() const {
+    return *replacement;
+}
 
-    loadBlockFromMemory(line, addr.tag, address - addr.blockOffset);
-    line.lastUsed = ++counter;
+void SetAssociativeCache::setHitLatency(const unsigned int hitLatency) {
+    this->hitLatency = hitLatency;
+}
 
-    return result;
+void SetAssociativeCache::setWritePolicy(const bool writeThrough, const bool writeAllocate, const unsigned int writeBufferEntries) {
+    this->writeThrough = writeThrough;
+    this->writeAllocate = writeAllocate;
+    writeBuffer = WriteBuffer(memory, writeBufferEntries, geometry.blockSize);
+    buffered = writeBufferEntries > 0;
 }
 
-unsigned char DirectMappedCache::getCachedByte(const unsigned int address) {
-    const AddressInfo addr(address, CACHE_LINES);
-    const CacheLine& line = cache[addr.index];
+const WriteBuffer& SetAssociativeCache::getWriteBuffer() const {
+    return writeBuffer;
+}
 
-    return line.data[addr.blockOffset];
+unsigned int SetAssociativeCache::drainWriteBuffer() {
+    return writeBuffer.drain();
 }
 
-CacheResult DirectMappedCache::readWord(const unsigned int address) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
-        const CacheResult result1 = readByte(address);
-        const CacheResult result2 = readByte(address + 3);
-        return CacheResult(result1.hit && result2.hit,
-            result1.getCycles() + result2.getCycles(),
-            result1.writebackOccurred || result2.writebackOccurred,
-            result1.writebackCycles + result2.writebackCycles
-        );
+void SetAssociativeCache::writeBackAll() {
+    writeBuffer.drain();
+    for (size_t i = 0; i < cache.size(); i++) {
+        CacheLine& line = cache[i];
+        if (line.valid && line.dirty) {
+            writeBackBlock(line, i / geometry.ways);
+            line.dirty = false;
+        }
     }
+    unsigned int blockAddress = 0;
+    while (victimCache.cleanAny(blockAddress, displacedBlock)) {
+        memory->writeBlock(blockAddress, displacedBlock.data(), geometry.blockSize);
+    }
+}
 
-    return readByte(address);
+void SetAssociativeCache::setCoherenceBus(CoherenceBus* bus) {
+    this->bus = bus;
 }
 
-unsigned int DirectMappedCache::getCachedWord(const unsigned int address) {
-    const AddressInfo addr(address, CACHE_LINES);
-    const CacheLine& line = cache[addr.index];
+// Copies only in the write buffer or the victim cache are not worth tracking: they go to the level below.
+bool SetAssociativeCache::snoopRead(const unsigned int blockAddress, unsigned char* data, const bool keepOwnership,
+                                    bool& supplied) {
+    const AddressInfo addr(blockAddress, geometry.sets, geometry.blockSize);
+    writeBuffer.drainBlock(blockAddress, geometry.blockSize);
+    if (victimCache.clean(blockAddress, displacedBlock)) {
+        stats.writebacks++;
+        memory->writeBlock(blockAddress, displacedBlock.data(), geometry.blockSize);
+    }
+    victimCache.invalidate(blockAddress);
 
-    return line.data[addr.blockOffset] |
-        (line.data[addr.blockOffset + 1] << 8) |
-        (line.data[addr.blockOffset + 2] << 16) |
-        (line.data[addr.blockOffset + 3] << 24);
+    CacheLine* line = findLine(addr);
+    if (line == nullptr) {
+        return false;
+    }
+    line->exclusive = false;
+    if (line->dirty) {
+        std::copy(line->data.begin(), line->data.end(), data);
+        supplied = true;
+        if (!keepOwnership) {
+            stats.writebacks++;
+            writeBackBlock(*line, addr.index);
+            line->dirty = false;
+        }
+    }
+    return true;
 }
 
-CacheResult DirectMappedCache::writeByte(const unsigned int address, const unsigned char data) {
-    const AddressInfo addr(address, CACHE_LINES);
-    CacheLine& line = cache[addr.index];
+bool SetAssociativeCache::snoopInvalidate(const unsigned int blockAddress, unsigned char* data, bool& supplied) {
+    const AddressInfo addr(blockAddress, geometry.sets, geometry.blockSize);
+    writeBuffer.drainBlock(blockAddress, geometry.blockSize);
+    bool held = false;
+    if (data != nullptr) {
+        supplied = victimCache.recall(blockAddress, data);
+        held = supplied;
+    } else if (victimCache.clean(blockAddress, displacedBlock)) {
+        stats.writebacks++;
+        memory->writeBlock(blockAddress, displacedBlock.data(), geometry.blockSize);
+    }
+    victimCache.invalidate(blockAddress);
 
-    if (line.valid && line.tag == addr.tag) {
-        line.data[addr.blockOffset] = data;
-        line.dirty = true;
-        line.lastUsed = ++counter;
-        return calculateTiming(true);
+    CacheLine* line = findLine(addr);
+    if (line == nullptr) {
+        return held;
+    }
+    if (line->dirty && data != nullptr) {
+        std::copy(line->data.begin(), line->data.end(), data);
+        supplied = true;
+    } else if (line->dirty) {
+        stats.writebacks++;
+        writeBackBlock(*line, addr.index);
     }
+    line->invalidate();
+    return true;
+}
 
-    const bool needsWriteback = line.valid && line.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+void SetAssociativeCache::setPrefetcher(std::unique_ptr<Prefetcher> prefetcher) {
+    this->prefetcher = std::move(prefetcher);
+}
 
-    if (needsWriteback) {
-        writeBackBlock(line, addr.index);
-    }
+bool SetAssociativeCache::hasPrefetcher() const {
+    return prefetcher != nullptr;
+}
 
-    loadBlockFromMemory(line, addr.tag, address - addr.blockOffset);
-    line.data[addr.blockOffset] = data;
-    line.dirty = true;
-    line.lastUsed = ++counter;
+const PrefetchStats& SetAssociativeCache::getPrefetchStats() const {
+    return prefetchStats;
+}
 
-    return result;
+void SetAssociativeCache::setAccessPC(const unsigned int pc) {
+    accessPC = pc;
 }
 
-CacheResult DirectMappedCache::writeWord(const unsigned int address, const unsigned int data) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
-        const CacheResult result1 = writeByte(address, data & 0xFF);
-        const CacheResult result2 = writeByte(address + 1, (data >> 8) & 0xFF);
-        const CacheResult result3 = writeByte(address + 2, (data >> 16) & 0xFF);
-        const CacheResult result4 = writeByte(address + 3, (data >> 24) & 0xFF);
-        return CacheResult(result1.hit && result2.hit && result3.hit && result4.hit,
-            result1.getCycles() + result2.getCycles() + result3.getCycles() + result4.getCycles(),
-            result1.writebackOccurred || result2.writebackOccurred || result3.writebackOccurred || result4.writebackOccurred,
-            result1.writebackCycles + result2.writebackCycles + result3.writebackCycles + result4.writebackCycles
-        );
-    }
+void SetAssociativeCache::setFetching(const bool fetching) {
+    this->fetching = fetching;
+}
 
-    const AddressInfo addr(address, CACHE_LINES);
-    CacheLine& line = cache[addr.index];
+void SetAssociativeCache::setMissClassification(const bool enabled) {
+    classifier = enabled ? std::make_unique<MissClassifier>(geometry.lines()) : nullptr;
+}
 
-    if (line.valid && line.tag == addr.tag) {
-        writeWordToBlock(line, addr.blockOffset, data);
-        line.dirty = true;
-        line.lastUsed = ++counter;
-        return calculateTiming(true);
-    }
+void SetAssociativeCache::setVictimCache(const unsigned int entries) {
+    victimCache = VictimCache(entries, geometry.blockSize);
+    victimBlock.resize(geometry.blockSize);
+    displacedBlock.resize(geometry.blockSize);
+}
 
-    const bool needsWriteback = line.valid && line.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+const VictimCache& SetAssociativeCache::getVictimCache() const {
+    return victimCache;
+}
 
-    if (needsWriteback) {
-        writeBackBlock(line, addr.index);
+bool SetAssociativeCache::classifiesMisses() const {
+    return classifier != nullptr;
+}
+
+void SetAssociativeCache::classify(const AddressInfo& addr, const bool hit, const bool fills) {
+    if (!classifier) {
+        return;
     }
+    // A miss that leaves the block out of the cache says nothing about its size or mapping, and
+    // the shadow cache leaves it out too
+    if (!fills) {
+        stats.noAllocateMisses++;
+        return;
+    }
+    switch (classifier->access(addr.blockAddress, hit)) {
+        case MissClass::COMPULSORY:
+            stats.compulsoryMisses++;
+            break;
+        case MissClass::CAPACITY:
+            stats.capacityMisses++;
+            break;
+        case MissClass::CONFLICT:
+            stats.conflictMisses++;
+            break;
+        default:
+            break;
+    }
+}
 
-    loadBlockFromMemory(line, addr.tag, address - addr.blockOffset);
-    writeWordToBlock(line, addr.blockOffset, data);
-    line.dirty = true;
-    line.lastUsed = ++counter;
+AccessType SetAssociativeCache::readType() const {
+    return fetching ? AccessType::FETCH : AccessType::READ;
+}
 
-    return result;
+void SetAssociativeCache::addUpperLevel(SetAssociativeCache* upper) {
+    upperLevels.push_back(upper);
 }
 
-void DirectMappedCache::loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const {
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        line.data[i] = memory->readByteFromMemory(offset + i);
+void SetAssociativeCache::reset() {
+    for (CacheLine& line : cache) {
+        line.invalidate();
     }
-    line.valid = true;
-    line.dirty = false;
-    line.tag = tag;
+    replacement->reset();
+    lastTouched = nullptr;
+    writeBuffer.reset();
+    victimCache.reset();
+    if (prefetcher) {
+        prefetcher->reset();
+    }
+    prefetchStats = PrefetchStats();
+    if (classifier) {
+        classifier->reset();
+    }
+    clock = 0;
+    stats = CacheStats();
 }
 
-void DirectMappedCache::writeBackBlock(CacheLine& line, const unsigned int index) const {
-    const unsigned int blockAddress = (line.tag * CACHE_LINES + index) * BLOCK_SIZE;
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        memory->writeByteToMemory(blockAddress + i, line.data[i]);
+CacheLine* SetAssociativeCache::findLine(const AddressInfo& addr) {
+    CacheLine* set = &cache[addr.index * geometry.ways];
+    for (unsigned int way = 0; way < geometry.ways; way++) {
+        if (set[way].valid && set[way].tag == addr.tag) {
+            return &set[way];
+        }
     }
-    line.invalidate();
+    return nullptr;
 }
 
-void DirectMappedCache::writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data) {
-    line.data[offset] = data & 0xFF;
-    line.data[offset + 1] = (data >> 8) & 0xFF;
-    line.data[offset + 2] = (data >> 16) & 0xFF;
-    line.data[offset + 3] = (data >> 24) & 0xFF;
+unsigned int SetAssociativeCache::wayOf(const CacheLine& line, const unsigned int index) const {
+    return static_cast<unsigned int>(&line - &cache[index * geometry.ways]);
 }
 
-FullyAssociativeCache::FullyAssociativeCache(MemoryInterface* memory) : memory(memory), counter(0) {
-    cache.resize(CACHE_LINES);
+void SetAssociativeCache::touchLine(const CacheLine& line, const unsigned int index) {
+    if (&line == lastTouched) {
+        return;
+    }
+    replacement->onHit(index, wayOf(line, index));
+    lastTouched = &line;
 }
 
-std::string FullyAssociativeCache::getType() const {
-    return "Fully Associative Cache";
+// Demand access to a resident line. A prefetched line counts as useful the first time it is
+// used; if its fill is still in flight the access waits for the rest of it.
+unsigned int SetAssociativeCache::useLine(CacheLine& line, const unsigned int index, bool& firstUse) {
+    touchLine(line, index);
+    if (!prefetcher || !line.prefetched) {
+        return 0;
+    }
+    firstUse = true;
+    line.prefetched = false;
+    prefetchStats.useful++;
+    if (line.readyAt <= clock) {
+        return 0;
+    }
+    prefetchStats.late++;
+    return static_cast<unsigned int>(line.readyAt - clock);
 }
 
-void FullyAssociativeCache::reset() {
-    for (CacheLine& line : cache) {
-        line.invalidate();
+// Prefetch fills happen off the demand path: they are not charged to the access that
+// triggered them, but queue up behind each other and only become usable once complete.
+// Only called with a prefetcher.
+void SetAssociativeCache::prefetch(const unsigned int address, const bool miss, const bool firstUse) {
+    prefetchCandidates.clear();
+    prefetcher->onAccess(address, accessPC, miss, firstUse, prefetchCandidates);
+
+    unsigned long long readyAt = clock;
+    for (const unsigned int candidate : prefetchCandidates) {
+        if (candidate >= memory->getMemorySize()) {
+            continue;
+        }
+        const AddressInfo addr(candidate, geometry.sets, geometry.blockSize);
+        if (findLine(addr) != nullptr) {
+            continue;
+        }
+        CacheResult fill;
+        CacheLine& line = allocateLine(addr, candidate, fill);
+        readyAt += fill.getCycles();
+        line.prefetched = true;
+        line.readyAt = readyAt;
+        prefetchStats.issued++;
     }
-    counter = 0;
 }
 
-CacheResult FullyAssociativeCache::readByte(const unsigned int address) {
-    const AddressInfo addr(address, 0);
+void SetAssociativeCache::beforeFill(const unsigned int /*blockStart*/) {}
 
-    for (CacheLine& line : cache) {
-        if (line.valid && line.tag == addr.tag) {
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
+// Invalid ways are always filled first; the policy only chooses among valid lines.
+CacheLine& SetAssociativeCache::findVictim(const unsigned int index) {
+    CacheLine* set = &cache[index * geometry.ways];
+    for (unsigned int way = 0; way < geometry.ways; way++) {
+        if (!set[way].valid) {
+            return set[way];
         }
     }
+    lastTouched = nullptr;
+    return set[replacement->victim(index)];
+}
 
-    CacheLine& evictLine = findLRULine();
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+// With a victim cache the incoming block is taken out of it before the evicted line goes in,
+// so a hit there is a swap; only a dirty block pushed out of the victim cache is written back.
+CacheLine& SetAssociativeCache::allocateLine(const AddressInfo& addr, const unsigned int address, CacheResult& result,
+                                             const bool ownership) {
+    const unsigned int blockStart = address - addr.blockOffset;
+    CacheLine& evictLine = findVictim(addr.index);
+    if (evictLine.valid) {
+        recallFromUpperLevels(evictLine, addr.index);
+        stats.evictions++;
+        if (evictLine.prefetched) {
+            prefetchStats.polluting++;
+        }
+    }
+
+    bool victimDirty = false;
+    const bool victimHit = victimCache.isEnabled() && victimCache.take(blockStart, victimBlock.data(), victimDirty);
 
+    bool needsWriteback = evictLine.valid && evictLine.dirty;
+    unsigned int writebackAddress = blockAddressOf(evictLine, addr.index);
+    const unsigned char* writebackData = evictLine.data.data();
+    if (evictLine.valid && victimCache.isEnabled()) {
+        needsWriteback = victimCache.insert(writebackAddress, evictLine.data.data(), evictLine.dirty,
+                                            writebackAddress, displacedBlock);
+        writebackData = displacedBlock.data();
+    }
+
+    unsigned int writebackCycles = 0;
     if (needsWriteback) {
-        writeBackBlock(evictLine);
+        stats.writebacks++;
     }
+    if (needsWriteback && writeBuffer.isEnabled()) {
+        writebackCycles = writeBuffer.write(writebackAddress, writebackData, geometry.blockSize);
+    } else if (needsWriteback) {
+        writebackCycles = memory->writeBlock(writebackAddress, writebackData, geometry.blockSize);
+    }
+    evictLine.invalidate();
+
+    unsigned int fillCycles;
+    if (victimHit) {
+        evictLine.data = victimBlock;
+        evictLine.valid = true;
+        evictLine.dirty = victimDirty;
+        evictLine.tag = addr.tag;
+        // Whether other cores picked the block up meanwhile is not known, so a store has to upgrade it
+        evictLine.exclusive = bus == nullptr;
+        fillCycles = victimCache.getSwapCycles();
+    } else {
+        // A queued store to the incoming block has to reach the level below before the fill reads it.
+        beforeFill(blockStart);
+        fillCycles = writeBuffer.drainBlock(blockStart, geometry.blockSize);
+        CoherenceResponse response;
+        if (bus) {
+            response = bus->request(this, blockStart, evictLine.data.data(), ownership);
+        }
+        if (response.supplied) {
+            evictLine.valid = true;
+            evictLine.dirty = response.dirty;
+            evictLine.tag = addr.tag;
+        } else {
+            fillCycles += loadBlockFromMemory(evictLine, addr.tag, blockStart);
+        }
+        fillCycles += response.cycles;
+        evictLine.exclusive = ownership || !response.shared;
+    }
+    replacement->onFill(addr.index, wayOf(evictLine, addr.index));
+    lastTouched = nullptr;
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    evictLine.lastUsed = ++counter;
+    result = CacheResult(false, hitLatency + fillCycles, needsWriteback, writebackCycles);
+    return evictLine;
+}
 
+CacheResult SetAssociativeCache::record(const CacheResult& result, const AccessType type) {
+    unsigned long long* counters[3][2] = {
+        {&stats.readMisses, &stats.readHits},
+        {&stats.writeMisses, &stats.writeHits},
+        {&stats.fetchMisses, &stats.fetchHits}
+    };
+    (*counters[static_cast<int>(type)][result.hit ? 1 : 0])++;
+
+    if (result.hit) {
+        stats.hits++;
+        stats.hitCycles += result.getCycles();
+    } else {
+        stats.misses++;
+        stats.missCycles += result.getCycles();
+    }
+    stats.cycles += result.getCycles();
+    clock += result.getCycles();
+    if (buffered) {
+        writeBuffer.advance(result.getCycles());
+    }
     return result;
 }
 
-unsigned char FullyAssociativeCache::getCachedByte(const unsigned int address) {
-    const AddressInfo addr(address, 0);
+CacheResult SetAssociativeCache::readByte(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
 
-    for (const CacheLine& line : cache) {
-        if (line.valid && line.tag == addr.tag) {
-            return line.data[addr.blockOffset];
-        }
+    CacheResult result;
+    bool firstUse = false;
+    CacheLine* line = findLine(addr);
+    classify(addr, line != nullptr);
+    if (line) {
+        result = record(CacheResult(true, hitLatency + useLine(*line, addr.index, firstUse)), readType());
+    } else {
+        allocateLine(addr, address, result);
+        record(result, readType());
+    }
+    if (prefetcher) {
+        prefetch(address, !result.hit, firstUse);
     }
+    return result;
+}
 
-    return 0;
+unsigned char SetAssociativeCache::getCachedByte(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    if (const CacheLine* line = findLine(addr)) {
+        return line->data[addr.blockOffset];
+    }
+
+    // The block was evicted by a later access (e.g. the second half of a split word), so the level below is current
+    // unless the eviction is still waiting in the victim cache or the write buffer.
+    unsigned char value;
+    if (victimCache.forward(address, value) || writeBuffer.forward(address, value)) {
+        return value;
+    }
+    return memory->readByteFromMemory(address);
 }
 
-CacheResult FullyAssociativeCache::readWord(const unsigned int address) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
+CacheResult SetAssociativeCache::readWord(const unsigned int address) {
+    if ((address % geometry.blockSize) + 4 > geometry.blockSize) {
         const CacheResult result1 = readByte(address);
         const CacheResult result2 = readByte(address + 3);
         return CacheResult(result1.hit && result2.hit,
@@ -299,50 +642,170 @@ CacheResult FullyAssociativeCache::readWord(const unsigned int address) {
     return readByte(address);
 }
 
-unsigned int FullyAssociativeCache::getCachedWord(const unsigned int address) {
-    const AddressInfo addr(address, 0);
+CacheResult SetAssociativeCache::readWordExclusive(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
 
-    for (const CacheLine& line : cache) {
-        if (line.valid && line.tag == addr.tag) {
-            return line.data[addr.blockOffset] |
-                (line.data[addr.blockOffset + 1] << 8) |
-                (line.data[addr.blockOffset + 2] << 16) |
-                (line.data[addr.blockOffset + 3] << 24);
-        }
+    CacheResult result;
+    bool firstUse = false;
+    CacheLine* line = findLine(addr);
+    classify(addr, line != nullptr);
+    if (line) {
+        result = CacheResult(true, hitLatency + useLine(*line, addr.index, firstUse));
+    } else {
+        line = &allocateLine(addr, address, result, true);
     }
-    return 0;
+    // A hit, or a block taken back from the victim cache, may still be shared
+    result.cycles += takeOwnership(*line, address - addr.blockOffset);
+    record(result, readType());
+    if (prefetcher) {
+        prefetch(address, !result.hit, firstUse);
+    }
+    return result;
 }
 
-CacheResult FullyAssociativeCache::writeByte(const unsigned int address, const unsigned char data) {
-    const AddressInfo addr(address, 0);
+CacheResult SetAssociativeCache::fetchWord(const unsigned int address) {
+    const bool wasFetching = fetching;
+    fetching = true;
+    const CacheResult result = readWord(address);
+    fetching = wasFetching;
+    return result;
+}
 
-    for (CacheLine& line : cache) {
-        if (line.valid && line.tag == addr.tag) {
-            line.data[addr.blockOffset] = data;
-            line.dirty = true;
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
+bool SetAssociativeCache::readWordHit(const unsigned int address, const bool fetch, unsigned int& value,
+                                      unsigned int& cycles) {
+    if (prefetcher) {
+        return false;
+    }
+    unsigned int offset = address - lastBlockStart;
+    if (!lastLine || offset > geometry.blockSize - 4 || !lastLine->valid || lastLine->tag != lastTag) {
+        const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+        if (addr.blockOffset + 4 > geometry.blockSize) {
+            return false;
+        }
+        CacheLine* line = findLine(addr);
+        if (!line) {
+            return false;
         }
+        lastLine = line;
+        lastBlockStart = address - addr.blockOffset;
+        lastTag = addr.tag;
+        lastIndex = addr.index;
+        offset = addr.blockOffset;
     }
+    if (classifier) {
+        classify(AddressInfo(address, geometry.sets, geometry.blockSize), true);
+    }
+    touchLine(*lastLine, lastIndex);
+    record(CacheResult(true, hitLatency), fetch ? AccessType::FETCH : readType());
+    const unsigned char* bytes = &lastLine->data[offset];
+    value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+    cycles = hitLatency;
+    return true;
+}
 
-    CacheLine& evictLine = findLRULine();
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+bool SetAssociativeCache::servesAlone(const unsigned int address, const unsigned int size, const bool write) {
+    if (prefetcher || writeBuffer.isEnabled() || (write && writeThrough)) {
+        return false;
+    }
+    for (const unsigned int byte : {address, address + size - 1}) {
+        const CacheLine* line = findLine(AddressInfo(byte, geometry.sets, geometry.blockSize));
+        if (!line || (write && bus && !line->exclusive)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (needsWriteback) {
-        writeBackBlock(evictLine);
+unsigned int SetAssociativeCache::getCachedWord(const unsigned int address) {
+    if ((address % geometry.blockSize) + 4 > geometry.blockSize) {
+        return getCachedByte(address) |
+            (getCachedByte(address + 1) << 8) |
+            (getCachedByte(address + 2) << 16) |
+            (getCachedByte(address + 3) << 24);
+    }
+
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    if (const CacheLine* line = findLine(addr)) {
+        return line->data[addr.blockOffset] |
+            (line->data[addr.blockOffset + 1] << 8) |
+            (line->data[addr.blockOffset + 2] << 16) |
+            (line->data[addr.blockOffset + 3] << 24);
+    }
+
+    return readWordFromMemory(address);
+}
+
+// Sends bytes to the level below, through the write buffer when there is one.
+unsigned int SetAssociativeCache::writeBelow(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    if (writeBuffer.isEnabled()) {
+        return writeBuffer.write(address, data, size);
     }
+    return memory->writeBlock(address, data, size);
+}
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    evictLine.data[addr.blockOffset] = data;
-    evictLine.dirty = true;
-    evictLine.lastUsed = ++counter;
+// A write-back line just becomes dirty; a write-through line also passes the store down.
+unsigned int SetAssociativeCache::completeStore(CacheLine& line, const unsigned int address, const unsigned char* data, const unsigned int size) {
+    if (writeThrough) {
+        return writeBelow(address, data, size);
+    }
+    line.dirty = true;
+    return 0;
+}
 
+// A shared line has to become the only copy before it can be written.
+unsigned int SetAssociativeCache::takeOwnership(CacheLine& line, const unsigned int blockStart) {
+    if (!bus || line.exclusive) {
+        return 0;
+    }
+    bool ownerDropped = false;
+    const unsigned int cycles = bus->upgrade(this, blockStart, ownerDropped);
+    line.exclusive = true;
+    line.dirty = line.dirty || ownerDropped;
+    return cycles;
+}
+
+// Stores size bytes that all fall within one block.
+CacheResult SetAssociativeCache::store(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    CacheResult result;
+    bool firstUse = false;
+    CacheLine* line = findLine(addr);
+    classify(addr, line != nullptr, line != nullptr || writeAllocate);
+    if (line) {
+        const unsigned int upgradeCycles = takeOwnership(*line, address - addr.blockOffset);
+        for (unsigned int i = 0; i < size; i++) {
+            line->data[addr.blockOffset + i] = data[i];
+        }
+        const unsigned int wait = useLine(*line, addr.index, firstUse);
+        result = record(CacheResult(true, hitLatency + wait + upgradeCycles + completeStore(*line, address, data, size)),
+                        AccessType::WRITE);
+    } else if (!writeAllocate) {
+        const unsigned int invalidateCycles = bus ? bus->invalidate(this, address - addr.blockOffset) : 0;
+        victimCache.update(address, data, size);
+        result = record(CacheResult(false, hitLatency + invalidateCycles + writeBelow(address, data, size)),
+                        AccessType::WRITE);
+    } else {
+        CacheLine& line = allocateLine(addr, address, result, true);
+        for (unsigned int i = 0; i < size; i++) {
+            line.data[addr.blockOffset + i] = data[i];
+        }
+        result.cycles += completeStore(line, address, data, size);
+        record(result, AccessType::WRITE);
+    }
+    if (prefetcher) {
+        prefetch(address, !result.hit, firstUse);
+    }
     return result;
 }
 
-CacheResult FullyAssociativeCache::writeWord(const unsigned int address, const unsigned int data) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
+CacheResult SetAssociativeCache::writeByte(const unsigned int address, const unsigned char data) {
+    return store(address, &data, 1);
+}
+
+CacheResult SetAssociativeCache::writeWord(const unsigned int address, const unsigned int data) {
+    if ((address % geometry.blockSize) + 4 > geometry.blockSize) {
         const CacheResult result1 = writeByte(address, data & 0xFF);
         const CacheResult result2 = writeByte(address + 1, (data >> 8) & 0xFF);
         const CacheResult result3 = writeByte(address + 2, (data >> 16) & 0xFF);
@@ -354,269 +817,439 @@ CacheResult FullyAssociativeCache::writeWord(const unsigned int address, const u
         );
     }
 
-    const AddressInfo addr(address, 0);
+    const unsigned char bytes[4] = {
+        static_cast<unsigned char>(data & 0xFF),
+        static_cast<unsigned char>((data >> 8) & 0xFF),
+        static_cast<unsigned char>((data >> 16) & 0xFF),
+        static_cast<unsigned char>((data >> 24) & 0xFF)
+    };
+    return store(address, bytes, 4);
+}
 
-    for (CacheLine& line : cache) {
-        if (line.valid && line.tag == addr.tag) {
-            writeWordToBlock(line, addr.blockOffset, data);
-            line.dirty = true;
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
+void SetAssociativeCache::invalidateBlock(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    if (CacheLine* line = findLine(addr)) {
+        line->invalidate();
+    }
+    victimCache.invalidate(address - addr.blockOffset);
+}
+
+void SetAssociativeCache::cleanBlock(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    writeBuffer.drainBlock(address - addr.blockOffset, geometry.blockSize);
+    CacheLine* line = findLine(addr);
+    if (line && line->dirty) {
+        stats.writebacks++;
+        writeBackBlock(*line, addr.index);
+        line->dirty = false;
+    }
+    if (victimCache.clean(address - addr.blockOffset, displacedBlock)) {
+        stats.writebacks++;
+        memory->writeBlock(address - addr.blockOffset, displacedBlock.data(), geometry.blockSize);
+    }
+}
+
+unsigned char SetAssociativeCache::readByteFromMemory(const unsigned int address) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    if (const CacheLine* line = findLine(addr)) {
+        return line->data[addr.blockOffset];
+    }
+    unsigned char value;
+    if (victimCache.forward(address, value) || writeBuffer.forward(address, value)) {
+        return value;
+    }
+    return memory->readByteFromMemory(address);
+}
+
+unsigned int SetAssociativeCache::readWordFromMemory(const unsigned int address) {
+    return readByteFromMemory(address) |
+        (readByteFromMemory(address + 1) << 8) |
+        (readByteFromMemory(address + 2) << 16) |
+        (readByteFromMemory(address + 3) << 24);
+}
+
+void SetAssociativeCache::writeByteToMemory(const unsigned int address, const unsigned char data) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    writeBuffer.drainBlock(address - addr.blockOffset, geometry.blockSize);
+    if (CacheLine* line = findLine(addr)) {
+        line->data[addr.blockOffset] = data;
+        if (!writeThrough) {
+            line->dirty = true;
+            return;
         }
     }
+    victimCache.update(address, &data, 1);
+    memory->writeByteToMemory(address, data);
+}
 
-    CacheLine& evictLine = findLRULine();
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+void SetAssociativeCache::writeWordToMemory(const unsigned int address, const unsigned int data) {
+    writeByteToMemory(address, data & 0xFF);
+    writeByteToMemory(address + 1, (data >> 8) & 0xFF);
+    writeByteToMemory(address + 2, (data >> 16) & 0xFF);
+    writeByteToMemory(address + 3, (data >> 24) & 0xFF);
+}
 
-    if (needsWriteback) {
-        writeBackBlock(evictLine);
+unsigned int SetAssociativeCache::getMemorySize() const {
+    return memory->getMemorySize();
+}
+
+// Fill request from the level above. size never exceeds this level's block size.
+unsigned int SetAssociativeCache::readBlock(const unsigned int address, unsigned char* data, const unsigned int size) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    CacheResult result(true, hitLatency);
+    bool firstUse = false;
+    CacheLine* line = findLine(addr);
+    classify(addr, line != nullptr);
+    if (line) {
+        result.cycles += useLine(*line, addr.index, firstUse);
+    } else {
+        line = &allocateLine(addr, address, result);
     }
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    writeWordToBlock(evictLine, addr.blockOffset, data);
-    evictLine.dirty = true;
-    evictLine.lastUsed = ++counter;
+    for (unsigned int i = 0; i < size; i++) {
+        data[i] = line->data[addr.blockOffset + i];
+    }
+    record(result, readType());
+    if (prefetcher) {
+        prefetch(address, !result.hit, firstUse);
+    }
+    return result.getCycles();
+}
 
-    return result;
+// Write-back from the level above. size never exceeds this level's block size.
+unsigned int SetAssociativeCache::writeBlock(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    const AddressInfo addr(address, geometry.sets, geometry.blockSize);
+
+    CacheLine* line = findLine(addr);
+    classify(addr, line != nullptr, line != nullptr || writeAllocate);
+    if (!writeAllocate && line == nullptr) {
+        victimCache.update(address, data, size);
+        return record(CacheResult(false, hitLatency + writeBelow(address, data, size)), AccessType::WRITE).getCycles();
+    }
+
+    CacheResult result(true, hitLatency);
+    if (line) {
+        touchLine(*line, addr.index);
+    } else {
+        line = &allocateLine(addr, address, result);
+    }
+
+    for (unsigned int i = 0; i < size; i++) {
+        line->data[addr.blockOffset + i] = data[i];
+    }
+    result.cycles += completeStore(*line, address, data, size);
+    return record(result, AccessType::WRITE).getCycles();
 }
 
-CacheLine& FullyAssociativeCache::findLRULine() {
-    CacheLine* lruLine = &cache[0];
-    for (CacheLine& line : cache) {
-        if (!line.valid) {
-            return line;
+// Invalidates every copy of [address, address + size) held here or above, merging dirty bytes into data.
+bool SetAssociativeCache::recallBlock(const unsigned int address, unsigned char* data, const unsigned int size) {
+    bool dirty = false;
+    for (unsigned int offset = 0; offset < size; offset += geometry.blockSize) {
+        const AddressInfo addr(address + offset, geometry.sets, geometry.blockSize);
+        dirty = writeBuffer.recall(address + offset, &data[offset], geometry.blockSize) || dirty;
+        dirty = victimCache.recall(address + offset, &data[offset]) || dirty;
+        CacheLine* line = findLine(addr);
+        if (line == nullptr) {
+            continue;
         }
-        if (line.lastUsed < lruLine->lastUsed) {
-            lruLine = &line;
+
+        recallFromUpperLevels(*line, addr.index);
+        if (line->dirty) {
+            for (unsigned int i = 0; i < geometry.blockSize; i++) {
+                data[offset + i] = line->data[i];
+            }
+            dirty = true;
         }
+        line->invalidate();
     }
-    return *lruLine;
+    return dirty;
 }
 
-void FullyAssociativeCache::loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const {
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        line.data[i] = memory->readByteFromMemory(offset + i);
+bool SetAssociativeCache::recallFromUpperLevels(CacheLine& line, const unsigned int index) {
+    const unsigned int blockAddress = blockAddressOf(line, index);
+    bool dirty = false;
+    for (SetAssociativeCache* upper : upperLevels) {
+        dirty = upper->recallBlock(blockAddress, line.data.data(), geometry.blockSize) || dirty;
+    }
+    if (dirty) {
+        line.dirty = true;
     }
+    return dirty;
+}
+
+unsigned int SetAssociativeCache::blockAddressOf(const CacheLine& line, const unsigned int index) const {
+    return (line.tag * geometry.sets + index) * geometry.blockSize;
+}
+
+unsigned int SetAssociativeCache::loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const {
+    memory->setFetching(fetching);
+    const unsigned int cycles = memory->readBlock(offset, line.data.data(), geometry.blockSize);
     line.valid = true;
     line.dirty = false;
     line.tag = tag;
+    return cycles;
 }
 
-void FullyAssociativeCache::writeBackBlock(const CacheLine& line) const {
-    const unsigned int blockAddress = line.tag * BLOCK_SIZE;
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        memory->writeByteToMemory(blockAddress + i, line.data[i]);
-    }
+unsigned int SetAssociativeCache::writeBackBlock(const CacheLine& line, const unsigned int index) const {
+    return memory->writeBlock(blockAddressOf(line, index), line.data.data(), geometry.blockSize);
 }
 
-void FullyAssociativeCache::writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data) {
-    line.data[offset] = data & 0xFF;
-    line.data[offset + 1] = (data >> 8) & 0xFF;
-    line.data[offset + 2] = (data >> 16) & 0xFF;
-    line.data[offset + 3] = (data >> 24) & 0xFF;
+DirectMappedCache::DirectMappedCache(MemoryInterface* memory, const unsigned int lines, const unsigned int blockSize)
+    : SetAssociativeCache(memory, CacheGeometry(lines, 1, blockSize)) {}
+
+std::string DirectMappedCache::getType() const {
+    return "Direct Mapped Cache";
 }
 
-TwoWaySetAssociativeCache::TwoWaySetAssociativeCache(MemoryInterface* memory) : memory(memory), counter(0) {
-    cache.resize(SETS, std::vector<CacheLine>(WAYS));
+FullyAssociativeCache::FullyAssociativeCache(MemoryInterface* memory, const unsigned int lines, const unsigned int blockSize)
+    : SetAssociativeCache(memory, CacheGeometry(1, lines, blockSize)) {}
+
+std::string FullyAssociativeCache::getType() const {
+    return "Fully Associative Cache";
 }
 
+TwoWaySetAssociativeCache::TwoWaySetAssociativeCache(MemoryInterface* memory, const unsigned int lines, const unsigned int blockSize)
+    : SetAssociativeCache(memory, CacheGeometry(lines / WAYS, WAYS, blockSize)) {}
+
 std::string TwoWaySetAssociativeCache::getType() const {
     return "Two Way Set Associative Cache";
 }
 
-void TwoWaySetAssociativeCache::reset() {
-    for (std::vector<CacheLine>& set : cache) {
-        for (CacheLine& line : set) {
-            line.invalidate();
-        }
-    }
-    counter = 0;
+NWaySetAssociativeCache::NWaySetAssociativeCache(MemoryInterface* memory, const unsigned int lines, const unsigned int ways, const unsigned int blockSize)
+    : SetAssociativeCache(memory, CacheGeometry(lines / ways, ways, blockSize)) {}
+
+std::string NWaySetAssociativeCache::getType() const {
+    return std::to_string(geometry.ways) + " Way Set Associative Cache";
 }
 
-CacheResult TwoWaySetAssociativeCache::readByte(const unsigned int address) {
-    const AddressInfo addr(address, SETS);
-    auto& set = cache[addr.index];
+InstructionCache::InstructionCache(MemoryInterface* memory, const CacheGeometry& geometry)
+    : SetAssociativeCache(memory, geometry) {
+    fetching = true;
+}
 
-    for (CacheLine& line : set) {
-        if (line.valid && line.tag == addr.tag) {
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
-        }
-    }
+std::string InstructionCache::getType() const {
+    return "Instruction Cache";
+}
 
-    CacheLine& evictLine = findLRULine(set);
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
+void InstructionCache::addDataCache(SetAssociativeCache* dataCache) {
+    dataCaches.push_back(dataCache);
+}
 
-    if (needsWriteback) {
-        writeBackBlock(evictLine, addr.index);
+// The data caches may use a different block size, so clean every one of their blocks we are about to fill.
+void InstructionCache::beforeFill(const unsigned int blockStart) {
+    for (SetAssociativeCache* dataCache : dataCaches) {
+        const unsigned int dataBlockSize = dataCache->getGeometry().blockSize;
+        for (unsigned int a = blockStart - blockStart % dataBlockSize; a < blockStart + geometry.blockSize; a += dataBlockSize) {
+            dataCache->cleanBlock(a);
+        }
     }
+}
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    evictLine.lastUsed = ++counter;
-
-    return result;
+CacheResult InstructionCache::writeByte(const unsigned int address, const unsigned char /*data*/) {
+    invalidateBlock(address);
+    return CacheResult(true, 0);
 }
 
-unsigned char TwoWaySetAssociativeCache::getCachedByte(const unsigned int address) {
-    const AddressInfo addr(address, SETS);
-    const auto& set = cache[addr.index];
+CacheResult InstructionCache::writeWord(const unsigned int address, const unsigned int /*data*/) {
+    invalidateBlock(address);
+    invalidateBlock(address + 3);
+    return CacheResult(true, 0);
+}
 
-    for (const CacheLine& line : set) {
-        if (line.valid && line.tag == addr.tag) {
-            return line.data[addr.blockOffset];
-        }
+CacheGeometry CacheFactory::createGeometry(const unsigned int type, const unsigned int lines, const unsigned int blockSize, const unsigned int ways) {
+    switch (type) {
+        case 1:
+            return CacheGeometry(lines, 1, blockSize);
+        case 2:
+            return CacheGeometry(1, lines, blockSize);
+        case 3:
+            return CacheGeometry(lines / 2, 2, blockSize);
+        case 4:
+            if (ways == 0 || lines % ways != 0) {
+                return CacheGeometry(0, 0, 0);
+            }
+            return CacheGeometry(lines / ways, ways, blockSize);
+        default:
+            return CacheGeometry(0, 0, 0);
     }
+}
 
-    return 0;
+std::unique_ptr<Cache> CacheFactory::createCache(const unsigned int type, MemoryInterface* memory) {
+    return createCache(type, memory, CACHE_LINES, BLOCK_SIZE);
 }
 
+std::unique_ptr<Cache> CacheFactory::createCache(const unsigned int type, MemoryInterface* memory,
+                                                 const unsigned int lines, const unsigned int blockSize) {
+    return createLevel(CacheConfig(type, lines, blockSize), memory);
+}
 
-CacheResult TwoWaySetAssociativeCache::readWord(const unsigned int address) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
-        const CacheResult result1 = readByte(address);
-        const CacheResult result2 = readByte(address + 3);
-        return CacheResult(result1.hit && result2.hit,
-            result1.getCycles() + result2.getCycles(),
-            result1.writebackOccurred || result2.writebackOccurred,
-            result1.writebackCycles + result2.writebackCycles
-        );
+std::unique_ptr<SetAssociativeCache> CacheFactory::createLevel(const CacheConfig& config, MemoryInterface* memory) {
+    const CacheGeometry geometry = config.geometry();
+    if (!geometry.isValid()) {
+        return nullptr;
     }
 
-    return readByte(address);
+    std::unique_ptr<SetAssociativeCache> level;
+    switch (config.type) {
+        case 1:
+            level = std::make_unique<DirectMappedCache>(memory, config.lines, config.blockSize);
+            break;
+        case 2:
+            level = std::make_unique<FullyAssociativeCache>(memory, config.lines, config.blockSize);
+            break;
+        case 3:
+            level = std::make_unique<TwoWaySetAssociativeCache>(memory, config.lines, config.blockSize);
+            break;
+        case 4:
+            level = std::make_unique<NWaySetAssociativeCache>(memory, config.lines, config.ways, config.blockSize);
+            break;
+        default:
+            return nullptr;
+    }
+    std::unique_ptr<ReplacementPolicy> policy = createReplacementPolicy(config.replacement, geometry.sets,
+                                                                        geometry.ways, config.seed);
+    if (!policy) {
+        return nullptr;
+    }
+    level->setHitLatency(config.hitLatency);
+    level->setReplacementPolicy(std::move(policy));
+    level->setWritePolicy(config.writeThrough, config.writeAllocate, config.writeBufferEntries);
+    level->setPrefetcher(createPrefetcher(config.prefetcher, config.prefetchDegree, config.prefetchDistance, geometry.blockSize));
+    level->setMissClassification(config.classifyMisses);
+    level->setVictimCache(config.victimEntries);
+    return level;
 }
 
-unsigned int TwoWaySetAssociativeCache::getCachedWord(const unsigned int address) {
-    const AddressInfo addr(address, SETS);
-    const auto& set = cache[addr.index];
-
-    for (const CacheLine& line : set) {
-        if (line.valid && line.tag == addr.tag) {
-            return line.data[addr.blockOffset] |
-                (line.data[addr.blockOffset + 1] << 8) |
-                (line.data[addr.blockOffset + 2] << 16) |
-                (line.data[addr.blockOffset + 3] << 24);
-        }
+std::unique_ptr<InstructionCache> CacheFactory::createInstructionCache(const CacheConfig& config, MemoryInterface* memory) {
+    const CacheGeometry geometry = config.geometry();
+    if (!geometry.isValid()) {
+        return nullptr;
+    }
+    std::unique_ptr<InstructionCache> level = std::make_unique<InstructionCache>(memory, geometry);
+    std::unique_ptr<ReplacementPolicy> policy = createReplacementPolicy(config.replacement, geometry.sets,
+                                                                        geometry.ways, config.seed);
+    if (!policy) {
+        return nullptr;
     }
+    level->setHitLatency(config.hitLatency);
+    level->setReplacementPolicy(std::move(policy));
+    level->setPrefetcher(createPrefetcher(config.prefetcher, config.prefetchDegree, config.prefetchDistance, geometry.blockSize));
+    level->setMissClassification(config.classifyMisses);
+    level->setVictimCache(config.victimEntries);
+    return level;
+}
 
-    return 0;
+std::unique_ptr<MemoryTimingModel> CacheFactory::createMemoryTiming(const HierarchyConfig& config) {
+    if (config.dramModel == MemoryTimingType::BANKED) {
+        return std::make_unique<BankedDramTiming>(config.dramBanks, config.dramRowSize, config.dramRowHit,
+                                                  config.dramRowMiss, config.dramPrecharge, config.dramBurst,
+                                                  config.dramOpenPage);
+    }
+    return std::make_unique<FlatMemoryTiming>(config.dramFirstAccess, config.dramBurst);
 }
 
-CacheResult TwoWaySetAssociativeCache::writeByte(const unsigned int address, const unsigned char data) {
-    const AddressInfo addr(address, SETS);
-    auto& set = cache[addr.index];
+void CacheHierarchy::clear() {
+    l1i = nullptr;
+    coreL1d.clear();
+    l1d = nullptr;
+    l2 = nullptr;
+    l3 = nullptr;
+    memory = nullptr;
+    timing = nullptr;
+    bus = nullptr;
+    prefetching = false;
+}
 
-    for (CacheLine& line : set) {
-        if (line.valid && line.tag == addr.tag) {
-            line.data[addr.blockOffset] = data;
-            line.dirty = true;
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
+// Upper levels first, since what they write back lands in the level below.
+void CacheHierarchy::writeBackAll() {
+    if (l1d) {
+        l1d->writeBackAll();
+    }
+    for (const std::unique_ptr<SetAssociativeCache>& core : coreL1d) {
+        core->writeBackAll();
+    }
+    for (SetAssociativeCache* level : {l2.get(), l3.get()}) {
+        if (level) {
+            level->writeBackAll();
         }
     }
+}
 
-    CacheLine& evictLine = findLRULine(set);
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
-
-    if (needsWriteback) {
-        writeBackBlock(evictLine, addr.index);
+void CacheHierarchy::build(const HierarchyConfig& config, unsigned char* data, const unsigned int size,
+                           const unsigned int cores) {
+    clear();
+    timing = CacheFactory::createMemoryTiming(config);
+    if (data == nullptr || (config.l1d.type == 0 && config.l1i.type == 0)) {
+        return;
     }
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    evictLine.data[addr.blockOffset] = data;
-    evictLine.dirty = true;
-    evictLine.lastUsed = ++counter;
+    memory = std::make_unique<SystemMemory>(data, size, timing.get());
+    MemoryInterface* backing = memory.get();
+    SetAssociativeCache* lowest = nullptr;
 
-    return result;
-}
-
-CacheResult TwoWaySetAssociativeCache::writeWord(const unsigned int address, const unsigned int data) {
-    if ((address % BLOCK_SIZE) + 4 > BLOCK_SIZE) {
-        const CacheResult result1 = writeByte(address, data & 0xFF);
-        const CacheResult result2 = writeByte(address + 1, (data >> 8) & 0xFF);
-        const CacheResult result3 = writeByte(address + 2, (data >> 16) & 0xFF);
-        const CacheResult result4 = writeByte(address + 3, (data >> 24) & 0xFF);
-        return CacheResult(result1.hit && result2.hit && result3.hit && result4.hit,
-            result1.getCycles() + result2.getCycles() + result3.getCycles() + result4.getCycles(),
-            result1.writebackOccurred || result2.writebackOccurred || result3.writebackOccurred || result4.writebackOccurred,
-            result1.writebackCycles + result2.writebackCycles + result3.writebackCycles + result4.writebackCycles
-        );
+    if (config.l3.type != 0) {
+        l3 = CacheFactory::createLevel(config.l3, backing);
+        backing = l3.get();
+        lowest = l3.get();
     }
-    const AddressInfo addr(address, SETS);
-    auto& set = cache[addr.index];
-
-    for (CacheLine& line : set) {
-        if (line.valid && line.tag == addr.tag) {
-            writeWordToBlock(line, addr.blockOffset, data);
-            line.dirty = true;
-            line.lastUsed = ++counter;
-            return calculateTiming(true);
+    if (config.l2.type != 0) {
+        l2 = CacheFactory::createLevel(config.l2, backing);
+        if (config.inclusive && lowest) {
+            lowest->addUpperLevel(l2.get());
         }
+        backing = l2.get();
+        lowest = l2.get();
     }
 
-    CacheLine& evictLine = findLRULine(set);
-    const bool needsWriteback = evictLine.valid && evictLine.dirty;
-    const CacheResult result = calculateTiming(false, needsWriteback);
-
-    if (needsWriteback) {
-        writeBackBlock(evictLine, addr.index);
+    if (config.l1d.type != 0) {
+        l1d = CacheFactory::createLevel(config.l1d, backing);
+    }
+    if (config.l1i.type != 0) {
+        l1i = CacheFactory::createInstructionCache(config.l1i, backing);
     }
 
-    loadBlockFromMemory(evictLine, addr.tag, address - addr.blockOffset);
-    writeWordToBlock(evictLine, addr.blockOffset, data);
-    evictLine.dirty = true;
-    evictLine.lastUsed = ++counter;
-
-    return result;
-}
-
-CacheLine& TwoWaySetAssociativeCache::findLRULine(std::vector<CacheLine>& set) {
-    CacheLine* lruLine = &set[0];
-    for (CacheLine& line : set) {
-        if (!line.valid) {
-            return line;
+    if (config.coherence != CoherenceProtocol::NONE && l1d && cores > 1) {
+        bus = std::make_unique<CoherenceBus>(config.coherence, config.coherenceTransfer, config.coherenceUpgrade,
+                                             config.coherenceInvalidate);
+        bus->attach(l1d.get());
+        for (unsigned int core = 1; core < cores; core++) {
+            coreL1d.push_back(CacheFactory::createLevel(config.l1d, backing));
+            bus->attach(coreL1d.back().get());
         }
-        if (line.lastUsed < lruLine->lastUsed) {
-            lruLine = &line;
+    }
+    if (l1i && l1d) {
+        l1i->addDataCache(l1d.get());
+        for (const auto& cache : coreL1d) {
+            l1i->addDataCache(cache.get());
         }
     }
-    return *lruLine;
-}
 
-void TwoWaySetAssociativeCache::loadBlockFromMemory(CacheLine& line, const unsigned int tag, const unsigned int offset) const {
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        line.data[i] = memory->readByteFromMemory(offset + i);
+    if (config.inclusive && lowest) {
+        if (l1d) {
+            lowest->addUpperLevel(l1d.get());
+        }
+        for (const auto& cache : coreL1d) {
+            lowest->addUpperLevel(cache.get());
+        }
+        if (l1i) {
+            lowest->addUpperLevel(l1i.get());
+        }
     }
-    line.valid = true;
-    line.dirty = false;
-    line.tag = tag;
-}
 
-void TwoWaySetAssociativeCache::writeBackBlock(const CacheLine& line, const unsigned int index) const {
-    const unsigned int blockAddress = (line.tag * SETS + index) * BLOCK_SIZE;
-    for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
-        memory->writeByteToMemory(blockAddress + i, line.data[i]);
+    for (const SetAssociativeCache* level : {static_cast<SetAssociativeCache*>(l1i.get()), l1d.get(), l2.get(), l3.get()}) {
+        prefetching = prefetching || (level && level->hasPrefetcher());
     }
 }
 
-void TwoWaySetAssociativeCache::writeWordToBlock(CacheLine& line, const unsigned int offset, const unsigned int data) {
-    line.data[offset] = data & 0xFF;
-    line.data[offset + 1] = (data >> 8) & 0xFF;
-    line.data[offset + 2] = (data >> 16) & 0xFF;
-    line.data[offset + 3] = (data >> 24) & 0xFF;
-}
-
-std::unique_ptr<Cache> CacheFactory::createCache(const unsigned int type, MemoryInterface* memory) {
-    switch (type) {
-        case 1:
-            return std::make_unique<DirectMappedCache>(memory);
-        case 2:
-            return std::make_unique<FullyAssociativeCache>(memory);
-        case 3:
-            return std::make_unique<TwoWaySetAssociativeCache>(memory);
-        default:
-            return nullptr;
+// Without a coherence bus every hart shares the one L1D.
+SetAssociativeCache* CacheHierarchy::dataCache(const unsigned int core) const {
+    if (core == 0 || core > coreL1d.size()) {
+        return l1d.get();
     }
+    return coreL1d[core - 1].get();
 }
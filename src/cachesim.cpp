@@ -0,0 +1,216 @@
+#include <cstring>
+
+#include "../include/cache.h"
+#include "../include/config.h"
+#include "../include/stats.h"
+#include "../include/timing_replay.h"
+#include "../include/trace.h"
+#include "../include/work_pool.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+static const char* USAGE = " <trace_file> [-c cache_type[:lines:block_size[:ways]]]... [-f config_file]... [-L config_list] [-m memory_size] [-j threads] [-o csv_file]\n";
+
+struct Configuration {
+    std::string label;
+    HierarchyConfig hierarchy;
+};
+
+struct LevelResult {
+    std::string name;
+    CacheStats stats;
+};
+
+struct Result {
+    unsigned long long cycles;
+    std::vector<LevelResult> levels;
+};
+
+static bool addCacheSpec(const std::string& spec, std::vector<Configuration>& configurations) {
+    Configuration configuration;
+    configuration.label = spec;
+    if (!parseCacheSpec(spec, configuration.hierarchy.l1d) || configuration.hierarchy.l1d.type == 0) {
+        std::cerr << "Invalid cache configuration " << spec << ". Aborting.\n";
+        return false;
+    }
+    configurations.push_back(configuration);
+    return true;
+}
+
+static bool addConfigFile(const std::string& path, std::vector<Configuration>& configurations) {
+    Configuration configuration;
+    configuration.label = path;
+    ConfigFile file;
+    std::string error;
+    if (!file.load(path, error) || !loadHierarchyConfig(file, configuration.hierarchy, error) ||
+        !configuration.hierarchy.isValid(error)) {
+        std::cerr << "Invalid configuration file: " << error << ". Aborting.\n";
+        return false;
+    }
+    for (const std::string& key : file.unusedKeys()) {
+        std::cerr << "Warning: unknown configuration key " << key << " in " << path << "\n";
+    }
+    configurations.push_back(configuration);
+    return true;
+}
+
+// One configuration per line: a configuration file if it ends in .cfg, otherwise a -c cache spec.
+static bool addConfigList(const std::string& path, std::vector<Configuration>& configurations) {
+    std::ifstream list(path);
+    if (!list) {
+        std::cerr << "Cannot open configuration list " << path << ". Aborting.\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string entry;
+        if (!(fields >> entry)) {
+            continue;
+        }
+        const bool isFile = entry.size() > 4 && entry.compare(entry.size() - 4, 4, ".cfg") == 0;
+        if (!(isFile ? addConfigFile(entry, configurations) : addCacheSpec(entry, configurations))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Result replay(const MappedTrace& trace, const HierarchyConfig& config, const unsigned int memorySize) {
+    TimingReplay replay(config, memorySize);
+    Result result;
+    result.cycles = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+        result.cycles += replay.access(trace[i]).getCycles();
+    }
+
+    const CacheHierarchy& hierarchy = replay.getHierarchy();
+    const NamedCache levels[] = {{"L1I", hierarchy.l1i.get()}, {"L1D", hierarchy.l1d.get()}, {"L2", hierarchy.l2.get()}, {"L3", hierarchy.l3.get()}};
+    for (const NamedCache& level : levels) {
+        if (level.cache) {
+            result.levels.push_back(LevelResult{level.name, level.cache->getStats()});
+        }
+    }
+    return result;
+}
+
+// Quotes a label for CSV when it contains a separator or a quote.
+static std::string csvField(const std::string& text) {
+    if (text.find_first_of(",\"") == std::string::npos) {
+        return text;
+    }
+    std::string quoted = "\"";
+    for (const char c : text) {
+        quoted += c;
+        if (c == '"') {
+            quoted += '"';
+        }
+    }
+    return quoted + "\"";
+}
+
+static void writeCsv(std::ostream& out, const std::vector<Configuration>& configurations, const std::vector<Result>& results) {
+    out << "config,level,hits,misses,miss_ratio,read_misses,write_misses,fetch_misses,writebacks,evictions,cycles,total_cycles\n";
+    out << std::fixed << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        for (const LevelResult& level : results[i].levels) {
+            const CacheStats& stats = level.stats;
+            const unsigned long long accesses = stats.hits + stats.misses;
+            out << csvField(configurations[i].label) << "," << level.name << "," << stats.hits << "," << stats.misses
+                << "," << (accesses == 0 ? 0.0 : static_cast<double>(stats.misses) / accesses) << ","
+                << stats.readMisses << "," << stats.writeMisses << "," << stats.fetchMisses << "," << stats.writebacks
+                << "," << stats.evictions << "," << stats.cycles << "," << results[i].cycles << "\n";
+        }
+    }
+}
+
+int main(const int argc, char* argv[]) {
+    std::string trace_path;
+    std::string csv_path;
+    unsigned int mem_size = 131072;
+    unsigned int threads = 0;
+    std::vector<Configuration> configurations;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-c") == 0 && hasValue) {
+            if (!addCacheSpec(argv[++i], configurations)) {
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-f") == 0 && hasValue) {
+            if (!addConfigFile(argv[++i], configurations)) {
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-L") == 0 && hasValue) {
+            if (!addConfigList(argv[++i], configurations)) {
+                return 2;
+            }
+        }
+        else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "-j") == 0) && hasValue) {
+            unsigned int& target = argv[i][1] == 'm' ? mem_size : threads;
+            try {
+                target = std::stoul(argv[++i]);
+            } catch (std::invalid_argument&) {
+                std::cerr << "Invalid number " << argv[i] << ". Aborting.\n";
+                return 2;
+            } catch (std::out_of_range&) {
+                std::cerr << "Invalid number " << argv[i] << ". Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && hasValue) {
+            csv_path = argv[++i];
+        }
+        else if (argv[i][0] == '-' || !trace_path.empty()) {
+            std::cerr << "Usage: " << argv[0] << USAGE;
+            return 1;
+        }
+        else {
+            trace_path = argv[i];
+        }
+    }
+
+    if (trace_path.empty() || configurations.empty()) {
+        std::cerr << "Usage: " << argv[0] << USAGE;
+        return 1;
+    }
+
+    MappedTrace trace;
+    std::string error;
+    if (!trace.open(trace_path, error)) {
+        std::cerr << "Invalid trace: " << error << ". Aborting.\n";
+        return 2;
+    }
+
+    // The emulator drops accesses outside its memory, so this only grows for traces recorded with a larger -m.
+    for (size_t i = 0; i < trace.size(); i++) {
+        const TraceRecord record = trace[i];
+        mem_size = std::max(mem_size, record.address + record.size);
+    }
+
+    std::vector<Result> results(configurations.size());
+    WorkStealingPool pool(threads);
+    pool.run(configurations.size(), [&](const size_t index) {
+        results[index] = replay(trace, configurations[index].hierarchy, mem_size);
+    });
+
+    if (csv_path.empty()) {
+        writeCsv(std::cout, configurations, results);
+        return 0;
+    }
+    std::ofstream csv(csv_path);
+    if (!csv) {
+        std::cerr << "Cannot write " << csv_path << ". Aborting.\n";
+        return 2;
+    }
+    writeCsv(csv, configurations, results);
+    std::cerr << "Replayed " << trace.size() << " accesses against " << configurations.size() << " configurations on "
+              << pool.getThreads() << " threads\n";
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "../include/coherence.h"
+#include "../include/cache.h"
+
+bool parseCoherenceProtocol(const std::string& text, CoherenceProtocol& protocol) {
+    if (text == "none") {
+        protocol = CoherenceProtocol::NONE;
+    } else if (text == "mesi") {
+        protocol = CoherenceProtocol::MESI;
+    } else if (text == "moesi") {
+        protocol = CoherenceProtocol::MOESI;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* coherenceProtocolName(const CoherenceProtocol protocol) {
+    switch (protocol) {
+        case CoherenceProtocol::MESI:
+            return "MESI";
+        case CoherenceProtocol::MOESI:
+            return "MOESI";
+        default:
+            return "none";
+    }
+}
+
+CoherenceStats::CoherenceStats()
+    : readRequests(0), ownershipRequests(0), upgrades(0), invalidations(0), transfers(0), snoopWritebacks(0) {}
+
+CoherenceResponse::CoherenceResponse() : shared(false), supplied(false), dirty(false), cycles(0) {}
+
+CoherenceBus::CoherenceBus(const CoherenceProtocol protocol, const unsigned int transferCycles,
+                           const unsigned int upgradeCycles, const unsigned int invalidateCycles)
+    : protocol(protocol), transferCycles(transferCycles), upgradeCycles(upgradeCycles),
+      invalidateCycles(invalidateCycles) {}
+
+void CoherenceBus::attach(SetAssociativeCache* cache) {
+    caches.push_back(cache);
+    cache->setCoherenceBus(this);
+}
+
+CoherenceResponse CoherenceBus::request(const SetAssociativeCache* requester, const unsigned int blockAddress,
+                                        unsigned char* data, const bool ownership) {
+    CoherenceResponse response;
+    bool invalidated = false;
+    for (SetAssociativeCache* cache : caches) {
+        if (cache == requester) {
+            continue;
+        }
+        bool supplied = false;
+        if (ownership) {
+            if (cache->snoopInvalidate(blockAddress, data, supplied)) {
+                stats.invalidations++;
+                invalidated = true;
+            }
+        } else if (cache->snoopRead(blockAddress, data, protocol == CoherenceProtocol::MOESI, supplied)) {
+            response.shared = true;
+            if (supplied && protocol == CoherenceProtocol::MESI) {
+                stats.snoopWritebacks++;
+            }
+        }
+        response.supplied = response.supplied || supplied;
+    }
+
+    if (ownership) {
+        stats.ownershipRequests++;
+    } else {
+        stats.readRequests++;
+    }
+    // Only an ownership request takes the dirty copy over; a reader gets a clean shared one.
+    response.dirty = ownership && response.supplied;
+    if (response.supplied) {
+        stats.transfers++;
+        response.cycles += transferCycles;
+    }
+    if (invalidated) {
+        response.cycles += invalidateCycles;
+    }
+    return response;
+}
+
+unsigned int CoherenceBus::upgrade(const SetAssociativeCache* requester, const unsigned int blockAddress, bool& dirty) {
+    scratch.resize(requester->getGeometry().blockSize);
+    for (SetAssociativeCache* cache : caches) {
+        bool supplied = false;
+        if (cache != requester && cache->snoopInvalidate(blockAddress, scratch.data(), supplied)) {
+            stats.invalidations++;
+        }
+        dirty = dirty || supplied;
+    }
+    stats.upgrades++;
+    return upgradeCycles;
+}
+
+unsigned int CoherenceBus::invalidate(const SetAssociativeCache* requester, const unsigned int blockAddress) {
+    bool invalidated = false;
+    for (SetAssociativeCache* cache : caches) {
+        bool supplied = false;
+        if (cache != requester && cache->snoopInvalidate(blockAddress, nullptr, supplied)) {
+            stats.invalidations++;
+            invalidated = true;
+        }
+    }
+    return invalidated ? invalidateCycles : 0;
+}
+
+CoherenceProtocol CoherenceBus::getProtocol() const {
+    return protocol;
+}
+
+const CoherenceStats& CoherenceBus::getStats() const {
+    return stats;
+}
+
+void CoherenceBus::reset() {
+    stats = CoherenceStats();
+}
@@ -0,0 +1,335 @@
+#include "../include/config.h"
+#include "../include/branch_predictor.h"
+#include "../include/cache.h"
+#include "../include/hart.h"
+#include "../include/intervals.h"
+#include "../include/latency.h"
+#include "../include/pipeline.h"
+#include "../include/sampling.h"
+#include "../include/simpoint.h"
+#include <cctype>
+#include <fstream>
+
+static std::string trim(const std::string& text) {
+    const size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    const size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+bool ConfigFile::load(const std::string& path, std::string& error) {
+    std::ifstream input(path);
+    if (!input) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    unsigned int lineNum = 0;
+    while (std::getline(input, line)) {
+        lineNum++;
+        line = trim(line.substr(0, line.find_first_of("#;")));
+        if (line.empty()) {
+            continue;
+        }
+
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = path + ":" + std::to_string(lineNum) + ": expected key = value";
+            return false;
+        }
+        values[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+    }
+    return true;
+}
+
+bool ConfigFile::has(const std::string& key) const {
+    return values.count(key) > 0;
+}
+
+bool ConfigFile::getUInt(const std::string& key, unsigned int& value) const {
+    const auto it = values.find(key);
+    if (it == values.end()) {
+        return true;
+    }
+    used.insert(key);
+
+    try {
+        size_t parsed = 0;
+        const unsigned long number = std::stoul(it->second, &parsed);
+        if (parsed != it->second.size()) {
+            return false;
+        }
+        value = static_cast<unsigned int>(number);
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+bool ConfigFile::getString(const std::string& key, std::string& value) const {
+    const auto it = values.find(key);
+    if (it == values.end()) {
+        return false;
+    }
+    used.insert(key);
+    value = it->second;
+    return true;
+}
+
+std::vector<std::string> ConfigFile::unusedKeys() const {
+    std::vector<std::string> unused;
+    for (const auto& entry : values) {
+        if (used.count(entry.first) == 0) {
+            unused.push_back(entry.first);
+        }
+    }
+    return unused;
+}
+
+bool parseCacheSpec(const std::string& text, CacheConfig& config) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        const size_t end = text.find(':', start);
+        fields.push_back(text.substr(start, end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (fields.size() == 2 || fields.size() > 4) {
+        return false;
+    }
+
+    unsigned int* targets[] = {&config.type, &config.lines, &config.blockSize, &config.ways};
+    try {
+        for (size_t i = 0; i < fields.size(); i++) {
+            *targets[i] = std::stoul(fields[i]);
+        }
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+
+    return config.type <= 4 && (config.type == 0 || config.geometry().isValid());
+}
+
+static bool loadCacheConfig(const ConfigFile& file, const std::string& prefix, CacheConfig& config, std::string& error) {
+    const char* fields[] = {"type", "lines", "block_size", "ways", "hit_latency"};
+    unsigned int* targets[] = {&config.type, &config.lines, &config.blockSize, &config.ways, &config.hitLatency};
+
+    for (unsigned int i = 0; i < 5; i++) {
+        const std::string key = prefix + "." + fields[i];
+        if (!file.getUInt(key, *targets[i])) {
+            error = key + ": expected an unsigned integer";
+            return false;
+        }
+    }
+
+    std::string policy;
+    if (file.getString(prefix + ".replacement", policy) && !parseReplacementType(policy, config.replacement, config.seed)) {
+        error = prefix + ".replacement: expected lru, plru, fifo, random[:seed], srrip or brrip";
+        return false;
+    }
+
+    std::string writePolicy;
+    if (file.getString(prefix + ".write_policy", writePolicy)) {
+        if (writePolicy != "write-back" && writePolicy != "write-through") {
+            error = prefix + ".write_policy: expected write-back or write-through";
+            return false;
+        }
+        config.writeThrough = writePolicy == "write-through";
+    }
+
+    std::string writeMiss;
+    if (file.getString(prefix + ".write_miss", writeMiss)) {
+        if (writeMiss != "allocate" && writeMiss != "no-allocate") {
+            error = prefix + ".write_miss: expected allocate or no-allocate";
+            return false;
+        }
+        config.writeAllocate = writeMiss == "allocate";
+    }
+
+    if (!file.getUInt(prefix + ".write_buffer", config.writeBufferEntries)) {
+        error = prefix + ".write_buffer: expected an unsigned integer";
+        return false;
+    }
+
+    std::string prefetcher;
+    if (file.getString(prefix + ".prefetcher", prefetcher) &&
+        !parsePrefetchSpec(prefetcher, config.prefetcher, config.prefetchDegree, config.prefetchDistance)) {
+        error = prefix + ".prefetcher: expected none, next-line or stride, optionally followed by :degree[:distance]";
+        return false;
+    }
+
+    if (!file.getUInt(prefix + ".victim_entries", config.victimEntries)) {
+        error = prefix + ".victim_entries: expected an unsigned integer";
+        return false;
+    }
+
+    std::string classify;
+    if (file.getString(prefix + ".classify_misses", classify)) {
+        if (classify != "yes" && classify != "no") {
+            error = prefix + ".classify_misses: expected yes or no";
+            return false;
+        }
+        config.classifyMisses = classify == "yes";
+    }
+    return true;
+}
+
+bool loadHierarchyConfig(const ConfigFile& file, HierarchyConfig& config, std::string& error) {
+    if (!loadCacheConfig(file, "l1d", config.l1d, error) ||
+        !loadCacheConfig(file, "l1i", config.l1i, error) ||
+        !loadCacheConfig(file, "l2", config.l2, error) ||
+        !loadCacheConfig(file, "l3", config.l3, error)) {
+        return false;
+    }
+
+    if (!file.getUInt("dram.first_access", config.dramFirstAccess) || !file.getUInt("dram.burst", config.dramBurst) ||
+        !file.getUInt("dram.banks", config.dramBanks) || !file.getUInt("dram.row_size", config.dramRowSize) ||
+        !file.getUInt("dram.row_hit", config.dramRowHit) || !file.getUInt("dram.row_miss", config.dramRowMiss) ||
+        !file.getUInt("dram.precharge", config.dramPrecharge)) {
+        error = "dram: expected an unsigned integer";
+        return false;
+    }
+
+    std::string model;
+    if (file.getString("dram.model", model) && !parseMemoryTimingType(model, config.dramModel)) {
+        error = "dram.model: expected flat or banked";
+        return false;
+    }
+
+    std::string pagePolicy;
+    if (file.getString("dram.page_policy", pagePolicy)) {
+        if (pagePolicy != "open" && pagePolicy != "closed") {
+            error = "dram.page_policy: expected open or closed";
+            return false;
+        }
+        config.dramOpenPage = pagePolicy == "open";
+    }
+
+    std::string timingMode;
+    if (file.getString("timing.mode", timingMode)) {
+        if (timingMode != "inline" && timingMode != "decoupled") {
+            error = "timing.mode: expected inline or decoupled";
+            return false;
+        }
+        config.decoupled = timingMode == "decoupled";
+    }
+
+    std::string protocol;
+    if (file.getString("coherence.protocol", protocol) && !parseCoherenceProtocol(protocol, config.coherence)) {
+        error = "coherence.protocol: expected none, mesi or moesi";
+        return false;
+    }
+    if (!file.getUInt("coherence.transfer", config.coherenceTransfer) ||
+        !file.getUInt("coherence.upgrade", config.coherenceUpgrade) ||
+        !file.getUInt("coherence.invalidate", config.coherenceInvalidate)) {
+        error = "coherence: expected an unsigned integer";
+        return false;
+    }
+
+    std::string inclusion;
+    if (file.getString("hierarchy.inclusion", inclusion)) {
+        if (inclusion == "inclusive") {
+            config.inclusive = true;
+        } else if (inclusion == "non-inclusive") {
+            config.inclusive = false;
+        } else {
+            error = "hierarchy.inclusion: expected inclusive or non-inclusive";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool loadLatencyTable(const ConfigFile& file, LatencyTable& table, std::string& error) {
+    for (unsigned int opcode = 0; opcode < LatencyTable::OPCODES; opcode++) {
+        const char* name = opcodeName(opcode);
+        if (name == nullptr) {
+            continue;
+        }
+        std::string key = "latency.";
+        for (const char* c = name; *c != '\0'; c++) {
+            key += static_cast<char>(std::tolower(static_cast<unsigned char>(*c)));
+        }
+        unsigned int cycles = table[opcode];
+        if (!file.getUInt(key, cycles)) {
+            error = key + ": expected an unsigned integer";
+            return false;
+        }
+        table.set(opcode, cycles);
+    }
+    return true;
+}
+
+bool loadBranchConfig(const ConfigFile& file, BranchPredictorConfig& config, std::string& error) {
+    std::string predictor;
+    if (file.getString("branch.predictor", predictor) && !parsePredictorSpec(predictor, config)) {
+        error = "branch.predictor: expected none, not-taken, bimodal, gshare or tournament";
+        return false;
+    }
+    if (!file.getUInt("branch.entries", config.entries) || !file.getUInt("branch.history_bits", config.historyBits) ||
+        !file.getUInt("branch.btb_entries", config.btbEntries) || !file.getUInt("branch.ras_depth", config.rasDepth) ||
+        !file.getUInt("branch.penalty", config.penalty)) {
+        error = "branch: expected an unsigned integer";
+        return false;
+    }
+    return true;
+}
+
+bool loadPipelineMode(const ConfigFile& file, PipelineMode& mode, std::string& error) {
+    std::string text;
+    if (file.getString("pipeline.mode", text) && !parsePipelineMode(text, mode)) {
+        error = "pipeline.mode: expected off, forwarding or no-forwarding";
+        return false;
+    }
+    return true;
+}
+
+bool loadHartConfig(const ConfigFile& file, HartConfig& config, std::string& error) {
+    if (!file.getUInt("harts.count", config.harts) || !file.getUInt("harts.stack_size", config.stackSize)) {
+        error = "harts: expected an unsigned integer";
+        return false;
+    }
+    return true;
+}
+
+bool loadIntervalConfig(const ConfigFile& file, IntervalConfig& config, std::string& error) {
+    if (!file.getUInt("intervals.length", config.length) || !file.getUInt("intervals.warmup", config.warmup) ||
+        !file.getUInt("intervals.jobs", config.jobs)) {
+        error = "intervals: expected an unsigned integer";
+        return false;
+    }
+    return true;
+}
+
+bool loadSimPointConfig(const ConfigFile& file, SimPointConfig& config, std::string& error) {
+    if (!file.getUInt("simpoint.length", config.length) || !file.getUInt("simpoint.clusters", config.clusters) ||
+        !file.getUInt("simpoint.warmup", config.warmup)) {
+        error = "simpoint: expected an unsigned integer";
+        return false;
+    }
+    if (config.clusters == 0) {
+        error = "simpoint.clusters must be at least 1";
+        return false;
+    }
+    return true;
+}
+
+bool loadSamplingConfig(const ConfigFile& file, SamplingConfig& config, std::string& error) {
+    if (!file.getUInt("sampling.period", config.period) || !file.getUInt("sampling.window", config.window) ||
+        !file.getUInt("sampling.warmup", config.warmup)) {
+        error = "sampling: expected an unsigned integer";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#include "../include/decoupled_timing.h"
+#include "../include/miss_profile.h"
+
+DecoupledTiming::DecoupledTiming(const HierarchyConfig& config, const unsigned int memorySize, MissProfile* misses,
+                                 const size_t capacity)
+    : replay(config, memorySize), misses(misses), ring(capacity), pushed(0), timed(0), stopping(false), fetchCycles(0),
+      dataCycles(0) {
+    consumer = std::thread(&DecoupledTiming::run, this);
+}
+
+DecoupledTiming::~DecoupledTiming() {
+    stopping.store(true, std::memory_order_release);
+    consumer.join();
+}
+
+// Yields rather than sleeping when the ring is empty: the interpreter refills it within
+// nanoseconds, and on a machine with a single core the yield is what lets it run.
+void DecoupledTiming::run() {
+    TraceRecord record;
+    unsigned long long count = 0;
+    while (!stopping.load(std::memory_order_acquire)) {
+        if (!ring.pop(record)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const CacheResult result = replay.access(record);
+        if (record.flags & TRACE_FETCH) {
+            fetchCycles += result.getCycles();
+        } else {
+            dataCycles += result.getCycles();
+        }
+        if (misses && (!result.hit || result.writebackOccurred)) {
+            misses->record(record.pc, result.hit ? 0 : 1, result.writebackOccurred ? 1 : 0, result.getCycles());
+        }
+        timed.store(++count, std::memory_order_release);
+    }
+}
+
+void DecoupledTiming::record(const TraceRecord& record) {
+    while (!ring.push(record)) {
+        std::this_thread::yield();
+    }
+    pushed++;
+}
+
+void DecoupledTiming::sync() {
+    while (timed.load(std::memory_order_acquire) != pushed) {
+        std::this_thread::yield();
+    }
+}
+
+void DecoupledTiming::takeCycles(unsigned long long& fetch, unsigned long long& data) {
+    fetch = fetchCycles;
+    data = dataCycles;
+    fetchCycles = 0;
+    dataCycles = 0;
+}
+
+const CacheHierarchy& DecoupledTiming::getHierarchy() const {
+    return replay.getHierarchy();
+}
@@ -1,35 +1,791 @@
 #include "../include/emu.h"
+#include "../include/branch_predictor.h"
 #include "../include/cache.h"
+#include "../include/decoupled_timing.h"
+#include "../include/intervals.h"
+#include "../include/sampling.h"
+#include "../include/simpoint.h"
+#include "../include/hart.h"
+#include "../include/latency.h"
+#include "../include/stats.h"
+#include "../include/miss_profile.h"
+#include "../include/pipeline.h"
+#include "../include/stack_distance.h"
+#include "../include/trace.h"
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
 #include <iostream>
 #include <cstdlib>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-unsigned int reg_file[22] = {0};
-unsigned int cntrl_regs[5] = {0};
+thread_local unsigned int reg_file[22] = {0};
+thread_local unsigned int cntrl_regs[5] = {0};
 unsigned char *prog_mem = nullptr;
-unsigned int mem_cycle_cntr = 0;
+thread_local unsigned long long mem_cycle_cntr = 0;
 unsigned int prog_mem_size = 0;
 bool test_mode = false;
-bool memStream = false;
+// Bytes allocated for prog_mem, which may be more than the current run uses
+static unsigned int prog_mem_capacity = 0;
+static bool program_halted = false;
+
+static HierarchyConfig hierarchy_config;
+static CacheHierarchy hierarchy;
+
+static StatsFormat stats_format = StatsFormat::TABLE;
+static std::unique_ptr<MissProfile> miss_profile = nullptr;
+static unsigned int miss_report_size = 0;
+static SymbolTable symbols;
+static std::unique_ptr<StackDistanceProfile> stack_profile = nullptr;
+static TraceWriter trace;
+static LatencyTable latencies;
+static thread_local CycleCounters cycle_counters;
+static std::unique_ptr<BranchUnit> branch_unit = nullptr;
+static const unsigned int BRANCH_REPORT_SIZE = 10;
+static std::unique_ptr<PipelineModel> pipeline = nullptr;
+// Memory cycles spent fetching the instruction now being executed, for the pipeline's IF stage.
+static thread_local unsigned int instruction_fetch_cycles = 0;
+// Set while fetch() reads the instruction words, so observers can tell fetches from data reads.
+static thread_local bool fetching_instruction = false;
+// Address of the instruction being fetched or executed, i.e. reg_file[PC] - 8 once it has been fetched.
+static thread_local unsigned int instruction_pc = 0;
+// Times the configured hierarchy in place of the inline one, which is left empty. Declared after
+// the miss profile it records into, so it is destroyed first.
+static std::unique_ptr<DecoupledTiming> decoupled = nullptr;
+// Whether the trace, the reuse profile or decoupled timing is watching accesses. Set by
+// useObservers() whenever one of them is turned on or off.
+static bool observing = false;
+static std::unique_ptr<IntervalSimulation> intervals = nullptr;
+static std::unique_ptr<SimPointSampler> simpoints = nullptr;
+static std::unique_ptr<SystematicSampler> windows = nullptr;
+// Whether fetch() has a budget to count down or a sampler to step. Set by useFetchHooks() whenever
+// one of them is turned on or off.
+static bool fetch_hooks = false;
+static bool guest_mode = false;
+static unsigned int instruction_budget = 0;
+static void (*budget_yield)() = nullptr;
+// Instructions the run in progress has left before it yields
+static unsigned int budget_left = 0;
+// What sampled stretches are timed with, while the functional pass runs without it
+static HierarchyConfig interval_hierarchy;
+static BranchPredictorConfig interval_predictor;
+// The counts when a forked interval started measuring
+static IntervalResult interval_start;
+static bool interval_measuring = false;
+
+// A spawned hart runs on a host thread of its own. Nothing the interpreter touches per
+// instruction is shared between harts except guest memory, so only the memory model, when
+// there is one, has to take a lock.
+struct Hart {
+    std::thread thread;
+    // Claimed by the hart that is joining this one
+    bool joining;
+    // Filled in by the hart itself as it stops
+    bool failed;
+    unsigned long long memCycles;
+    CycleCounters counters;
+    // The DRAM model the hart times its uncached accesses on
+    std::unique_ptr<MemoryTimingModel> timing;
+
+    Hart() : joining(false), failed(false), memCycles(0) {}
+};
+
+// TRP 7 and TRP 8 return this in R3 when they fail.
+static const unsigned int NO_HART = 0xFFFFFFFF;
+static HartConfig hart_config;
+// Indexed by hart id, a free slot is null. Slot 0 is the thread that runs main().
+static std::vector<std::unique_ptr<Hart>> harts;
+// Guards harts and the counters of joined harts
+static std::mutex hart_mutex;
+static unsigned long long retired_mem_cycles = 0;
+static CycleCounters retired_counters;
+static std::atomic<unsigned int> running_harts(1);
+static std::atomic<bool> stop_requested(false);
+static std::mutex memory_mutex;
+// One per L1, [0] for the L1I and [1 + core] for each L1D, only ever grown so that a hart's
+// pointer to its own stays valid. See MemoryGuard.
+static std::deque<std::mutex> l1_locks(2);
+// The locks of the L1s that can serve an access alone, L1Ds before the L1I, and the L1I's on its
+// own. Only these are ever taken. Set by build_hierarchy().
+static std::vector<std::mutex*> guarded_l1_locks;
+static std::mutex* l1i_lock = nullptr;
+static thread_local unsigned int hart_id = 0;
+static thread_local bool hart_halted = false;
+// Spawned harts time their uncached accesses on a DRAM model of their own, owned by their Hart.
+static thread_local MemoryTimingModel* hart_timing = nullptr;
+// The model this thread's uncached accesses are timed by, and the same model again when it is the
+// flat one, so that the common case is a direct call. Set by useHierarchy().
+static thread_local MemoryTimingModel* memory_timing = nullptr;
+static thread_local FlatMemoryTiming* flat_timing = nullptr;
+// The L1D this thread's data accesses go to: its own core's with a coherence bus, otherwise the
+// shared one, and nullptr without one. Set by useHierarchy().
+static thread_local SetAssociativeCache* hart_l1d = nullptr;
+// The L1 instruction words are read through, and the locks of it and of hart_l1d, nullptr for
+// an L1 that cannot serve an access alone.
+static thread_local SetAssociativeCache* hart_fetch_cache = nullptr;
+static thread_local std::mutex* hart_l1d_lock = nullptr;
+static thread_local std::mutex* hart_fetch_lock = nullptr;
+// Set while this thread's MemoryGuard holds every lock, so guards inside it take none.
+static thread_local bool holding_memory = false;
+
+void set_stats_format(const StatsFormat format) {
+    stats_format = format;
+}
+
+void set_latencies(const LatencyTable& table) {
+    latencies = table;
+}
+
+const CycleCounters& get_cycle_counters() {
+    return cycle_counters;
+}
+
+void init_branch_predictor(const BranchPredictorConfig& config) {
+    branch_unit = config.type != PredictorType::NONE ? std::make_unique<BranchUnit>(config) : nullptr;
+}
+
+void print_branch_report() {
+    if (!branch_unit) {
+        return;
+    }
+    const BranchStats& stats = branch_unit->getStats();
+    const std::vector<BranchRecord> worst = branch_unit->worst(BRANCH_REPORT_SIZE);
+    const auto accuracy = [](const unsigned long long executions, const unsigned long long mispredictions) {
+        return executions == 0 ? 100.0 : 100.0 * static_cast<double>(executions - mispredictions) / executions;
+    };
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2);
+
+    if (stats_format == StatsFormat::JSON) {
+        std::cout << "{\"branch_predictor\": {\"type\": \"" << predictorName(branch_unit->getConfig().type)
+                  << "\", \"branches\": " << stats.branches << ", \"mispredictions\": " << stats.mispredictions
+                  << ", \"conditional\": " << stats.conditional
+                  << ", \"conditional_mispredictions\": " << stats.conditionalMispredictions
+                  << ", \"btb_misses\": " << stats.btbMisses
+                  << ", \"return_mispredictions\": " << stats.returnMispredictions
+                  << ", \"penalty_cycles\": " << cycle_counters.branch << ", \"worst\": [";
+        for (size_t i = 0; i < worst.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << "{\"pc\": " << worst[i].pc << ", \"label\": \""
+                      << symbols.resolve(worst[i].pc) << "\", \"executions\": " << worst[i].executions
+                      << ", \"mispredictions\": " << worst[i].mispredictions << "}";
+        }
+        std::cout << "]}}" << std::endl;
+    } else {
+        std::cout << "Branch predictor (" << predictorName(branch_unit->getConfig().type) << "): " << stats.branches
+                  << " branches, " << stats.mispredictions << " mispredicted ("
+                  << accuracy(stats.branches, stats.mispredictions) << "% accurate), " << stats.btbMisses
+                  << " BTB misses, " << stats.returnMispredictions << " mispredicted returns, "
+                  << cycle_counters.branch << " penalty cycles" << std::endl;
+        for (const BranchRecord& record : worst) {
+            std::cout << "  PC " << record.pc;
+            const std::string label = symbols.resolve(record.pc);
+            if (!label.empty()) {
+                std::cout << " (" << label << ")";
+            }
+            std::cout << ": " << record.executions << " executions, " << record.mispredictions << " mispredicted, "
+                      << accuracy(record.executions, record.mispredictions) << "% accurate" << std::endl;
+        }
+    }
+
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+void init_pipeline(const PipelineMode mode) {
+    pipeline = mode != PipelineMode::OFF ? std::make_unique<PipelineModel>(mode == PipelineMode::FORWARDING) : nullptr;
+}
+
+void print_pipeline_report() {
+    if (!pipeline) {
+        return;
+    }
+    const PipelineStats& stats = pipeline->getStats();
+    const char* stages[] = {"IF", "ID", "EX", "MEM", "WB"};
+    const auto share = [&stats](const unsigned long long cycles) {
+        return stats.cycles == 0 ? 0.0 : 100.0 * static_cast<double>(cycles) / static_cast<double>(stats.cycles);
+    };
+    const double cpi = stats.instructions == 0 ? 0.0 : static_cast<double>(stats.cycles) / stats.instructions;
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(3);
+
+    if (stats_format == StatsFormat::JSON) {
+        std::cout << "{\"pipeline\": {\"forwarding\": " << (pipeline->isForwarding() ? "true" : "false")
+                  << ", \"instructions\": " << stats.instructions << ", \"cycles\": " << stats.cycles
+                  << ", \"cpi\": " << cpi << ", \"raw_stalls\": " << stats.rawStalls
+                  << ", \"load_use_stalls\": " << stats.loadUseStalls << ", \"flush_cycles\": " << stats.flushCycles
+                  << ", \"utilisation\": {";
+        for (unsigned int stage = STAGE_IF; stage < PIPELINE_STAGES; stage++) {
+            std::cout << (stage == STAGE_IF ? "" : ", ") << "\"" << stages[stage] << "\": " << share(stats.busy[stage]) / 100.0;
+        }
+        std::cout << "}}}" << std::endl;
+    } else {
+        std::cout << "Pipeline (" << (pipeline->isForwarding() ? "forwarding" : "no forwarding") << "): "
+                  << stats.instructions << " instructions in " << stats.cycles << " cycles, CPI " << cpi << std::endl;
+        std::cout << "  RAW stalls: " << stats.rawStalls << " (" << stats.loadUseStalls << " load-use), flush cycles: "
+                  << stats.flushCycles << std::endl;
+        std::cout << std::setprecision(1) << "  Utilisation:";
+        for (unsigned int stage = STAGE_IF; stage < PIPELINE_STAGES; stage++) {
+            std::cout << " " << stages[stage] << " " << share(stats.busy[stage]) << "%";
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+const PipelineStats* get_pipeline_stats() {
+    return pipeline ? &pipeline->getStats() : nullptr;
+}
+
+void print_cpi_breakdown() {
+    printCpiBreakdown(std::cout, cycle_counters, stats_format);
+}
+
+void print_cache_statistics() {
+    const CacheHierarchy& caches = decoupled ? decoupled->getHierarchy() : hierarchy;
+    std::vector<NamedCache> levels;
+    // Private L1Ds are numbered by the hart that uses them
+    std::vector<std::string> coreNames = {"L1D"};
+    if (!caches.coreL1d.empty()) {
+        coreNames[0] = "L1D0";
+        for (size_t core = 1; core <= caches.coreL1d.size(); core++) {
+            coreNames.push_back("L1D" + std::to_string(core));
+        }
+    }
+    const NamedCache candidates[] = {{"L1I", caches.l1i.get()}, {coreNames[0].c_str(), caches.l1d.get()}};
+    for (const NamedCache& level : candidates) {
+        if (level.cache) {
+            levels.push_back(level);
+        }
+    }
+    for (size_t core = 0; core < caches.coreL1d.size(); core++) {
+        levels.push_back({coreNames[core + 1].c_str(), caches.coreL1d[core].get()});
+    }
+    for (const NamedCache& level : {NamedCache{"L2", caches.l2.get()}, NamedCache{"L3", caches.l3.get()}}) {
+        if (level.cache) {
+            levels.push_back(level);
+        }
+    }
+    const MemoryTimingModel* memory = caches.timing.get();
+    if (!levels.empty() || (memory && memory->getType() == MemoryTimingType::BANKED)) {
+        printCacheStatistics(std::cout, levels, mem_cycle_cntr, stats_format, memory, caches.bus.get());
+    }
+}
+
+void enable_miss_profile(const unsigned int topN) {
+    miss_report_size = topN;
+    miss_profile = topN > 0 ? std::make_unique<MissProfile>() : nullptr;
+}
+
+bool load_symbols(const std::string& path, std::string& error) {
+    return symbols.load(path, error);
+}
+
+void print_miss_report() {
+    if (!miss_profile) {
+        return;
+    }
+    const std::vector<MissRecord> hottest = miss_profile->top(miss_report_size);
+
+    if (stats_format == StatsFormat::JSON) {
+        std::cout << "{\"hot_misses\": [";
+        for (size_t i = 0; i < hottest.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << "{\"pc\": " << hottest[i].pc << ", \"label\": \""
+                      << symbols.resolve(hottest[i].pc) << "\", \"misses\": " << hottest[i].misses
+                      << ", \"writebacks\": " << hottest[i].writebacks << ", \"cycles\": " << hottest[i].cycles << "}";
+        }
+        std::cout << "]}" << std::endl;
+        return;
+    }
+
+    std::cout << "Top " << hottest.size() << " missing instructions:" << std::endl;
+    for (const MissRecord& record : hottest) {
+        std::cout << "  PC " << record.pc;
+        const std::string label = symbols.resolve(record.pc);
+        if (!label.empty()) {
+            std::cout << " (" << label << ")";
+        }
+        std::cout << ": " << record.misses << " misses, " << record.writebacks << " write-backs, "
+                  << record.cycles << " cycles" << std::endl;
+    }
+}
+
+static void useObservers() {
+    observing = trace.isOpen() || stack_profile || decoupled;
+}
+
+static void useFetchHooks() {
+    fetch_hooks = instruction_budget > 0 || intervals || simpoints || windows;
+}
+
+void enable_stack_distance(const unsigned int blockSize, const unsigned int maxLines) {
+    stack_profile = blockSize > 0 ? std::make_unique<StackDistanceProfile>(blockSize, maxLines) : nullptr;
+    useObservers();
+}
+
+void print_miss_ratio_curve() {
+    if (stack_profile) {
+        printMissRatioCurve(std::cout, *stack_profile, stats_format);
+    }
+}
+
+bool enable_trace(const std::string& path, std::string& error) {
+    const bool opened = trace.open(path, error);
+    useObservers();
+    return opened;
+}
+
+// Feeds the trace, the stack distance profile and decoupled timing every access, cached or not.
+static void recordAccess(const unsigned int address, const unsigned int size, const bool write) {
+    const TraceRecord record{address, instruction_pc, static_cast<unsigned char>(size),
+                             static_cast<unsigned char>((write ? TRACE_WRITE : 0) | (fetching_instruction ? TRACE_FETCH : 0))};
+    trace.record(record);
+    if (decoupled) {
+        decoupled->record(record);
+    }
+    if (!stack_profile) {
+        return;
+    }
+    stack_profile->access(address);
+    const unsigned int blockSize = stack_profile->getBlockSize();
+    if (address / blockSize != (address + size - 1) / blockSize) {
+        stack_profile->access(address + size - 1);
+    }
+}
+
+// Without observers an access costs one test of a flag that is only set as they are turned on or off.
+static void observeAccess(const unsigned int address, const unsigned int size, const bool write) {
+    if (observing) {
+        recordAccess(address, size, write);
+    }
+}
+
+static void joinAllHarts();
+static void useHierarchy();
+
+// Interval simulation and SimPoint sampling run the program without caches or branch prediction,
+// and turn them on only in the stretches they time.
+static void set_timing_model(const bool on) {
+    // The caches hold data, so what they have not written back must not go with them
+    hierarchy.writeBackAll();
+    init_hierarchy(on ? interval_hierarchy : HierarchyConfig());
+    init_branch_predictor(on ? interval_predictor : BranchPredictorConfig());
+}
+
+static void enter_functional_pass(const BranchPredictorConfig& predictor) {
+    interval_hierarchy = hierarchy_config;
+    interval_predictor = predictor;
+    interval_measuring = false;
+    set_timing_model(false);
+}
+
+// A forked process leaves the trace and the reuse profile to the functional pass.
+static void detach_observers() {
+    trace.abandon();
+    stack_profile = nullptr;
+    useObservers();
+}
+
+void init_intervals(const IntervalConfig& config, const BranchPredictorConfig& predictor) {
+    intervals = nullptr;
+    useFetchHooks();
+    if (config.length == 0) {
+        return;
+    }
+    intervals = std::make_unique<IntervalSimulation>(config);
+    useFetchHooks();
+    enter_functional_pass(predictor);
+}
+
+bool init_simpoints(const SimPointConfig& config, const BranchPredictorConfig& predictor, std::string& error) {
+    simpoints = nullptr;
+    useFetchHooks();
+    if (config.length == 0) {
+        return true;
+    }
+    simpoints = std::make_unique<SimPointSampler>(config);
+    useFetchHooks();
+    enter_functional_pass(predictor);
+    if (!simpoints->startReplayer(error)) {
+        simpoints = nullptr;
+        useFetchHooks();
+        return false;
+    }
+    if (simpoints->isReplaying()) {
+        detach_observers();
+    }
+    return true;
+}
+
+void init_sampling(const SamplingConfig& config, const BranchPredictorConfig& predictor) {
+    windows = nullptr;
+    useFetchHooks();
+    if (config.period == 0) {
+        return;
+    }
+    windows = std::make_unique<SystematicSampler>(config);
+    useFetchHooks();
+    enter_functional_pass(predictor);
+}
+
+static IntervalResult interval_counts() {
+    IntervalResult result;
+    result.counters = cycle_counters;
+    result.memoryCycles = mem_cycle_cntr;
+    const Cache* levels[IntervalResult::LEVELS] = {hierarchy.l1i.get(), hierarchy.l1d.get(), hierarchy.l2.get(),
+                                                   hierarchy.l3.get()};
+    for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+        if (levels[level]) {
+            result.levels[level] = levels[level]->getStats();
+        }
+    }
+    return result;
+}
+
+// What the timed stretch has counted since it started measuring.
+static IntervalResult measured_counts() {
+    IntervalResult measured;
+    if (interval_measuring) {
+        measured = interval_counts();
+        measured.subtract(interval_start);
+    }
+    return measured;
+}
+
+// Forks the intervals that start here, and in a forked one turns the timing model on, starts
+// counting and reports at the interval's bounds.
+static void step_intervals() {
+    const unsigned long long retired = cycle_counters.instructions;
+    if (intervals->startInterval(retired)) {
+        set_timing_model(true);
+        detach_observers();
+    }
+    if (intervals->startsMeasuring(retired)) {
+        interval_start = interval_counts();
+        interval_measuring = true;
+    }
+    if (intervals->endsInterval(retired)) {
+        intervals->report(measured_counts());
+    }
+}
+
+// Profiles the functional pass, or in the replay process times the representatives.
+static void step_simpoints() {
+    const unsigned long long retired = cycle_counters.instructions;
+    if (!simpoints->isReplaying()) {
+        simpoints->profile(reg_file[PC], retired, cycle_counters.execute, mem_cycle_cntr);
+        return;
+    }
+    if (simpoints->endsMeasuring(retired)) {
+        simpoints->record(measured_counts(), retired);
+        interval_measuring = false;
+    }
+    if (simpoints->stopsTiming(retired)) {
+        set_timing_model(false);
+    }
+    if (simpoints->isDone()) {
+        simpoints->report();
+    }
+    if (simpoints->startsTiming(retired)) {
+        set_timing_model(true);
+    }
+    if (simpoints->startsMeasuring(retired)) {
+        interval_start = interval_counts();
+        interval_measuring = true;
+    }
+}
+
+// Fast-forwards between windows, and turns the timing model on to warm up and measure each one.
+static void step_windows() {
+    const unsigned long long retired = cycle_counters.instructions;
+    if (windows->endsWindow(retired)) {
+        windows->record(measured_counts());
+        interval_measuring = false;
+        set_timing_model(false);
+    }
+    if (windows->startsTiming(retired)) {
+        set_timing_model(true);
+    }
+    if (windows->startsWindow(retired)) {
+        interval_start = interval_counts();
+        interval_measuring = true;
+    }
+}
+
+// A forked interval or replay process that gets to the end of the program reports and ends there.
+static void report_sampled_counts() {
+    if (intervals && intervals->isChild()) {
+        intervals->report(measured_counts());
+    }
+    if (simpoints && simpoints->isReplaying()) {
+        if (simpoints->isMeasuring()) {
+            simpoints->record(measured_counts(), cycle_counters.instructions);
+        }
+        simpoints->report();
+    }
+}
+
+// Puts the sampled counts in place of the functional pass's own for the report. The caches are
+// rebuilt only to hold the counts, without the parts whose counts are not sent back.
+static void show_sampled_counts(const IntervalResult& total) {
+    const unsigned long long instructions = cycle_counters.instructions;
+    cycle_counters = total.counters;
+    cycle_counters.instructions = instructions;
+    mem_cycle_cntr = total.memoryCycles;
+
+    HierarchyConfig shown = interval_hierarchy;
+    for (CacheConfig* level : {&shown.l1d, &shown.l1i, &shown.l2, &shown.l3}) {
+        level->prefetcher = PrefetchType::NONE;
+        level->writeBufferEntries = 0;
+        level->victimEntries = 0;
+    }
+    shown.dramModel = MemoryTimingType::FLAT;
+    init_hierarchy(shown);
+    Cache* levels[IntervalResult::LEVELS] = {hierarchy.l1i.get(), hierarchy.l1d.get(), hierarchy.l2.get(),
+                                             hierarchy.l3.get()};
+    for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+        if (levels[level]) {
+            levels[level]->setStats(total.levels[level]);
+        }
+    }
+}
+
+static void finish_sampling() {
+    report_sampled_counts();
+    IntervalResult total;
+    std::string error;
+    if (intervals) {
+        if (!intervals->finish(total, error)) {
+            std::cerr << "Interval simulation: " << error << std::endl;
+        }
+        show_sampled_counts(total);
+        std::cerr << "Timed " << intervals->getIntervals() << " intervals of " << intervals->getConfig().length
+                  << " instructions, " << intervals->getJobs() << " at a time" << std::endl;
+    }
+    if (simpoints) {
+        if (simpoints->finish(cycle_counters.execute, mem_cycle_cntr, total, error)) {
+            show_sampled_counts(total);
+        } else {
+            std::cerr << "SimPoint: " << error << "; the counts are the functional pass's" << std::endl;
+        }
+    }
+    if (windows) {
+        // A window cut short by the halt still counts, for the instructions it measured
+        if (windows->isMeasuring()) {
+            windows->record(measured_counts());
+        }
+        if (windows->finish(cycle_counters.instructions, total, error)) {
+            show_sampled_counts(total);
+        } else {
+            std::cerr << "Sampling: " << error << "; the counts are the functional pass's" << std::endl;
+        }
+    }
+}
 
-// 0 = no cache, 1 = direct mapped, 2 = fully associative, 3 = 2-way set associative
-static unsigned int cache_type = 0;
-static std::unique_ptr<Cache> cache = nullptr;
-static std::unique_ptr<MemoryInterface> memory_interface = nullptr;
+void print_simpoint_report() {
+    if (simpoints && !simpoints->isReplaying()) {
+        simpoints->printReport(std::cout, stats_format);
+    }
+}
+
+void print_sampling_report() {
+    if (windows) {
+        windows->printReport(std::cout, stats_format);
+    }
+}
+
+// Waits for the timing thread to catch up and adds the stall cycles it has timed since the last call.
+static void collectDecoupledTiming() {
+    if (!decoupled) {
+        return;
+    }
+    decoupled->sync();
+    unsigned long long fetch = 0;
+    unsigned long long data = 0;
+    decoupled->takeCycles(fetch, data);
+    mem_cycle_cntr += fetch + data;
+    cycle_counters.fetch += fetch;
+    cycle_counters.data += data;
+}
 
 void cleanupAndExit() {
-    if (prog_mem != nullptr) {
+    joinAllHarts();
+    collectDecoupledTiming();
+    finish_sampling();
+    // Runs that return keep the arena for the next program
+    if (prog_mem != nullptr && !test_mode) {
         delete[] prog_mem;
         prog_mem = nullptr;
+        prog_mem_capacity = 0;
     }
     std::cout << "Execution completed. Total memory cycles: " << mem_cycle_cntr << std::endl;
+    print_cpi_breakdown();
+    print_pipeline_report();
+    print_branch_report();
+    print_cache_statistics();
+    print_simpoint_report();
+    print_sampling_report();
+    print_miss_report();
+    print_miss_ratio_curve();
+    decoupled = nullptr;
+    if (!trace.close()) {
+        std::cerr << "Failed to write the memory trace" << std::endl;
+    }
+    useObservers();
 
     if (test_mode) {
+        program_halted = true;
         return;
     }
     std::exit(EXIT_SUCCESS);
 }
 
+bool has_halted() {
+    return program_halted;
+}
+
+void reset_emulator() {
+    stop_harts();
+    decoupled = nullptr;
+    intervals = nullptr;
+    simpoints = nullptr;
+    windows = nullptr;
+    stats_format = StatsFormat::TABLE;
+    miss_profile = nullptr;
+    miss_report_size = 0;
+    symbols = SymbolTable();
+    stack_profile = nullptr;
+    trace.close();
+    useObservers();
+    useFetchHooks();
+    program_halted = false;
+    mem_cycle_cntr = 0;
+    cycle_counters = CycleCounters();
+}
+
+struct GuestContext::State {
+    unsigned int regFile[22] = {0};
+    unsigned int cntrlRegs[5] = {0};
+    unsigned char* progMem = nullptr;
+    unsigned int progMemSize = 0;
+    unsigned int progMemCapacity = 0;
+    unsigned long long memCycles = 0;
+    bool halted = false;
+    bool testMode = false;
+    HierarchyConfig hierarchyConfig;
+    CacheHierarchy hierarchy;
+    StatsFormat statsFormat = StatsFormat::TABLE;
+    std::unique_ptr<MissProfile> missProfile;
+    unsigned int missReportSize = 0;
+    SymbolTable symbols;
+    std::unique_ptr<StackDistanceProfile> stackProfile;
+    LatencyTable latencies;
+    CycleCounters cycleCounters;
+    std::unique_ptr<BranchUnit> branchUnit;
+    std::unique_ptr<PipelineModel> pipeline;
+    unsigned int instructionFetchCycles = 0;
+    bool fetchingInstruction = false;
+    unsigned int instructionPC = 0;
+    std::unique_ptr<SystematicSampler> windows;
+    HierarchyConfig intervalHierarchy;
+    BranchPredictorConfig intervalPredictor;
+    IntervalResult intervalStart;
+    bool intervalMeasuring = false;
+    HartConfig hartConfig;
+    std::vector<std::unique_ptr<Hart>> harts;
+    unsigned long long retiredMemCycles = 0;
+    CycleCounters retiredCounters;
+    MemoryTimingModel* hartTiming = nullptr;
+    unsigned int budgetLeft = 0;
+    std::streambuf* buffers[3] = {std::cin.rdbuf(), std::cout.rdbuf(), std::cerr.rdbuf()};
+    std::ios_base::iostate streamStates[3] = {std::ios_base::goodbit, std::ios_base::goodbit,
+                                              std::ios_base::goodbit};
+
+    ~State() {
+        hierarchy.clear();
+        delete[] progMem;
+    }
+};
+
+GuestContext::GuestContext() : state(std::make_unique<State>()) {
+    state->budgetLeft = instruction_budget;
+}
+
+GuestContext::~GuestContext() = default;
+
+// Harts, decoupled timing, the samplers that fork and the trace are refused in guest mode, so
+// what they keep is left out.
+void GuestContext::swap() {
+    State& other = *state;
+    std::swap(reg_file, other.regFile);
+    std::swap(cntrl_regs, other.cntrlRegs);
+    std::swap(prog_mem, other.progMem);
+    std::swap(prog_mem_size, other.progMemSize);
+    std::swap(prog_mem_capacity, other.progMemCapacity);
+    std::swap(mem_cycle_cntr, other.memCycles);
+    std::swap(program_halted, other.halted);
+    std::swap(test_mode, other.testMode);
+    std::swap(hierarchy_config, other.hierarchyConfig);
+    std::swap(hierarchy, other.hierarchy);
+    std::swap(stats_format, other.statsFormat);
+    std::swap(miss_profile, other.missProfile);
+    std::swap(miss_report_size, other.missReportSize);
+    std::swap(symbols, other.symbols);
+    std::swap(stack_profile, other.stackProfile);
+    useObservers();
+    std::swap(latencies, other.latencies);
+    std::swap(cycle_counters, other.cycleCounters);
+    std::swap(branch_unit, other.branchUnit);
+    std::swap(pipeline, other.pipeline);
+    std::swap(instruction_fetch_cycles, other.instructionFetchCycles);
+    std::swap(fetching_instruction, other.fetchingInstruction);
+    std::swap(instruction_pc, other.instructionPC);
+    std::swap(windows, other.windows);
+    useFetchHooks();
+    std::swap(interval_hierarchy, other.intervalHierarchy);
+    std::swap(interval_predictor, other.intervalPredictor);
+    std::swap(interval_start, other.intervalStart);
+    std::swap(interval_measuring, other.intervalMeasuring);
+    std::swap(hart_config, other.hartConfig);
+    std::swap(harts, other.harts);
+    std::swap(retired_mem_cycles, other.retiredMemCycles);
+    std::swap(retired_counters, other.retiredCounters);
+    std::swap(hart_timing, other.hartTiming);
+    useHierarchy();
+    std::swap(budget_left, other.budgetLeft);
+    std::ios* const streams[3] = {&std::cin, &std::cout, &std::cerr};
+    for (unsigned int i = 0; i < 3; i++) {
+        // rdbuf() clears the state, so it is read first
+        const std::ios_base::iostate state = streams[i]->rdstate();
+        std::streambuf* const buffer = streams[i]->rdbuf(other.buffers[i]);
+        streams[i]->clear(other.streamStates[i]);
+        other.buffers[i] = buffer;
+        other.streamStates[i] = state;
+    }
+}
+
+void set_instruction_budget(const unsigned int budget, void (*yield)()) {
+    instruction_budget = yield == nullptr ? 0 : budget;
+    budget_yield = yield;
+    budget_left = instruction_budget;
+    useFetchHooks();
+}
+
+void set_guest_mode(const bool enabled) {
+    guest_mode = enabled;
+}
+
+bool in_guest_mode() {
+    return guest_mode;
+}
+
 bool init_registers(const unsigned int code_section) {
     for (int i = 0; i < PC; i++) {
         reg_file[i] = 0;
@@ -38,7 +794,7 @@ bool init_registers(const unsigned int code_section) {
     for (int i = 0; i < 5; i++) {
         cntrl_regs[i] = 0;
     }
-    memStream = false;
+    end_memory_stream();
 
     reg_file[PC] = 0;
     reg_file[SL] = code_section + 1;
@@ -60,120 +816,596 @@ bool validate_stack_pointer() {
 }
 
 bool init_mem(const unsigned int size) {
-    if (prog_mem != nullptr) delete[] prog_mem;
+    if (prog_mem != nullptr && size <= prog_mem_capacity) {
+        std::fill(prog_mem, prog_mem + size, 0);
+    } else {
+        if (prog_mem != nullptr) delete[] prog_mem;
 
-    prog_mem = new(std::nothrow) unsigned char[size];
+        prog_mem = new(std::nothrow) unsigned char[size]();
+        prog_mem_capacity = prog_mem == nullptr ? 0 : size;
 
-    if (prog_mem == nullptr) return false;
+        if (prog_mem == nullptr) return false;
+    }
 
     prog_mem_size = size;
     mem_cycle_cntr = 0;
+    cycle_counters = CycleCounters();
+    if (branch_unit) {
+        branch_unit->reset();
+    }
+    if (pipeline) {
+        pipeline->reset();
+    }
+
+    return true;
+}
 
+bool init_harts(const HartConfig& config) {
+    if (config.harts > 1 && reg_file[SB] - reg_file[SL] < config.harts * config.stackSize) {
+        return false;
+    }
+    stop_harts();
+    hart_config = config;
+    harts.clear();
+    harts.resize(config.harts);
+    if (config.harts > 1) {
+        reg_file[SL] = reg_file[SB] - config.stackSize;
+    }
     return true;
 }
 
+static void addCounters(CycleCounters& to, const CycleCounters& from) {
+    to.instructions += from.instructions;
+    to.execute += from.execute;
+    to.fetch += from.fetch;
+    to.data += from.data;
+    to.branch += from.branch;
+}
+
+// Body of a spawned hart's thread. It starts at entry with its id in R3 and its own stack
+// region; the heap pointer is the spawning hart's.
+static void runHart(Hart* hart, const unsigned int id, const unsigned int entry, const unsigned int heap) {
+    hart_id = id;
+    hart->timing = CacheFactory::createMemoryTiming(hierarchy_config);
+    hart_timing = hart->timing.get();
+    useHierarchy();
+    reg_file[PC] = entry;
+    reg_file[SB] = prog_mem_size - id * hart_config.stackSize;
+    reg_file[SL] = reg_file[SB] - hart_config.stackSize;
+    reg_file[SP] = reg_file[SB];
+    reg_file[HP] = heap;
+    reg_file[R3] = id;
+
+    bool failed = false;
+    while (!hart_halted && !stop_requested.load(std::memory_order_relaxed)) {
+        if (!fetch() || !decode() || !execute()) {
+            std::cout << "INVALID INSTRUCTION AT: " << reg_file[PC] - 8 << " ON HART " << id << std::endl;
+            failed = true;
+            break;
+        }
+    }
+
+    hart->failed = failed;
+    hart->memCycles = mem_cycle_cntr;
+    hart->counters = cycle_counters;
+    running_harts--;
+}
+
+// Returns the new hart's id, or NO_HART when every hart is busy or entry is outside memory.
+static unsigned int spawnHart(const unsigned int entry) {
+    if (prog_mem_size < 8 || entry > prog_mem_size - 8) {
+        return NO_HART;
+    }
+    const std::lock_guard<std::mutex> lock(hart_mutex);
+    for (unsigned int id = 1; id < harts.size(); id++) {
+        if (!harts[id]) {
+            harts[id] = std::make_unique<Hart>();
+            running_harts++;
+            harts[id]->thread = std::thread(runHart, harts[id].get(), id, entry, reg_file[HP]);
+            return id;
+        }
+    }
+    return NO_HART;
+}
+
+// Waits for the hart to halt and adds its cycles to the run's totals. Returns 0 when it halted,
+// 1 when it stopped on an invalid instruction and NO_HART when there is no such hart to join.
+static unsigned int joinHart(const unsigned int id) {
+    Hart* hart;
+    {
+        const std::lock_guard<std::mutex> lock(hart_mutex);
+        if (id == 0 || id == hart_id || id >= harts.size() || !harts[id] || harts[id]->joining) {
+            return NO_HART;
+        }
+        hart = harts[id].get();
+        hart->joining = true;
+    }
+    hart->thread.join();
+
+    const std::lock_guard<std::mutex> lock(hart_mutex);
+    const unsigned int result = hart->failed ? 1 : 0;
+    retired_mem_cycles += hart->memCycles;
+    addCounters(retired_counters, hart->counters);
+    harts[id].reset();
+    return result;
+}
+
+// Joins every hart still running, including any they spawn meanwhile, and folds all joined
+// harts' cycles into hart 0's counters.
+static void joinAllHarts() {
+    while (true) {
+        unsigned int next = 0;
+        {
+            const std::lock_guard<std::mutex> lock(hart_mutex);
+            for (unsigned int id = 1; id < harts.size() && next == 0; id++) {
+                if (harts[id] && !harts[id]->joining) {
+                    next = id;
+                }
+            }
+        }
+        if (next == 0) {
+            break;
+        }
+        joinHart(next);
+    }
+
+    const std::lock_guard<std::mutex> lock(hart_mutex);
+    mem_cycle_cntr += retired_mem_cycles;
+    addCounters(cycle_counters, retired_counters);
+    retired_mem_cycles = 0;
+    retired_counters = CycleCounters();
+}
+
+void stop_harts() {
+    stop_requested = true;
+    joinAllHarts();
+    stop_requested = false;
+    // A forked process that ends on an invalid instruction reports what it counted, and must not
+    // return into the functional pass's caller
+    report_sampled_counts();
+}
+
+// Memory cycles are stalls of the fetch or of the instruction's own data accesses.
+static void chargeMemoryCycles(const unsigned int cycles) {
+    mem_cycle_cntr += cycles;
+    if (fetching_instruction) {
+        cycle_counters.fetch += cycles;
+    } else {
+        cycle_counters.data += cycles;
+    }
+}
+
+// Prefetchers attribute the accesses of one instruction, including its fetch, to its address.
+static void setAccessPC(const unsigned int pc) {
+    for (SetAssociativeCache* level : {static_cast<SetAssociativeCache*>(hierarchy.l1i.get()), hart_l1d, hierarchy.l2.get(), hierarchy.l3.get()}) {
+        if (level) {
+            level->setAccessPC(pc);
+        }
+    }
+}
+
+// Whether an L1 can serve any access without going past it.
+static bool servesAlone(const SetAssociativeCache* cache) {
+    return cache && !cache->hasPrefetcher() && !cache->getWriteBuffer().isEnabled();
+}
+
+// Caches and the access observers model one memory system for all harts, so while more
+// than one hart runs, accesses that touch them take turns. Without them guest memory is all that
+// is shared and accesses go ahead unlocked. A hart only goes from one to several by spawning
+// from between accesses, so the count cannot change under an access that skipped the lock.
+//
+// An access that its L1 serves alone takes only that L1's lock, and a store also the L1I's to drop
+// stale instructions. Anything that may go past an L1, or that an observer sees, takes the memory
+// lock and then those of the L1s that serve accesses alone, so it has the whole hierarchy to
+// itself. As the levels it may reach are shared, it also points their prefetchers at this hart's
+// instruction.
+class MemoryGuard {
+private:
+    std::mutex* l1;
+    std::mutex* l1i;
+    bool all;
+
+    // Whether a run of more than one hart has to lock this thread's accesses.
+    static bool locking();
+    void lockAll();
+    void lock(SetAssociativeCache* cache, std::mutex* lock, unsigned int address, unsigned int size, bool write);
+    void unlock();
+
+public:
+    // A single hart, the common case, is told apart inline.
+    // Takes everything when needed is set.
+    explicit MemoryGuard(const bool needed = true) : l1(nullptr), l1i(nullptr), all(false) {
+        if (needed && running_harts.load(std::memory_order_relaxed) > 1 && locking()) {
+            lockAll();
+        }
+    }
+    // For an access through cache, whose lock is lock. Both are nullptr for an uncached access.
+    MemoryGuard(SetAssociativeCache* cache, std::mutex* lock, const unsigned int address, const unsigned int size,
+                const bool write)
+        : l1(nullptr), l1i(nullptr), all(false) {
+        if (running_harts.load(std::memory_order_relaxed) > 1 && locking()) {
+            this->lock(cache, lock, address, size, write);
+        }
+    }
+    ~MemoryGuard() {
+        if (l1 || all) {
+            unlock();
+        }
+    }
+    MemoryGuard(const MemoryGuard&) = delete;
+    MemoryGuard& operator=(const MemoryGuard&) = delete;
+};
+
+bool MemoryGuard::locking() {
+    return (hierarchy.l1d || hierarchy.l1i || observing) && !holding_memory;
+}
+
+void MemoryGuard::lockAll() {
+    all = true;
+    holding_memory = true;
+    memory_mutex.lock();
+    for (std::mutex* lock : guarded_l1_locks) {
+        lock->lock();
+    }
+    if (hierarchy.prefetching) {
+        setAccessPC(instruction_pc);
+    }
+}
+
+void MemoryGuard::lock(SetAssociativeCache* cache, std::mutex* lock, const unsigned int address, const unsigned int size,
+                       const bool write) {
+    if (lock && !observing && (!write || !hierarchy.l1i || l1i_lock)) {
+        lock->lock();
+        if (cache->servesAlone(address, size, write)) {
+            l1 = lock;
+            if (write && l1i_lock) {
+                l1i = l1i_lock;
+                l1i->lock();
+            }
+            return;
+        }
+        lock->unlock();
+    }
+    lockAll();
+}
+
+void MemoryGuard::unlock() {
+    if (l1i) {
+        l1i->unlock();
+    }
+    if (l1) {
+        l1->unlock();
+    }
+    if (all) {
+        for (auto lock = guarded_l1_locks.rbegin(); lock != guarded_l1_locks.rend(); ++lock) {
+            (*lock)->unlock();
+        }
+        memory_mutex.unlock();
+        holding_memory = false;
+    }
+}
+
+// Charges a cache access and attributes its misses and write-backs to the current instruction.
+static void chargeCacheAccess(const CacheResult& result) {
+    chargeMemoryCycles(result.getCycles());
+    if (miss_profile && (!result.hit || result.writebackOccurred)) {
+        miss_profile->record(instruction_pc, result.hit ? 0 : 1, result.writebackOccurred ? 1 : 0, result.getCycles());
+    }
+}
+
+// Looks the calling thread's L1D and timing model up again, after they or the hierarchy have been replaced.
+static void useHierarchy() {
+    hart_l1d = hierarchy.dataCache(hart_id);
+    hart_l1d_lock = servesAlone(hart_l1d) ? &l1_locks[hart_l1d == hierarchy.l1d.get() ? 1 : 1 + hart_id] : nullptr;
+    hart_fetch_cache = hierarchy.l1i ? hierarchy.l1i.get() : hart_l1d;
+    hart_fetch_lock = hierarchy.l1i ? l1i_lock : hart_l1d_lock;
+    memory_timing = hart_timing ? hart_timing : hierarchy.timing.get();
+    // Decoupled timing times uncached accesses itself, so they must not find the fast path
+    flat_timing = !decoupled && memory_timing && memory_timing->getType() == MemoryTimingType::FLAT
+                      ? static_cast<FlatMemoryTiming*>(memory_timing)
+                      : nullptr;
+}
+
+// The timing model outlives the caches, but a run that never configured them has none yet.
+static MemoryTimingModel& memoryTiming() {
+    if (!memory_timing) {
+        if (!hart_timing && !hierarchy.timing) {
+            hierarchy.timing = CacheFactory::createMemoryTiming(hierarchy_config);
+        }
+        useHierarchy();
+    }
+    return *memory_timing;
+}
+
+// Uncached accesses are timed by the DRAM model, one stream per instruction.
+static void chargeUncachedAccess(const unsigned int address, const unsigned int size, const bool write) {
+    if (flat_timing) {
+        chargeMemoryCycles(flat_timing->uncachedAccess(address, size, write));
+    } else if (!decoupled) {
+        chargeMemoryCycles(memoryTiming().uncachedAccess(address, size, write));
+    }
+}
+
+// Only the hart's own uncached accesses look at the stream, so this needs no lock.
+void end_memory_stream() {
+    if (flat_timing) {
+        flat_timing->endStream();
+    } else {
+        memoryTiming().endStream();
+    }
+}
+
+// Stores must not leave stale copies of code in the instruction side of the hierarchy.
+static void snoopStore(const unsigned int address, const unsigned int size) {
+    if (hierarchy.l1i) {
+        hierarchy.l1i->invalidateBlock(address);
+        hierarchy.l1i->invalidateBlock(address + size - 1);
+    }
+    if (!hierarchy.l1d) {
+        for (SetAssociativeCache* level : {hierarchy.l2.get(), hierarchy.l3.get()}) {
+            if (level) {
+                level->invalidateBlock(address);
+                level->invalidateBlock(address + size - 1);
+            }
+        }
+    }
+}
+
 unsigned char readByte(const unsigned int address) {
     if (address >= prog_mem_size) {
         return 0;
     }
-    if (!cache) {
-        if (memStream) {
-            mem_cycle_cntr += 2;
-        } else {
-            mem_cycle_cntr += 8;
-            memStream = true;
-        }
+    const MemoryGuard guard(hart_l1d, hart_l1d_lock, address, 1, false);
+    observeAccess(address, 1, false);
+    if (!hart_l1d) {
+        chargeUncachedAccess(address, 1, false);
         return prog_mem[address];
     }
-    const CacheResult result = cache->readByte(address);
-    mem_cycle_cntr += result.getCycles();
+    const CacheResult result = hart_l1d->readByte(address);
+    chargeCacheAccess(result);
 
-    return cache->getCachedByte(address);
+    return hart_l1d->getCachedByte(address);
 }
 
 unsigned int readWord(const unsigned int address) {
     if (address + 3 >= prog_mem_size) {
         return 0;
     }
+    const MemoryGuard guard(hart_l1d, hart_l1d_lock, address, 4, false);
+    observeAccess(address, 4, false);
 
-    if (!cache) {
-        if (memStream) {
-            mem_cycle_cntr += 2;
-        } else {
-            mem_cycle_cntr += 8;
-            memStream = true;
-        }
+    if (!hart_l1d) {
+        chargeUncachedAccess(address, 4, false);
         return (prog_mem[address + 3] << 24) |
             (prog_mem[address + 2] << 16) |
             (prog_mem[address + 1] << 8) |
             prog_mem[address];
     }
-    const CacheResult result = cache->readWord(address);
-    mem_cycle_cntr += result.getCycles();
-    return cache->getCachedWord(address);
+    unsigned int word;
+    unsigned int cycles;
+    if (hart_l1d->readWordHit(address, false, word, cycles)) {
+        chargeMemoryCycles(cycles);
+        return word;
+    }
+    const CacheResult result = hart_l1d->readWord(address);
+    chargeCacheAccess(result);
+    return hart_l1d->getCachedWord(address);
 }
 
 void writeByte(const unsigned int address, const unsigned char byte) {
     if (address >= prog_mem_size) {
         return;
     }
+    const MemoryGuard guard(hart_l1d, hart_l1d_lock, address, 1, true);
+    observeAccess(address, 1, true);
 
-    if (!cache) {
-        if (memStream) {
-            mem_cycle_cntr += 2;
-        } else {
-            mem_cycle_cntr += 8;
-            memStream = true;
-        }
+    if (!hart_l1d) {
+        chargeUncachedAccess(address, 1, true);
         prog_mem[address] = byte;
-        return;
+    } else {
+        const CacheResult result = hart_l1d->writeByte(address, byte);
+        chargeCacheAccess(result);
     }
-    const CacheResult result = cache->writeByte(address, byte);
-    mem_cycle_cntr += result.getCycles();
+    snoopStore(address, 1);
 }
 
 void writeWord(const unsigned int address, const unsigned int word) {
     if (address + 3 >= prog_mem_size) {
         return;
     }
+    const MemoryGuard guard(hart_l1d, hart_l1d_lock, address, 4, true);
+    observeAccess(address, 4, true);
 
-    if (!cache) {
-        if (memStream) {
-            mem_cycle_cntr += 2;
-        } else {
-            mem_cycle_cntr += 8;
-            memStream = true;
-        }
+    if (!hart_l1d) {
+        chargeUncachedAccess(address, 4, true);
         prog_mem[address] = word & 0xFF;
         prog_mem[address + 1] = (word >> 8) & 0xFF;
         prog_mem[address + 2] = (word >> 16) & 0xFF;
         prog_mem[address + 3] = (word >> 24) & 0xFF;
-        return;
+    } else {
+        const CacheResult result = hart_l1d->writeWord(address, word);
+        chargeCacheAccess(result);
     }
-    const CacheResult result = cache->writeWord(address, word);
-    mem_cycle_cntr += result.getCycles();
+    snoopStore(address, 4);
 }
 
-void init_cache(const unsigned int cacheType) {
-    cache_type = cacheType;
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Atomic instructions operate on guest words in place, which needs a little-endian host"
+#endif
+
+enum class AtomicOp { COMPARE_SWAP, FETCH_ADD, EXCHANGE };
 
-    if (cache_type > 0 && prog_mem != nullptr) {
-        memory_interface = std::make_unique<SystemMemory>(prog_mem, prog_mem_size);
-        cache = CacheFactory::createCache(cache_type, memory_interface.get());
+// Read-modify-write of the aligned word at address, returning the old value. Without a data
+// cache it is a host atomic on guest memory itself, so it holds against every hart at once.
+// With one, the memory guard already makes each cached access exclusive; the atomic takes the
+// block for ownership with a read and then writes it, even when a compare-and-swap fails, as a
+// locked read-modify-write does.
+static bool atomicAccess(const AtomicOp op, const unsigned int address, const unsigned int operand,
+                         const unsigned int expected, unsigned int& old) {
+    if (address % 4 != 0 || address + 3 >= prog_mem_size) {
+        return false;
+    }
+    const MemoryGuard guard(hart_l1d, hart_l1d_lock, address, 4, true);
+    observeAccess(address, 4, true);
+
+    if (!hart_l1d) {
+        chargeUncachedAccess(address, 4, true);
+        unsigned int* word = reinterpret_cast<unsigned int*>(prog_mem + address);
+        switch (op) {
+            case AtomicOp::COMPARE_SWAP:
+                old = expected;
+                __atomic_compare_exchange_n(word, &old, operand, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+                break;
+            case AtomicOp::FETCH_ADD:
+                old = __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+                break;
+            case AtomicOp::EXCHANGE:
+                old = __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+                break;
+        }
     } else {
-        cache = nullptr;
-        memory_interface = nullptr;
+        // One ownership request, so the store below needs no upgrade
+        chargeCacheAccess(hart_l1d->readWordExclusive(address));
+        old = hart_l1d->getCachedWord(address);
+        unsigned int value = operand;
+        if (op == AtomicOp::COMPARE_SWAP && old != expected) {
+            value = old;
+        } else if (op == AtomicOp::FETCH_ADD) {
+            value = old + operand;
+        }
+        chargeCacheAccess(hart_l1d->writeWord(address, value));
+    }
+    snoopStore(address, 4);
+    return true;
+}
+
+// A fence waits for every buffered store to reach memory.
+static void fence() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const MemoryGuard guard;
+    for (SetAssociativeCache* level : {hart_l1d, hierarchy.l2.get(), hierarchy.l3.get()}) {
+        if (level) {
+            chargeMemoryCycles(level->drainWriteBuffer());
+        }
+    }
+}
+
+// In decoupled mode the interpreter keeps no caches of its own and every access goes to the
+// timing thread instead.
+static void build_hierarchy() {
+    decoupled = nullptr;
+    if (hierarchy_config.decoupled) {
+        hierarchy.build(HierarchyConfig(), prog_mem, prog_mem_size);
+        decoupled = std::make_unique<DecoupledTiming>(hierarchy_config, prog_mem_size, miss_profile.get());
+    } else {
+        hierarchy.build(hierarchy_config, prog_mem, prog_mem_size, hart_config.harts);
+    }
+    while (l1_locks.size() < 2 + hierarchy.coreL1d.size()) {
+        l1_locks.emplace_back();
+    }
+    guarded_l1_locks.clear();
+    for (unsigned int core = 0; core <= hierarchy.coreL1d.size(); core++) {
+        if (servesAlone(hierarchy.dataCache(core))) {
+            guarded_l1_locks.push_back(&l1_locks[1 + core]);
+        }
+    }
+    l1i_lock = servesAlone(hierarchy.l1i.get()) ? &l1_locks[0] : nullptr;
+    if (l1i_lock) {
+        guarded_l1_locks.push_back(l1i_lock);
+    }
+    useHierarchy();
+    useObservers();
+}
+
+void init_hierarchy(const HierarchyConfig& config) {
+    hierarchy_config = config;
+    build_hierarchy();
+}
+
+void init_cache(const unsigned int cacheType) {
+    init_cache(cacheType, CACHE_LINES, BLOCK_SIZE);
+}
+
+// Resets the instruction side back to the unified layout; lower levels and latencies are kept.
+void init_cache(const unsigned int cacheType, const unsigned int lines, const unsigned int blockSize) {
+    hierarchy_config.l1d.type = cacheType;
+    hierarchy_config.l1d.lines = lines;
+    hierarchy_config.l1d.blockSize = blockSize;
+    hierarchy_config.l1i.type = 0;
+    build_hierarchy();
+}
+
+// Must run after init_cache(). The whole hierarchy is rebuilt cold.
+void init_icache(const unsigned int cacheType, const unsigned int lines, const unsigned int blockSize) {
+    hierarchy_config.l1i.type = cacheType;
+    hierarchy_config.l1i.lines = lines;
+    hierarchy_config.l1i.blockSize = blockSize;
+    build_hierarchy();
+}
+
+// Instruction words go through the L1I when one is configured, otherwise through the unified path.
+// Without caches they are read here directly: fetch() has checked the bounds and holds the guard.
+static unsigned int fetchWord(const unsigned int address) {
+    if (!hart_fetch_cache) {
+        observeAccess(address, 4, false);
+        chargeUncachedAccess(address, 4, false);
+        return (prog_mem[address + 3] << 24) |
+            (prog_mem[address + 2] << 16) |
+            (prog_mem[address + 1] << 8) |
+            prog_mem[address];
+    }
+    const MemoryGuard guard(hart_fetch_cache, hart_fetch_lock, address, 4, false);
+    observeAccess(address, 4, false);
+    unsigned int word;
+    unsigned int cycles;
+    if (hart_fetch_cache->readWordHit(address, true, word, cycles)) {
+        chargeMemoryCycles(cycles);
+        return word;
+    }
+    const CacheResult result = hart_fetch_cache->fetchWord(address);
+    chargeCacheAccess(result);
+    return hart_fetch_cache->getCachedWord(address);
+}
+
+// Counts down the instruction budget and steps the samplers, ahead of each fetch.
+static void run_fetch_hooks() {
+    if (instruction_budget > 0 && --budget_left == 0) {
+        budget_left = instruction_budget;
+        budget_yield();
+    }
+    if (intervals) {
+        step_intervals();
+    }
+    if (simpoints) {
+        step_simpoints();
+    }
+    if (windows) {
+        step_windows();
     }
 }
 
 bool fetch() {
+    if (fetch_hooks) {
+        run_fetch_hooks();
+    }
     if (reg_file[PC] > prog_mem_size - 8 || prog_mem_size < 8) {
         return false;
     }
 
-    const unsigned int firstWord = readWord(reg_file[PC]);
-    const unsigned int secondWord = readWord(reg_file[PC] + 4);
-    memStream = false;
+    instruction_pc = reg_file[PC];
+    // With more than one hart, the memory guard sets it for the accesses that can reach a prefetcher
+    if (hierarchy.prefetching && running_harts.load(std::memory_order_relaxed) == 1) {
+        setAccessPC(reg_file[PC]);
+    }
+    // Without a lock of its own the fetch would take everything for each word, so take it once for both
+    const MemoryGuard guard(!hart_fetch_lock);
+    const unsigned long long fetch_cycles = cycle_counters.fetch;
+    fetching_instruction = true;
+    const unsigned int firstWord = fetchWord(reg_file[PC]);
+    const unsigned int secondWord = fetchWord(reg_file[PC] + 4);
+    fetching_instruction = false;
+    instruction_fetch_cycles = static_cast<unsigned int>(cycle_counters.fetch - fetch_cycles);
+    end_memory_stream();
 
     cntrl_regs[OPERATION] = firstWord & 0xFF;
     cntrl_regs[OPERAND_1] = (firstWord >> 8) & 0xFF;
@@ -300,7 +1532,10 @@ bool decode() {
                 case CHAR_IN:
                 case STRING_OUT:
                 case STRING_IN:
+                case SPAWN:
+                case JOIN:
                 case PRINT_REG:
+                case PRINT_STATS:
                     break;
                 default:
                     return false;
@@ -347,6 +1582,24 @@ bool decode() {
         case RET:
             break;
 
+        case CAS:
+        case FAA:
+            if (cntrl_regs[OPERAND_1] >= 22 ||
+                cntrl_regs[OPERAND_2] >= 22 ||
+                cntrl_regs[OPERAND_3] >= 22) {
+                return false;
+            }
+            break;
+
+        case XCHG:
+            if (cntrl_regs[OPERAND_1] >= 22 || cntrl_regs[OPERAND_2] >= 22) {
+                return false;
+            }
+            break;
+
+        case FENCE:
+            break;
+
         default:
             return false;
     }
@@ -354,7 +1607,7 @@ bool decode() {
     return true;
 }
 
-bool execute() {
+static bool executeInstruction() {
     switch (cntrl_regs[OPERATION]) {
         case JMP:
             if (cntrl_regs[IMMEDIATE] >= prog_mem_size) {
@@ -417,7 +1670,7 @@ bool execute() {
                 return false;
             }
             writeWord(cntrl_regs[IMMEDIATE], reg_file[cntrl_regs[OPERAND_1]]);
-            memStream = false;
+            end_memory_stream();
             break;
 
         case LDR:
@@ -425,7 +1678,7 @@ bool execute() {
                 return false;
             }
             reg_file[cntrl_regs[OPERAND_1]] = readWord(cntrl_regs[IMMEDIATE]);
-            memStream = false;
+            end_memory_stream();
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
@@ -436,7 +1689,7 @@ bool execute() {
                 return false;
             }
             writeByte(cntrl_regs[IMMEDIATE], reg_file[cntrl_regs[OPERAND_1]] & 0xFF);
-            memStream = false;
+            end_memory_stream();
             break;
 
         case LDB:
@@ -447,17 +1700,17 @@ bool execute() {
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
-            memStream = false;
+            end_memory_stream();
             break;
 
         case ISTR:
             writeWord(reg_file[cntrl_regs[OPERAND_2]], reg_file[cntrl_regs[OPERAND_1]]);
-            memStream = false;
+            end_memory_stream();
             break;
 
         case ILDR:
             reg_file[cntrl_regs[OPERAND_1]] = readWord(reg_file[cntrl_regs[OPERAND_2]]);
-            memStream = false;
+            end_memory_stream();
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
@@ -465,12 +1718,12 @@ bool execute() {
 
         case ISTB:
             writeByte(reg_file[cntrl_regs[OPERAND_2]], reg_file[cntrl_regs[OPERAND_1]] & 0xFF);
-            memStream = false;
+            end_memory_stream();
             break;
 
         case ILDB:
             reg_file[cntrl_regs[OPERAND_1]] = readByte(reg_file[cntrl_regs[OPERAND_2]]);
-            memStream = false;
+            end_memory_stream();
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
@@ -604,7 +1857,7 @@ bool execute() {
                 const unsigned int word = readWord(cntrl_regs[IMMEDIATE]);
                 reg_file[cntrl_regs[OPERAND_1]] = reg_file[HP];
                 reg_file[HP] += word;
-                memStream = false;
+                end_memory_stream();
 
                 if (reg_file[HP] >= reg_file[SP]) {
                     return false;
@@ -620,7 +1873,7 @@ bool execute() {
             const unsigned int word = readWord(address);
             reg_file[cntrl_regs[OPERAND_1]] = reg_file[HP];
             reg_file[HP] += word;
-            memStream = false;
+            end_memory_stream();
             if (reg_file[HP] >= reg_file[SP]) {
                 return false;
             }
@@ -636,7 +1889,7 @@ bool execute() {
                 if (!validate_stack_pointer()) { return false; }
             }
             writeWord(reg_file[SP], reg_file[cntrl_regs[OPERAND_1]]);
-            memStream = false;
+            end_memory_stream();
         }
             break;
 
@@ -649,7 +1902,7 @@ bool execute() {
                 if (!validate_stack_pointer()) { return false; }
             }
             writeByte(reg_file[SP], reg_file[cntrl_regs[OPERAND_1]] & 0xFF);
-            memStream = false;
+            end_memory_stream();
         }
             break;
 
@@ -662,7 +1915,7 @@ bool execute() {
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
-            memStream = false;
+            end_memory_stream();
             if (!validate_stack_pointer()) { return false; }
         }
             break;
@@ -676,7 +1929,7 @@ bool execute() {
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
-            memStream = false;
+            end_memory_stream();
             if (!validate_stack_pointer()) { return false; }
         }
             break;
@@ -691,7 +1944,7 @@ bool execute() {
             }
             writeWord(reg_file[SP], reg_file[PC]);
             reg_file[PC] = cntrl_regs[IMMEDIATE];
-            memStream = false;
+            end_memory_stream();
         }
             break;
 
@@ -704,16 +1957,49 @@ bool execute() {
             if (cntrl_regs[OPERAND_1] == SP) {
                 if (!validate_stack_pointer()) { return false; }
             }
-            memStream = false;
+            end_memory_stream();
+        }
+            break;
+
+        case CAS:
+        case FAA:
+        case XCHG: {
+            const AtomicOp op = cntrl_regs[OPERATION] == CAS   ? AtomicOp::COMPARE_SWAP
+                                : cntrl_regs[OPERATION] == FAA ? AtomicOp::FETCH_ADD
+                                                               : AtomicOp::EXCHANGE;
+            const unsigned int operand = reg_file[cntrl_regs[cntrl_regs[OPERATION] == XCHG ? OPERAND_1 : OPERAND_3]];
+            unsigned int old;
+            if (!atomicAccess(op, reg_file[cntrl_regs[OPERAND_2]], operand, reg_file[cntrl_regs[OPERAND_1]], old)) {
+                return false;
+            }
+            reg_file[cntrl_regs[OPERAND_1]] = old;
+            end_memory_stream();
         }
             break;
 
+        case FENCE:
+            fence();
+            break;
+
         case TRP:
             switch (cntrl_regs[IMMEDIATE]) {
                 case HALT:
+                    // Only hart 0 ends the run, once every other hart has halted too
+                    if (hart_id != 0) {
+                        hart_halted = true;
+                        return true;
+                    }
                     cleanupAndExit();
                     return true;
 
+                case SPAWN:
+                    reg_file[3] = spawnHart(reg_file[3]);
+                    break;
+
+                case JOIN:
+                    reg_file[3] = joinHart(reg_file[3]);
+                    break;
+
                 case INT_OUT:
                     std::cout << static_cast<int>(reg_file[3]) << std::flush;
                     break;
@@ -748,7 +2034,7 @@ bool execute() {
                         std::cout << static_cast<char>(readByte(address + i));
                     }
                     std::cout << std::flush;
-                    memStream = false;
+                    end_memory_stream();
                 }
                     break;
 
@@ -772,7 +2058,7 @@ bool execute() {
                     if (address + str.length() + 1 < prog_mem_size) {
                         writeByte(address + str.length() + 1, 0);
                     }
-                    memStream = false;
+                    end_memory_stream();
                 }
                     break;
 
@@ -789,6 +2075,16 @@ bool execute() {
                     std::cout << "HP\t" << reg_file[HP] << std::endl;
                     break;
 
+                case PRINT_STATS:
+                    collectDecoupledTiming();
+                    print_cpi_breakdown();
+                    print_pipeline_report();
+                    print_branch_report();
+                    print_cache_statistics();
+                    print_miss_report();
+                    print_miss_ratio_curve();
+                    break;
+
                 default:
                     return false;
             }
@@ -798,3 +2094,79 @@ bool execute() {
     }
     return true;
 }
+
+static bool branchKind(const unsigned int opcode, BranchKind& kind) {
+    switch (opcode) {
+        case BNZ:
+        case BGT:
+        case BLT:
+        case BRZ:
+            kind = BranchKind::CONDITIONAL;
+            return true;
+        case JMP:
+            kind = BranchKind::JUMP;
+            return true;
+        case JMR:
+            kind = BranchKind::INDIRECT;
+            return true;
+        case CALL:
+            kind = BranchKind::CALL;
+            return true;
+        case RET:
+            kind = BranchKind::RETURN;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The pipeline only times what the interpreter has already done, so it sees the instruction
+// once it has executed, along with its fetch and data cycles and whether fetch went astray.
+static void issueToPipeline(const unsigned int opcode, const unsigned int (&operands)[5],
+                            const unsigned long long dataCycles, const bool redirect) {
+    PipelineInstruction instruction;
+    describeInstruction(opcode, operands[OPERAND_1], operands[OPERAND_2], operands[OPERAND_3], operands[IMMEDIATE],
+                        instruction);
+    instruction.fetchCycles = instruction_fetch_cycles;
+    instruction.executeCycles = latencies[opcode];
+    instruction.memoryCycles = static_cast<unsigned int>(dataCycles);
+    instruction.redirect = redirect;
+    pipeline->issue(instruction);
+}
+
+bool execute() {
+    const unsigned int opcode = cntrl_regs[OPERATION];
+    const unsigned int fallthrough = reg_file[PC];
+    const unsigned int operands[5] = {cntrl_regs[0], cntrl_regs[1], cntrl_regs[2], cntrl_regs[3], cntrl_regs[4]};
+    const unsigned long long data_cycles = cycle_counters.data;
+    cycle_counters.instructions++;
+    cycle_counters.execute += latencies[opcode];
+
+    // The halting trap prints the reports from inside executeInstruction, so the pipeline has to
+    // see it first. It neither branches nor touches data.
+    const bool halting = opcode == TRP && operands[IMMEDIATE] == HALT && hart_id == 0;
+    if (pipeline && halting) {
+        issueToPipeline(opcode, operands, 0, false);
+    }
+    if (!executeInstruction()) {
+        return false;
+    }
+
+    // Without a predictor the front end simply fetches the next instruction, so every taken branch redirects it
+    bool redirect = false;
+    BranchKind kind;
+    if (branchKind(opcode, kind)) {
+        if (branch_unit && hart_id == 0) {
+            const unsigned long long mispredictions = branch_unit->getStats().mispredictions;
+            cycle_counters.branch += branch_unit->resolve(instruction_pc, kind, fallthrough, reg_file[PC]);
+            redirect = branch_unit->getStats().mispredictions != mispredictions;
+        } else {
+            redirect = reg_file[PC] != fallthrough;
+        }
+    }
+
+    if (pipeline && hart_id == 0 && !halting) {
+        issueToPipeline(opcode, operands, cycle_counters.data - data_cycles, redirect);
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#include <cstring>
+
+#include "../include/batch.h"
+#include "../include/batch_workers.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static const char* USAGE = " <manifest> [-j threads] [-o results_file] [-T timeout_seconds] [-F quantum]\n";
+
+static bool parseNumber(const char* text, unsigned int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used);
+        return text[used] == '\0';
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+static int reportBatch(std::ostream& out, const std::vector<BatchJob>& jobs, const std::vector<BatchResult>& results,
+                       const double seconds, const size_t worker_count) {
+    writeBatchResults(out, jobs, results);
+    size_t failed = 0;
+    for (const BatchResult& result : results) {
+        failed += result.status != 0 ? 1 : 0;
+    }
+    std::cerr << "Ran " << jobs.size() << " jobs, " << failed << " failed, in " << seconds << " s on "
+              << worker_count << " workers\n";
+    return failed == 0 ? 0 : 1;
+}
+
+int main(const int argc, char* argv[]) {
+    std::string manifest_path;
+    std::string results_path;
+    unsigned int threads = 0;
+    unsigned int timeout = 0;
+    unsigned int quantum = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "-F") == 0) && hasValue) {
+            unsigned int& target = argv[i][1] == 'j' ? threads : argv[i][1] == 'T' ? timeout : quantum;
+            if (!parseNumber(argv[++i], target) || (&target == &quantum && quantum == 0)) {
+                std::cerr << "Invalid number " << argv[i] << ". Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && hasValue) {
+            results_path = argv[++i];
+        }
+        else if (argv[i][0] == '-' || !manifest_path.empty()) {
+            std::cerr << "Usage: " << argv[0] << USAGE;
+            return 1;
+        }
+        else {
+            manifest_path = argv[i];
+        }
+    }
+
+    if (manifest_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << USAGE;
+        return 1;
+    }
+    if (quantum > 0 && timeout > 0) {
+        std::cerr << "A timeout cannot stop one guest without the others on its worker. Aborting.\n";
+        return 2;
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string error;
+    if (!loadBatchManifest(manifest_path, jobs, error)) {
+        std::cerr << "Invalid manifest: " << error << ". Aborting.\n";
+        return 2;
+    }
+    std::ofstream results_file;
+    if (!results_path.empty()) {
+        results_file.open(results_path);
+        if (!results_file) {
+            std::cerr << "Cannot write " << results_path << ". Aborting.\n";
+            return 2;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results;
+    size_t worker_count = 0;
+    if (!runOnWorkers(jobs, threads, timeout, quantum, results, worker_count)) {
+        std::cerr << "Cannot start a worker process. Aborting.\n";
+        return 2;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return reportBatch(results_path.empty() ? std::cout : results_file, jobs, results, seconds, worker_count);
+}
@@ -0,0 +1,66 @@
+#include "../include/fiber.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static thread_local Fiber* running = nullptr;
+
+Fiber::Fiber(std::function<void()> body, const size_t stackSize)
+    : body(std::move(body)), mapping(MAP_FAILED), mappingSize(0), started(false), finished(false) {
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    mappingSize = (stackSize + page - 1) / page * page + page;
+    mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping != MAP_FAILED) {
+        // Stacks grow down, so the guard page is the lowest one
+        mprotect(mapping, page, PROT_NONE);
+    }
+}
+
+Fiber::~Fiber() {
+    if (mapping != MAP_FAILED) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+// makecontext passes only ints, so the fiber to start is taken from running instead.
+void Fiber::start() {
+    Fiber* const fiber = running;
+    fiber->body();
+    fiber->finished = true;
+    // Returning would end the thread; the caller's context is where the fiber was resumed from
+    setcontext(&fiber->caller);
+}
+
+bool Fiber::resume() {
+    if (finished || mapping == MAP_FAILED) {
+        return false;
+    }
+    if (!started) {
+        getcontext(&context);
+        context.uc_stack.ss_sp = mapping;
+        context.uc_stack.ss_size = mappingSize;
+        context.uc_link = nullptr;
+        makecontext(&context, &Fiber::start, 0);
+        started = true;
+    }
+    Fiber* const outer = running;
+    running = this;
+    swapcontext(&caller, &context);
+    running = outer;
+    return true;
+}
+
+bool Fiber::isFinished() const {
+    return finished;
+}
+
+void Fiber::yield() {
+    Fiber* const fiber = running;
+    if (fiber != nullptr) {
+        swapcontext(&fiber->context, &fiber->caller);
+    }
+}
+
+Fiber* Fiber::current() {
+    return running;
+}
@@ -0,0 +1,175 @@
+#include "../include/guests.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+GuestInput::GuestInput(GuestScheduler& scheduler, const int fd, const bool pipe)
+    : scheduler(scheduler), fd(fd), pipe(pipe) {}
+
+GuestInput::~GuestInput() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+GuestInput::int_type GuestInput::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    // A named pipe reads as empty both before its writer opens it and after the writer closes it.
+    // Only the second is reported as a hang-up, and only that ends the input.
+    bool hungUp = false;
+    while (fd >= 0) {
+        const ssize_t done = read(fd, buffer, sizeof(buffer));
+        if (done > 0) {
+            setg(buffer, buffer, buffer + done);
+            return traits_type::to_int_type(*gptr());
+        }
+        const bool empty = done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (!empty && !(done == 0 && pipe && !hungUp)) {
+            break;
+        }
+        const unsigned int events = scheduler.waitForInput(fd);
+        if (events == 0) {
+            break;
+        }
+        hungUp = (events & (EPOLLHUP | EPOLLERR)) != 0;
+    }
+    return traits_type::eof();
+}
+
+// Guests yield from inside the interpreter, which calls back without a scheduler to hand.
+static void yieldGuest() {
+    Fiber::yield();
+}
+
+GuestScheduler::GuestScheduler(const unsigned int quantum, const size_t stackSize)
+    : quantum(quantum), stackSize(stackSize), reactor(epoll_create1(EPOLL_CLOEXEC)), current(nullptr) {}
+
+GuestScheduler::~GuestScheduler() {
+    if (reactor >= 0) {
+        close(reactor);
+    }
+}
+
+bool GuestScheduler::startGuest(Guest& guest, const BatchJob& job, std::string& error) {
+    int fd = -1;
+    bool pipe = false;
+    if (job.input != "-") {
+        fd = open(job.input.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            error = "Cannot open input " + job.input + "\n";
+            return false;
+        }
+        struct stat info;
+        pipe = fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+    }
+    guest.input = std::make_unique<GuestInput>(*this, fd, pipe);
+    guest.context = std::make_unique<GuestContext>();
+    GuestInput* const input = guest.input.get();
+    BatchResult* const result = &guest.result;
+    guest.fiber = std::make_unique<Fiber>([&job, input, result] {
+        *result = runBatchJob(job, input);
+    }, stackSize);
+    return true;
+}
+
+unsigned int GuestScheduler::waitForInput(const int fd) {
+    Guest* const guest = current;
+    if (guest == nullptr) {
+        return 0;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = guest;
+    if (epoll_ctl(reactor, guest->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0) {
+        return 0;
+    }
+    guest->registered = true;
+    guest->waiting = true;
+    Fiber::yield();
+    return guest->events;
+}
+
+bool GuestScheduler::waitForEvents(std::string& error) {
+    epoll_event events[64];
+    const int count = epoll_wait(reactor, events, 64, -1);
+    if (count < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        error = "the input reactor failed";
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        Guest* const guest = static_cast<Guest*>(events[i].data.ptr);
+        guest->events = events[i].events;
+        guest->waiting = false;
+        ready.push_back(guest);
+    }
+    return true;
+}
+
+bool GuestScheduler::run(const std::vector<BatchJob>& jobs, const std::vector<size_t>& indices,
+                         const std::function<void(size_t, const BatchResult&)>& done, std::string& error) {
+    if (reactor < 0) {
+        error = "cannot create the input reactor";
+        return false;
+    }
+    // Set first, so each context starts with a whole quantum
+    const bool guestMode = in_guest_mode();
+    set_guest_mode(true);
+    set_instruction_budget(quantum, yieldGuest);
+    std::vector<std::unique_ptr<Guest>> guests;
+    for (const size_t index : indices) {
+        std::unique_ptr<Guest> guest(new Guest{index, nullptr, nullptr, nullptr, BatchResult(), false, false, 0});
+        if (!startGuest(*guest, jobs[index], guest->result.errors)) {
+            guest->result.status = 2;
+            done(index, guest->result);
+            continue;
+        }
+        ready.push_back(guest.get());
+        guests.push_back(std::move(guest));
+    }
+
+    size_t running = guests.size();
+    bool ok = true;
+    while (running > 0) {
+        if (ready.empty()) {
+            if (!(ok = waitForEvents(error))) {
+                break;
+            }
+            continue;
+        }
+        Guest* const guest = ready.front();
+        ready.pop_front();
+        current = guest;
+        guest->context->swap();
+        const bool resumed = guest->fiber->resume();
+        guest->context->swap();
+        current = nullptr;
+        if (!resumed || guest->fiber->isFinished()) {
+            if (!resumed) {
+                guest->result.status = 2;
+                guest->result.errors = "Cannot map a stack for the guest\n";
+            }
+            done(guest->job, guest->result);
+            // The context holds the guest's memory and caches, and the fiber its stack
+            guest->fiber = nullptr;
+            guest->context = nullptr;
+            guest->input = nullptr;
+            running--;
+        } else if (!guest->waiting) {
+            ready.push_back(guest);
+        }
+    }
+    set_instruction_budget(0, nullptr);
+    set_guest_mode(guestMode);
+    return ok;
+}
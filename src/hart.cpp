@@ -0,0 +1,49 @@
+#include "../include/hart.h"
+
+#include <stdexcept>
+
+constexpr unsigned int HartConfig::MAX_HARTS;
+
+HartConfig::HartConfig() : harts(1), stackSize(16384) {}
+
+bool HartConfig::isValid(const unsigned int memorySize, std::string& error) const {
+    if (harts == 0 || harts > MAX_HARTS) {
+        error = "harts: between 1 and " + std::to_string(MAX_HARTS) + " harts";
+        return false;
+    }
+    if (stackSize < 8 || stackSize % 4 != 0) {
+        error = "harts: the stack size must be a multiple of 4 of at least 8 bytes";
+        return false;
+    }
+    if (static_cast<unsigned long long>(harts) * stackSize >= memorySize) {
+        error = "harts: the stacks do not fit in memory";
+        return false;
+    }
+    return true;
+}
+
+bool parseHartSpec(const std::string& text, HartConfig& config) {
+    const size_t colon = text.find(':');
+    HartConfig parsed = config;
+    try {
+        size_t used = 0;
+        const std::string harts = text.substr(0, colon);
+        parsed.harts = std::stoul(harts, &used);
+        if (used != harts.size()) {
+            return false;
+        }
+        if (colon != std::string::npos) {
+            const std::string stackSize = text.substr(colon + 1);
+            parsed.stackSize = std::stoul(stackSize, &used);
+            if (used != stackSize.size()) {
+                return false;
+            }
+        }
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+    config = parsed;
+    return true;
+}
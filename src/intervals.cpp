@@ -0,0 +1,436 @@
+#include "../include/intervals.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+IntervalConfig::IntervalConfig() : length(0), warmup(100000), jobs(0) {}
+
+static bool parseNumber(const std::string& text, unsigned int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used);
+        return used == text.size();
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+bool parseIntervalSpec(const std::string& text, IntervalConfig& config) {
+    IntervalConfig parsed = config;
+    const size_t first = text.find(':');
+    if (!parseNumber(text.substr(0, first), parsed.length) || parsed.length == 0) {
+        return false;
+    }
+    if (first != std::string::npos) {
+        const size_t second = text.find(':', first + 1);
+        if (!parseNumber(text.substr(first + 1, second - first - 1), parsed.warmup)) {
+            return false;
+        }
+        if (second != std::string::npos && !parseNumber(text.substr(second + 1), parsed.jobs)) {
+            return false;
+        }
+    }
+    config = parsed;
+    return true;
+}
+
+IntervalResult::IntervalResult() : memoryCycles(0) {}
+
+// Calls apply(field, value) for every count of total and the matching one of other.
+template <typename Apply>
+static void forEachCount(IntervalResult& total, const IntervalResult& other, Apply apply) {
+    apply(total.counters.instructions, other.counters.instructions);
+    apply(total.counters.execute, other.counters.execute);
+    apply(total.counters.fetch, other.counters.fetch);
+    apply(total.counters.data, other.counters.data);
+    apply(total.counters.branch, other.counters.branch);
+    apply(total.memoryCycles, other.memoryCycles);
+    for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+        CacheStats& stats = total.levels[level];
+        const CacheStats& added = other.levels[level];
+        apply(stats.hits, added.hits);
+        apply(stats.misses, added.misses);
+        apply(stats.cycles, added.cycles);
+        apply(stats.readHits, added.readHits);
+        apply(stats.readMisses, added.readMisses);
+        apply(stats.writeHits, added.writeHits);
+        apply(stats.writeMisses, added.writeMisses);
+        apply(stats.fetchHits, added.fetchHits);
+        apply(stats.fetchMisses, added.fetchMisses);
+        apply(stats.writebacks, added.writebacks);
+        apply(stats.evictions, added.evictions);
+        apply(stats.hitCycles, added.hitCycles);
+        apply(stats.missCycles, added.missCycles);
+        apply(stats.compulsoryMisses, added.compulsoryMisses);
+        apply(stats.capacityMisses, added.capacityMisses);
+        apply(stats.conflictMisses, added.conflictMisses);
+        apply(stats.noAllocateMisses, added.noAllocateMisses);
+    }
+}
+
+void IntervalResult::add(const IntervalResult& other) {
+    forEachCount(*this, other, [](auto& field, const auto value) {
+        field += value;
+    });
+}
+
+void IntervalResult::subtract(const IntervalResult& other) {
+    forEachCount(*this, other, [](auto& field, const auto value) {
+        field -= value;
+    });
+}
+
+void IntervalResult::addScaled(const IntervalResult& other, const double factor) {
+    forEachCount(*this, other, [factor](auto& field, const auto value) {
+        field += static_cast<std::remove_reference_t<decltype(field)>>(std::llround(value * factor));
+    });
+}
+
+bool readPipe(const int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t done = read(fd, bytes, size);
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool writePipe(const int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t done = write(fd, bytes, size);
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        size -= done;
+    }
+    return true;
+}
+
+BufferedInput::BufferedInput() : source(std::cin.rdbuf()), ended(false), feed(-1) {
+    std::cin.rdbuf(this);
+}
+
+BufferedInput::~BufferedInput() {
+    std::cin.rdbuf(source);
+    for (const int fd : feeds) {
+        close(fd);
+    }
+    if (feed >= 0) {
+        close(feed);
+    }
+}
+
+static bool sendAll(const int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t done = send(fd, data, size, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        size -= done;
+    }
+    return true;
+}
+
+// Reads what the source has ready, at least one byte, and passes it on to every feed.
+bool BufferedInput::readSource() {
+    if (ended) {
+        return false;
+    }
+    const int_type first = source->sbumpc();
+    if (traits_type::eq_int_type(first, traits_type::eof())) {
+        ended = true;
+        for (const int fd : feeds) {
+            shutdown(fd, SHUT_WR);
+        }
+        return false;
+    }
+    const size_t start = history.size();
+    history.push_back(traits_type::to_char_type(first));
+    while (source->in_avail() > 0) {
+        history.push_back(traits_type::to_char_type(source->sbumpc()));
+    }
+    // A child that has ended just misses out
+    for (const int fd : feeds) {
+        sendAll(fd, history.data() + start, history.size() - start);
+    }
+    return true;
+}
+
+// Takes what the parent has already sent, or else asks it for more and waits.
+bool BufferedInput::readFeed() {
+    char chunk[4096];
+    ssize_t done = recv(feed, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        const char request = 0;
+        if (!sendAll(feed, &request, 1)) {
+            return false;
+        }
+        do {
+            done = recv(feed, chunk, sizeof(chunk), 0);
+        } while (done < 0 && errno == EINTR);
+    }
+    if (done <= 0) {
+        return false;
+    }
+    history.append(chunk, done);
+    return true;
+}
+
+BufferedInput::int_type BufferedInput::underflow() {
+    const size_t position = gptr() - eback();
+    bool more = position < history.size();
+    while (!more && (feed >= 0 ? readFeed() : readSource())) {
+        more = position < history.size();
+    }
+    // The history may have moved as it grew
+    char* const base = &history[0];
+    setg(base, base + position, base + history.size());
+    return more ? traits_type::to_int_type(history[position]) : traits_type::eof();
+}
+
+bool BufferedInput::openFeed(int& parentEnd, int& childEnd) {
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+        return false;
+    }
+    if (ended) {
+        shutdown(ends[0], SHUT_WR);
+    }
+    feeds.push_back(ends[0]);
+    parentEnd = ends[0];
+    childEnd = ends[1];
+    return true;
+}
+
+void BufferedInput::followFeed(const int childEnd) {
+    for (const int fd : feeds) {
+        close(fd);
+    }
+    feeds.clear();
+    feed = childEnd;
+}
+
+void BufferedInput::closeFeed(const int parentEnd) {
+    feeds.erase(std::remove(feeds.begin(), feeds.end(), parentEnd), feeds.end());
+    close(parentEnd);
+}
+
+bool BufferedInput::serveFeed(const int parentEnd) {
+    char requests[64];
+    const ssize_t done = recv(parentEnd, requests, sizeof(requests), MSG_DONTWAIT);
+    if (done == 0) {
+        return false;
+    }
+    if (done < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    // At the end of the input the feeds are already shut down, which is the child's answer
+    readSource();
+    return true;
+}
+
+const std::string& BufferedInput::getHistory() const {
+    return history;
+}
+
+void BufferedInput::replay(const std::string& input) {
+    const size_t position = gptr() - eback();
+    history = input;
+    ended = true;
+    char* const base = &history[0];
+    setg(base, base + std::min(position, history.size()), base + history.size());
+}
+
+IntervalSimulation::IntervalSimulation(const IntervalConfig& config)
+    : config(config), jobs(config.jobs), nextFork(0), nextInterval(0), failed(0), child(false), resultPipe(-1),
+      measureFrom(0), measureTo(0) {
+    if (jobs == 0) {
+        jobs = std::thread::hardware_concurrency();
+    }
+    if (jobs == 0) {
+        jobs = 1;
+    }
+}
+
+IntervalSimulation::~IntervalSimulation() {
+    // Intervals left over by a run that ended on an invalid instruction
+    for (const Child& interval : running) {
+        kill(interval.pid, SIGKILL);
+        close(interval.results);
+        waitpid(interval.pid, nullptr, 0);
+    }
+}
+
+// Until the oldest interval reports, reads ahead for any interval that has run out of input. The
+// functional pass is stopped here, so it would not read that input itself.
+void IntervalSimulation::serveInput(const Child& oldest) {
+    std::vector<Child*> children;
+    for (Child& interval : running) {
+        children.push_back(&interval);
+    }
+    Child last = oldest;
+    children.push_back(&last);
+    while (true) {
+        std::vector<pollfd> ready = {pollfd{oldest.results, POLLIN, 0}};
+        std::vector<Child*> feeding;
+        for (Child* const interval : children) {
+            if (interval->input >= 0) {
+                ready.push_back(pollfd{interval->input, POLLIN, 0});
+                feeding.push_back(interval);
+            }
+        }
+        if (poll(ready.data(), ready.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (ready[0].revents != 0) {
+            break;
+        }
+        for (size_t i = 0; i < feeding.size(); i++) {
+            if (ready[i + 1].revents != 0 && !input.serveFeed(feeding[i]->input)) {
+                input.closeFeed(feeding[i]->input);
+                feeding[i]->input = -1;
+            }
+        }
+    }
+    if (last.input >= 0) {
+        input.closeFeed(last.input);
+    }
+}
+
+// Waits for the oldest interval; intervals are forked in order and take about as long as each other.
+void IntervalSimulation::collect() {
+    const Child oldest = running.front();
+    running.erase(running.begin());
+    serveInput(oldest);
+    IntervalResult result;
+    const bool reported = readPipe(oldest.results, &result, sizeof(result));
+    close(oldest.results);
+    int status = 0;
+    waitpid(oldest.pid, &status, 0);
+    if (reported && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        total.add(result);
+    } else {
+        failed++;
+    }
+}
+
+void IntervalSimulation::forkInterval(const unsigned long long retired) {
+    while (retired == nextFork) {
+        while (running.size() >= jobs) {
+            collect();
+        }
+        int results[2];
+        int feed = -1;
+        int childFeed = -1;
+        if (!input.openFeed(feed, childFeed)) {
+            failed++;
+        } else if (pipe(results) != 0) {
+            input.closeFeed(feed);
+            close(childFeed);
+            failed++;
+        } else {
+            std::cout.flush();
+            std::cerr.flush();
+            const pid_t pid = fork();
+            if (pid == 0) {
+                for (const Child& other : running) {
+                    close(other.results);
+                }
+                running.clear();
+                input.followFeed(childFeed);
+                close(results[0]);
+                resultPipe = results[1];
+                child = true;
+                measureFrom = static_cast<unsigned long long>(nextInterval) * config.length;
+                measureTo = measureFrom + config.length;
+                // Only the functional pass prints what the program outputs
+                std::cout.rdbuf(nullptr);
+                return;
+            }
+            close(results[1]);
+            close(childFeed);
+            if (pid < 0) {
+                close(results[0]);
+                input.closeFeed(feed);
+                failed++;
+            } else {
+                running.push_back(Child{pid, results[0], feed});
+            }
+        }
+        nextInterval++;
+        const unsigned long long start = static_cast<unsigned long long>(nextInterval) * config.length;
+        nextFork = start > config.warmup ? start - config.warmup : 0;
+    }
+}
+
+bool IntervalSimulation::startInterval(const unsigned long long retired) {
+    if (child || retired != nextFork) {
+        return false;
+    }
+    forkInterval(retired);
+    return child;
+}
+
+bool IntervalSimulation::startsMeasuring(const unsigned long long retired) const {
+    return child && retired == measureFrom;
+}
+
+bool IntervalSimulation::endsInterval(const unsigned long long retired) const {
+    return child && retired == measureTo;
+}
+
+bool IntervalSimulation::isChild() const {
+    return child;
+}
+
+void IntervalSimulation::report(const IntervalResult& result) {
+    _exit(writePipe(resultPipe, &result, sizeof(result)) ? 0 : 1);
+}
+
+bool IntervalSimulation::finish(IntervalResult& result, std::string& error) {
+    while (!running.empty()) {
+        collect();
+    }
+    result = total;
+    if (failed > 0) {
+        error = std::to_string(failed) + " of " + std::to_string(nextInterval) + " intervals did not report";
+        return false;
+    }
+    return true;
+}
+
+const IntervalConfig& IntervalSimulation::getConfig() const {
+    return config;
+}
+
+unsigned int IntervalSimulation::getJobs() const {
+    return jobs;
+}
+
+unsigned int IntervalSimulation::getIntervals() const {
+    return nextInterval;
+}
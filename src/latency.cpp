@@ -0,0 +1,80 @@
+#include "../include/latency.h"
+#include "../include/emu.h"
+
+#include <cctype>
+#include <stdexcept>
+
+static const char* const OPCODE_NAMES[] = {
+    nullptr, "JMP", "JMR", "BNZ", "BGT", "BLT", "BRZ", "MOV", "MOVI", "LDA", "STR", "LDR", "STB", "LDB",
+    "ISTR", "ILDR", "ISTB", "ILDB", "ADD", "ADDI", "SUB", "SUBI", "MUL", "MULI", "DIV", "SDIV", "DIVI",
+    "AND", "OR", "CMP", "CMPI", "TRP", "ALCI", "ALLC", "IALLC", "PSHR", "PSHB", "POPR", "POPB", "CALL", "RET",
+    "CAS", "FAA", "XCHG", "FENCE"};
+
+static const unsigned int NAMED_OPCODES = sizeof(OPCODE_NAMES) / sizeof(OPCODE_NAMES[0]);
+
+const char* opcodeName(const unsigned int opcode) {
+    return opcode < NAMED_OPCODES ? OPCODE_NAMES[opcode] : nullptr;
+}
+
+bool lookupOpcode(const std::string& mnemonic, unsigned int& opcode) {
+    std::string upper = mnemonic;
+    for (char& c : upper) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    for (unsigned int i = 1; i < NAMED_OPCODES; i++) {
+        if (upper == OPCODE_NAMES[i]) {
+            opcode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+constexpr unsigned int LatencyTable::OPCODES;
+
+LatencyTable::LatencyTable() {
+    for (unsigned int& latency : cycles) {
+        latency = 1;
+    }
+    cycles[MUL] = 3;
+    cycles[MULI] = 3;
+    cycles[DIV] = 12;
+    cycles[SDIV] = 12;
+    cycles[DIVI] = 12;
+}
+
+unsigned int LatencyTable::operator[](const unsigned int opcode) const {
+    return opcode < OPCODES ? cycles[opcode] : 1;
+}
+
+void LatencyTable::set(const unsigned int opcode, const unsigned int latency) {
+    if (opcode < OPCODES) {
+        cycles[opcode] = latency;
+    }
+}
+
+bool LatencyTable::parse(const std::string& spec) {
+    const size_t equals = spec.find('=');
+    unsigned int opcode;
+    if (equals == std::string::npos || !lookupOpcode(spec.substr(0, equals), opcode)) {
+        return false;
+    }
+    const std::string value = spec.substr(equals + 1);
+    try {
+        size_t parsed = 0;
+        const unsigned long latency = std::stoul(value, &parsed);
+        if (parsed != value.size() || value[0] == '-') {
+            return false;
+        }
+        cycles[opcode] = static_cast<unsigned int>(latency);
+        return true;
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+unsigned long long CycleCounters::total() const {
+    return execute + fetch + data + branch;
+}
@@ -0,0 +1,101 @@
+#include "../include/memory_timing.h"
+
+MemoryTimingStats::MemoryTimingStats() : transfers(0), rowHits(0), rowMisses(0), rowEmpty(0) {}
+
+bool parseMemoryTimingType(const std::string& text, MemoryTimingType& type) {
+    if (text == "flat") {
+        type = MemoryTimingType::FLAT;
+    } else if (text == "banked") {
+        type = MemoryTimingType::BANKED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void MemoryTimingModel::endStream() {}
+
+void MemoryTimingModel::reset() {
+    stats = MemoryTimingStats();
+}
+
+const MemoryTimingStats& MemoryTimingModel::getStats() const {
+    return stats;
+}
+
+FlatMemoryTiming::FlatMemoryTiming(const unsigned int firstAccessCycles, const unsigned int burstCycles)
+    : firstAccessCycles(firstAccessCycles), burstCycles(burstCycles), streaming(false) {}
+
+// The first word of a block pays the full access latency, the rest stream in behind it.
+unsigned int FlatMemoryTiming::transfer(const unsigned int /*address*/, const unsigned int size, const bool /*write*/) {
+    const unsigned int words = (size + 3) / 4;
+    stats.transfers++;
+    return firstAccessCycles + burstCycles * (words - 1);
+}
+
+unsigned int FlatMemoryTiming::uncachedAccess(const unsigned int /*address*/, const unsigned int /*size*/,
+                                              const bool /*write*/) {
+    stats.transfers++;
+    if (streaming) {
+        return burstCycles;
+    }
+    streaming = true;
+    return firstAccessCycles;
+}
+
+void FlatMemoryTiming::endStream() {
+    streaming = false;
+}
+
+MemoryTimingType FlatMemoryTiming::getType() const {
+    return MemoryTimingType::FLAT;
+}
+
+void FlatMemoryTiming::reset() {
+    MemoryTimingModel::reset();
+    streaming = false;
+}
+
+constexpr unsigned int BankedDramTiming::CLOSED;
+
+BankedDramTiming::BankedDramTiming(const unsigned int banks, const unsigned int rowSize, const unsigned int rowHitCycles,
+                                   const unsigned int rowMissCycles, const unsigned int prechargeCycles,
+                                   const unsigned int burstCycles, const bool openPage)
+    : rowSize(rowSize), rowHitCycles(rowHitCycles), rowMissCycles(rowMissCycles), prechargeCycles(prechargeCycles),
+      burstCycles(burstCycles), openPage(openPage), openRows(banks, CLOSED) {}
+
+unsigned int BankedDramTiming::transfer(const unsigned int address, const unsigned int size, const bool /*write*/) {
+    const unsigned int row = address / rowSize;
+    unsigned int& openRow = openRows[row % openRows.size()];
+    const unsigned int words = (size + 3) / 4;
+
+    unsigned int cycles;
+    if (openRow == row) {
+        stats.rowHits++;
+        cycles = rowHitCycles;
+    } else if (openRow == CLOSED) {
+        stats.rowEmpty++;
+        cycles = rowMissCycles - prechargeCycles;
+    } else {
+        stats.rowMisses++;
+        cycles = rowMissCycles;
+    }
+    openRow = openPage ? row : CLOSED;
+    stats.transfers++;
+    return cycles + burstCycles * (words - 1);
+}
+
+unsigned int BankedDramTiming::uncachedAccess(const unsigned int address, const unsigned int size, const bool write) {
+    return transfer(address, size, write);
+}
+
+MemoryTimingType BankedDramTiming::getType() const {
+    return MemoryTimingType::BANKED;
+}
+
+void BankedDramTiming::reset() {
+    MemoryTimingModel::reset();
+    for (unsigned int& row : openRows) {
+        row = CLOSED;
+    }
+}
@@ -0,0 +1,88 @@
+#include "../include/miss_classifier.h"
+
+constexpr unsigned int ShadowLRU::NIL;
+
+ShadowLRU::ShadowLRU(const unsigned int capacity) : nodes(capacity), head(NIL), tail(NIL), used(0) {
+    index.reserve(capacity * 2);
+}
+
+void ShadowLRU::unlink(const unsigned int node) {
+    const Node& n = nodes[node];
+    if (n.prev != NIL) {
+        nodes[n.prev].next = n.next;
+    } else {
+        head = n.next;
+    }
+    if (n.next != NIL) {
+        nodes[n.next].prev = n.prev;
+    } else {
+        tail = n.prev;
+    }
+}
+
+void ShadowLRU::pushFront(const unsigned int node) {
+    nodes[node].prev = NIL;
+    nodes[node].next = head;
+    if (head != NIL) {
+        nodes[head].prev = node;
+    }
+    head = node;
+    if (tail == NIL) {
+        tail = node;
+    }
+}
+
+bool ShadowLRU::access(const unsigned int block) {
+    const std::unordered_map<unsigned int, unsigned int>::iterator it = index.find(block);
+    if (it != index.end()) {
+        if (it->second != head) {
+            unlink(it->second);
+            pushFront(it->second);
+        }
+        return true;
+    }
+
+    unsigned int node;
+    if (used < nodes.size()) {
+        node = used++;
+    } else {
+        node = tail;
+        unlink(node);
+        index.erase(nodes[node].block);
+    }
+    nodes[node].block = block;
+    pushFront(node);
+    index[block] = node;
+    return false;
+}
+
+void ShadowLRU::reset() {
+    index.clear();
+    head = NIL;
+    tail = NIL;
+    used = 0;
+}
+
+MissClassifier::MissClassifier(const unsigned int lines) : shadow(lines) {}
+
+MissClass MissClassifier::access(const unsigned int block, const bool hit) {
+    const bool shadowHit = shadow.access(block);
+    if (block >= touched.size()) {
+        touched.resize(block + block / 2 + 1, false);
+    }
+    const bool firstTouch = !touched[block];
+    touched[block] = true;
+
+    if (hit) {
+        return MissClass::HIT;
+    }
+    if (firstTouch) {
+        return MissClass::COMPULSORY;
+    }
+    return shadowHit ? MissClass::CONFLICT : MissClass::CAPACITY;
+}
+
+void MissClassifier::reset() {
+    touched.clear();
+    shadow.reset();
+}
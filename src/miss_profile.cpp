@@ -0,0 +1,137 @@
+#include "../include/miss_profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+MissProfile::MissProfile(const unsigned int capacity) : count(0) {
+    unsigned int size = 16;
+    while (size < capacity) {
+        size *= 2;
+    }
+    table.resize(size);
+    used.assign(size, false);
+}
+
+// Instructions are 8 byte aligned, so drop those bits before the multiplicative hash.
+unsigned int MissProfile::slotOf(const unsigned int pc) const {
+    const unsigned int mask = static_cast<unsigned int>(table.size()) - 1;
+    unsigned int slot = ((pc >> 3) * 2654435761u) & mask;
+    while (used[slot] && table[slot].pc != pc) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void MissProfile::grow() {
+    std::vector<MissRecord> oldTable;
+    std::vector<bool> oldUsed;
+    oldTable.swap(table);
+    oldUsed.swap(used);
+
+    table.resize(oldTable.size() * 2);
+    used.assign(table.size(), false);
+    for (size_t i = 0; i < oldTable.size(); i++) {
+        if (oldUsed[i]) {
+            const unsigned int slot = slotOf(oldTable[i].pc);
+            table[slot] = oldTable[i];
+            used[slot] = true;
+        }
+    }
+}
+
+void MissProfile::record(const unsigned int pc, const unsigned int misses, const unsigned int writebacks,
+                         const unsigned int cycles) {
+    unsigned int slot = slotOf(pc);
+    if (!used[slot]) {
+        if ((count + 1) * 4 > table.size() * 3) {
+            grow();
+            slot = slotOf(pc);
+        }
+        used[slot] = true;
+        table[slot] = MissRecord{pc, 0, 0, 0};
+        count++;
+    }
+    table[slot].misses += misses;
+    table[slot].writebacks += writebacks;
+    table[slot].cycles += cycles;
+}
+
+std::vector<MissRecord> MissProfile::top(const unsigned int n) const {
+    std::vector<MissRecord> records;
+    records.reserve(count);
+    for (size_t i = 0; i < table.size(); i++) {
+        if (used[i]) {
+            records.push_back(table[i]);
+        }
+    }
+
+    const auto hotter = [](const MissRecord& a, const MissRecord& b) {
+        if (a.misses != b.misses) {
+            return a.misses > b.misses;
+        }
+        if (a.cycles != b.cycles) {
+            return a.cycles > b.cycles;
+        }
+        return a.pc < b.pc;
+    };
+    const size_t keep = std::min<size_t>(n, records.size());
+    std::partial_sort(records.begin(), records.begin() + keep, records.end(), hotter);
+    records.resize(keep);
+    return records;
+}
+
+unsigned int MissProfile::size() const {
+    return count;
+}
+
+void MissProfile::reset() {
+    used.assign(table.size(), false);
+    count = 0;
+}
+
+bool SymbolTable::load(const std::string& path, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        unsigned int address;
+        std::string label;
+        if (!(fields >> address)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            error = path + ":" + std::to_string(lineNumber) + ": expected <address> <label>";
+            return false;
+        }
+        if (!(fields >> label)) {
+            error = path + ":" + std::to_string(lineNumber) + ": expected <address> <label>";
+            return false;
+        }
+        labels[address] = label;
+    }
+    return true;
+}
+
+bool SymbolTable::empty() const {
+    return labels.empty();
+}
+
+std::string SymbolTable::resolve(const unsigned int address) const {
+    std::map<unsigned int, std::string>::const_iterator it = labels.upper_bound(address);
+    if (it == labels.begin()) {
+        return "";
+    }
+    --it;
+    if (it->first == address) {
+        return it->second;
+    }
+    return it->second + "+" + std::to_string(address - it->first);
+}
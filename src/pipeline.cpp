@@ -0,0 +1,255 @@
+#include "../include/pipeline.h"
+#include "../include/emu.h"
+
+#include <algorithm>
+
+bool parsePipelineMode(const std::string& text, PipelineMode& mode) {
+    if (text == "off") {
+        mode = PipelineMode::OFF;
+    } else if (text == "forwarding") {
+        mode = PipelineMode::FORWARDING;
+    } else if (text == "no-forwarding") {
+        mode = PipelineMode::NO_FORWARDING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* pipelineModeName(const PipelineMode mode) {
+    switch (mode) {
+        case PipelineMode::FORWARDING:
+            return "forwarding";
+        case PipelineMode::NO_FORWARDING:
+            return "no-forwarding";
+        default:
+            return "off";
+    }
+}
+
+constexpr unsigned int PipelineInstruction::MAX_SOURCES;
+constexpr unsigned int PipelineInstruction::MAX_DESTINATIONS;
+
+PipelineInstruction::PipelineInstruction()
+    : sources{}, sourceCount(0), destinations{}, destinationCount(0), load(false), fetchCycles(1), executeCycles(1),
+      memoryCycles(0), redirect(false) {}
+
+void PipelineInstruction::addSource(const unsigned int reg) {
+    if (sourceCount < MAX_SOURCES) {
+        sources[sourceCount++] = reg;
+    }
+}
+
+void PipelineInstruction::addDestination(const unsigned int reg) {
+    if (destinationCount < MAX_DESTINATIONS) {
+        destinations[destinationCount++] = reg;
+    }
+}
+
+void describeInstruction(const unsigned int opcode, const unsigned int operand1, const unsigned int operand2,
+                         const unsigned int operand3, const unsigned int immediate, PipelineInstruction& instruction) {
+    switch (opcode) {
+        case JMR:
+        case BNZ:
+        case BGT:
+        case BLT:
+        case BRZ:
+        case STR:
+        case STB:
+            instruction.addSource(operand1);
+            break;
+
+        case MOV:
+        case ADDI:
+        case SUBI:
+        case MULI:
+        case DIVI:
+        case CMPI:
+            instruction.addSource(operand2);
+            instruction.addDestination(operand1);
+            break;
+
+        case MOVI:
+        case LDA:
+            instruction.addDestination(operand1);
+            break;
+
+        case LDR:
+        case LDB:
+            instruction.addDestination(operand1);
+            instruction.load = true;
+            break;
+
+        case ISTR:
+        case ISTB:
+            instruction.addSource(operand1);
+            instruction.addSource(operand2);
+            break;
+
+        case ILDR:
+        case ILDB:
+            instruction.addSource(operand2);
+            instruction.addDestination(operand1);
+            instruction.load = true;
+            break;
+
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case SDIV:
+        case AND:
+        case OR:
+        case CMP:
+            instruction.addSource(operand2);
+            instruction.addSource(operand3);
+            instruction.addDestination(operand1);
+            break;
+
+        case TRP:
+            // Traps pass their argument and result in R3
+            instruction.addSource(R3);
+            if (immediate == INT_IN || immediate == CHAR_IN) {
+                instruction.addDestination(R3);
+            }
+            break;
+
+        case ALCI:
+        case ALLC:
+            instruction.addSource(HP);
+            instruction.addDestination(operand1);
+            instruction.addDestination(HP);
+            instruction.load = opcode == ALLC;
+            break;
+
+        case IALLC:
+            instruction.addSource(operand2);
+            instruction.addSource(HP);
+            instruction.addDestination(operand1);
+            instruction.addDestination(HP);
+            instruction.load = true;
+            break;
+
+        case PSHR:
+        case PSHB:
+            instruction.addSource(operand1);
+            instruction.addSource(SP);
+            instruction.addDestination(SP);
+            break;
+
+        case POPR:
+        case POPB:
+            instruction.addSource(SP);
+            instruction.addDestination(operand1);
+            instruction.addDestination(SP);
+            instruction.load = true;
+            break;
+
+        case CALL:
+            instruction.addSource(SP);
+            instruction.addDestination(SP);
+            break;
+
+        case RET:
+            instruction.addSource(SP);
+            instruction.addDestination(SP);
+            instruction.load = true;
+            break;
+
+        case CAS:
+        case FAA:
+            instruction.addSource(operand1);
+            instruction.addSource(operand2);
+            instruction.addSource(operand3);
+            instruction.addDestination(operand1);
+            instruction.load = true;
+            break;
+
+        case XCHG:
+            instruction.addSource(operand1);
+            instruction.addSource(operand2);
+            instruction.addDestination(operand1);
+            instruction.load = true;
+            break;
+
+        default:
+            break;
+    }
+}
+
+PipelineStats::PipelineStats() : instructions(0), cycles(0), rawStalls(0), loadUseStalls(0), flushCycles(0), busy{} {}
+
+constexpr unsigned int PipelineModel::REGISTERS;
+
+PipelineModel::PipelineModel(const bool forwarding) : forwarding(forwarding) {
+    reset();
+}
+
+void PipelineModel::issue(const PipelineInstruction& instruction) {
+    const unsigned int latency[PIPELINE_STAGES] = {
+        std::max(1u, instruction.fetchCycles), 1, std::max(1u, instruction.executeCycles),
+        std::max(1u, instruction.memoryCycles), 1};
+    // When the instruction ahead left each stage, i.e. entered the next one
+    const unsigned long long aheadLeft[PIPELINE_STAGES] = {start[STAGE_ID], start[STAGE_EX], start[STAGE_MEM],
+                                                           start[STAGE_WB], end[STAGE_WB]};
+
+    unsigned long long operandsReady = 0;
+    bool waitsOnLoad = false;
+    for (unsigned int i = 0; i < instruction.sourceCount; i++) {
+        const unsigned int reg = instruction.sources[i];
+        if (reg < REGISTERS && ready[reg] > operandsReady) {
+            operandsReady = ready[reg];
+            waitsOnLoad = readyFromLoad[reg];
+        }
+    }
+
+    for (unsigned int stage = STAGE_IF; stage < PIPELINE_STAGES; stage++) {
+        const unsigned long long previous = stage == STAGE_IF ? 0 : end[stage - 1];
+        unsigned long long begin = std::max(previous, aheadLeft[stage]);
+        if (stage == STAGE_IF && fetchResume > begin) {
+            stats.flushCycles += fetchResume - begin;
+            begin = fetchResume;
+        }
+        if (stage == STAGE_EX && operandsReady > begin) {
+            stats.rawStalls += operandsReady - begin;
+            stats.loadUseStalls += waitsOnLoad ? operandsReady - begin : 0;
+            begin = operandsReady;
+        }
+        start[stage] = begin;
+        end[stage] = begin + latency[stage];
+        stats.busy[stage] += latency[stage];
+    }
+
+    const unsigned long long resultReady = !forwarding ? end[STAGE_WB]
+                                           : instruction.load ? end[STAGE_MEM] : end[STAGE_EX];
+    for (unsigned int i = 0; i < instruction.destinationCount; i++) {
+        const unsigned int reg = instruction.destinations[i];
+        if (reg < REGISTERS) {
+            ready[reg] = resultReady;
+            readyFromLoad[reg] = instruction.load;
+        }
+    }
+    if (instruction.redirect) {
+        fetchResume = end[STAGE_EX];
+    }
+
+    stats.instructions++;
+    stats.cycles = end[STAGE_WB];
+}
+
+bool PipelineModel::isForwarding() const {
+    return forwarding;
+}
+
+const PipelineStats& PipelineModel::getStats() const {
+    return stats;
+}
+
+void PipelineModel::reset() {
+    std::fill(start, start + PIPELINE_STAGES, 0);
+    std::fill(end, end + PIPELINE_STAGES, 0);
+    std::fill(ready, ready + REGISTERS, 0);
+    std::fill(readyFromLoad, readyFromLoad + REGISTERS, false);
+    fetchResume = 0;
+    stats = PipelineStats();
+}
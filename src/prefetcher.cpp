@@ -0,0 +1,140 @@
+#include "../include/prefetcher.h"
+
+#include <stdexcept>
+
+constexpr unsigned char StridePrefetcher::CONFIDENT;
+constexpr unsigned char StridePrefetcher::MAX_CONFIDENCE;
+
+PrefetchStats::PrefetchStats() : issued(0), useful(0), late(0), polluting(0) {}
+
+NextLinePrefetcher::NextLinePrefetcher(const unsigned int degree, const unsigned int distance, const unsigned int blockSize)
+    : degree(degree), distance(distance), blockSize(blockSize) {}
+
+void NextLinePrefetcher::onAccess(const unsigned int address, const unsigned int /*pc*/, const bool miss, const bool firstUse,
+                                  std::vector<unsigned int>& candidates) {
+    if (!miss && !firstUse) {
+        return;
+    }
+    const unsigned int block = address - address % blockSize;
+    for (unsigned int i = 0; i < degree; i++) {
+        candidates.push_back(block + (distance + i) * blockSize);
+    }
+}
+
+void NextLinePrefetcher::reset() {}
+
+std::string NextLinePrefetcher::getName() const {
+    return "Next Line";
+}
+
+StridePrefetcher::StridePrefetcher(const unsigned int degree, const unsigned int distance, const unsigned int tableSize)
+    : degree(degree), distance(distance), table(tableSize) {
+    reset();
+}
+
+void StridePrefetcher::onAccess(const unsigned int address, const unsigned int pc, const bool /*miss*/, const bool /*firstUse*/,
+                                std::vector<unsigned int>& candidates) {
+    // Instructions are 8 bytes long, so the low bits of the PC carry no information.
+    Entry& entry = table[(pc / 8) % table.size()];
+    if (!entry.valid || entry.pc != pc) {
+        entry.valid = true;
+        entry.pc = pc;
+        entry.lastAddress = address;
+        entry.stride = 0;
+        entry.confidence = 0;
+        return;
+    }
+
+    const int stride = static_cast<int>(address - entry.lastAddress);
+    entry.lastAddress = address;
+    if (stride == entry.stride) {
+        if (entry.confidence < MAX_CONFIDENCE) {
+            entry.confidence++;
+        }
+    } else {
+        if (entry.confidence > 0) {
+            entry.confidence--;
+        }
+        if (entry.confidence == 0) {
+            entry.stride = stride;
+        }
+    }
+
+    if (entry.stride == 0 || entry.confidence < CONFIDENT) {
+        return;
+    }
+    for (unsigned int i = 0; i < degree; i++) {
+        candidates.push_back(address + static_cast<unsigned int>(entry.stride) * (distance + i));
+    }
+}
+
+void StridePrefetcher::reset() {
+    for (Entry& entry : table) {
+        entry.valid = false;
+        entry.pc = 0;
+        entry.lastAddress = 0;
+        entry.stride = 0;
+        entry.confidence = 0;
+    }
+}
+
+std::string StridePrefetcher::getName() const {
+    return "Stride";
+}
+
+// Accepts none, next-line or stride, optionally followed by :<degree> and :<distance>.
+bool parsePrefetchSpec(const std::string& text, PrefetchType& type, unsigned int& degree, unsigned int& distance) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        const size_t end = text.find(':', start);
+        fields.push_back(text.substr(start, end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (fields.size() > 3) {
+        return false;
+    }
+
+    unsigned int values[2] = {degree, distance};
+    for (size_t i = 1; i < fields.size(); i++) {
+        try {
+            size_t parsed = 0;
+            values[i - 1] = std::stoul(fields[i], &parsed);
+            if (parsed != fields[i].size() || values[i - 1] == 0) {
+                return false;
+            }
+        } catch (std::invalid_argument&) {
+            return false;
+        } catch (std::out_of_range&) {
+            return false;
+        }
+    }
+
+    if (fields[0] == "none") {
+        type = PrefetchType::NONE;
+    } else if (fields[0] == "next-line") {
+        type = PrefetchType::NEXT_LINE;
+    } else if (fields[0] == "stride") {
+        type = PrefetchType::STRIDE;
+    } else {
+        return false;
+    }
+    degree = values[0];
+    distance = values[1];
+    return true;
+}
+
+std::unique_ptr<Prefetcher> createPrefetcher(const PrefetchType type, const unsigned int degree,
+                                             const unsigned int distance, const unsigned int blockSize) {
+    switch (type) {
+        case PrefetchType::NEXT_LINE:
+            return std::make_unique<NextLinePrefetcher>(degree, distance, blockSize);
+        case PrefetchType::STRIDE:
+            return std::make_unique<StridePrefetcher>(degree, distance);
+        default:
+            return nullptr;
+    }
+}
@@ -0,0 +1,334 @@
+#include <cstring>
+
+#include "../include/batch.h"
+#include "../include/batch_workers.h"
+#include "../include/work_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+static const char* USAGE =
+    " <manifest> [-j threads] [-T timeout_seconds] [-g golden_dir] [-a assembler] [-b build_dir] [-u]\n";
+
+// What a job is checked against: its exit status and counts on the first line, then everything
+// it printed, byte for byte.
+struct Golden {
+    int status;
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long memoryCycles;
+    std::string output;
+};
+
+static bool parseNumber(const char* text, unsigned int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used);
+        return text[used] == '\0';
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::string directoryOf(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// A job is named after its program, with -2, -3 and so on for the programs listed more than once.
+static std::vector<std::string> jobNames(const std::vector<BatchJob>& jobs) {
+    std::vector<std::string> names;
+    std::map<std::string, unsigned int> seen;
+    for (const BatchJob& job : jobs) {
+        std::string name = job.program.substr(job.program.rfind('/') + 1);
+        name = name.substr(0, name.rfind('.'));
+        const unsigned int count = ++seen[name];
+        names.push_back(count == 1 ? name : name + "-" + std::to_string(count));
+    }
+    return names;
+}
+
+static bool copyFile(const std::string& from, const std::string& to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    out << in.rdbuf();
+    return in && out;
+}
+
+// The assembler writes the image next to its source, so each source is copied into the build
+// directory first and the checkout is left alone. Any image left from an earlier run is removed,
+// so a source that no longer assembles cannot pass on a stale one. Each source is assembled once,
+// however many jobs run it, and all of them at the same time.
+static bool assemblePrograms(std::vector<BatchJob>& jobs, const std::string& assembler, const std::string& build_dir,
+                             const unsigned int threads) {
+    std::vector<std::string> sources;
+    for (const BatchJob& job : jobs) {
+        if (endsWith(job.program, ".asm")) {
+            sources.push_back(job.program);
+        }
+    }
+    std::sort(sources.begin(), sources.end());
+    sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+    // Numbered, since sources in different directories can share a name
+    std::vector<std::string> copies;
+    for (size_t index = 0; index < sources.size(); index++) {
+        const std::string name = sources[index].substr(sources[index].rfind('/') + 1);
+        copies.push_back(build_dir + "/" + std::to_string(index) + "-" + name);
+        unlink((copies.back().substr(0, copies.back().size() - 4) + ".bin").c_str());
+        if (!copyFile(sources[index], copies.back())) {
+            std::cerr << "Cannot copy " << sources[index] << " to " << build_dir << "\n";
+            return false;
+        }
+    }
+    for (BatchJob& job : jobs) {
+        if (endsWith(job.program, ".asm")) {
+            const size_t index = std::lower_bound(sources.begin(), sources.end(), job.program) - sources.begin();
+            job.program = copies[index].substr(0, copies[index].size() - 4) + ".bin";
+        }
+    }
+
+    std::vector<int> statuses(sources.size(), 0);
+    WorkStealingPool pool(threads);
+    pool.run(sources.size(), [&](const size_t index) {
+        std::vector<std::string> arguments = {"python3", assembler, copies[index]};
+        std::vector<char*> argv;
+        for (std::string& argument : arguments) {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+        pid_t pid;
+        int status = 0;
+        if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0 ||
+            waitpid(pid, &status, 0) != pid) {
+            statuses[index] = -1;
+            return;
+        }
+        statuses[index] = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    });
+
+    bool assembled = true;
+    for (size_t index = 0; index < sources.size(); index++) {
+        if (statuses[index] != 0) {
+            std::cerr << "Cannot assemble " << sources[index] << "\n";
+            assembled = false;
+        }
+    }
+    return assembled;
+}
+
+// Removes a temporary build directory with the copies and images in it.
+static void removeBuildDirectory(const std::string& build_dir) {
+    DIR* const directory = opendir(build_dir.c_str());
+    if (directory != nullptr) {
+        while (const dirent* entry = readdir(directory)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                unlink((build_dir + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(directory);
+    }
+    rmdir(build_dir.c_str());
+}
+
+static bool loadGolden(const std::string& path, Golden& golden) {
+    std::ifstream file(path, std::ios::binary);
+    std::string header;
+    if (!std::getline(file, header)) {
+        return false;
+    }
+    std::istringstream fields(header);
+    std::string hash, status, instructions, cycles, memoryCycles;
+    if (!(fields >> hash >> status >> golden.status >> instructions >> golden.instructions >> cycles >>
+          golden.cycles >> memoryCycles >> golden.memoryCycles) ||
+        hash != "#" || status != "status" || instructions != "instructions" || cycles != "cycles" ||
+        memoryCycles != "memory_cycles") {
+        return false;
+    }
+    std::ostringstream output;
+    output << file.rdbuf();
+    golden.output = output.str();
+    return true;
+}
+
+static bool writeGolden(const std::string& path, const BatchResult& result) {
+    std::ofstream file(path, std::ios::binary);
+    file << "# status " << result.status << " instructions " << result.instructions << " cycles " << result.cycles
+         << " memory_cycles " << result.memoryCycles << "\n"
+         << result.output;
+    return static_cast<bool>(file);
+}
+
+static std::string lineAt(const std::string& text, const size_t start) {
+    const size_t end = text.find('\n', start);
+    return text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// Every way the result differs from the golden file, one per line.
+static std::string compareWithGolden(const Golden& golden, const BatchResult& result) {
+    std::ostringstream differences;
+    const auto count = [&](const char* name, const unsigned long long expected, const unsigned long long actual) {
+        if (expected != actual) {
+            differences << "    " << name << ": expected " << expected << ", got " << actual << "\n";
+        }
+    };
+    count("status", static_cast<unsigned long long>(golden.status), static_cast<unsigned long long>(result.status));
+    count("instructions", golden.instructions, result.instructions);
+    count("cycles", golden.cycles, result.cycles);
+    count("memory cycles", golden.memoryCycles, result.memoryCycles);
+    if (golden.output != result.output) {
+        const auto mismatch = std::mismatch(golden.output.begin(),
+                                            golden.output.begin() + std::min(golden.output.size(), result.output.size()),
+                                            result.output.begin());
+        const size_t at = mismatch.first - golden.output.begin();
+        const size_t lineStart = at == 0 ? 0 : golden.output.rfind('\n', at - 1) + 1;
+        const size_t line = std::count(golden.output.begin(), golden.output.begin() + lineStart, '\n') + 1;
+        differences << "    output line " << line << ": expected \"" << lineAt(golden.output, lineStart)
+                    << "\", got \"" << lineAt(result.output, lineStart) << "\"\n";
+    }
+    if (result.status != 0 && !result.errors.empty() && golden.status != result.status) {
+        differences << "    errors: " << lineAt(result.errors, 0) << "\n";
+    }
+    return differences.str();
+}
+
+int main(const int argc, char* argv[]) {
+    std::string manifest_path;
+    std::string golden_dir;
+    std::string assembler = "assembler/asm.py";
+    std::string build_dir;
+    unsigned int threads = 0;
+    unsigned int timeout = 0;
+    bool update = false;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-T") == 0) && hasValue) {
+            unsigned int& target = argv[i][1] == 'j' ? threads : timeout;
+            if (!parseNumber(argv[++i], target)) {
+                std::cerr << "Invalid number " << argv[i] << ". Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-g") == 0 && hasValue) {
+            golden_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-a") == 0 && hasValue) {
+            assembler = argv[++i];
+        }
+        else if (strcmp(argv[i], "-b") == 0 && hasValue) {
+            build_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-u") == 0) {
+            update = true;
+        }
+        else if (argv[i][0] == '-' || !manifest_path.empty()) {
+            std::cerr << "Usage: " << argv[0] << USAGE;
+            return 1;
+        }
+        else {
+            manifest_path = argv[i];
+        }
+    }
+
+    if (manifest_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << USAGE;
+        return 1;
+    }
+    if (golden_dir.empty()) {
+        golden_dir = directoryOf(manifest_path) + "/golden";
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string error;
+    if (!loadBatchManifest(manifest_path, jobs, error)) {
+        std::cerr << "Invalid manifest: " << error << ". Aborting.\n";
+        return 2;
+    }
+    const std::vector<std::string> names = jobNames(jobs);
+
+    // Without -b the images go to a directory of their own that is removed afterwards
+    const bool temporary = build_dir.empty();
+    if (temporary) {
+        char path[] = "/tmp/emu-regressXXXXXX";
+        if (mkdtemp(path) == nullptr) {
+            std::cerr << "Cannot create a build directory. Aborting.\n";
+            return 2;
+        }
+        build_dir = path;
+    } else if (mkdir(build_dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        std::cerr << "Cannot create " << build_dir << ". Aborting.\n";
+        return 2;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool assembled = assemblePrograms(jobs, assembler, build_dir, threads);
+    std::vector<BatchResult> results;
+    size_t worker_count = 0;
+    const bool ran = assembled && runOnWorkers(jobs, threads, timeout, 0, results, worker_count);
+    if (temporary) {
+        removeBuildDirectory(build_dir);
+    }
+    if (!assembled) {
+        std::cerr << "Aborting.\n";
+        return 2;
+    }
+    if (!ran) {
+        std::cerr << "Cannot start a worker process. Aborting.\n";
+        return 2;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0;
+    size_t slowest = 0;
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    std::cout << std::fixed << std::setprecision(3);
+    for (size_t index = 0; index < jobs.size(); index++) {
+        const BatchResult& result = results[index];
+        const std::string path = golden_dir + "/" + names[index] + ".out";
+        std::string verdict = "PASS";
+        std::string differences;
+        Golden golden;
+        if (update) {
+            verdict = writeGolden(path, result) ? "UPDATED" : "UNWRITTEN";
+        } else if (!loadGolden(path, golden)) {
+            verdict = "NO GOLDEN";
+            differences = "    cannot read " + path + "\n";
+        } else {
+            differences = compareWithGolden(golden, result);
+            verdict = differences.empty() ? "PASS" : "FAIL";
+        }
+        failed += verdict != "PASS" && verdict != "UPDATED" ? 1 : 0;
+        slowest = result.seconds > results[slowest].seconds ? index : slowest;
+        std::cout << std::left << std::setw(10) << verdict << std::setw(24) << names[index] << std::right
+                  << std::setw(10) << result.seconds << " s\n"
+                  << differences;
+    }
+    std::cout.flags(flags);
+
+    std::cerr << "Ran " << jobs.size() << " programs, " << failed << " failed, in " << seconds << " s on "
+              << worker_count << " workers";
+    if (!jobs.empty()) {
+        std::cerr << "; the slowest, " << names[slowest] << ", took " << results[slowest].seconds << " s";
+    }
+    std::cerr << "\n";
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "../include/replacement.h"
+
+#include <stdexcept>
+
+LRUPolicy::LRUPolicy(const unsigned int sets, const unsigned int ways) : ways(ways), clock(0), stamps(sets * ways) {
+    reset();
+}
+
+void LRUPolicy::onHit(const unsigned int set, const unsigned int way) {
+    stamps[set * ways + way] = ++clock;
+}
+
+void LRUPolicy::onFill(const unsigned int set, const unsigned int way) {
+    stamps[set * ways + way] = ++clock;
+}
+
+unsigned int LRUPolicy::victim(const unsigned int set) {
+    const unsigned long long* stamp = &stamps[set * ways];
+    unsigned int oldest = 0;
+    for (unsigned int w = 1; w < ways; w++) {
+        if (stamp[w] < stamp[oldest]) {
+            oldest = w;
+        }
+    }
+    return oldest;
+}
+
+// Way 0 starts as the most recent and the last way as the least, as if filled in reverse.
+void LRUPolicy::reset() {
+    clock = ways;
+    for (size_t i = 0; i < stamps.size(); i++) {
+        stamps[i] = ways - i % ways;
+    }
+}
+
+std::string LRUPolicy::getName() const {
+    return "LRU";
+}
+
+TreePLRUPolicy::TreePLRUPolicy(const unsigned int sets, const unsigned int ways) : ways(ways), bits(sets * (ways - 1), false) {}
+
+// Walk from the root to the leaf for way, pointing every node on the path at the other subtree.
+void TreePLRUPolicy::touch(const unsigned int set, const unsigned int way) {
+    const unsigned int base = set * (ways - 1);
+    unsigned int node = 1;
+    for (unsigned int half = ways / 2; half > 0; half /= 2) {
+        const bool right = (way & half) != 0;
+        bits[base + node - 1] = !right;
+        node = node * 2 + (right ? 1 : 0);
+    }
+}
+
+void TreePLRUPolicy::onHit(const unsigned int set, const unsigned int way) {
+    touch(set, way);
+}
+
+void TreePLRUPolicy::onFill(const unsigned int set, const unsigned int way) {
+    touch(set, way);
+}
+
+unsigned int TreePLRUPolicy::victim(const unsigned int set) {
+    const unsigned int base = set * (ways - 1);
+    unsigned int node = 1;
+    unsigned int way = 0;
+    for (unsigned int half = ways / 2; half > 0; half /= 2) {
+        const bool right = bits[base + node - 1];
+        way |= right ? half : 0;
+        node = node * 2 + (right ? 1 : 0);
+    }
+    return way;
+}
+
+void TreePLRUPolicy::reset() {
+    bits.assign(bits.size(), false);
+}
+
+std::string TreePLRUPolicy::getName() const {
+    return "Tree PLRU";
+}
+
+FIFOPolicy::FIFOPolicy(const unsigned int sets, const unsigned int ways) : ways(ways), next(sets, 0) {}
+
+void FIFOPolicy::onHit(const unsigned int /*set*/, const unsigned int /*way*/) {}
+
+void FIFOPolicy::onFill(const unsigned int set, const unsigned int way) {
+    if (next[set] == way) {
+        next[set] = static_cast<unsigned short>((way + 1) % ways);
+    }
+}
+
+unsigned int FIFOPolicy::victim(const unsigned int set) {
+    return next[set];
+}
+
+void FIFOPolicy::reset() {
+    next.assign(next.size(), 0);
+}
+
+std::string FIFOPolicy::getName() const {
+    return "FIFO";
+}
+
+RandomPolicy::RandomPolicy(const unsigned int ways, const unsigned int seed) : ways(ways), seed(seed == 0 ? 1 : seed), state(this->seed) {}
+
+void RandomPolicy::onHit(const unsigned int /*set*/, const unsigned int /*way*/) {}
+
+void RandomPolicy::onFill(const unsigned int /*set*/, const unsigned int /*way*/) {}
+
+unsigned int RandomPolicy::victim(const unsigned int /*set*/) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % ways;
+}
+
+void RandomPolicy::reset() {
+    state = seed;
+}
+
+std::string RandomPolicy::getName() const {
+    return "Random";
+}
+
+constexpr unsigned char RRIPPolicy::MAX_RRPV;
+constexpr unsigned int RRIPPolicy::BRRIP_EPSILON;
+
+RRIPPolicy::RRIPPolicy(const unsigned int sets, const unsigned int ways, const bool bimodal)
+    : ways(ways), bimodal(bimodal), fills(0), rrpv(sets * ways, MAX_RRPV) {}
+
+void RRIPPolicy::onHit(const unsigned int set, const unsigned int way) {
+    rrpv[set * ways + way] = 0;
+}
+
+void RRIPPolicy::onFill(const unsigned int set, const unsigned int way) {
+    if (bimodal && ++fills % BRRIP_EPSILON != 0) {
+        rrpv[set * ways + way] = MAX_RRPV;
+    } else {
+        rrpv[set * ways + way] = MAX_RRPV - 1;
+    }
+}
+
+// Age the whole set until some way reaches the distant re-reference value.
+unsigned int RRIPPolicy::victim(const unsigned int set) {
+    unsigned char* value = &rrpv[set * ways];
+    while (true) {
+        for (unsigned int w = 0; w < ways; w++) {
+            if (value[w] == MAX_RRPV) {
+                return w;
+            }
+        }
+        for (unsigned int w = 0; w < ways; w++) {
+            value[w]++;
+        }
+    }
+}
+
+void RRIPPolicy::reset() {
+    fills = 0;
+    rrpv.assign(rrpv.size(), MAX_RRPV);
+}
+
+std::string RRIPPolicy::getName() const {
+    return bimodal ? "BRRIP" : "SRRIP";
+}
+
+// Accepts lru, plru, fifo, srrip, brrip, random or random:<seed>.
+bool parseReplacementType(const std::string& text, ReplacementType& type, unsigned int& seed) {
+    const size_t colon = text.find(':');
+    const std::string name = text.substr(0, colon);
+
+    if (colon != std::string::npos) {
+        if (name != "random") {
+            return false;
+        }
+        try {
+            size_t parsed = 0;
+            seed = std::stoul(text.substr(colon + 1), &parsed);
+            if (parsed != text.size() - colon - 1) {
+                return false;
+            }
+        } catch (std::invalid_argument&) {
+            return false;
+        } catch (std::out_of_range&) {
+            return false;
+        }
+    }
+
+    if (name == "lru") {
+        type = ReplacementType::LRU;
+    } else if (name == "plru") {
+        type = ReplacementType::PLRU;
+    } else if (name == "fifo") {
+        type = ReplacementType::FIFO;
+    } else if (name == "random") {
+        type = ReplacementType::RANDOM;
+    } else if (name == "srrip") {
+        type = ReplacementType::SRRIP;
+    } else if (name == "brrip") {
+        type = ReplacementType::BRRIP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<ReplacementPolicy> createReplacementPolicy(const ReplacementType type, const unsigned int sets,
+                                                           const unsigned int ways, const unsigned int seed) {
+    switch (type) {
+        case ReplacementType::LRU:
+            return std::make_unique<LRUPolicy>(sets, ways);
+        case ReplacementType::PLRU:
+            if ((ways & (ways - 1)) != 0) {
+                return nullptr;
+            }
+            return std::make_unique<TreePLRUPolicy>(sets, ways);
+        case ReplacementType::FIFO:
+            return std::make_unique<FIFOPolicy>(sets, ways);
+        case ReplacementType::RANDOM:
+            return std::make_unique<RandomPolicy>(ways, seed);
+        case ReplacementType::SRRIP:
+            return std::make_unique<RRIPPolicy>(sets, ways, false);
+        case ReplacementType::BRRIP:
+            return std::make_unique<RRIPPolicy>(sets, ways, true);
+        default:
+            return nullptr;
+    }
+}
@@ -0,0 +1,548 @@
+#include <cstring>
+
+#include "../include/runner.h"
+#include "../include/emu.h"
+#include "../include/branch_predictor.h"
+#include "../include/cache.h"
+#include "../include/config.h"
+#include "../include/hart.h"
+#include "../include/intervals.h"
+#include "../include/sampling.h"
+#include "../include/simpoint.h"
+#include "../include/latency.h"
+#include "../include/pipeline.h"
+#include "../include/stats.h"
+#include "../include/stack_distance.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+static void overrideGeometry(const CacheConfig& from, CacheConfig& to) {
+    to.type = from.type;
+    to.lines = from.lines;
+    to.blockSize = from.blockSize;
+    to.ways = from.ways;
+}
+
+// Splits "<level>=<value>" where level is l1d, l1i, l2 or l3.
+static CacheConfig* findLevelSpec(const std::string& spec, HierarchyConfig& hierarchy, std::string& value) {
+    const size_t equals = spec.find('=');
+    if (equals == std::string::npos) {
+        return nullptr;
+    }
+
+    const std::string level = spec.substr(0, equals);
+    value = spec.substr(equals + 1);
+    if (level == "l1d") {
+        return &hierarchy.l1d;
+    } else if (level == "l1i") {
+        return &hierarchy.l1i;
+    } else if (level == "l2") {
+        return &hierarchy.l2;
+    } else if (level == "l3") {
+        return &hierarchy.l3;
+    }
+    return nullptr;
+}
+
+static bool applyReplacementSpec(const std::string& spec, HierarchyConfig& hierarchy) {
+    std::string policy;
+    CacheConfig* config = findLevelSpec(spec, hierarchy, policy);
+    return config != nullptr && parseReplacementType(policy, config->replacement, config->seed);
+}
+
+static bool applyPrefetchSpec(const std::string& spec, HierarchyConfig& hierarchy) {
+    std::string prefetcher;
+    CacheConfig* config = findLevelSpec(spec, hierarchy, prefetcher);
+    return config != nullptr &&
+           parsePrefetchSpec(prefetcher, config->prefetcher, config->prefetchDegree, config->prefetchDistance);
+}
+
+static bool applyVictimSpec(const std::string& spec, HierarchyConfig& hierarchy) {
+    std::string entries;
+    CacheConfig* config = findLevelSpec(spec, hierarchy, entries);
+    if (config == nullptr) {
+        return false;
+    }
+    try {
+        size_t parsed = 0;
+        config->victimEntries = std::stoul(entries, &parsed);
+        return parsed == entries.size();
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+static bool applyWriteSpec(const std::string& spec, HierarchyConfig& hierarchy) {
+    std::string policy;
+    CacheConfig* config = findLevelSpec(spec, hierarchy, policy);
+    return config != nullptr && config != &hierarchy.l1i && parseWritePolicy(policy, *config);
+}
+
+int run_emulator(const int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <bytecode_file> [-m memory_size] [-c cache_type[:lines:block_size[:ways]]] [-i icache_type[:lines:block_size[:ways]]] [-f config_file] [-r level=policy] [-w level=write_policy] [-p level=prefetcher[:degree[:distance]]] [-v level=victim_entries] [-s table|json] [-t top_misses] [-l symbol_file] [-3] [-d block_size[:max_lines]] [-o trace_file] [-e opcode=cycles] [-b predictor[:entries[:history_bits]]] [-P forwarding|no-forwarding] [-H harts[:stack_size]] [-C none|mesi|moesi] [-D] [-I length[:warmup[:jobs]]] [-S length[:clusters[:warmup]]] [-W period[:window[:warmup]]]\n";
+        return 1;
+    }
+
+    std::string filename;
+    unsigned int mem_size = 131072;
+    HierarchyConfig hierarchy;
+    CacheConfig data_cache;
+    CacheConfig inst_cache;
+    bool data_cache_given = false;
+    bool inst_cache_given = false;
+    std::string config_path;
+    std::vector<std::string> replacement_specs;
+    std::vector<std::string> write_specs;
+    std::vector<std::string> prefetch_specs;
+    std::vector<std::string> victim_specs;
+    std::vector<std::string> latency_specs;
+    LatencyTable latencies;
+    BranchPredictorConfig branch_predictor;
+    std::string predictor_spec;
+    PipelineMode pipeline_mode = PipelineMode::OFF;
+    std::string pipeline_spec;
+    HartConfig hart_config;
+    std::string hart_spec;
+    std::string coherence_spec;
+    bool classify_misses = false;
+    bool decoupled_timing = false;
+    IntervalConfig interval_config;
+    std::string interval_spec;
+    SimPointConfig simpoint_config;
+    std::string simpoint_spec;
+    SamplingConfig sampling_config;
+    std::string sampling_spec;
+    bool miss_report = false;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid memory configuration. Aborting.\n";
+                return 2;
+            }
+
+            try {
+                mem_size = std::stoul(argv[++i]);
+            } catch (std::invalid_argument&) {
+                std::cerr << "Invalid memory configuration. Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid cache configuration. Aborting.\n";
+                return 2;
+            }
+
+            if (!parseCacheSpec(argv[++i], data_cache)) {
+                std::cerr << "Invalid cache configuration. Aborting.\n";
+                return 2;
+            }
+            data_cache_given = true;
+        }
+        else if (strcmp(argv[i], "-i") == 0) {
+            if (i + 1 >= argc || !parseCacheSpec(argv[++i], inst_cache)) {
+                std::cerr << "Invalid instruction cache configuration. Aborting.\n";
+                return 2;
+            }
+            inst_cache_given = true;
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing configuration file. Aborting.\n";
+                return 2;
+            }
+            config_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-r") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid replacement policy. Aborting.\n";
+                return 2;
+            }
+            replacement_specs.emplace_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid write policy. Aborting.\n";
+                return 2;
+            }
+            write_specs.emplace_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            StatsFormat format;
+            if (i + 1 >= argc || !parseStatsFormat(argv[++i], format)) {
+                std::cerr << "Invalid statistics format. Aborting.\n";
+                return 2;
+            }
+            set_stats_format(format);
+        }
+        else if (strcmp(argv[i], "-t") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid miss report size. Aborting.\n";
+                return 2;
+            }
+            try {
+                const unsigned int topN = std::stoul(argv[++i]);
+                enable_miss_profile(topN);
+                miss_report = topN > 0;
+            } catch (std::invalid_argument&) {
+                std::cerr << "Invalid miss report size. Aborting.\n";
+                return 2;
+            } catch (std::out_of_range&) {
+                std::cerr << "Invalid miss report size. Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0) {
+            std::string error;
+            if (i + 1 >= argc) {
+                std::cerr << "Missing symbol file. Aborting.\n";
+                return 2;
+            }
+            if (!load_symbols(argv[++i], error)) {
+                std::cerr << "Invalid symbol file: " << error << ". Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid prefetcher. Aborting.\n";
+                return 2;
+            }
+            prefetch_specs.emplace_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid victim cache. Aborting.\n";
+                return 2;
+            }
+            victim_specs.emplace_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0) {
+            unsigned int block_size = BLOCK_SIZE;
+            unsigned int max_lines = 4096;
+            if (i + 1 >= argc || !parseStackDistanceSpec(argv[++i], block_size, max_lines)) {
+                std::cerr << "Invalid stack distance configuration. Aborting.\n";
+                return 2;
+            }
+            enable_stack_distance(block_size, max_lines);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            std::string error;
+            if (i + 1 >= argc) {
+                std::cerr << "Missing trace file. Aborting.\n";
+                return 2;
+            }
+            if (in_guest_mode()) {
+                std::cerr << "Invalid trace file: guests cannot write a trace. Aborting.\n";
+                return 2;
+            }
+            if (!enable_trace(argv[++i], error)) {
+                std::cerr << "Invalid trace file: " << error << ". Aborting.\n";
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid opcode latency. Aborting.\n";
+                return 2;
+            }
+            latency_specs.emplace_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-b") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid branch predictor. Aborting.\n";
+                return 2;
+            }
+            predictor_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-P") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid pipeline mode. Aborting.\n";
+                return 2;
+            }
+            pipeline_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-H") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid hart configuration. Aborting.\n";
+                return 2;
+            }
+            hart_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-C") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid coherence protocol. Aborting.\n";
+                return 2;
+            }
+            coherence_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-3") == 0) {
+            classify_misses = true;
+        }
+        else if (strcmp(argv[i], "-D") == 0) {
+            decoupled_timing = true;
+        }
+        else if (strcmp(argv[i], "-I") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid interval configuration. Aborting.\n";
+                return 2;
+            }
+            interval_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-S") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid SimPoint configuration. Aborting.\n";
+                return 2;
+            }
+            simpoint_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "-W") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Invalid sampling configuration. Aborting.\n";
+                return 2;
+            }
+            sampling_spec = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            std::cerr << "Usage: " << argv[0] << " <bytecode_file> [-m memory_size] [-c cache_type[:lines:block_size[:ways]]] [-i icache_type[:lines:block_size[:ways]]] [-f config_file] [-r level=policy] [-w level=write_policy] [-p level=prefetcher[:degree[:distance]]] [-v level=victim_entries] [-s table|json] [-t top_misses] [-l symbol_file] [-3] [-d block_size[:max_lines]] [-o trace_file] [-e opcode=cycles] [-b predictor[:entries[:history_bits]]] [-P forwarding|no-forwarding] [-H harts[:stack_size]] [-C none|mesi|moesi] [-D] [-I length[:warmup[:jobs]]] [-S length[:clusters[:warmup]]] [-W period[:window[:warmup]]]\n";
+            return 1;
+        }
+        else {
+            if (filename.empty()) {
+                filename = argv[i];
+            }
+        }
+    }
+
+    if (!config_path.empty()) {
+        ConfigFile file;
+        std::string error;
+        if (!file.load(config_path, error) || !loadHierarchyConfig(file, hierarchy, error) ||
+            !loadLatencyTable(file, latencies, error) || !loadBranchConfig(file, branch_predictor, error) ||
+            !loadPipelineMode(file, pipeline_mode, error) || !loadHartConfig(file, hart_config, error) ||
+            !loadIntervalConfig(file, interval_config, error) || !loadSimPointConfig(file, simpoint_config, error) ||
+            !loadSamplingConfig(file, sampling_config, error)) {
+            std::cerr << "Invalid configuration file: " << error << ". Aborting.\n";
+            return 2;
+        }
+        for (const std::string& key : file.unusedKeys()) {
+            std::cerr << "Warning: unknown configuration key " << key << "\n";
+        }
+    }
+
+    // Command line cache options override the geometry from the configuration file
+    if (data_cache_given) {
+        overrideGeometry(data_cache, hierarchy.l1d);
+    }
+    if (inst_cache_given) {
+        overrideGeometry(inst_cache, hierarchy.l1i);
+    }
+
+    for (const std::string& spec : replacement_specs) {
+        if (!applyReplacementSpec(spec, hierarchy)) {
+            std::cerr << "Invalid replacement policy " << spec << ". Aborting.\n";
+            return 2;
+        }
+    }
+    for (const std::string& spec : write_specs) {
+        if (!applyWriteSpec(spec, hierarchy)) {
+            std::cerr << "Invalid write policy " << spec << ". Aborting.\n";
+            return 2;
+        }
+    }
+    for (const std::string& spec : prefetch_specs) {
+        if (!applyPrefetchSpec(spec, hierarchy)) {
+            std::cerr << "Invalid prefetcher " << spec << ". Aborting.\n";
+            return 2;
+        }
+    }
+    for (const std::string& spec : victim_specs) {
+        if (!applyVictimSpec(spec, hierarchy)) {
+            std::cerr << "Invalid victim cache " << spec << ". Aborting.\n";
+            return 2;
+        }
+    }
+
+    for (const std::string& spec : latency_specs) {
+        if (!latencies.parse(spec)) {
+            std::cerr << "Invalid opcode latency " << spec << ". Aborting.\n";
+            return 2;
+        }
+    }
+    set_latencies(latencies);
+
+    std::string branch_error;
+    if (!predictor_spec.empty() && !parsePredictorSpec(predictor_spec, branch_predictor)) {
+        std::cerr << "Invalid branch predictor " << predictor_spec << ". Aborting.\n";
+        return 2;
+    }
+    if (!branch_predictor.isValid(branch_error)) {
+        std::cerr << "Invalid branch predictor: " << branch_error << ". Aborting.\n";
+        return 2;
+    }
+    init_branch_predictor(branch_predictor);
+
+    if (!pipeline_spec.empty() && !parsePipelineMode(pipeline_spec, pipeline_mode)) {
+        std::cerr << "Invalid pipeline mode " << pipeline_spec << ". Aborting.\n";
+        return 2;
+    }
+    init_pipeline(pipeline_mode);
+
+    std::string hart_error;
+    if (!hart_spec.empty() && !parseHartSpec(hart_spec, hart_config)) {
+        std::cerr << "Invalid hart configuration " << hart_spec << ". Aborting.\n";
+        return 2;
+    }
+    if (!hart_config.isValid(mem_size, hart_error)) {
+        std::cerr << "Invalid hart configuration: " << hart_error << ". Aborting.\n";
+        return 2;
+    }
+
+    if (!coherence_spec.empty() && !parseCoherenceProtocol(coherence_spec, hierarchy.coherence)) {
+        std::cerr << "Invalid coherence protocol " << coherence_spec << ". Aborting.\n";
+        return 2;
+    }
+
+    if (decoupled_timing) {
+        hierarchy.decoupled = true;
+    }
+    // The timing thread follows one interpreter and charges no cycles back to a pipeline
+    if (hierarchy.decoupled && (hart_config.harts > 1 || pipeline_mode != PipelineMode::OFF)) {
+        std::cerr << "Invalid timing configuration: decoupled timing needs one hart and no pipeline. Aborting.\n";
+        return 2;
+    }
+
+    if (!interval_spec.empty() && !parseIntervalSpec(interval_spec, interval_config)) {
+        std::cerr << "Invalid interval configuration " << interval_spec << ". Aborting.\n";
+        return 2;
+    }
+    // Intervals are forked processes and send back only the cycle and cache counts
+    if (interval_config.length > 0 &&
+        (hart_config.harts > 1 || pipeline_mode != PipelineMode::OFF || hierarchy.decoupled || miss_report)) {
+        std::cerr << "Invalid interval configuration: intervals need one hart, inline timing, no pipeline and no "
+                     "hot-miss report. Aborting.\n";
+        return 2;
+    }
+    if (!simpoint_spec.empty() && !parseSimPointSpec(simpoint_spec, simpoint_config)) {
+        std::cerr << "Invalid SimPoint configuration " << simpoint_spec << ". Aborting.\n";
+        return 2;
+    }
+    // The representatives are timed in a forked process, as intervals are
+    if (simpoint_config.length > 0 && (interval_config.length > 0 || hart_config.harts > 1 ||
+                                       pipeline_mode != PipelineMode::OFF || hierarchy.decoupled || miss_report)) {
+        std::cerr << "Invalid SimPoint configuration: SimPoint sampling needs one hart, inline timing, no pipeline, "
+                     "no hot-miss report and no interval simulation. Aborting.\n";
+        return 2;
+    }
+    if (!sampling_spec.empty() && !parseSamplingSpec(sampling_spec, sampling_config)) {
+        std::cerr << "Invalid sampling configuration " << sampling_spec << ". Aborting.\n";
+        return 2;
+    }
+    std::string sampling_error;
+    if (!sampling_config.isValid(sampling_error)) {
+        std::cerr << "Invalid sampling configuration: " << sampling_error << ". Aborting.\n";
+        return 2;
+    }
+    // Windows switch the timing model of the one hart on and off, and count only cycles and caches
+    if (sampling_config.period > 0 &&
+        (interval_config.length > 0 || simpoint_config.length > 0 || hart_config.harts > 1 ||
+         pipeline_mode != PipelineMode::OFF || hierarchy.decoupled || miss_report)) {
+        std::cerr << "Invalid sampling configuration: sampling needs one hart, inline timing, no pipeline, no "
+                     "hot-miss report, no interval simulation and no SimPoint sampling. Aborting.\n";
+        return 2;
+    }
+    // Guests take turns on one host thread, which they must not leave or fork
+    if (in_guest_mode() && (hart_config.harts > 1 || hierarchy.decoupled || interval_config.length > 0 ||
+                            simpoint_config.length > 0)) {
+        std::cerr << "Invalid guest configuration: guests need one hart, inline timing, no interval simulation "
+                     "and no SimPoint sampling. Aborting.\n";
+        return 2;
+    }
+
+    if (classify_misses) {
+        hierarchy.l1d.classifyMisses = true;
+        hierarchy.l1i.classifyMisses = true;
+        hierarchy.l2.classifyMisses = true;
+        hierarchy.l3.classifyMisses = true;
+    }
+
+    std::string hierarchy_error;
+    if (!hierarchy.isValid(hierarchy_error)) {
+        std::cerr << "Invalid cache configuration: " << hierarchy_error << ". Aborting.\n";
+        return 2;
+    }
+
+    if (filename.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <bytecode_file> [-m memory_size] [-c cache_type[:lines:block_size[:ways]]] [-i icache_type[:lines:block_size[:ways]]] [-f config_file] [-r level=policy] [-w level=write_policy] [-p level=prefetcher[:degree[:distance]]] [-v level=victim_entries] [-s table|json] [-t top_misses] [-l symbol_file] [-3] [-d block_size[:max_lines]] [-o trace_file] [-e opcode=cycles] [-b predictor[:entries[:history_bits]]] [-P forwarding|no-forwarding] [-H harts[:stack_size]] [-C none|mesi|moesi] [-D] [-I length[:warmup[:jobs]]] [-S length[:clusters[:warmup]]] [-W period[:window[:warmup]]]\n";
+        return 1;
+    }
+
+    if (!init_mem(mem_size)) {
+        std::cerr << "Failed to initialize memory\n";
+        return 1;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    if (!input) {
+        std::cerr << "Failed to open input file\n";
+        return 1;
+    }
+
+    input.seekg(0, std::ios::end);
+    const std::streamsize file_size = input.tellg();
+    input.seekg(0, std::ios::beg);
+
+    if (file_size > mem_size) {
+        std::cout << "INSUFFICIENT MEMORY SPACE\n";
+        return 2;
+    }
+    if (!init_registers(file_size)) {
+        std::cerr << "Failed to initialize registers\n";
+        return 1;
+    }
+
+    input.read(reinterpret_cast<char*>(prog_mem), file_size);
+
+    reg_file[PC] = (prog_mem[3] << 24) | (prog_mem[2] << 16) |
+                   (prog_mem[1] << 8) | prog_mem[0];
+    mem_cycle_cntr = 0;
+
+    if (!init_harts(hart_config)) {
+        std::cerr << "Invalid hart configuration: the stacks overlap the program. Aborting.\n";
+        return 2;
+    }
+    init_hierarchy(hierarchy);
+    init_intervals(interval_config, branch_predictor);
+    std::string simpoint_error;
+    if (!init_simpoints(simpoint_config, branch_predictor, simpoint_error)) {
+        std::cerr << "Cannot start SimPoint sampling: " << simpoint_error << "\n";
+        return 1;
+    }
+    init_sampling(sampling_config, branch_predictor);
+
+    while (!has_halted()) {
+        if (!fetch()) {
+            std::cout << "fINVALID INSTRUCTION AT: " << reg_file[PC] - 8 << std::flush;
+            stop_harts();
+            return 1;
+        }
+
+        if (!decode()) {
+            std::cout << "dINVALID INSTRUCTION AT: " << reg_file[PC] - 8 << std::flush;
+            stop_harts();
+            return 1;
+        }
+
+        if (!execute()) {
+            std::cout << "eINVALID INSTRUCTION AT: " << reg_file[PC] - 8 << std::flush;
+            stop_harts();
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include "../include/sampling.h"
+#include "../include/stats.h"
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+SamplingConfig::SamplingConfig() : period(0), window(1000), warmup(2000) {}
+
+bool SamplingConfig::isValid(std::string& error) const {
+    if (period > 0 && (window == 0 || static_cast<unsigned long long>(window) + warmup >= period)) {
+        error = "the window and its warm-up must be shorter than the period";
+        return false;
+    }
+    return true;
+}
+
+static bool parseNumber(const std::string& text, unsigned int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used);
+        return used == text.size();
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+bool parseSamplingSpec(const std::string& text, SamplingConfig& config) {
+    SamplingConfig parsed = config;
+    const size_t first = text.find(':');
+    if (!parseNumber(text.substr(0, first), parsed.period) || parsed.period == 0) {
+        return false;
+    }
+    if (first != std::string::npos) {
+        const size_t second = text.find(':', first + 1);
+        if (!parseNumber(text.substr(first + 1, second - first - 1), parsed.window)) {
+            return false;
+        }
+        if (second != std::string::npos && !parseNumber(text.substr(second + 1), parsed.warmup)) {
+            return false;
+        }
+    }
+    config = parsed;
+    return true;
+}
+
+SampledEstimate::SampledEstimate() : value(0.0), margin(0.0) {}
+
+SampledEstimate estimateRatio(const std::vector<double>& numerators, const std::vector<double>& denominators) {
+    SampledEstimate estimate;
+    const size_t n = numerators.size();
+    double numerator = 0.0;
+    double denominator = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        numerator += numerators[i];
+        denominator += denominators[i];
+    }
+    if (denominator == 0.0) {
+        return estimate;
+    }
+    estimate.value = numerator / denominator;
+    if (n < 2) {
+        return estimate;
+    }
+    // Residuals around the ratio, as for a ratio estimator in survey sampling
+    double squares = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        const double residual = numerators[i] - estimate.value * denominators[i];
+        squares += residual * residual;
+    }
+    const double meanDenominator = denominator / n;
+    const double standardError = std::sqrt(squares / (n - 1) / n) / meanDenominator;
+    estimate.margin = 1.96 * standardError;
+    return estimate;
+}
+
+SystematicSampler::SystematicSampler(const SamplingConfig& config)
+    : config(config), timing(false), measuring(false), instructions(0) {}
+
+unsigned long long SystematicSampler::offset(const unsigned long long retired) const {
+    return retired % config.period;
+}
+
+bool SystematicSampler::endsWindow(const unsigned long long retired) const {
+    return measuring && offset(retired) == 0;
+}
+
+void SystematicSampler::record(const IntervalResult& measured) {
+    windows.push_back(measured);
+    measuring = false;
+    timing = false;
+}
+
+bool SystematicSampler::startsTiming(const unsigned long long retired) {
+    if (!timing && offset(retired) == config.period - config.window - config.warmup) {
+        timing = true;
+        return true;
+    }
+    return false;
+}
+
+bool SystematicSampler::startsWindow(const unsigned long long retired) {
+    if (!measuring && offset(retired) == config.period - config.window) {
+        measuring = true;
+        return true;
+    }
+    return false;
+}
+
+bool SystematicSampler::isMeasuring() const {
+    return measuring;
+}
+
+bool SystematicSampler::finish(const unsigned long long instructions, IntervalResult& total, std::string& error) {
+    this->instructions = instructions;
+    IntervalResult sampled;
+    for (const IntervalResult& window : windows) {
+        sampled.add(window);
+    }
+    if (sampled.counters.instructions == 0) {
+        error = "the run ended before the first window";
+        return false;
+    }
+    total = IntervalResult();
+    total.addScaled(sampled, static_cast<double>(instructions) / sampled.counters.instructions);
+
+    std::vector<double> cycles;
+    std::vector<double> retired;
+    for (const IntervalResult& window : windows) {
+        cycles.push_back(static_cast<double>(window.counters.total()));
+        retired.push_back(static_cast<double>(window.counters.instructions));
+    }
+    cpi = estimateRatio(cycles, retired);
+    for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+        std::vector<double> misses;
+        std::vector<double> accesses;
+        for (const IntervalResult& window : windows) {
+            misses.push_back(window.levels[level].misses);
+            accesses.push_back(window.levels[level].hits + window.levels[level].misses);
+        }
+        levelMissRates[level] = estimateRatio(misses, accesses);
+    }
+    return true;
+}
+
+void SystematicSampler::printReport(std::ostream& out, const StatsFormat format) const {
+    if (instructions == 0 || windows.empty()) {
+        return;
+    }
+    static const char* const LEVEL_NAMES[IntervalResult::LEVELS] = {"L1I", "L1D", "L2", "L3"};
+    unsigned long long measured = 0;
+    unsigned long long levelAccesses[IntervalResult::LEVELS] = {};
+    for (const IntervalResult& window : windows) {
+        measured += window.counters.instructions;
+        for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+            levelAccesses[level] += window.levels[level].hits + window.levels[level].misses;
+        }
+    }
+    // With one window there is no spread to estimate a margin from
+    const bool known = windows.size() > 1;
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed;
+
+    if (format == StatsFormat::JSON) {
+        const auto margin = [&](const double value) -> std::ostream& {
+            if (known) {
+                return out << value;
+            }
+            return out << "null";
+        };
+        out << "{\"sampling\": {\"period\": " << config.period << ", \"window\": " << config.window
+            << ", \"warmup\": " << config.warmup << ", \"windows\": " << windows.size()
+            << ", \"measured_instructions\": " << measured << ", \"cpi\": " << std::setprecision(4) << cpi.value
+            << ", \"cpi_margin\": ";
+        margin(cpi.margin) << ", \"cycles\": " << std::setprecision(0) << cpi.value * instructions
+                           << ", \"cycles_margin\": ";
+        margin(cpi.margin * instructions) << ", \"miss_rates\": {";
+        bool first = true;
+        for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+            if (levelAccesses[level] == 0) {
+                continue;
+            }
+            out << (first ? "" : ", ") << "\"" << LEVEL_NAMES[level] << "\": {\"rate\": " << std::setprecision(4)
+                << levelMissRates[level].value << ", \"margin\": ";
+            margin(levelMissRates[level].margin) << "}";
+            first = false;
+        }
+        out << "}}}" << std::endl;
+    } else {
+        out << "Sampling: " << windows.size() << " windows of " << config.window << " instructions every "
+            << config.period << ", " << std::setprecision(1) << 100.0 * measured / instructions
+            << "% of the run measured" << std::endl;
+        out << std::left << std::setw(16) << "Estimate" << std::right << std::setw(14) << "Value" << std::setw(16)
+            << "95% interval" << std::endl;
+        const auto row = [&](const std::string& name, const double value, const double margin, const int digits) {
+            out << std::left << std::setw(16) << name << std::right << std::setprecision(digits) << std::setw(14)
+                << value << std::setw(16);
+            std::ostringstream interval;
+            interval << std::fixed << std::setprecision(digits) << "+/- " << margin;
+            out << (known ? interval.str() : "n/a") << std::endl;
+        };
+        row("CPI", cpi.value, cpi.margin, 3);
+        row("Cycles", cpi.value * instructions, cpi.margin * instructions, 0);
+        for (unsigned int level = 0; level < IntervalResult::LEVELS; level++) {
+            if (levelAccesses[level] > 0) {
+                row(std::string(LEVEL_NAMES[level]) + " miss rate", levelMissRates[level].value,
+                    levelMissRates[level].margin, 4);
+            }
+        }
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,451 @@
+#include "../include/simpoint.h"
+#include "../include/stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+SimPointConfig::SimPointConfig() : length(0), clusters(10), warmup(100000) {}
+
+static bool parseNumber(const std::string& text, unsigned int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoul(text, &used);
+        return used == text.size();
+    } catch (std::invalid_argument&) {
+        return false;
+    } catch (std::out_of_range&) {
+        return false;
+    }
+}
+
+bool parseSimPointSpec(const std::string& text, SimPointConfig& config) {
+    SimPointConfig parsed = config;
+    const size_t first = text.find(':');
+    if (!parseNumber(text.substr(0, first), parsed.length) || parsed.length == 0) {
+        return false;
+    }
+    if (first != std::string::npos) {
+        const size_t second = text.find(':', first + 1);
+        if (!parseNumber(text.substr(first + 1, second - first - 1), parsed.clusters) || parsed.clusters == 0) {
+            return false;
+        }
+        if (second != std::string::npos && !parseNumber(text.substr(second + 1), parsed.warmup)) {
+            return false;
+        }
+    }
+    config = parsed;
+    return true;
+}
+
+static double distance2(const std::vector<double>& a, const std::vector<double>& b) {
+    double sum = 0.0;
+    for (size_t d = 0; d < a.size(); d++) {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return sum;
+}
+
+std::vector<unsigned int> clusterPoints(const std::vector<std::vector<double>>& points, unsigned int k,
+                                        std::vector<size_t>& representatives) {
+    representatives.clear();
+    const size_t n = points.size();
+    if (n == 0) {
+        return {};
+    }
+    k = static_cast<unsigned int>(std::min<size_t>(std::max(k, 1u), n));
+
+    // k-means++: each further centroid is a point drawn with probability proportional to its
+    // squared distance from the centroids so far
+    std::mt19937 random(1);
+    std::vector<std::vector<double>> centroids = {points[random() % n]};
+    std::vector<double> nearest(n, std::numeric_limits<double>::max());
+    while (centroids.size() < k) {
+        double sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            nearest[i] = std::min(nearest[i], distance2(points[i], centroids.back()));
+            sum += nearest[i];
+        }
+        if (sum == 0.0) {
+            break;
+        }
+        double pick = std::uniform_real_distribution<double>(0.0, sum)(random);
+        size_t chosen = 0;
+        while (chosen + 1 < n && pick >= nearest[chosen]) {
+            pick -= nearest[chosen];
+            chosen++;
+        }
+        centroids.push_back(points[chosen]);
+    }
+
+    std::vector<unsigned int> assignment(n, 0);
+    for (unsigned int iteration = 0; iteration < 100; iteration++) {
+        bool changed = false;
+        for (size_t i = 0; i < n; i++) {
+            unsigned int best = 0;
+            for (unsigned int c = 1; c < centroids.size(); c++) {
+                if (distance2(points[i], centroids[c]) < distance2(points[i], centroids[best])) {
+                    best = c;
+                }
+            }
+            changed = changed || best != assignment[i];
+            assignment[i] = best;
+        }
+        if (!changed && iteration > 0) {
+            break;
+        }
+        std::vector<std::vector<double>> sums(centroids.size(), std::vector<double>(points[0].size(), 0.0));
+        std::vector<size_t> members(centroids.size(), 0);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t d = 0; d < points[i].size(); d++) {
+                sums[assignment[i]][d] += points[i][d];
+            }
+            members[assignment[i]]++;
+        }
+        for (size_t c = 0; c < centroids.size(); c++) {
+            if (members[c] > 0) {
+                for (size_t d = 0; d < sums[c].size(); d++) {
+                    centroids[c][d] = sums[c][d] / members[c];
+                }
+            }
+        }
+    }
+
+    // Renumber the clusters that kept members, and pick the member nearest each centroid
+    std::vector<unsigned int> renumbered(centroids.size(), std::numeric_limits<unsigned int>::max());
+    for (size_t i = 0; i < n; i++) {
+        unsigned int& cluster = renumbered[assignment[i]];
+        if (cluster == std::numeric_limits<unsigned int>::max()) {
+            cluster = static_cast<unsigned int>(representatives.size());
+            representatives.push_back(i);
+        }
+        const size_t current = representatives[cluster];
+        if (distance2(points[i], centroids[assignment[i]]) < distance2(points[current], centroids[assignment[i]])) {
+            representatives[cluster] = i;
+        }
+    }
+    for (unsigned int& cluster : assignment) {
+        cluster = renumbered[cluster];
+    }
+    return assignment;
+}
+
+// A fixed pseudo-random weight in [-1, 1) for each block and dimension (splitmix64).
+static double projectionWeight(const unsigned int blockStart, const unsigned int dimension) {
+    uint64_t x = static_cast<uint64_t>(blockStart) * SimPointSampler::DIMENSIONS + dimension + 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return static_cast<double>(x >> 11) / 9007199254740992.0 * 2.0 - 1.0;
+}
+
+SimPointSampler::SimPointSampler(const SimPointConfig& config)
+    : config(config), current(), nextBoundary(config.length), lastPC(0xFFFFFFFF), blockStart(0), blockLength(0),
+      intervalExecute(0), intervalMemory(0), replayer(0), selectionPipe(-1), resultPipe(-1), executeError(0.0),
+      memoryError(0.0), replaying(false), next(0), warmFrom(0), timing(false), measuring(false) {}
+
+SimPointSampler::~SimPointSampler() {
+    if (replayer > 0) {
+        kill(replayer, SIGKILL);
+        close(selectionPipe);
+        close(resultPipe);
+        waitpid(replayer, nullptr, 0);
+    }
+}
+
+bool SimPointSampler::startReplayer(std::string& error) {
+    int selection[2];
+    int measured[2];
+    if (pipe(selection) != 0) {
+        error = "cannot create a pipe";
+        return false;
+    }
+    if (pipe(measured) != 0) {
+        close(selection[0]);
+        close(selection[1]);
+        error = "cannot create a pipe";
+        return false;
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(selection[1]);
+        close(measured[0]);
+        selectionPipe = selection[0];
+        resultPipe = measured[1];
+        replaying = true;
+        uint64_t count = 0;
+        if (!readPipe(selectionPipe, &count, sizeof(count))) {
+            _exit(1);
+        }
+        std::vector<uint64_t> intervals(count);
+        if (count > 0 && !readPipe(selectionPipe, intervals.data(), count * sizeof(uint64_t))) {
+            _exit(1);
+        }
+        selected.assign(intervals.begin(), intervals.end());
+        // The replay reads what the functional pass read, and then finds the input at its end
+        uint64_t size = 0;
+        if (!readPipe(selectionPipe, &size, sizeof(size))) {
+            _exit(1);
+        }
+        std::string history(size, '\0');
+        if (size > 0 && !readPipe(selectionPipe, &history[0], size)) {
+            _exit(1);
+        }
+        input.replay(history);
+        selectNext(0);
+        // Only the functional pass prints what the program outputs
+        std::cout.rdbuf(nullptr);
+        return true;
+    }
+    close(selection[0]);
+    close(measured[1]);
+    if (pid < 0) {
+        close(selection[1]);
+        close(measured[0]);
+        error = "cannot start the replay process";
+        return false;
+    }
+    replayer = pid;
+    selectionPipe = selection[1];
+    resultPipe = measured[0];
+    return true;
+}
+
+bool SimPointSampler::isReplaying() const {
+    return replaying;
+}
+
+void SimPointSampler::endBlock() {
+    if (blockLength == 0) {
+        return;
+    }
+    for (unsigned int d = 0; d < DIMENSIONS; d++) {
+        current.projection[d] += blockLength * projectionWeight(blockStart, d);
+    }
+    current.instructions += blockLength;
+    blockLength = 0;
+}
+
+void SimPointSampler::endInterval(const unsigned long long executeCycles, const unsigned long long memoryCycles) {
+    current.executeCycles = executeCycles - intervalExecute;
+    current.memoryCycles = memoryCycles - intervalMemory;
+    profiles.push_back(current);
+    current = Profile();
+    intervalExecute = executeCycles;
+    intervalMemory = memoryCycles;
+}
+
+void SimPointSampler::profile(const unsigned int pc, const unsigned long long retired,
+                              const unsigned long long executeCycles, const unsigned long long memoryCycles) {
+    if (retired == nextBoundary) {
+        // A block that runs across the boundary counts in both intervals
+        endBlock();
+        endInterval(executeCycles, memoryCycles);
+        nextBoundary += config.length;
+    }
+    if (pc != lastPC + 8) {
+        endBlock();
+        blockStart = pc;
+    }
+    lastPC = pc;
+    blockLength++;
+}
+
+bool SimPointSampler::finish(const unsigned long long executeCycles, const unsigned long long memoryCycles,
+                             IntervalResult& total, std::string& error) {
+    endBlock();
+    if (current.instructions > 0) {
+        endInterval(executeCycles, memoryCycles);
+    }
+    if (profiles.empty()) {
+        error = "no instructions ran";
+        return false;
+    }
+
+    std::vector<std::vector<double>> points;
+    for (const Profile& profile : profiles) {
+        std::vector<double> point(profile.projection, profile.projection + DIMENSIONS);
+        for (double& value : point) {
+            value /= profile.instructions;
+        }
+        points.push_back(point);
+    }
+    std::vector<size_t> chosen;
+    const std::vector<unsigned int> assignment = clusterPoints(points, config.clusters, chosen);
+    representatives.clear();
+    for (const size_t interval : chosen) {
+        representatives.push_back(Representative{interval, 0, IntervalResult()});
+    }
+    for (size_t i = 0; i < profiles.size(); i++) {
+        representatives[assignment[i]].clusterInstructions += profiles[i].instructions;
+    }
+    std::sort(representatives.begin(), representatives.end(),
+              [](const Representative& a, const Representative& b) { return a.interval < b.interval; });
+
+    std::vector<uint64_t> intervals;
+    for (const Representative& representative : representatives) {
+        intervals.push_back(representative.interval);
+    }
+    const uint64_t count = intervals.size();
+    const std::string& history = input.getHistory();
+    const uint64_t size = history.size();
+    std::vector<IntervalResult> measured(count);
+    uint64_t reported = 0;
+    const bool received = writePipe(selectionPipe, &count, sizeof(count)) &&
+                          writePipe(selectionPipe, intervals.data(), count * sizeof(uint64_t)) &&
+                          writePipe(selectionPipe, &size, sizeof(size)) &&
+                          writePipe(selectionPipe, history.data(), size) &&
+                          readPipe(resultPipe, &reported, sizeof(reported)) && reported == count &&
+                          readPipe(resultPipe, measured.data(), count * sizeof(IntervalResult));
+    close(selectionPipe);
+    close(resultPipe);
+    waitpid(replayer, nullptr, 0);
+    replayer = 0;
+    if (!received) {
+        error = "the replay process did not report";
+        representatives.clear();
+        return false;
+    }
+
+    // Every count of a cluster is its representative's, scaled up to the cluster's instructions
+    total = IntervalResult();
+    double executeEstimate = 0.0;
+    double memoryEstimate = 0.0;
+    for (size_t i = 0; i < representatives.size(); i++) {
+        Representative& representative = representatives[i];
+        representative.measured = measured[i];
+        const Profile& profile = profiles[representative.interval];
+        if (measured[i].counters.instructions != profile.instructions) {
+            error = "interval " + std::to_string(representative.interval) + " replayed differently";
+            representatives.clear();
+            return false;
+        }
+        const double factor = static_cast<double>(representative.clusterInstructions) / profile.instructions;
+        total.addScaled(measured[i], factor);
+        executeEstimate += profile.executeCycles * factor;
+        memoryEstimate += profile.memoryCycles * factor;
+    }
+    const unsigned long long executeTotal = executeCycles;
+    const unsigned long long memoryTotal = memoryCycles;
+    executeError = executeTotal == 0 ? 0.0 : (executeEstimate - executeTotal) / executeTotal;
+    memoryError = memoryTotal == 0 ? 0.0 : (memoryEstimate - memoryTotal) / memoryTotal;
+    return true;
+}
+
+void SimPointSampler::printReport(std::ostream& out, const StatsFormat format) const {
+    if (representatives.empty()) {
+        return;
+    }
+    unsigned long long instructions = 0;
+    unsigned long long timed = 0;
+    for (const Profile& profile : profiles) {
+        instructions += profile.instructions;
+    }
+    for (const Representative& representative : representatives) {
+        timed += representative.measured.counters.instructions;
+    }
+    const auto cpi = [](const unsigned long long cycles, const unsigned long long count) {
+        return count == 0 ? 0.0 : static_cast<double>(cycles) / count;
+    };
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed;
+
+    if (format == StatsFormat::JSON) {
+        out << "{\"simpoint\": {\"interval_length\": " << config.length << ", \"intervals\": " << profiles.size()
+            << ", \"timed_instructions\": " << timed << ", \"points\": [";
+        for (size_t i = 0; i < representatives.size(); i++) {
+            const Representative& representative = representatives[i];
+            const CycleCounters& counters = representative.measured.counters;
+            out << (i == 0 ? "" : ", ") << "{\"interval\": " << representative.interval << ", \"weight\": "
+                << std::setprecision(4) << static_cast<double>(representative.clusterInstructions) / instructions
+                << ", \"cpi\": " << std::setprecision(3) << cpi(counters.total(), counters.instructions) << "}";
+        }
+        out << "], \"execute_error\": " << std::setprecision(6) << executeError << ", \"memory_error\": "
+            << memoryError << "}}" << std::endl;
+    } else {
+        out << "SimPoint: " << representatives.size() << " of " << profiles.size() << " intervals of "
+            << config.length << " instructions timed, " << std::setprecision(1) << 100.0 * timed / instructions
+            << "% of the run" << std::endl;
+        out << std::setw(10) << "Interval" << std::setw(10) << "Weight" << std::setw(10) << "CPI" << std::setw(14)
+            << "Memory CPI" << std::endl;
+        for (const Representative& representative : representatives) {
+            const IntervalResult& measured = representative.measured;
+            out << std::setw(10) << representative.interval << std::setw(10) << std::setprecision(3)
+                << static_cast<double>(representative.clusterInstructions) / instructions << std::setw(10)
+                << cpi(measured.counters.total(), measured.counters.instructions) << std::setw(14)
+                << cpi(measured.memoryCycles, measured.counters.instructions) << std::endl;
+        }
+        out << "Check: the same extrapolation is " << std::showpos << std::setprecision(2) << 100.0 * executeError
+            << "% off for execute cycles and " << 100.0 * memoryError << std::noshowpos
+            << "% off for uncached memory cycles" << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void SimPointSampler::selectNext(const unsigned long long retired) {
+    if (next < selected.size()) {
+        const unsigned long long start = static_cast<unsigned long long>(selected[next]) * config.length;
+        warmFrom = std::max(start > config.warmup ? start - config.warmup : 0, retired);
+    }
+}
+
+bool SimPointSampler::endsMeasuring(const unsigned long long retired) const {
+    return measuring && retired == static_cast<unsigned long long>(selected[next]) * config.length + config.length;
+}
+
+void SimPointSampler::record(const IntervalResult& measured, const unsigned long long retired) {
+    results.push_back(measured);
+    measuring = false;
+    next++;
+    selectNext(retired);
+}
+
+bool SimPointSampler::stopsTiming(const unsigned long long retired) {
+    if (timing && (next == selected.size() || warmFrom > retired)) {
+        timing = false;
+        return true;
+    }
+    return false;
+}
+
+bool SimPointSampler::startsTiming(const unsigned long long retired) {
+    if (replaying && !timing && next < selected.size() && retired == warmFrom) {
+        timing = true;
+        return true;
+    }
+    return false;
+}
+
+bool SimPointSampler::startsMeasuring(const unsigned long long retired) {
+    if (replaying && !measuring && next < selected.size() &&
+        retired == static_cast<unsigned long long>(selected[next]) * config.length) {
+        measuring = true;
+        return true;
+    }
+    return false;
+}
+
+bool SimPointSampler::isMeasuring() const {
+    return measuring;
+}
+
+bool SimPointSampler::isDone() const {
+    return replaying && next == selected.size();
+}
+
+void SimPointSampler::report() {
+    const uint64_t count = results.size();
+    const bool sent = writePipe(resultPipe, &count, sizeof(count)) &&
+                      writePipe(resultPipe, results.data(), count * sizeof(IntervalResult));
+    _exit(sent ? 0 : 1);
+}
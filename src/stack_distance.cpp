@@ -0,0 +1,204 @@
+#include "../include/stack_distance.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+constexpr unsigned int StackDistance::COLD;
+
+StackDistance::StackDistance() : now(0) {
+    rebuild(1024);
+}
+
+void StackDistance::add(const unsigned int timestamp, const int delta) {
+    for (size_t i = timestamp + 1; i < tree.size(); i += i & (~i + 1)) {
+        tree[i] += delta;
+    }
+}
+
+// Marks at or before timestamp.
+unsigned int StackDistance::prefix(const unsigned int timestamp) const {
+    unsigned int sum = 0;
+    for (size_t i = timestamp + 1; i > 0; i -= i & (~i + 1)) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+void StackDistance::rebuild(const unsigned int capacity) {
+    tree.assign(capacity + 1, 0);
+    for (const auto& entry : lastAccess) {
+        tree[entry.second + 1]++;
+    }
+    for (size_t i = 1; i < tree.size(); i++) {
+        const size_t parent = i + (i & (~i + 1));
+        if (parent < tree.size()) {
+            tree[parent] += tree[i];
+        }
+    }
+}
+
+unsigned int StackDistance::access(const unsigned int block) {
+    const unsigned int capacity = static_cast<unsigned int>(tree.size()) - 1;
+    if (now == capacity) {
+        if (lastAccess.size() * 2 > capacity) {
+            rebuild(capacity * 2);
+        } else {
+            std::vector<std::pair<unsigned int, unsigned int>> live;
+            live.reserve(lastAccess.size());
+            for (const auto& entry : lastAccess) {
+                live.emplace_back(entry.second, entry.first);
+            }
+            std::sort(live.begin(), live.end());
+            for (unsigned int i = 0; i < live.size(); i++) {
+                lastAccess[live[i].second] = i;
+            }
+            now = static_cast<unsigned int>(live.size());
+            rebuild(capacity);
+        }
+    }
+
+    unsigned int distance = COLD;
+    const std::unordered_map<unsigned int, unsigned int>::iterator it = lastAccess.find(block);
+    if (it != lastAccess.end()) {
+        distance = static_cast<unsigned int>(lastAccess.size()) - prefix(it->second);
+        add(it->second, -1);
+        it->second = now;
+    } else {
+        lastAccess.emplace(block, now);
+    }
+    add(now, 1);
+    now++;
+    return distance;
+}
+
+void StackDistance::reset() {
+    lastAccess.clear();
+    now = 0;
+    rebuild(1024);
+}
+
+StackDistanceProfile::StackDistanceProfile(const unsigned int blockSize, const unsigned int maxLines,
+                                           const unsigned int maxWays)
+    : blockSize(blockSize), maxLines(maxLines), maxWays(maxWays), distances(maxLines + 1, 0), accesses(0) {
+    for (unsigned int sets = 1; sets <= maxLines; sets *= 2) {
+        SetStacks stacks;
+        stacks.sets = sets;
+        stacks.blocks.assign(sets * maxWays, 0);
+        stacks.depth.assign(sets, 0);
+        stacks.histogram.assign(maxWays + 1, 0);
+        setStacks.push_back(std::move(stacks));
+    }
+}
+
+void StackDistanceProfile::accessSets(SetStacks& stacks, const unsigned int block) {
+    const unsigned int set = block & (stacks.sets - 1);
+    unsigned int* const stack = &stacks.blocks[set * maxWays];
+    unsigned int& depth = stacks.depth[set];
+
+    unsigned int position = 0;
+    while (position < depth && stack[position] != block) {
+        position++;
+    }
+    if (position < depth) {
+        stacks.histogram[position]++;
+    } else {
+        stacks.histogram[maxWays]++;
+        if (depth < maxWays) {
+            depth++;
+        }
+        position = depth - 1;
+    }
+    for (unsigned int i = position; i > 0; i--) {
+        stack[i] = stack[i - 1];
+    }
+    stack[0] = block;
+}
+
+void StackDistanceProfile::access(const unsigned int address) {
+    const unsigned int block = address / blockSize;
+    const unsigned int distance = fullyAssociative.access(block);
+    distances[std::min(distance, maxLines)]++;
+    for (SetStacks& stacks : setStacks) {
+        accessSets(stacks, block);
+    }
+    accesses++;
+}
+
+unsigned long long StackDistanceProfile::misses(const unsigned int lines, const unsigned int ways) const {
+    unsigned long long hits = 0;
+    if (ways == 0) {
+        for (unsigned int d = 0; d < lines && d < maxLines; d++) {
+            hits += distances[d];
+        }
+        return accesses - hits;
+    }
+
+    const unsigned int sets = lines / ways;
+    for (const SetStacks& stacks : setStacks) {
+        if (stacks.sets == sets) {
+            for (unsigned int d = 0; d < ways && d < maxWays; d++) {
+                hits += stacks.histogram[d];
+            }
+        }
+    }
+    return accesses - hits;
+}
+
+unsigned long long StackDistanceProfile::getAccesses() const {
+    return accesses;
+}
+
+unsigned int StackDistanceProfile::getBlockSize() const {
+    return blockSize;
+}
+
+unsigned int StackDistanceProfile::getMaxLines() const {
+    return maxLines;
+}
+
+unsigned int StackDistanceProfile::getMaxWays() const {
+    return maxWays;
+}
+
+void StackDistanceProfile::reset() {
+    fullyAssociative.reset();
+    std::fill(distances.begin(), distances.end(), 0);
+    for (SetStacks& stacks : setStacks) {
+        std::fill(stacks.depth.begin(), stacks.depth.end(), 0);
+        std::fill(stacks.histogram.begin(), stacks.histogram.end(), 0);
+    }
+    accesses = 0;
+}
+
+// Bounds the per-set recency stacks, which hold about 2 * maxLines * maxWays blocks.
+static const unsigned int MAX_PROFILE_LINES = 65536;
+
+static bool isPowerOfTwo(const unsigned int value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+bool parseStackDistanceSpec(const std::string& text, unsigned int& blockSize, unsigned int& maxLines) {
+    const size_t colon = text.find(':');
+    const std::string fields[] = {text.substr(0, colon), colon == std::string::npos ? "" : text.substr(colon + 1)};
+    unsigned int values[2] = {blockSize, maxLines};
+    for (unsigned int i = 0; i < 2; i++) {
+        if (i == 1 && colon == std::string::npos) {
+            break;
+        }
+        try {
+            size_t parsed = 0;
+            values[i] = std::stoul(fields[i], &parsed);
+            if (parsed != fields[i].size() || !isPowerOfTwo(values[i]) || values[i] > MAX_PROFILE_LINES) {
+                return false;
+            }
+        } catch (std::invalid_argument&) {
+            return false;
+        } catch (std::out_of_range&) {
+            return false;
+        }
+    }
+    blockSize = values[0];
+    maxLines = values[1];
+    return true;
+}
@@ -0,0 +1,228 @@
+#include "../include/stats.h"
+#include "../include/cache.h"
+#include "../include/latency.h"
+#include "../include/stack_distance.h"
+
+#include <iomanip>
+
+bool parseStatsFormat(const std::string& text, StatsFormat& format) {
+    if (text == "table") {
+        format = StatsFormat::TABLE;
+    } else if (text == "json") {
+        format = StatsFormat::JSON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool hasRowBuffers(const MemoryTimingModel* memory) {
+    return memory != nullptr && memory->getType() == MemoryTimingType::BANKED;
+}
+
+static void printTable(std::ostream& out, const std::vector<NamedCache>& levels, const MemoryTimingModel* memory,
+                       const CoherenceBus* bus) {
+    const char* headers[] = {"Level", "Read hit", "Read miss", "Write hit", "Write miss", "Fetch hit", "Fetch miss",
+                             "Write-backs", "Evictions", "Hit cycles", "Miss cycles"};
+    if (!levels.empty()) {
+        out << std::left << std::setw(6) << headers[0] << std::right;
+        for (unsigned int i = 1; i < 11; i++) {
+            out << std::setw(13) << headers[i];
+        }
+        out << std::endl;
+    }
+
+    for (const NamedCache& level : levels) {
+        const CacheStats& stats = level.cache->getStats();
+        const unsigned long long values[] = {stats.readHits, stats.readMisses, stats.writeHits, stats.writeMisses,
+                                       stats.fetchHits, stats.fetchMisses, stats.writebacks, stats.evictions,
+                                       stats.hitCycles, stats.missCycles};
+        out << std::left << std::setw(6) << level.name << std::right;
+        for (const unsigned long long value : values) {
+            out << std::setw(13) << value;
+        }
+        out << std::endl;
+    }
+
+    for (const NamedCache& level : levels) {
+        if (level.cache->hasPrefetcher()) {
+            const PrefetchStats& stats = level.cache->getPrefetchStats();
+            out << level.name << " prefetcher: " << stats.issued << " issued, " << stats.useful << " useful, "
+                << stats.late << " late, " << stats.polluting << " polluting" << std::endl;
+        }
+        if (level.cache->getWriteBuffer().isEnabled()) {
+            const WriteBufferStats& stats = level.cache->getWriteBuffer().getStats();
+            out << level.name << " write buffer: " << stats.writes << " writes, " << stats.coalesced << " coalesced, "
+                << stats.drains << " drains, " << stats.fullStalls << " full stalls, "
+                << stats.stallCycles << " stall cycles" << std::endl;
+        }
+        if (level.cache->getVictimCache().isEnabled()) {
+            const VictimCacheStats& stats = level.cache->getVictimCache().getStats();
+            out << level.name << " victim cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                << stats.insertions << " insertions, " << stats.writebacks << " write-backs" << std::endl;
+        }
+        if (level.cache->classifiesMisses()) {
+            const CacheStats& stats = level.cache->getStats();
+            out << level.name << " misses: " << stats.compulsoryMisses << " compulsory, " << stats.capacityMisses
+                << " capacity, " << stats.conflictMisses << " conflict, " << stats.noAllocateMisses << " no-allocate"
+                << std::endl;
+        }
+    }
+
+    if (hasRowBuffers(memory)) {
+        const MemoryTimingStats& stats = memory->getStats();
+        out << "DRAM: " << stats.transfers << " transfers, " << stats.rowHits << " row hits, " << stats.rowMisses
+            << " row misses, " << stats.rowEmpty << " closed bank" << std::endl;
+    }
+    if (bus) {
+        const CoherenceStats& stats = bus->getStats();
+        out << "Coherence (" << coherenceProtocolName(bus->getProtocol()) << "): " << stats.readRequests
+            << " read requests, " << stats.ownershipRequests << " ownership requests, " << stats.upgrades
+            << " upgrades, " << stats.invalidations << " invalidations, " << stats.transfers
+            << " cache-to-cache transfers, " << stats.snoopWritebacks << " snoop write-backs" << std::endl;
+    }
+}
+
+static void printJson(std::ostream& out, const std::vector<NamedCache>& levels, const unsigned long long memoryCycles,
+                      const MemoryTimingModel* memory, const CoherenceBus* bus) {
+    out << "{\"memory_cycles\": " << memoryCycles << ", \"levels\": [";
+    for (size_t i = 0; i < levels.size(); i++) {
+        const SetAssociativeCache& cache = *levels[i].cache;
+        const CacheStats& stats = cache.getStats();
+        out << (i == 0 ? "" : ", ") << "{\"name\": \"" << levels[i].name << "\", \"type\": \"" << cache.getType() << "\""
+            << ", \"hits\": " << stats.hits << ", \"misses\": " << stats.misses << ", \"cycles\": " << stats.cycles
+            << ", \"read_hits\": " << stats.readHits << ", \"read_misses\": " << stats.readMisses
+            << ", \"write_hits\": " << stats.writeHits << ", \"write_misses\": " << stats.writeMisses
+            << ", \"fetch_hits\": " << stats.fetchHits << ", \"fetch_misses\": " << stats.fetchMisses
+            << ", \"writebacks\": " << stats.writebacks << ", \"evictions\": " << stats.evictions
+            << ", \"hit_cycles\": " << stats.hitCycles << ", \"miss_cycles\": " << stats.missCycles;
+
+        if (cache.hasPrefetcher()) {
+            const PrefetchStats& prefetch = cache.getPrefetchStats();
+            out << ", \"prefetcher\": {\"issued\": " << prefetch.issued << ", \"useful\": " << prefetch.useful
+                << ", \"late\": " << prefetch.late << ", \"polluting\": " << prefetch.polluting << "}";
+        }
+        if (cache.getWriteBuffer().isEnabled()) {
+            const WriteBufferStats& buffer = cache.getWriteBuffer().getStats();
+            out << ", \"write_buffer\": {\"writes\": " << buffer.writes << ", \"coalesced\": " << buffer.coalesced
+                << ", \"drains\": " << buffer.drains << ", \"full_stalls\": " << buffer.fullStalls
+                << ", \"stall_cycles\": " << buffer.stallCycles << "}";
+        }
+        if (cache.getVictimCache().isEnabled()) {
+            const VictimCacheStats& victim = cache.getVictimCache().getStats();
+            out << ", \"victim_cache\": {\"hits\": " << victim.hits << ", \"misses\": " << victim.misses
+                << ", \"insertions\": " << victim.insertions << ", \"writebacks\": " << victim.writebacks << "}";
+        }
+        if (cache.classifiesMisses()) {
+            out << ", \"miss_classes\": {\"compulsory\": " << stats.compulsoryMisses
+                << ", \"capacity\": " << stats.capacityMisses << ", \"conflict\": " << stats.conflictMisses
+                << ", \"no_allocate\": " << stats.noAllocateMisses << "}";
+        }
+        out << "}";
+    }
+    out << "]";
+    if (hasRowBuffers(memory)) {
+        const MemoryTimingStats& stats = memory->getStats();
+        out << ", \"dram\": {\"transfers\": " << stats.transfers << ", \"row_hits\": " << stats.rowHits
+            << ", \"row_misses\": " << stats.rowMisses << ", \"closed_bank\": " << stats.rowEmpty << "}";
+    }
+    if (bus) {
+        const CoherenceStats& stats = bus->getStats();
+        out << ", \"coherence\": {\"protocol\": \"" << coherenceProtocolName(bus->getProtocol())
+            << "\", \"read_requests\": " << stats.readRequests << ", \"ownership_requests\": " << stats.ownershipRequests
+            << ", \"upgrades\": " << stats.upgrades << ", \"invalidations\": " << stats.invalidations
+            << ", \"transfers\": " << stats.transfers << ", \"snoop_writebacks\": " << stats.snoopWritebacks << "}";
+    }
+    out << "}" << std::endl;
+}
+
+void printCacheStatistics(std::ostream& out, const std::vector<NamedCache>& levels, const unsigned long long memoryCycles,
+                          const StatsFormat format, const MemoryTimingModel* memory, const CoherenceBus* bus) {
+    if (format == StatsFormat::JSON) {
+        printJson(out, levels, memoryCycles, memory, bus);
+    } else {
+        printTable(out, levels, memory, bus);
+    }
+}
+
+static double perInstruction(const unsigned long long cycles, const unsigned long long instructions) {
+    return instructions == 0 ? 0.0 : static_cast<double>(cycles) / static_cast<double>(instructions);
+}
+
+void printCpiBreakdown(std::ostream& out, const CycleCounters& counters, const StatsFormat format) {
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    const char* names[] = {"execute", "fetch", "data", "branch"};
+    const unsigned long long cycles[] = {counters.execute, counters.fetch, counters.data, counters.branch};
+    if (format == StatsFormat::JSON) {
+        out << "{\"instructions\": " << counters.instructions << ", \"cycles\": " << counters.total()
+            << ", \"cpi\": " << perInstruction(counters.total(), counters.instructions);
+        for (unsigned int i = 0; i < 4; i++) {
+            out << ", \"" << names[i] << "\": {\"cycles\": " << cycles[i]
+                << ", \"cpi\": " << perInstruction(cycles[i], counters.instructions) << "}";
+        }
+        out << "}" << std::endl;
+    } else {
+        out << "Instructions: " << counters.instructions << ", total cycles: " << counters.total()
+            << ", CPI: " << perInstruction(counters.total(), counters.instructions) << std::endl;
+        const char* labels[] = {"Execute", "Fetch stalls", "Data stalls", "Branch stalls"};
+        for (unsigned int i = 0; i < 4; i++) {
+            out << "  " << std::left << std::setw(14) << labels[i] << std::right << std::setw(14) << cycles[i]
+                << std::setw(10) << perInstruction(cycles[i], counters.instructions) << std::endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+static double missRatio(const StackDistanceProfile& profile, const unsigned int lines, const unsigned int ways) {
+    if (profile.getAccesses() == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(profile.misses(lines, ways)) / static_cast<double>(profile.getAccesses());
+}
+
+void printMissRatioCurve(std::ostream& out, const StackDistanceProfile& profile, const StatsFormat format) {
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(4);
+
+    if (format == StatsFormat::JSON) {
+        out << "{\"miss_ratio_curve\": {\"block_size\": " << profile.getBlockSize() << ", \"accesses\": "
+            << profile.getAccesses() << ", \"points\": [";
+        for (unsigned int lines = 1; lines <= profile.getMaxLines(); lines *= 2) {
+            out << (lines == 1 ? "" : ", ") << "{\"lines\": " << lines << ", \"fully_associative\": "
+                << missRatio(profile, lines, 0) << ", \"set_associative\": {";
+            for (unsigned int ways = 1; ways <= profile.getMaxWays() && ways <= lines; ways *= 2) {
+                out << (ways == 1 ? "" : ", ") << "\"" << ways << "\": " << missRatio(profile, lines, ways);
+            }
+            out << "}}";
+        }
+        out << "]}}" << std::endl;
+    } else {
+        out << "Miss ratio curve (" << profile.getBlockSize() << " byte blocks, " << profile.getAccesses()
+            << " accesses):" << std::endl;
+        out << std::setw(8) << "Lines" << std::setw(10) << "FA";
+        for (unsigned int ways = 1; ways <= profile.getMaxWays(); ways *= 2) {
+            out << std::setw(10) << (std::to_string(ways) + "-way");
+        }
+        out << std::endl;
+        for (unsigned int lines = 1; lines <= profile.getMaxLines(); lines *= 2) {
+            out << std::setw(8) << lines << std::setw(10) << missRatio(profile, lines, 0);
+            for (unsigned int ways = 1; ways <= profile.getMaxWays(); ways *= 2) {
+                if (ways <= lines) {
+                    out << std::setw(10) << missRatio(profile, lines, ways);
+                } else {
+                    out << std::setw(10) << "-";
+                }
+            }
+            out << std::endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,64 @@
+#include "../include/timing_replay.h"
+
+TimingReplay::TimingReplay(const HierarchyConfig& config, const unsigned int memorySize)
+    : memory(memorySize, 0), lastPC(0xFFFFFFFF) {
+    hierarchy.build(config, memory.data(), memorySize);
+}
+
+CacheResult TimingReplay::access(const TraceRecord& record) {
+    const bool fetch = (record.flags & TRACE_FETCH) != 0;
+    const bool write = (record.flags & TRACE_WRITE) != 0;
+    if (hierarchy.prefetching && record.pc != lastPC) {
+        for (SetAssociativeCache* level : {static_cast<SetAssociativeCache*>(hierarchy.l1i.get()), hierarchy.l1d.get(),
+                                           hierarchy.l2.get(), hierarchy.l3.get()}) {
+            if (level) {
+                level->setAccessPC(record.pc);
+            }
+        }
+        lastPC = record.pc;
+    }
+
+    // Like the emulator, uncached streams end at every instruction boundary and once the fetch is done
+    if (fetch && record.address == record.pc) {
+        hierarchy.timing->endStream();
+    }
+
+    // As in the emulator, a fetch without an L1I goes through the L1D, which counts it and its fills as fetches
+    CacheResult result;
+    if (fetch && hierarchy.l1i) {
+        result = hierarchy.l1i->readWord(record.address);
+    } else if (!hierarchy.l1d) {
+        result = CacheResult(true, hierarchy.timing->uncachedAccess(record.address, record.size, write));
+    } else if (write) {
+        result = record.size == 1 ? hierarchy.l1d->writeByte(record.address, 0) : hierarchy.l1d->writeWord(record.address, 0);
+    } else if (fetch) {
+        result = hierarchy.l1d->fetchWord(record.address);
+    } else {
+        result = record.size == 1 ? hierarchy.l1d->readByte(record.address) : hierarchy.l1d->readWord(record.address);
+    }
+
+    if (fetch && record.address == record.pc + 4) {
+        hierarchy.timing->endStream();
+    }
+
+    if (write) {
+        const unsigned int last = record.address + record.size - 1;
+        if (hierarchy.l1i) {
+            hierarchy.l1i->invalidateBlock(record.address);
+            hierarchy.l1i->invalidateBlock(last);
+        }
+        if (!hierarchy.l1d) {
+            for (SetAssociativeCache* level : {hierarchy.l2.get(), hierarchy.l3.get()}) {
+                if (level) {
+                    level->invalidateBlock(record.address);
+                    level->invalidateBlock(last);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+const CacheHierarchy& TimingReplay::getHierarchy() const {
+    return hierarchy;
+}
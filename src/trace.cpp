@@ -0,0 +1,142 @@
+#include "../include/trace.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TRACE_MAGIC[TRACE_HEADER_SIZE + 1] = "EMUTRC01";
+static const size_t TRACE_BUFFER_RECORDS = 65536;
+
+static void putWord(unsigned char* out, const unsigned int value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static unsigned int getWord(const unsigned char* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<unsigned int>(in[3]) << 24);
+}
+
+TraceWriter::TraceWriter() : file(nullptr), count(0) {}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string& path, std::string& error) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        error = "cannot open " + path;
+        return false;
+    }
+    if (std::fwrite(TRACE_MAGIC, 1, TRACE_HEADER_SIZE, file) != TRACE_HEADER_SIZE) {
+        error = "cannot write " + path;
+        close();
+        return false;
+    }
+    buffer.reserve(TRACE_BUFFER_RECORDS * TRACE_RECORD_SIZE);
+    count = 0;
+    return true;
+}
+
+bool TraceWriter::flush() {
+    const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    buffer.clear();
+    return written;
+}
+
+void TraceWriter::record(const TraceRecord& record) {
+    if (file == nullptr) {
+        return;
+    }
+    unsigned char bytes[TRACE_RECORD_SIZE];
+    putWord(bytes, record.address);
+    putWord(bytes + 4, record.pc);
+    bytes[8] = record.size;
+    bytes[9] = record.flags;
+    buffer.insert(buffer.end(), bytes, bytes + TRACE_RECORD_SIZE);
+    count++;
+    if (buffer.size() >= TRACE_BUFFER_RECORDS * TRACE_RECORD_SIZE) {
+        flush();
+    }
+}
+
+bool TraceWriter::close() {
+    if (file == nullptr) {
+        return true;
+    }
+    const bool flushed = flush();
+    const bool closed = std::fclose(file) == 0;
+    file = nullptr;
+    return flushed && closed;
+}
+
+void TraceWriter::abandon() {
+    file = nullptr;
+    buffer.clear();
+}
+
+bool TraceWriter::isOpen() const {
+    return file != nullptr;
+}
+
+size_t TraceWriter::size() const {
+    return count;
+}
+
+MappedTrace::MappedTrace() : data(nullptr), length(0) {}
+
+MappedTrace::~MappedTrace() {
+    if (data != nullptr) {
+        munmap(const_cast<unsigned char*>(data), length);
+    }
+}
+
+bool MappedTrace::open(const std::string& path, std::string& error) {
+    if (data != nullptr) {
+        munmap(const_cast<unsigned char*>(data), length);
+        data = nullptr;
+    }
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < TRACE_HEADER_SIZE ||
+        (info.st_size - TRACE_HEADER_SIZE) % TRACE_RECORD_SIZE != 0) {
+        ::close(fd);
+        error = path + " is not a trace file";
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "cannot map " + path;
+        return false;
+    }
+    if (std::memcmp(mapped, TRACE_MAGIC, TRACE_HEADER_SIZE) != 0) {
+        munmap(mapped, info.st_size);
+        error = path + " is not a trace file";
+        return false;
+    }
+    madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+
+    data = static_cast<const unsigned char*>(mapped);
+    length = info.st_size;
+    return true;
+}
+
+size_t MappedTrace::size() const {
+    return data == nullptr ? 0 : (length - TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE;
+}
+
+TraceRecord MappedTrace::operator[](const size_t index) const {
+    const unsigned char* bytes = data + TRACE_HEADER_SIZE + index * TRACE_RECORD_SIZE;
+    return TraceRecord{getWord(bytes), getWord(bytes + 4), bytes[8], bytes[9]};
+}
@@ -0,0 +1,157 @@
+#include "../include/victim_cache.h"
+
+VictimCacheStats::VictimCacheStats() : hits(0), misses(0), insertions(0), writebacks(0) {}
+
+VictimCache::VictimCache(const unsigned int capacity, const unsigned int blockSize, const unsigned int swapCycles)
+    : entries(capacity, Entry{false, false, 0, 0, std::vector<unsigned char>(blockSize)}), blockSize(blockSize),
+      swapCycles(swapCycles), useCounter(0) {}
+
+bool VictimCache::isEnabled() const {
+    return !entries.empty();
+}
+
+unsigned int VictimCache::getSwapCycles() const {
+    return swapCycles;
+}
+
+const VictimCacheStats& VictimCache::getStats() const {
+    return stats;
+}
+
+VictimCache::Entry* VictimCache::find(const unsigned int blockAddress) {
+    for (Entry& entry : entries) {
+        if (entry.valid && entry.blockAddress == blockAddress) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+const VictimCache::Entry* VictimCache::find(const unsigned int blockAddress) const {
+    for (const Entry& entry : entries) {
+        if (entry.valid && entry.blockAddress == blockAddress) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool VictimCache::take(const unsigned int blockAddress, unsigned char* data, bool& dirty) {
+    Entry* entry = find(blockAddress);
+    if (entry == nullptr) {
+        stats.misses++;
+        return false;
+    }
+    for (unsigned int i = 0; i < blockSize; i++) {
+        data[i] = entry->data[i];
+    }
+    dirty = entry->dirty;
+    entry->valid = false;
+    stats.hits++;
+    return true;
+}
+
+bool VictimCache::insert(const unsigned int blockAddress, const unsigned char* data, const bool dirty,
+                         unsigned int& displacedAddress, std::vector<unsigned char>& displaced) {
+    Entry* slot = &entries[0];
+    for (Entry& entry : entries) {
+        if (!entry.valid) {
+            slot = &entry;
+            break;
+        }
+        if (entry.lastUse < slot->lastUse) {
+            slot = &entry;
+        }
+    }
+
+    const bool writeback = slot->valid && slot->dirty;
+    if (writeback) {
+        displacedAddress = slot->blockAddress;
+        displaced = slot->data;
+        stats.writebacks++;
+    }
+
+    slot->valid = true;
+    slot->dirty = dirty;
+    slot->blockAddress = blockAddress;
+    slot->lastUse = ++useCounter;
+    for (unsigned int i = 0; i < blockSize; i++) {
+        slot->data[i] = data[i];
+    }
+    stats.insertions++;
+    return writeback;
+}
+
+bool VictimCache::update(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    const unsigned int offset = address % blockSize;
+    Entry* entry = find(address - offset);
+    if (entry == nullptr) {
+        return false;
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        entry->data[offset + i] = data[i];
+    }
+    return true;
+}
+
+bool VictimCache::forward(const unsigned int address, unsigned char& value) const {
+    const unsigned int offset = address % blockSize;
+    const Entry* entry = find(address - offset);
+    if (entry == nullptr) {
+        return false;
+    }
+    value = entry->data[offset];
+    return true;
+}
+
+bool VictimCache::recall(const unsigned int blockAddress, unsigned char* data) {
+    Entry* entry = find(blockAddress);
+    if (entry == nullptr) {
+        return false;
+    }
+    entry->valid = false;
+    if (!entry->dirty) {
+        return false;
+    }
+    for (unsigned int i = 0; i < blockSize; i++) {
+        data[i] = entry->data[i];
+    }
+    return true;
+}
+
+bool VictimCache::clean(const unsigned int blockAddress, std::vector<unsigned char>& data) {
+    Entry* entry = find(blockAddress);
+    if (entry == nullptr || !entry->dirty) {
+        return false;
+    }
+    data = entry->data;
+    entry->dirty = false;
+    return true;
+}
+
+bool VictimCache::cleanAny(unsigned int& blockAddress, std::vector<unsigned char>& data) {
+    for (Entry& entry : entries) {
+        if (entry.valid && entry.dirty) {
+            blockAddress = entry.blockAddress;
+            data = entry.data;
+            entry.dirty = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+void VictimCache::invalidate(const unsigned int blockAddress) {
+    if (Entry* entry = find(blockAddress)) {
+        entry->valid = false;
+    }
+}
+
+void VictimCache::reset() {
+    for (Entry& entry : entries) {
+        entry.valid = false;
+        entry.lastUse = 0;
+    }
+    useCounter = 0;
+    stats = VictimCacheStats();
+}
@@ -0,0 +1,67 @@
+#include "../include/work_pool.h"
+
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(unsigned int threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+}
+
+bool WorkStealingPool::takeOwn(const size_t worker, size_t& task) {
+    Queue& queue = *queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(const size_t worker, size_t& task) {
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+        Queue& victim = *queues[(worker + offset) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// No task is ever added while workers run, so finding every deque empty means the run is over.
+void WorkStealingPool::work(const size_t worker, const std::function<void(size_t)>& task) {
+    size_t next;
+    while (takeOwn(worker, next) || steal(worker, next)) {
+        task(next);
+    }
+}
+
+void WorkStealingPool::run(const size_t count, const std::function<void(size_t)>& task) {
+    // Dealt in reverse so each worker starts on its lowest numbered task.
+    for (size_t i = count; i > 0; i--) {
+        queues[(i - 1) % queues.size()]->tasks.push_back(i - 1);
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t worker = 1; worker < queues.size() && worker < count; worker++) {
+        threads.emplace_back(&WorkStealingPool::work, this, worker, std::cref(task));
+    }
+    work(0, task);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+unsigned int WorkStealingPool::getThreads() const {
+    return static_cast<unsigned int>(queues.size());
+}
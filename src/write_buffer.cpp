@@ -0,0 +1,190 @@
+#include "../include/write_buffer.h"
+#include "../include/cache.h"
+
+WriteBufferStats::WriteBufferStats() : writes(0), coalesced(0), drains(0), fullStalls(0), stallCycles(0) {}
+
+WriteBuffer::WriteBuffer(MemoryInterface* memory, const unsigned int capacity, const unsigned int blockSize)
+    : memory(memory), capacity(capacity), blockSize(blockSize), draining(false), clock(0), headDone(0), pendingStall(0) {}
+
+bool WriteBuffer::isEnabled() const {
+    return capacity > 0;
+}
+
+const WriteBufferStats& WriteBuffer::getStats() const {
+    return stats;
+}
+
+void WriteBuffer::reset() {
+    entries.clear();
+    draining = false;
+    clock = 0;
+    headDone = 0;
+    pendingStall = 0;
+    stats = WriteBufferStats();
+}
+
+// Index of the oldest entry whose bytes have not been handed to the level below.
+unsigned int WriteBuffer::firstWaiting() const {
+    return draining ? 1 : 0;
+}
+
+// Hands the head entry to the level below. The level below may recall blocks from the
+// cache owning this buffer while it handles the write, so the entry is copied first.
+void WriteBuffer::startDrain(const unsigned long long start) {
+    draining = true;
+    const Entry entry = entries.front();
+
+    unsigned int cycles = 0;
+    unsigned int i = 0;
+    while (i < blockSize) {
+        if (!entry.mask[i]) {
+            i++;
+            continue;
+        }
+        const unsigned int runStart = i;
+        while (i < blockSize && entry.mask[i]) {
+            i++;
+        }
+        cycles += memory->writeBlock(entry.blockAddress + runStart, &entry.data[runStart], i - runStart);
+    }
+
+    headDone = start + cycles;
+    stats.drains++;
+}
+
+void WriteBuffer::retire() {
+    while (draining && headDone <= clock) {
+        const unsigned long long done = headDone;
+        entries.pop_front();
+        draining = false;
+        if (!entries.empty()) {
+            startDrain(done);
+        }
+    }
+    if (!draining && !entries.empty()) {
+        startDrain(clock);
+    }
+}
+
+// Stalls until the head entry has drained. The stall is charged to the current access,
+// so advance() must not count those cycles a second time.
+unsigned int WriteBuffer::waitForHead() {
+    if (!draining) {
+        startDrain(clock);
+    }
+    const unsigned int stall = headDone > clock ? static_cast<unsigned int>(headDone - clock) : 0;
+    clock += stall;
+    pendingStall += stall;
+    retire();
+    return stall;
+}
+
+void WriteBuffer::advance(const unsigned int cycles) {
+    if (!isEnabled()) {
+        return;
+    }
+    clock += cycles > pendingStall ? cycles - pendingStall : 0;
+    pendingStall = 0;
+    retire();
+}
+
+unsigned int WriteBuffer::write(const unsigned int address, const unsigned char* data, const unsigned int size) {
+    const unsigned int blockAddress = address - address % blockSize;
+    const unsigned int offset = address % blockSize;
+    stats.writes++;
+
+    for (unsigned int e = entries.size(); e > firstWaiting(); e--) {
+        Entry& entry = entries[e - 1];
+        if (entry.blockAddress == blockAddress) {
+            for (unsigned int i = 0; i < size; i++) {
+                entry.data[offset + i] = data[i];
+                entry.mask[offset + i] = true;
+            }
+            stats.coalesced++;
+            return 0;
+        }
+    }
+
+    unsigned int stall = 0;
+    if (entries.size() >= capacity) {
+        stall = waitForHead();
+        stats.fullStalls++;
+        stats.stallCycles += stall;
+    }
+
+    Entry entry;
+    entry.blockAddress = blockAddress;
+    entry.data.assign(blockSize, 0);
+    entry.mask.assign(blockSize, false);
+    for (unsigned int i = 0; i < size; i++) {
+        entry.data[offset + i] = data[i];
+        entry.mask[offset + i] = true;
+    }
+    entries.push_back(entry);
+
+    if (!draining) {
+        startDrain(clock);
+    }
+    return stall;
+}
+
+bool WriteBuffer::forward(const unsigned int address, unsigned char& value) const {
+    const unsigned int blockAddress = address - address % blockSize;
+    const unsigned int offset = address % blockSize;
+
+    for (unsigned int e = entries.size(); e > firstWaiting(); e--) {
+        const Entry& entry = entries[e - 1];
+        if (entry.blockAddress == blockAddress && entry.mask[offset]) {
+            value = entry.data[offset];
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int WriteBuffer::drainBlock(const unsigned int address, const unsigned int size) {
+    unsigned int stall = 0;
+    bool queued = true;
+    while (queued) {
+        queued = false;
+        for (unsigned int e = firstWaiting(); e < entries.size(); e++) {
+            if (entries[e].blockAddress < address + size && entries[e].blockAddress + blockSize > address) {
+                queued = true;
+                break;
+            }
+        }
+        if (queued) {
+            stall += waitForHead();
+        }
+    }
+    stats.stallCycles += stall;
+    return stall;
+}
+
+unsigned int WriteBuffer::drain() {
+    unsigned int stall = 0;
+    while (entries.size() > firstWaiting()) {
+        stall += waitForHead();
+    }
+    stats.stallCycles += stall;
+    return stall;
+}
+
+bool WriteBuffer::recall(const unsigned int address, unsigned char* data, const unsigned int size) {
+    bool found = false;
+    std::deque<Entry>::iterator it = entries.begin() + firstWaiting();
+    while (it != entries.end()) {
+        if (it->blockAddress < address || it->blockAddress >= address + size) {
+            ++it;
+            continue;
+        }
+        for (unsigned int i = 0; i < blockSize; i++) {
+            if (it->mask[i]) {
+                data[it->blockAddress - address + i] = it->data[i];
+            }
+        }
+        found = true;
+        it = entries.erase(it);
+    }
+    return found;
+}
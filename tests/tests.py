@@ -126,6 +126,14 @@ class TestASM4380:
             asm4380.process_data_directive(['LABEL1', '.INT', '#2'], 104)
         assert excinfo.value.code == 2
 
+    def test_fence_with_and_without_label(self):
+        assert asm4380.process_instruction(['fence'], 100) == 8
+        assert asm4380.process_instruction(['WAIT', 'fence'], 108) == 8
+        assert asm4380.labels['WAIT'] == 108
+        expected = struct.pack('<BBBBi', 44, 0, 0, 0, 0)
+        assert asm4380.code_section[-1] == expected
+        assert asm4380.code_section[-2] == expected
+
     def create_temp_asm_file(self, content):
         temp_file = tempfile.NamedTemporaryFile(mode='w', suffix='.asm', delete=False)
         temp_file.write(content)
@@ -1,9 +1,30 @@
 #include <gtest/gtest.h>
 #include <climits>
 #include "../include/emu4380.h"
+#include "../include/batch.h"
+#include "../include/branch_predictor.h"
+#include "../include/cache.h"
+#include "../include/config.h"
+#include "../include/decoupled_timing.h"
+#include "../include/fiber.h"
+#include "../include/guests.h"
+#include "../include/hart.h"
+#include "../include/intervals.h"
+#include "../include/sampling.h"
+#include "../include/simpoint.h"
+#include "../include/latency.h"
+#include "../include/stats.h"
+#include "../include/miss_profile.h"
+#include "../include/pipeline.h"
+#include "../include/stack_distance.h"
+#include "../include/trace.h"
+#include "../include/work_pool.h"
 #include <cstring>
 #include <string>
+#include <thread>
 #include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cstdio> // For the sample test he provided
 
@@ -1057,7 +1078,7 @@ TEST(cache, memory_cycle_counting_no_cache) {
     init_mem(1000);
     init_cache(0);
     mem_cycle_cntr = 0;
-    memStream = false;
+    end_memory_stream();
 
     readByte(100);
     EXPECT_EQ(mem_cycle_cntr, 8);
@@ -1066,6 +1087,603 @@ TEST(cache, memory_cycle_counting_no_cache) {
     EXPECT_EQ(mem_cycle_cntr, 10); // 8 + 2
 }
 
+TEST(cache, icache_fetch_separate_from_data) {
+    init_mem(1000);
+    init_cache(1);
+    init_icache(1, CACHE_LINES, BLOCK_SIZE);
+
+    prog_mem[64] = 8; // MOVI
+    prog_mem[65] = R1;
+    prog_mem[68] = 7;
+    reg_file[PC] = 64;
+
+    EXPECT_TRUE(fetch());
+    EXPECT_EQ(cntrl_regs[OPERATION], 8);
+    EXPECT_EQ(cntrl_regs[IMMEDIATE], 7);
+
+    // The data cache was never touched by the fetch, so this read is a cold miss
+    mem_cycle_cntr = 0;
+    readByte(64);
+    EXPECT_EQ(mem_cycle_cntr, 1 + 8 + 2 * (WORDS_PER_BLOCK - 1));
+    init_cache(0);
+}
+
+TEST(cache, icache_sees_self_modifying_store) {
+    init_mem(1000);
+    init_cache(3);
+    init_icache(1, CACHE_LINES, BLOCK_SIZE);
+
+    prog_mem[64] = 8; // MOVI
+    reg_file[PC] = 64;
+    EXPECT_TRUE(fetch());
+    EXPECT_EQ(cntrl_regs[OPERATION], 8);
+
+    // Rewrite the opcode through the write-back data cache and fetch it again
+    writeWord(64, 7); // MOV
+    reg_file[PC] = 64;
+    EXPECT_TRUE(fetch());
+    EXPECT_EQ(cntrl_regs[OPERATION], 7);
+    init_cache(0);
+}
+
+TEST(cache, word_read_across_blocks) {
+    init_mem(1000);
+    init_cache(1);
+
+    prog_mem[BLOCK_SIZE - 2] = 0x78;
+    prog_mem[BLOCK_SIZE - 1] = 0x56;
+    prog_mem[BLOCK_SIZE] = 0x34;
+    prog_mem[BLOCK_SIZE + 1] = 0x12;
+
+    EXPECT_EQ(readWord(BLOCK_SIZE - 2), 0x12345678);
+    init_cache(0);
+}
+
+TEST(cache, l2_latencies_from_hierarchy_config) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 2, 32);
+    config.l2 = CacheConfig(4, 16, 32);
+    config.l2.hitLatency = 5;
+    config.dramFirstAccess = 10;
+    config.dramBurst = 3;
+    init_hierarchy(config);
+
+    mem_cycle_cntr = 0;
+    readByte(0);
+    EXPECT_EQ(mem_cycle_cntr, 1 + 5 + 10 + 3 * 7);
+
+    readByte(64); // evicts block 0 from the two line L1
+    mem_cycle_cntr = 0;
+    readByte(0);
+    EXPECT_EQ(mem_cycle_cntr, 1 + 5);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(cache, inclusive_l2_recalls_dirty_l1_line) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 4, 32);
+    config.l2 = CacheConfig(2, 1, 32);
+    config.inclusive = true;
+    init_hierarchy(config);
+
+    writeByte(0, 0xAB);
+    readByte(32); // the single line L2 evicts block 0 and takes the dirty copy out of the L1
+    EXPECT_EQ(prog_mem[0], 0xAB);
+
+    config.inclusive = false;
+    init_mem(1000);
+    prog_mem[0] = 0;
+    init_hierarchy(config);
+
+    writeByte(0, 0xAB);
+    readByte(32);
+    EXPECT_EQ(prog_mem[0], 0);
+    EXPECT_EQ(readByte(0), 0xAB);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(cache, hierarchy_config_file) {
+    char path[] = "/tmp/emu_configXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    const std::string text = "; comment\nl2.type = 4\nl2.lines = 64\nl2.ways = 8\nl2.hit_latency = 7\n"
+                             "dram.first_access = 20 # trailing comment\nhierarchy.inclusion = non-inclusive\n";
+    ASSERT_EQ(write(fd, text.c_str(), text.size()), static_cast<ssize_t>(text.size()));
+    close(fd);
+
+    ConfigFile file;
+    HierarchyConfig config;
+    std::string error;
+    EXPECT_TRUE(file.load(path, error));
+    EXPECT_TRUE(loadHierarchyConfig(file, config, error));
+    unlink(path);
+
+    EXPECT_EQ(config.l2.type, 4);
+    EXPECT_EQ(config.l2.ways, 8);
+    EXPECT_EQ(config.l2.hitLatency, 7);
+    EXPECT_EQ(config.dramFirstAccess, 20);
+    EXPECT_EQ(config.dramBurst, 2);
+    EXPECT_FALSE(config.inclusive);
+    EXPECT_TRUE(file.unusedKeys().empty());
+}
+
+TEST(replacement, lru_evicts_least_recent) {
+    LRUPolicy policy(1, 4);
+    for (unsigned int way = 0; way < 4; way++) {
+        policy.onFill(0, way);
+    }
+    policy.onHit(0, 0);
+    EXPECT_EQ(policy.victim(0), 1);
+    policy.onHit(0, 1);
+    EXPECT_EQ(policy.victim(0), 2);
+
+    // A reset set ages from the last way to the first
+    policy.reset();
+    EXPECT_EQ(policy.victim(0), 3);
+    policy.onHit(0, 3);
+    EXPECT_EQ(policy.victim(0), 2);
+}
+
+TEST(replacement, tree_plru_points_away_from_recent) {
+    TreePLRUPolicy policy(2, 4);
+    for (unsigned int way = 0; way < 4; way++) {
+        policy.onFill(1, way);
+    }
+    EXPECT_EQ(policy.victim(1), 0);
+    policy.onHit(1, 0);
+    EXPECT_GE(policy.victim(1), 2);
+    EXPECT_EQ(policy.victim(0), 0);
+}
+
+TEST(replacement, fifo_ignores_hits) {
+    FIFOPolicy policy(1, 2);
+    policy.onFill(0, 0);
+    policy.onFill(0, 1);
+    policy.onHit(0, 0);
+    EXPECT_EQ(policy.victim(0), 0);
+}
+
+TEST(replacement, srrip_protects_reused_line) {
+    RRIPPolicy policy(1, 2, false);
+    policy.onFill(0, 0);
+    policy.onFill(0, 1);
+    policy.onHit(0, 0);
+    EXPECT_EQ(policy.victim(0), 1);
+}
+
+TEST(replacement, parse_policy_names) {
+    ReplacementType type;
+    unsigned int seed = 1;
+    EXPECT_TRUE(parseReplacementType("plru", type, seed));
+    EXPECT_EQ(type, ReplacementType::PLRU);
+    EXPECT_TRUE(parseReplacementType("random:42", type, seed));
+    EXPECT_EQ(type, ReplacementType::RANDOM);
+    EXPECT_EQ(seed, 42);
+    EXPECT_FALSE(parseReplacementType("mru", type, seed));
+    EXPECT_EQ(createReplacementPolicy(ReplacementType::PLRU, 4, 3, 1), nullptr);
+}
+
+TEST(replacement, hierarchy_selects_policy) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(4, 8, 16);
+    config.l1d.ways = 2;
+    config.l1d.replacement = ReplacementType::FIFO;
+    std::string error;
+    ASSERT_TRUE(config.isValid(error));
+    init_hierarchy(config);
+
+    // Four blocks mapping to set 0 of a 4-set, 2-way cache: FIFO evicts block 0 despite the re-read
+    readWord(0);
+    readWord(64);
+    readWord(0);
+    readWord(128);
+    const unsigned int before = mem_cycle_cntr;
+    readWord(64);
+    EXPECT_EQ(mem_cycle_cntr - before, 1);
+    readWord(0);
+    EXPECT_GT(mem_cycle_cntr - before, 2);
+
+    config.l1d.replacement = ReplacementType::PLRU;
+    config.l1d.ways = 3;
+    config.l1d.lines = 12;
+    EXPECT_FALSE(config.isValid(error));
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(write_policy, write_through_updates_memory) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 8, 16);
+    config.l1d.writeThrough = true;
+    init_hierarchy(config);
+
+    readWord(100);
+    const unsigned int before = mem_cycle_cntr;
+    writeWord(100, 0x12345678);
+    EXPECT_EQ(mem_cycle_cntr - before, 1 + 8);
+    EXPECT_EQ(prog_mem[100], 0x78);
+    EXPECT_EQ(prog_mem[103], 0x12);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(write_policy, no_allocate_skips_fill) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 8, 16);
+    EXPECT_TRUE(parseWritePolicy("write-through,no-allocate", config.l1d));
+    EXPECT_FALSE(parseWritePolicy("write-around", config.l1d));
+    init_hierarchy(config);
+
+    writeWord(200, 42);
+    EXPECT_EQ(mem_cycle_cntr, 1 + 8);
+    // The store did not allocate, so the load still misses and fills the block
+    EXPECT_EQ(readWord(200), 42);
+    EXPECT_EQ(mem_cycle_cntr, 1 + 8 + 1 + 8 + 2 * 3);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(write_policy, write_buffer_coalesces_and_forwards) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 8, 16);
+    cache.setWritePolicy(true, false, 2);
+
+    // The first store drains at once; the next two to one block share the second entry
+    EXPECT_EQ(cache.writeWord(0, 1).getCycles(), 1);
+    EXPECT_EQ(cache.writeWord(16, 2).getCycles(), 1);
+    EXPECT_EQ(cache.writeWord(20, 3).getCycles(), 1);
+    EXPECT_EQ(cache.getWriteBuffer().getStats().writes, 3);
+    EXPECT_EQ(cache.getWriteBuffer().getStats().coalesced, 1);
+
+    // A third block finds the buffer full and waits for the head entry to drain
+    EXPECT_GT(cache.writeWord(32, 4).getCycles(), 1);
+    EXPECT_EQ(cache.getWriteBuffer().getStats().fullStalls, 1);
+
+    cache.readWord(32);
+    EXPECT_EQ(cache.getCachedWord(32), 4);
+    EXPECT_EQ(cache.getCachedWord(20), 3);
+}
+
+TEST(write_policy, write_back_all_leaves_memory_current) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 8, 16);
+    cache.setVictimCache(2);
+
+    cache.writeWord(0, 5);
+    cache.writeWord(128, 6); // evicts block 0 into the victim cache
+    EXPECT_EQ(prog_mem[0], 0);
+    EXPECT_EQ(prog_mem[128], 0);
+    cache.writeBackAll();
+    EXPECT_EQ(prog_mem[0], 5);
+    EXPECT_EQ(prog_mem[128], 6);
+    EXPECT_EQ(cache.getCachedWord(128), 6);
+}
+
+TEST(prefetch, next_line_fetches_ahead) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 8, 16);
+    cache.setPrefetcher(createPrefetcher(PrefetchType::NEXT_LINE, 2, 1, 16));
+
+    EXPECT_FALSE(cache.readWord(0).hit);
+    EXPECT_EQ(cache.getPrefetchStats().issued, 2);
+
+    // The prefetch fills queue behind the miss, so touching block 1 at once waits for its fill
+    const CacheResult late = cache.readWord(16);
+    EXPECT_TRUE(late.hit);
+    EXPECT_GT(late.getCycles(), 1);
+    EXPECT_EQ(cache.getPrefetchStats().late, 1);
+
+    // Block 2 was filled by the first trigger; its first use triggers blocks 3 and 4
+    for (unsigned int i = 0; i < 10; i++) {
+        cache.readWord(100);
+    }
+    EXPECT_EQ(cache.readWord(32).getCycles(), 1);
+    EXPECT_EQ(cache.getPrefetchStats().useful, 2);
+    EXPECT_EQ(cache.getPrefetchStats().issued, 6);
+    EXPECT_EQ(cache.getStats().misses, 2);
+}
+
+TEST(victim_cache, swaps_conflicting_blocks) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 4, 16);
+    cache.setVictimCache(4);
+
+    // Blocks 0 and 64 share a set; after the first two fills they only swap with the victim cache
+    cache.readWord(0);
+    cache.readWord(64);
+    for (unsigned int i = 0; i < 3; i++) {
+        EXPECT_EQ(cache.readWord(0).getCycles(), 2);
+        EXPECT_EQ(cache.readWord(64).getCycles(), 2);
+    }
+    EXPECT_EQ(cache.getStats().misses, 8);
+    EXPECT_EQ(cache.getVictimCache().getStats().hits, 6);
+    EXPECT_EQ(cache.getVictimCache().getStats().misses, 2);
+}
+
+TEST(victim_cache, writes_back_dirty_blocks_it_displaces) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 4, 16);
+    cache.setVictimCache(1);
+
+    cache.writeWord(0, 0xCAFEF00D);
+    cache.readWord(64);
+    // Still waiting in the victim cache: the dirty word is visible but not yet written back
+    EXPECT_EQ(cache.getStats().writebacks, 0);
+    EXPECT_EQ(cache.readWordFromMemory(0), 0xCAFEF00D);
+
+    cache.readWord(128);
+    EXPECT_EQ(cache.getStats().writebacks, 1);
+    EXPECT_EQ(memory.readWordFromMemory(0), 0xCAFEF00D);
+    EXPECT_EQ(cache.getVictimCache().getStats().writebacks, 1);
+}
+
+TEST(statistics, counts_by_access_type) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 2, 16);
+
+    cache.readWord(0);
+    cache.writeWord(4, 1);
+    cache.setFetching(true);
+    cache.readWord(32);
+    cache.setFetching(false);
+    cache.readWord(64);
+
+    const CacheStats& stats = cache.getStats();
+    EXPECT_EQ(stats.readMisses, 2);
+    EXPECT_EQ(stats.writeHits, 1);
+    EXPECT_EQ(stats.fetchMisses, 1);
+    EXPECT_EQ(stats.evictions, 2);
+    EXPECT_EQ(stats.writebacks, 1);
+    EXPECT_EQ(stats.hitCycles + stats.missCycles, stats.cycles);
+}
+
+TEST(statistics, fetch_word_asks_for_its_fill_as_a_fetch) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    NWaySetAssociativeCache l2(&memory, 16, 2, 16);
+    DirectMappedCache l1(&l2, 2, 16);
+
+    l1.fetchWord(32);
+    l1.readWord(64);
+
+    EXPECT_EQ(l1.getStats().fetchMisses, 1);
+    EXPECT_EQ(l1.getStats().readMisses, 1);
+    EXPECT_EQ(l2.getStats().fetchMisses, 1);
+    EXPECT_EQ(l2.getStats().readMisses, 1);
+}
+
+TEST(cache, serves_alone_only_resident_blocks_it_keeps) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 8, 16);
+
+    cache.readWord(0);
+    EXPECT_TRUE(cache.servesAlone(0, 4, false));
+    EXPECT_TRUE(cache.servesAlone(12, 4, true));
+    // The word runs into a block that is not resident
+    EXPECT_FALSE(cache.servesAlone(14, 4, false));
+    EXPECT_FALSE(cache.servesAlone(64, 1, false));
+
+    cache.setWritePolicy(true, true, 0);
+    EXPECT_TRUE(cache.servesAlone(0, 4, false));
+    EXPECT_FALSE(cache.servesAlone(0, 4, true));
+}
+
+TEST(cache, read_word_hit_takes_only_resident_words) {
+    init_mem(1000);
+    prog_mem[16] = 0x11;
+    prog_mem[17] = 0x22;
+    prog_mem[18] = 0x33;
+    prog_mem[19] = 0x44;
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 8, 16);
+    unsigned int value = 0;
+    unsigned int cycles = 0;
+
+    EXPECT_FALSE(cache.readWordHit(16, false, value, cycles));
+    EXPECT_EQ(cache.getStats().misses, 0);
+    cache.readWord(16);
+    EXPECT_TRUE(cache.readWordHit(16, false, value, cycles));
+    EXPECT_EQ(value, 0x44332211);
+    EXPECT_EQ(cycles, 1);
+    EXPECT_TRUE(cache.readWordHit(20, true, value, cycles));
+    EXPECT_EQ(cache.getStats().readHits, 1);
+    EXPECT_EQ(cache.getStats().fetchHits, 1);
+    // The word runs into a block that is not resident
+    EXPECT_FALSE(cache.readWordHit(30, false, value, cycles));
+
+    cache.reset();
+    EXPECT_FALSE(cache.readWordHit(16, false, value, cycles));
+}
+
+TEST(statistics, trap_prints_json) {
+    init_mem(1000);
+    init_cache(1);
+    set_stats_format(StatsFormat::JSON);
+    readWord(0);
+
+    testing::internal::CaptureStdout();
+    cntrl_regs[OPERATION] = TRP;
+    cntrl_regs[IMMEDIATE] = PRINT_STATS;
+    EXPECT_TRUE(decode());
+    EXPECT_TRUE(execute());
+    const std::string output = testing::internal::GetCapturedStdout();
+    EXPECT_NE(output.find("\"name\": \"L1D\""), std::string::npos);
+    EXPECT_NE(output.find("\"read_misses\": 1"), std::string::npos);
+
+    set_stats_format(StatsFormat::TABLE);
+    init_cache(0);
+}
+
+TEST(statistics, miss_profile_ranks_hot_pcs) {
+    MissProfile profile(16);
+    for (unsigned int pc = 0; pc < 800; pc += 8) {
+        profile.record(pc, 1, 0, 10);
+    }
+    profile.record(96, 5, 1, 80);
+    profile.record(40, 5, 0, 90);
+    EXPECT_EQ(profile.size(), 100);
+
+    const std::vector<MissRecord> hottest = profile.top(2);
+    ASSERT_EQ(hottest.size(), 2);
+    EXPECT_EQ(hottest[0].pc, 40);
+    EXPECT_EQ(hottest[0].cycles, 100);
+    EXPECT_EQ(hottest[1].pc, 96);
+    EXPECT_EQ(hottest[1].misses, 6);
+    EXPECT_EQ(hottest[1].writebacks, 1);
+}
+
+TEST(statistics, symbol_table_resolves_offsets) {
+    char path[] = "/tmp/emu_symbolsXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    const std::string text = "4 data\n100 MAIN\n180 LOOP\n";
+    ASSERT_EQ(write(fd, text.c_str(), text.size()), static_cast<ssize_t>(text.size()));
+    close(fd);
+
+    SymbolTable symbols;
+    std::string error;
+    EXPECT_TRUE(symbols.load(path, error));
+    unlink(path);
+    EXPECT_EQ(symbols.resolve(100), "MAIN");
+    EXPECT_EQ(symbols.resolve(196), "LOOP+16");
+    EXPECT_EQ(symbols.resolve(0), "");
+}
+
+TEST(statistics, classifies_three_cs) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 4, 16);
+    cache.setMissClassification(true);
+
+    // Blocks 0 and 64 share a set but fit a four line cache: conflicts after the first touches
+    for (unsigned int i = 0; i < 3; i++) {
+        cache.readWord(0);
+        cache.readWord(64);
+    }
+    EXPECT_EQ(cache.getStats().compulsoryMisses, 2);
+    EXPECT_EQ(cache.getStats().conflictMisses, 4);
+
+    // Sweeping six blocks through four lines: the blocks the real cache still holds hit, the rest are capacity misses
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        for (unsigned int address = 128; address < 224; address += 16) {
+            cache.readWord(address);
+        }
+    }
+    EXPECT_EQ(cache.getStats().compulsoryMisses, 8);
+    EXPECT_EQ(cache.getStats().capacityMisses, 4);
+    EXPECT_EQ(cache.getStats().conflictMisses, 4);
+}
+
+TEST(statistics, no_allocate_write_misses_are_not_classified) {
+    init_mem(1000);
+    SystemMemory memory(prog_mem, 1000);
+    DirectMappedCache cache(&memory, 4, 16);
+    cache.setWritePolicy(true, false, 0);
+    cache.setMissClassification(true);
+
+    // Writes to blocks that share a set never fill it, so they are neither conflicts nor seen by the shadow
+    for (unsigned int i = 0; i < 3; i++) {
+        cache.writeWord(0, i);
+        cache.writeWord(64, i);
+    }
+    EXPECT_EQ(cache.getStats().writeMisses, 6);
+    EXPECT_EQ(cache.getStats().noAllocateMisses, 6);
+    EXPECT_EQ(cache.getStats().compulsoryMisses, 0);
+    EXPECT_EQ(cache.getStats().conflictMisses, 0);
+
+    // The first read of each block is still its first reference
+    cache.readWord(0);
+    cache.readWord(64);
+    EXPECT_EQ(cache.getStats().compulsoryMisses, 2);
+    cache.writeWord(64, 9);
+    EXPECT_EQ(cache.getStats().writeHits, 1);
+    EXPECT_EQ(cache.getStats().noAllocateMisses, 6);
+}
+
+TEST(statistics, shadow_lru_evicts_least_recent) {
+    ShadowLRU shadow(2);
+    EXPECT_FALSE(shadow.access(1));
+    EXPECT_FALSE(shadow.access(2));
+    EXPECT_TRUE(shadow.access(1));
+    EXPECT_FALSE(shadow.access(3));
+    EXPECT_TRUE(shadow.access(1));
+    EXPECT_FALSE(shadow.access(2));
+}
+
+TEST(statistics, stack_distance_counts_distinct_blocks) {
+    StackDistance tracker;
+    EXPECT_EQ(tracker.access(1), StackDistance::COLD);
+    EXPECT_EQ(tracker.access(2), StackDistance::COLD);
+    EXPECT_EQ(tracker.access(3), StackDistance::COLD);
+    EXPECT_EQ(tracker.access(2), 1);
+    EXPECT_EQ(tracker.access(2), 0);
+    EXPECT_EQ(tracker.access(1), 2);
+
+    // Enough accesses to force the timestamps to be renumbered several times
+    for (unsigned int i = 0; i < 5000; i++) {
+        tracker.access(i % 3 + 1);
+    }
+    EXPECT_EQ(tracker.access(3), 2);
+}
+
+TEST(statistics, miss_ratio_curve_matches_lru_caches) {
+    init_mem(4096);
+    SystemMemory memory(prog_mem, 4096);
+    DirectMappedCache directMapped(&memory, 8, 16);
+    FullyAssociativeCache fullyAssociative(&memory, 8, 16);
+    NWaySetAssociativeCache fourWay(&memory, 16, 4, 16);
+    StackDistanceProfile profile(16, 64);
+
+    unsigned int seed = 12345;
+    for (unsigned int i = 0; i < 3000; i++) {
+        seed = seed * 1103515245 + 12345;
+        // Mostly a small working set, with occasional reaches across all of memory
+        const unsigned int address = ((seed >> 16) % (i % 5 == 0 ? 4096 : 320)) & ~3u;
+        directMapped.readWord(address);
+        fullyAssociative.readWord(address);
+        fourWay.readWord(address);
+        profile.access(address);
+    }
+
+    EXPECT_EQ(profile.getAccesses(), 3000);
+    EXPECT_EQ(profile.misses(8, 1), directMapped.getStats().misses);
+    EXPECT_EQ(profile.misses(8, 0), fullyAssociative.getStats().misses);
+    EXPECT_EQ(profile.misses(16, 4), fourWay.getStats().misses);
+    EXPECT_LE(profile.misses(64, 0), profile.misses(32, 0));
+}
+
+TEST(prefetch, stride_table_follows_pc) {
+    StridePrefetcher prefetcher(1, 2);
+    std::vector<unsigned int> candidates;
+    for (unsigned int i = 0; i < 3; i++) {
+        prefetcher.onAccess(400 + i * 40, 64, true, false, candidates);
+        prefetcher.onAccess(7, 72, true, false, candidates);
+    }
+    EXPECT_TRUE(candidates.empty());
+
+    prefetcher.onAccess(520, 64, false, false, candidates);
+    ASSERT_EQ(candidates.size(), 1);
+    EXPECT_EQ(candidates[0], 600);
+
+    PrefetchType type;
+    unsigned int degree = 1;
+    unsigned int distance = 1;
+    EXPECT_TRUE(parsePrefetchSpec("stride:4", type, degree, distance));
+    EXPECT_EQ(type, PrefetchType::STRIDE);
+    EXPECT_EQ(degree, 4);
+    EXPECT_EQ(distance, 1);
+    EXPECT_FALSE(parsePrefetchSpec("next-line:0", type, degree, distance));
+}
+
 TEST(branches, jmr_valid) {
     init_mem(1000);
     reg_file[R5] = 500;
@@ -1408,7 +2026,7 @@ TEST(memory_streaming, word_read_no_cache) {
     init_mem(1000);
     init_cache(0);
     mem_cycle_cntr = 0;
-    memStream = false;
+    end_memory_stream();
 
     prog_mem[200] = 0x78;
     prog_mem[201] = 0x56;
@@ -1421,6 +2039,467 @@ TEST(memory_streaming, word_read_no_cache) {
     EXPECT_EQ(mem_cycle_cntr, 8);
 }
 
+TEST(memory_streaming, banked_dram_row_hits_and_misses) {
+    BankedDramTiming dram(2, 256, 4, 12, 4, 2, true);
+
+    EXPECT_EQ(dram.transfer(0, 16, false), 14u);  // bank 0 closed: 12 - 4, then 3 more words at 2
+    EXPECT_EQ(dram.transfer(64, 4, false), 4u);   // row 0 still open
+    EXPECT_EQ(dram.transfer(256, 4, false), 8u);  // row 1 maps to bank 1, still closed
+    EXPECT_EQ(dram.transfer(512, 4, true), 12u);  // row 2 must close row 0 first
+    EXPECT_EQ(dram.getStats().rowHits, 1u);
+    EXPECT_EQ(dram.getStats().rowMisses, 1u);
+    EXPECT_EQ(dram.getStats().rowEmpty, 2u);
+
+    BankedDramTiming closedPage(2, 256, 4, 12, 4, 2, false);
+    EXPECT_EQ(closedPage.transfer(0, 4, false), 8u);
+    EXPECT_EQ(closedPage.transfer(4, 4, false), 8u);
+    EXPECT_EQ(closedPage.getStats().rowHits, 0u);
+}
+
+TEST(memory_streaming, banked_dram_times_uncached_accesses) {
+    init_mem(1000);
+    HierarchyConfig config;
+    config.dramModel = MemoryTimingType::BANKED;
+    config.dramBanks = 1;
+    config.dramRowSize = 256;
+    init_hierarchy(config);
+    mem_cycle_cntr = 0;
+
+    readByte(100);
+    EXPECT_EQ(mem_cycle_cntr, 8);
+    end_memory_stream();
+    readByte(101);
+    EXPECT_EQ(mem_cycle_cntr, 12); // row hit, whatever the stream
+    readByte(600);
+    EXPECT_EQ(mem_cycle_cntr, 24); // another row in the only bank
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(cpi, splits_execute_fetch_and_data_cycles) {
+    LatencyTable latencies;
+    latencies.set(MUL, 5);
+    set_latencies(latencies);
+    init_mem(1000);
+    init_cache(0);
+
+    prog_mem[0] = MUL;
+    prog_mem[1] = R1;
+    prog_mem[2] = R2;
+    prog_mem[3] = R3;
+    prog_mem[8] = LDR;
+    prog_mem[9] = R4;
+    prog_mem[12] = 200;
+    reg_file[PC] = 0;
+    reg_file[R2] = 6;
+    reg_file[R3] = 7;
+
+    for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(fetch());
+        ASSERT_TRUE(decode());
+        ASSERT_TRUE(execute());
+    }
+
+    const CycleCounters& counters = get_cycle_counters();
+    EXPECT_EQ(reg_file[R1], 42u);
+    EXPECT_EQ(counters.instructions, 2u);
+    EXPECT_EQ(counters.execute, 6u);  // MUL at 5, LDR at 1
+    EXPECT_EQ(counters.fetch, 20u);   // two uncached fetches at 8 + 2
+    EXPECT_EQ(counters.data, 8u);
+    EXPECT_EQ(counters.total(), mem_cycle_cntr + 6);
+    set_latencies(LatencyTable());
+}
+
+TEST(cpi, parses_opcode_latencies) {
+    LatencyTable latencies;
+    EXPECT_EQ(latencies[ADD], 1u);
+    EXPECT_TRUE(latencies.parse("divi=20"));
+    EXPECT_EQ(latencies[DIVI], 20u);
+    EXPECT_TRUE(latencies.parse("MUL=0"));
+    EXPECT_EQ(latencies[MUL], 0u);
+    EXPECT_FALSE(latencies.parse("nop=1"));
+    EXPECT_FALSE(latencies.parse("add=-1"));
+    EXPECT_FALSE(latencies.parse("add"));
+}
+
+TEST(branch_prediction, bimodal_learns_a_loop_branch) {
+    BranchPredictorConfig config;
+    config.type = PredictorType::BIMODAL;
+    BranchUnit bimodal(config);
+    config.type = PredictorType::NOT_TAKEN;
+    BranchUnit notTaken(config);
+
+    for (int i = 0; i < 10; i++) {
+        const unsigned int target = i < 9 ? 40 : 88; // back to the loop top 9 times, then exit
+        bimodal.resolve(80, BranchKind::CONDITIONAL, 88, target);
+        notTaken.resolve(80, BranchKind::CONDITIONAL, 88, target);
+    }
+
+    EXPECT_EQ(bimodal.getStats().mispredictions, 2u); // the first iteration and the exit
+    EXPECT_EQ(notTaken.getStats().mispredictions, 9u);
+    ASSERT_EQ(bimodal.worst(5).size(), 1u);
+    EXPECT_EQ(bimodal.worst(5)[0].executions, 10u);
+}
+
+TEST(branch_prediction, gshare_learns_alternating_outcomes) {
+    BranchPredictorConfig config;
+    config.type = PredictorType::GSHARE;
+    config.historyBits = 2;
+    BranchUnit gshare(config);
+
+    for (int i = 0; i < 20; i++) {
+        gshare.resolve(80, BranchKind::CONDITIONAL, 88, i % 2 == 0 ? 40 : 88);
+    }
+    const unsigned long long warmup = gshare.getStats().mispredictions;
+    for (int i = 0; i < 20; i++) {
+        gshare.resolve(80, BranchKind::CONDITIONAL, 88, i % 2 == 0 ? 40 : 88);
+    }
+    EXPECT_EQ(gshare.getStats().mispredictions, warmup);
+}
+
+TEST(branch_prediction, return_address_stack_predicts_returns) {
+    BranchPredictorConfig config;
+    config.type = PredictorType::BIMODAL;
+    config.penalty = 5;
+    BranchUnit unit(config);
+
+    EXPECT_EQ(unit.resolve(100, BranchKind::CALL, 108, 500), 5u); // BTB miss
+    EXPECT_EQ(unit.resolve(520, BranchKind::RETURN, 528, 108), 0u);
+    EXPECT_EQ(unit.resolve(100, BranchKind::CALL, 108, 500), 0u);
+    EXPECT_EQ(unit.resolve(520, BranchKind::RETURN, 528, 108), 0u);
+    EXPECT_EQ(unit.resolve(520, BranchKind::RETURN, 528, 108), 5u); // nothing left on the stack
+    EXPECT_EQ(unit.getStats().returnMispredictions, 1u);
+
+    init_mem(1000);
+    init_branch_predictor(config);
+    reg_file[PC] = 16;
+    reg_file[R1] = 1;
+    cntrl_regs[OPERATION] = BNZ;
+    cntrl_regs[OPERAND_1] = R1;
+    cntrl_regs[IMMEDIATE] = 200;
+    EXPECT_TRUE(execute());
+    EXPECT_EQ(reg_file[PC], 200u);
+    EXPECT_EQ(get_cycle_counters().branch, 5u);
+    init_branch_predictor(BranchPredictorConfig());
+}
+
+static PipelineInstruction pipelineOp(const unsigned int opcode, const unsigned int op1, const unsigned int op2,
+                                      const unsigned int op3, const unsigned int memoryCycles = 0) {
+    PipelineInstruction instruction;
+    describeInstruction(opcode, op1, op2, op3, 0, instruction);
+    instruction.memoryCycles = memoryCycles;
+    return instruction;
+}
+
+TEST(pipeline, forwarding_hides_alu_hazards_but_not_load_use) {
+    PipelineModel forwarding(true);
+    PipelineModel interlocked(false);
+    for (PipelineModel* model : {&forwarding, &interlocked}) {
+        model->issue(pipelineOp(ADD, R1, R2, R3));
+        model->issue(pipelineOp(ADD, R4, R1, R1)); // needs R1 straight away
+    }
+    EXPECT_EQ(forwarding.getStats().rawStalls, 0u);
+    EXPECT_EQ(forwarding.getStats().cycles, 6u);
+    EXPECT_EQ(interlocked.getStats().rawStalls, 2u);
+    EXPECT_EQ(interlocked.getStats().cycles, 8u);
+
+    PipelineModel loads(true);
+    loads.issue(pipelineOp(LDR, R1, 0, 0, 1));
+    loads.issue(pipelineOp(ADD, R4, R1, R2));
+    EXPECT_EQ(loads.getStats().rawStalls, 1u);
+    EXPECT_EQ(loads.getStats().loadUseStalls, 1u);
+
+    loads.reset();
+    loads.issue(pipelineOp(LDR, R1, 0, 0, 10)); // a cache miss in MEM
+    loads.issue(pipelineOp(ADD, R4, R1, R2));
+    EXPECT_EQ(loads.getStats().loadUseStalls, 10u);
+}
+
+TEST(pipeline, mispredicted_branches_flush_fetch) {
+    PipelineModel model(true);
+    PipelineInstruction branch = pipelineOp(BNZ, R1, 0, 0);
+    branch.redirect = true;
+    model.issue(branch);
+    model.issue(pipelineOp(ADD, R2, R3, R4));
+
+    EXPECT_EQ(model.getStats().flushCycles, 2u); // refetch waits for the branch to leave EX
+    EXPECT_EQ(model.getStats().cycles, 8u);
+    EXPECT_EQ(model.getStats().busy[STAGE_IF], 2u);
+}
+
+TEST(pipeline, counts_the_halting_instruction) {
+    char program[] = "/tmp/emu_pipelineXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    const BatchResult result = runBatchJob(BatchJob{program, "-", {"-c", "1", "-P", "forwarding"}});
+    unlink(program);
+    EXPECT_EQ(result.status, 0);
+    EXPECT_EQ(result.instructions, 3u);
+    EXPECT_NE(result.output.find("Pipeline (forwarding): 3 instructions"), std::string::npos);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+static void storeInstruction(const unsigned int address, const unsigned int opcode, const unsigned int op1,
+                             const unsigned int op2, const unsigned int op3, const unsigned int immediate) {
+    writeWord(address, opcode | (op1 << 8) | (op2 << 16) | (op3 << 24));
+    writeWord(address + 4, immediate);
+}
+
+static void trap(const unsigned int code) {
+    cntrl_regs[OPERATION] = TRP;
+    cntrl_regs[IMMEDIATE] = code;
+    ASSERT_TRUE(decode());
+    ASSERT_TRUE(execute());
+}
+
+TEST(harts, spawned_hart_has_own_registers_and_stack) {
+    init_cache(0);
+    init_mem(4096);
+    init_registers(100);
+    HartConfig config;
+    config.harts = 2;
+    config.stackSize = 256;
+    ASSERT_TRUE(init_harts(config));
+    EXPECT_EQ(reg_file[SL], 4096u - 256);
+
+    storeInstruction(0, MOVI, R5, 0, 0, 7);
+    storeInstruction(8, ADD, R5, R5, R3, 0); // R3 holds the hart id
+    storeInstruction(16, STR, R5, 0, 0, 1000);
+    storeInstruction(24, PSHR, R5, 0, 0, 0);
+    storeInstruction(32, TRP, 0, 0, 0, HALT);
+
+    reg_file[R3] = 0;
+    trap(SPAWN);
+    ASSERT_EQ(reg_file[R3], 1u);
+    trap(SPAWN); // the only other hart is busy
+    EXPECT_EQ(reg_file[R3], 0xFFFFFFFFu);
+
+    reg_file[R3] = 1;
+    trap(JOIN);
+    EXPECT_EQ(reg_file[R3], 0u);
+    EXPECT_EQ(readWord(1000), 8u);
+    EXPECT_EQ(readWord(4096 - 256 - 4), 8u); // pushed onto hart 1's stack, just below hart 0's
+    EXPECT_EQ(reg_file[R5], 0u);
+
+    reg_file[R3] = 1;
+    trap(JOIN);
+    EXPECT_EQ(reg_file[R3], 0xFFFFFFFFu);
+    init_harts(HartConfig());
+}
+
+TEST(atomics, compare_swap_fetch_add_and_exchange) {
+    init_cache(0);
+    init_mem(1024);
+    init_registers(0);
+    writeWord(100, 5);
+    reg_file[R1] = 5;
+    reg_file[R2] = 100;
+    reg_file[R3] = 9;
+
+    cntrl_regs[OPERATION] = CAS;
+    cntrl_regs[OPERAND_1] = R1;
+    cntrl_regs[OPERAND_2] = R2;
+    cntrl_regs[OPERAND_3] = R3;
+    ASSERT_TRUE(decode());
+    ASSERT_TRUE(execute());
+    EXPECT_EQ(reg_file[R1], 5u);
+    EXPECT_EQ(readWord(100), 9u);
+
+    reg_file[R1] = 5;
+    ASSERT_TRUE(execute()); // 9 is not the expected 5
+    EXPECT_EQ(reg_file[R1], 9u);
+    EXPECT_EQ(readWord(100), 9u);
+
+    cntrl_regs[OPERATION] = FAA;
+    ASSERT_TRUE(execute());
+    EXPECT_EQ(reg_file[R1], 9u);
+    EXPECT_EQ(readWord(100), 18u);
+
+    init_cache(1);
+    reg_file[R1] = 7;
+    cntrl_regs[OPERATION] = XCHG;
+    ASSERT_TRUE(decode());
+    ASSERT_TRUE(execute());
+    EXPECT_EQ(reg_file[R1], 18u);
+    EXPECT_EQ(readWord(100), 7u);
+
+    reg_file[R2] = 102;
+    EXPECT_FALSE(execute()); // atomics need an aligned word
+    init_cache(0);
+}
+
+TEST(atomics, fetch_add_is_atomic_across_harts) {
+    init_cache(0);
+    init_mem(4096);
+    init_registers(100);
+    HartConfig config;
+    config.harts = 2;
+    config.stackSize = 256;
+    ASSERT_TRUE(init_harts(config));
+
+    const unsigned int iterations = 20000;
+    storeInstruction(0, MOVI, R1, 0, 0, iterations);
+    storeInstruction(8, MOVI, R2, 0, 0, 1000);
+    storeInstruction(16, MOVI, R4, 0, 0, 1);
+    storeInstruction(24, FAA, R5, R2, R4, 0);
+    storeInstruction(32, SUBI, R1, R1, 0, 1);
+    storeInstruction(40, BNZ, R1, 0, 0, 24);
+    storeInstruction(48, TRP, 0, 0, 0, HALT);
+    writeWord(1000, 0);
+
+    reg_file[R3] = 0;
+    trap(SPAWN);
+    ASSERT_EQ(reg_file[R3], 1u);
+    reg_file[PC] = 0;
+    while (reg_file[PC] != 48) {
+        ASSERT_TRUE(fetch());
+        ASSERT_TRUE(decode());
+        ASSERT_TRUE(execute());
+    }
+    reg_file[R3] = 1;
+    trap(JOIN);
+    EXPECT_EQ(reg_file[R3], 0u);
+    EXPECT_EQ(readWord(1000), 2 * iterations);
+    init_harts(HartConfig());
+}
+
+TEST(coherence, mesi_and_moesi_move_a_dirty_block_between_cores) {
+    for (const CoherenceProtocol protocol : {CoherenceProtocol::MESI, CoherenceProtocol::MOESI}) {
+        std::vector<unsigned char> memory(1024, 0);
+        HierarchyConfig config;
+        config.l1d = CacheConfig(1, 4, 32);
+        config.coherence = protocol;
+        config.coherenceUpgrade = 100;
+        CacheHierarchy hierarchy;
+        hierarchy.build(config, memory.data(), memory.size(), 2);
+        SetAssociativeCache* core0 = hierarchy.dataCache(0);
+        SetAssociativeCache* core1 = hierarchy.dataCache(1);
+        ASSERT_NE(core0, core1);
+
+        core0->writeWord(0, 0x11223344);
+        core1->readWord(0); // core 0 supplies its dirty copy
+        EXPECT_EQ(core1->getCachedWord(0), 0x11223344u);
+        // Only MESI has to write the block back to share it
+        EXPECT_EQ(memory[0], protocol == CoherenceProtocol::MESI ? 0x44 : 0);
+
+        EXPECT_GE(core1->writeWord(0, 5).getCycles(), 100u); // upgrades the shared copy
+        core0->readWord(0);
+        EXPECT_EQ(core0->getCachedWord(0), 5u);
+
+        const CoherenceStats& stats = hierarchy.bus->getStats();
+        EXPECT_EQ(stats.ownershipRequests, 1u);
+        EXPECT_EQ(stats.readRequests, 2u);
+        EXPECT_EQ(stats.upgrades, 1u);
+        EXPECT_EQ(stats.invalidations, 1u);
+        EXPECT_EQ(stats.transfers, 2u);
+        EXPECT_EQ(stats.snoopWritebacks, protocol == CoherenceProtocol::MESI ? 2u : 0u);
+    }
+}
+
+TEST(coherence, atomic_read_for_ownership_skips_the_upgrade) {
+    std::vector<unsigned char> memory(1024, 0);
+    memory[64] = 41;
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 4, 32);
+    config.coherence = CoherenceProtocol::MESI;
+    CacheHierarchy hierarchy;
+    hierarchy.build(config, memory.data(), memory.size(), 3);
+    SetAssociativeCache* core0 = hierarchy.dataCache(0);
+    hierarchy.dataCache(1)->readWord(64);
+    hierarchy.dataCache(2)->readWord(64);
+
+    // A fetch-and-add as the emulator performs it: read for ownership, then store
+    core0->readWordExclusive(64);
+    core0->writeWord(64, core0->getCachedWord(64) + 1);
+    EXPECT_EQ(core0->getStats().writeHits, 1u);
+
+    const CoherenceStats& stats = hierarchy.bus->getStats();
+    EXPECT_EQ(stats.readRequests, 2u);
+    EXPECT_EQ(stats.ownershipRequests, 1u);
+    EXPECT_EQ(stats.upgrades, 0u);
+    EXPECT_EQ(stats.invalidations, 2u);
+
+    // Core 0 held the block modified, so it supplies the new value
+    hierarchy.dataCache(1)->readWord(64);
+    EXPECT_EQ(hierarchy.dataCache(1)->getCachedWord(64), 42u);
+    EXPECT_EQ(stats.transfers, 1u);
+}
+
+TEST(coherence, instruction_fill_sees_every_cores_stores) {
+    std::vector<unsigned char> memory(1024, 0);
+    HierarchyConfig config;
+    config.l1d = CacheConfig(1, 4, 32);
+    config.l1i = CacheConfig(1, 4, 32);
+    config.coherence = CoherenceProtocol::MESI;
+    CacheHierarchy hierarchy;
+    hierarchy.build(config, memory.data(), memory.size(), 2);
+
+    // Code written by core 1 sits dirty in its own L1D, not in core 0's
+    hierarchy.dataCache(1)->writeWord(64, 0x2a);
+    EXPECT_EQ(memory[64], 0);
+    hierarchy.l1i->readWord(64);
+    EXPECT_EQ(hierarchy.l1i->getCachedWord(64), 0x2au);
+    EXPECT_EQ(memory[64], 0x2a);
+}
+
+TEST(batch, jobs_run_one_after_another_in_one_process) {
+    char program[] = "/tmp/emu_batchXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    char manifest[] = "/tmp/emu_manifestXXXXXX";
+    const int manifestFd = mkstemp(manifest);
+    ASSERT_NE(manifestFd, -1);
+    const std::string text = "# program input options\n\n" + std::string(program) + " - -c 1 -s json\n" + program + " -\n";
+    ASSERT_EQ(write(manifestFd, text.c_str(), text.size()), static_cast<ssize_t>(text.size()));
+    close(manifestFd);
+
+    std::vector<BatchJob> jobs;
+    std::string error;
+    ASSERT_TRUE(loadBatchManifest(manifest, jobs, error));
+    unlink(manifest);
+    ASSERT_EQ(jobs.size(), 2u);
+    EXPECT_EQ(jobs[0].options, std::vector<std::string>({"-c", "1", "-s", "json"}));
+
+    // The second job must not see the cache, the statistics format or the counts of the first
+    const BatchResult cached = runBatchJob(jobs[0]);
+    const BatchResult uncached = runBatchJob(jobs[1]);
+    unlink(program);
+    EXPECT_EQ(cached.status, 0);
+    EXPECT_EQ(cached.output.substr(0, 1), "7");
+    EXPECT_NE(cached.output.find("\"levels\""), std::string::npos);
+    EXPECT_EQ(uncached.status, 0);
+    EXPECT_EQ(uncached.instructions, 3u);
+    EXPECT_EQ(uncached.output.find("\"levels\""), std::string::npos);
+    EXPECT_NE(uncached.memoryCycles, cached.memoryCycles);
+
+    jobs.clear();
+    EXPECT_FALSE(loadBatchManifest("/nonexistent/manifest", jobs, error));
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(harts, parses_hart_specs) {
+    HartConfig config;
+    EXPECT_TRUE(parseHartSpec("4", config));
+    EXPECT_EQ(config.harts, 4u);
+    EXPECT_TRUE(parseHartSpec("8:4096", config));
+    EXPECT_EQ(config.stackSize, 4096u);
+    EXPECT_FALSE(parseHartSpec("8:", config));
+    std::string error;
+    EXPECT_TRUE(config.isValid(131072, error));
+    EXPECT_FALSE(config.isValid(32768, error));
+}
+
 TEST(special_registers, pc_operations) {
     init_mem(1000);
 
@@ -1553,3 +2632,384 @@ TEST(edge_cases, very_small_memory) {
     reg_file[PC] = 0;
     EXPECT_FALSE(fetch());
 }
+
+TEST(trace, round_trips_through_mapped_file) {
+    char path[] = "/tmp/emu_traceXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+
+    TraceWriter writer;
+    std::string error;
+    ASSERT_TRUE(writer.open(path, error));
+    for (unsigned int i = 0; i < 70000; i++) {
+        writer.record(TraceRecord{i * 4, 0x80000000u + i, static_cast<unsigned char>(i % 2 ? 1 : 4),
+                                  static_cast<unsigned char>(i % 3 == 0 ? TRACE_FETCH : TRACE_WRITE)});
+    }
+    EXPECT_TRUE(writer.close());
+
+    MappedTrace trace;
+    ASSERT_TRUE(trace.open(path, error));
+    unlink(path);
+    ASSERT_EQ(trace.size(), 70000);
+    const TraceRecord last = trace[69999];
+    EXPECT_EQ(last.address, 279996);
+    EXPECT_EQ(last.pc, 0x80000000u + 69999);
+    EXPECT_EQ(last.size, 1);
+    EXPECT_EQ(last.flags, TRACE_FETCH);
+    EXPECT_EQ(trace[1].flags, TRACE_WRITE);
+}
+
+TEST(decoupled_timing, ring_hands_values_across_threads) {
+    SpscRing<unsigned int> ring(5);
+    EXPECT_EQ(ring.getCapacity(), 8u);
+    unsigned long long sum = 0;
+    std::thread consumer([&]() {
+        unsigned int value = 0;
+        for (unsigned int received = 0; received < 100000;) {
+            if (ring.pop(value)) {
+                EXPECT_EQ(value, received);
+                sum += value;
+                received++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    // Both sides yield on an empty or full ring, as the timing thread does, so one core is enough
+    for (unsigned int value = 0; value < 100000;) {
+        if (ring.push(value)) {
+            value++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    EXPECT_EQ(sum, 100000ull * 99999 / 2);
+    unsigned int value = 0;
+    EXPECT_FALSE(ring.pop(value));
+}
+
+TEST(decoupled_timing, matches_inline_timing) {
+    char program[] = "/tmp/emu_decoupledXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; STR R3, 200; LDR R4, 200; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, STR | (R3 << 8), 200, LDR | (R4 << 8), 200, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    const BatchResult inlined = runBatchJob(BatchJob{program, "-", {"-c", "1", "-t", "2"}});
+    const BatchResult decoupled = runBatchJob(BatchJob{program, "-", {"-c", "1", "-t", "2", "-D"}});
+    const BatchResult rejected = runBatchJob(BatchJob{program, "-", {"-D", "-H", "2"}});
+    unlink(program);
+    EXPECT_EQ(decoupled.status, 0);
+    EXPECT_NE(inlined.memoryCycles, 0u);
+    EXPECT_EQ(decoupled.memoryCycles, inlined.memoryCycles);
+    EXPECT_EQ(decoupled.cycles, inlined.cycles);
+    EXPECT_EQ(decoupled.output, inlined.output);
+    EXPECT_EQ(rejected.status, 2);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(intervals, parses_interval_specs) {
+    IntervalConfig config;
+    EXPECT_TRUE(parseIntervalSpec("1000000", config));
+    EXPECT_EQ(config.length, 1000000u);
+    EXPECT_EQ(config.warmup, 100000u);
+    EXPECT_TRUE(parseIntervalSpec("5000:200:3", config));
+    EXPECT_EQ(config.length, 5000u);
+    EXPECT_EQ(config.warmup, 200u);
+    EXPECT_EQ(config.jobs, 3u);
+    EXPECT_FALSE(parseIntervalSpec("0", config));
+    EXPECT_FALSE(parseIntervalSpec("100:x", config));
+    EXPECT_EQ(config.length, 5000u);
+
+    IntervalResult total;
+    IntervalResult part;
+    part.memoryCycles = 7;
+    part.levels[1].readMisses = 2;
+    total.add(part);
+    total.add(part);
+    total.subtract(part);
+    EXPECT_EQ(total.memoryCycles, 7u);
+    EXPECT_EQ(total.levels[1].readMisses, 2u);
+
+    // Long runs count past 32 bits
+    part.levels[0].hits = 3000000000ULL;
+    total.add(part);
+    total.add(part);
+    EXPECT_EQ(total.levels[0].hits, 6000000000ULL);
+}
+
+TEST(intervals, stitched_intervals_match_a_full_run) {
+    char program[] = "/tmp/emu_intervalsXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; STR R3, 200; LDR R4, 200; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, STR | (R3 << 8), 200, LDR | (R4 << 8), 200,
+                                  TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    // Warming up from the first instruction, every interval sees the caches the full run does
+    const BatchResult full = runBatchJob(BatchJob{program, "-", {"-c", "1"}});
+    const BatchResult split = runBatchJob(BatchJob{program, "-", {"-c", "1", "-I", "2:4:2"}});
+    const BatchResult rejected = runBatchJob(BatchJob{program, "-", {"-I", "2", "-P", "forwarding"}});
+    unlink(program);
+    EXPECT_EQ(split.status, 0);
+    EXPECT_EQ(split.output, full.output);
+    EXPECT_EQ(split.instructions, full.instructions);
+    EXPECT_EQ(split.memoryCycles, full.memoryCycles);
+    EXPECT_EQ(split.cycles, full.cycles);
+    // Intervals 3 and 4 start warming up but the program ends first
+    EXPECT_NE(split.errors.find("Timed 5 intervals"), std::string::npos);
+    EXPECT_EQ(rejected.status, 2);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(intervals, input_is_read_as_it_is_needed) {
+    std::stringbuf source("12 34");
+    std::streambuf* const saved = std::cin.rdbuf(&source);
+    {
+        BufferedInput input;
+        EXPECT_EQ(source.in_avail(), 5);
+        int value = 0;
+        std::cin >> value;
+        EXPECT_EQ(value, 12);
+        EXPECT_EQ(input.getHistory(), "12 34");
+    }
+    EXPECT_EQ(std::cin.rdbuf(), &source);
+    {
+        // A replay is given the input up front and never reads the source
+        BufferedInput input;
+        input.replay("56");
+        int value = 0;
+        std::cin >> value;
+        EXPECT_EQ(value, 56);
+        EXPECT_FALSE(std::cin >> value);
+    }
+    std::cin.rdbuf(saved);
+    std::cin.clear();
+}
+
+TEST(intervals, forked_runs_get_input_that_arrives_late) {
+    char program[] = "/tmp/emu_lateXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: TRP #2; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, TRP, INT_IN, TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+    const std::string pipePath = std::string(program) + ".in";
+    ASSERT_EQ(mkfifo(pipePath.c_str(), 0600), 0);
+
+    // Every interval is forked before the first instruction, and with one at a time the functional
+    // pass waits for the first before it reads, so it reads ahead for the intervals instead
+    const std::vector<std::vector<std::string>> options = {{"-c", "1", "-I", "1:4:1"}, {"-c", "1", "-S", "1:2:0"}};
+    for (const std::vector<std::string>& option : options) {
+        std::thread writer([&] {
+            const int pipeFd = open(pipePath.c_str(), O_WRONLY);
+            usleep(20000);
+            EXPECT_EQ(write(pipeFd, "42\n", 3), 3);
+            close(pipeFd);
+        });
+        const BatchResult result = runBatchJob(BatchJob{program, pipePath, option});
+        writer.join();
+        EXPECT_EQ(result.status, 0);
+        EXPECT_EQ(result.output.substr(0, 2), "42");
+        EXPECT_EQ(result.errors.find("did not report"), std::string::npos);
+        EXPECT_EQ(result.instructions, 3u);
+    }
+    unlink(pipePath.c_str());
+    unlink(program);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(simpoint, clusters_separate_groups) {
+    SimPointConfig config;
+    EXPECT_TRUE(parseSimPointSpec("1000:4:50", config));
+    EXPECT_EQ(config.length, 1000u);
+    EXPECT_EQ(config.clusters, 4u);
+    EXPECT_EQ(config.warmup, 50u);
+    EXPECT_FALSE(parseSimPointSpec("1000:0", config));
+    EXPECT_EQ(config.clusters, 4u);
+
+    const std::vector<std::vector<double>> points = {{0.0, 0.0}, {0.1, 0.0}, {0.0, 0.2}, {5.0, 5.0}, {5.1, 5.0}};
+    std::vector<size_t> representatives;
+    const std::vector<unsigned int> clusters = clusterPoints(points, 2, representatives);
+    ASSERT_EQ(representatives.size(), 2u);
+    EXPECT_EQ(clusters[0], clusters[1]);
+    EXPECT_EQ(clusters[0], clusters[2]);
+    EXPECT_EQ(clusters[3], clusters[4]);
+    EXPECT_NE(clusters[0], clusters[3]);
+    EXPECT_EQ(clusters[representatives[clusters[0]]], clusters[0]);
+    // More clusters than points leaves each point its own
+    clusterPoints(points, 10, representatives);
+    EXPECT_EQ(representatives.size(), points.size());
+}
+
+TEST(simpoint, sampled_run_times_one_representative) {
+    char program[] = "/tmp/emu_simpointXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; STR R3, 200; LDR R4, 200; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, STR | (R3 << 8), 200, LDR | (R4 << 8), 200,
+                                  TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    const BatchResult full = runBatchJob(BatchJob{program, "-", {"-c", "1"}});
+    const BatchResult sampled = runBatchJob(BatchJob{program, "-", {"-c", "1", "-S", "2:10:4"}});
+    const BatchResult rejected = runBatchJob(BatchJob{program, "-", {"-S", "2", "-I", "2"}});
+    unlink(program);
+    EXPECT_EQ(sampled.status, 0);
+    EXPECT_EQ(sampled.output.substr(0, 1), "7");
+    EXPECT_EQ(sampled.instructions, full.instructions);
+    // The program is one straight run of code, so every interval has the same block vector
+    EXPECT_NE(sampled.output.find("SimPoint: 1 of 3 intervals of 2 instructions timed"), std::string::npos);
+    EXPECT_EQ(sampled.errors.find("SimPoint:"), std::string::npos);
+    // Interval 0 alone, extrapolated to the whole run, pays its cold misses 2.5 times over
+    EXPECT_GT(sampled.cycles, full.cycles);
+    EXPECT_EQ(rejected.status, 2);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(sampling, estimates_ratios_with_margins) {
+    SamplingConfig config;
+    std::string error;
+    EXPECT_TRUE(parseSamplingSpec("10000", config));
+    EXPECT_EQ(config.window, 1000u);
+    EXPECT_EQ(config.warmup, 2000u);
+    EXPECT_TRUE(config.isValid(error));
+    EXPECT_TRUE(parseSamplingSpec("1000:100:900", config));
+    EXPECT_FALSE(config.isValid(error));
+    EXPECT_FALSE(parseSamplingSpec("0:10", config));
+
+    // Windows that agree leave no margin
+    SampledEstimate same = estimateRatio({2, 4, 6}, {1, 2, 3});
+    EXPECT_DOUBLE_EQ(same.value, 2.0);
+    EXPECT_DOUBLE_EQ(same.margin, 0.0);
+    // Residuals of -1 and 1 give a standard error of 1
+    SampledEstimate spread = estimateRatio({1, 3}, {1, 1});
+    EXPECT_DOUBLE_EQ(spread.value, 2.0);
+    EXPECT_DOUBLE_EQ(spread.margin, 1.96);
+}
+
+TEST(sampling, windows_report_estimates) {
+    char program[] = "/tmp/emu_samplingXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: MOVI R3, #7; STR R3, 200; LDR R4, 200; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, MOVI | (R3 << 8), 7, STR | (R3 << 8), 200, LDR | (R4 << 8), 200,
+                                  TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+
+    const BatchResult full = runBatchJob(BatchJob{program, "-", {"-c", "1"}});
+    // The second and fourth instructions are measured, each with cold caches
+    const BatchResult sampled = runBatchJob(BatchJob{program, "-", {"-c", "1", "-W", "2:1:0"}});
+    const BatchResult invalid = runBatchJob(BatchJob{program, "-", {"-W", "2:1:1"}});
+    const BatchResult rejected = runBatchJob(BatchJob{program, "-", {"-W", "2:1:0", "-S", "2"}});
+    unlink(program);
+    EXPECT_EQ(sampled.status, 0);
+    EXPECT_EQ(sampled.output.substr(0, 1), "7");
+    EXPECT_EQ(sampled.instructions, full.instructions);
+    EXPECT_NE(sampled.output.find("Sampling: 2 windows of 1 instructions every 2"), std::string::npos);
+    EXPECT_NE(sampled.output.find("95% interval"), std::string::npos);
+    EXPECT_EQ(invalid.status, 2);
+    EXPECT_EQ(rejected.status, 2);
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(guests, fibers_take_turns) {
+    std::string order;
+    Fiber first([&] {
+        order += "a";
+        Fiber::yield();
+        order += "c";
+    });
+    Fiber second([&] {
+        order += "b";
+        EXPECT_EQ(Fiber::current(), &second);
+    });
+    EXPECT_TRUE(first.resume());
+    EXPECT_TRUE(second.resume());
+    EXPECT_TRUE(second.isFinished());
+    EXPECT_FALSE(first.isFinished());
+    EXPECT_TRUE(first.resume());
+    EXPECT_TRUE(first.isFinished());
+    EXPECT_FALSE(first.resume());
+    EXPECT_EQ(order, "abc");
+    EXPECT_EQ(Fiber::current(), nullptr);
+}
+
+TEST(guests, guests_wait_for_their_input_without_stalling_others) {
+    char program[] = "/tmp/emu_guestXXXXXX";
+    const int fd = mkstemp(program);
+    ASSERT_NE(fd, -1);
+    // Entry point 8: TRP #2; TRP #1; TRP #0
+    const unsigned int words[] = {8, 0, TRP, INT_IN, TRP, INT_OUT, TRP, HALT};
+    ASSERT_EQ(write(fd, words, sizeof(words)), static_cast<ssize_t>(sizeof(words)));
+    close(fd);
+    const std::string pipePath = std::string(program) + ".in";
+    ASSERT_EQ(mkfifo(pipePath.c_str(), 0600), 0);
+
+    const std::string filePath = std::string(program) + ".txt";
+    FILE* file = fopen(filePath.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    fputs("7\n", file);
+    fclose(file);
+
+    const std::vector<BatchJob> jobs = {BatchJob{program, pipePath, {"-c", "1"}},
+                                        BatchJob{program, filePath, {"-c", "1"}}, BatchJob{program, "-", {"-H", "2"}}};
+    const BatchResult alone = runBatchJob(jobs[1]);
+    // The writer opens the pipe only once the first guest has started waiting on it
+    std::thread writer([&] {
+        const int pipeFd = open(pipePath.c_str(), O_WRONLY);
+        usleep(20000);
+        EXPECT_EQ(write(pipeFd, "42\n", 3), 3);
+        close(pipeFd);
+    });
+    std::vector<size_t> finished;
+    std::vector<BatchResult> results(jobs.size());
+    GuestScheduler scheduler(1);
+    std::string error;
+    EXPECT_TRUE(scheduler.run(jobs, {0, 1, 2}, [&](const size_t job, const BatchResult& result) {
+        finished.push_back(job);
+        results[job] = result;
+    }, error));
+    writer.join();
+    unlink(pipePath.c_str());
+    unlink(filePath.c_str());
+    unlink(program);
+
+    // The refused configuration fails before its first quantum is up
+    EXPECT_EQ(finished, std::vector<size_t>({2, 1, 0}));
+    EXPECT_EQ(results[0].status, 0);
+    EXPECT_EQ(results[0].output.substr(0, 2), "42");
+    EXPECT_EQ(results[1].output.substr(0, 1), "7");
+    EXPECT_EQ(results[1].output, alone.output);
+    EXPECT_EQ(results[1].cycles, alone.cycles);
+    EXPECT_EQ(results[2].status, 2);
+    EXPECT_FALSE(in_guest_mode());
+    init_mem(1000);
+    init_hierarchy(HierarchyConfig());
+}
+
+TEST(trace, work_pool_runs_every_task_once) {
+    std::vector<int> runs(100, 0);
+    WorkStealingPool pool(4);
+    pool.run(runs.size(), [&](const size_t task) {
+        runs[task]++;
+    });
+    for (const int count : runs) {
+        EXPECT_EQ(count, 1);
+    }
+}
+